@@ -39,6 +39,7 @@
 #include "aptmethod.h"
 #include "filecntl.h"
 #include "hooks.h"
+#include "timings.h"
 
 struct tobedone {
 	/*@null@*/
@@ -1190,7 +1191,9 @@ retvalue aptmethod_download(struct aptmethodrun *run) {
 	struct aptmethod *method;
 	retvalue result, r;
 	int workleft;
+	struct timing tm;
 
+	timing_start(&tm);
 	result = RET_NOTHING;
 
 	/* fire up all methods, removing those that do not work: */
@@ -1211,6 +1214,7 @@ retvalue aptmethod_download(struct aptmethodrun *run) {
 	  // TODO: check interrupted here...
 	} while (workleft > 0 || uncompress_running());
 
+	timing_stop(tp_download, NULL, &tm);
 	return result;
 }
 
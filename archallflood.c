@@ -612,7 +612,7 @@ static retvalue floodlist_install(struct floodlist *list, struct logger *logger,
 
 					r = list->target->getsourceandversion(
 							pkg->new_control,
-							pkg->name,
+							pkg->name, NULL,
 							&source,
 							&sourceversion);
 					assert (r != RET_NOTHING);
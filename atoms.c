@@ -35,34 +35,40 @@ static const char * const types[4] = {
 };
 const char **atomtypes = (const char **)types;
 
-/* trivial implementation for now, perhaps make it more complicated later */
-static struct strlist architectures, components;
+/* names by atom, with a hash index to look them up */
+static struct strindex architectures, components;
+
+static retvalue atoms_add(struct strindex *index, const char *value) {
+	int dummy;
+
+	return strindex_intern(index, value, strlen(value), &dummy);
+}
 
 retvalue atoms_init(int count) {
 	retvalue r;
-	strlist_init(&architectures);
-	strlist_init(&components);
+	strindex_init(&architectures);
+	strindex_init(&components);
 
 	/* add a 0th entry to all, so 0 means uninitialized */
 
-	r = strlist_add_dup(&architectures, "!!NONE!!");
+	r = atoms_add(&architectures, "!!NONE!!");
 	if (RET_WAS_ERROR(r))
 		return r;
-	r = strlist_add_dup(&architectures, "source");
+	r = atoms_add(&architectures, "source");
 	if (RET_WAS_ERROR(r))
 		return r;
-	r = strlist_add_dup(&architectures, "all");
+	r = atoms_add(&architectures, "all");
 	if (RET_WAS_ERROR(r))
 		return r;
-	r = strlist_add_dup(&components, "!!NONE!!");
+	r = atoms_add(&components, "!!NONE!!");
 	if (RET_WAS_ERROR(r))
 		return r;
 	/* a fallback component to put things without a component in */
-	r = strlist_add_dup(&components, "strange");
+	r = atoms_add(&components, "strange");
 	if (RET_WAS_ERROR(r))
 		return r;
-	atoms_components = (const char**)components.values;
-	atoms_architectures = (const char**)architectures.values;
+	atoms_components = (const char**)components.strings.values;
+	atoms_architectures = (const char**)architectures.strings.values;
 	command_count = count;
 	if (command_count > 0) {
 		atoms_commands = nzNEW(command_count + 1, const char*);
@@ -76,41 +82,25 @@ retvalue architecture_intern(const char *value, architecture_t *atom_p) {
 	retvalue r;
 	int i;
 
-	i = strlist_ofs(&architectures, value);
-	if (i >= 0) {
+	r = strindex_intern(&architectures, value, strlen(value), &i);
+	atoms_architectures = (const char**)architectures.strings.values;
+	if (RET_IS_OK(r))
 		*atom_p = (architecture_t)i;
-		return RET_OK;
-	}
-	i = architectures.count;
-	r = strlist_add_dup(&architectures, value);
-	atoms_architectures = (const char**)architectures.values;
-	if (RET_IS_OK(r)) {
-		*atom_p = (architecture_t)i;
-		return RET_OK;
-	} else
-		return r;
+	return r;
 }
 retvalue component_intern(const char *value, component_t *atom_p) {
 	retvalue r;
 	int i;
 
-	i = strlist_ofs(&components, value);
-	if (i >= 0) {
+	r = strindex_intern(&components, value, strlen(value), &i);
+	atoms_components = (const char**)components.strings.values;
+	if (RET_IS_OK(r))
 		*atom_p = (component_t)i;
-		return RET_OK;
-	}
-	i = components.count;
-	r = strlist_add_dup(&components, value);
-	atoms_components = (const char**)components.values;
-	if (RET_IS_OK(r)) {
-		*atom_p = (component_t)i;
-		return RET_OK;
-	} else
-		return r;
+	return r;
 }
 
 architecture_t architecture_find(const char *value) {
-	int i = strlist_ofs(&architectures, value);
+	int i = strindex_ofs(&architectures, value);
 	if (i < 0)
 		return atom_unknown;
 	else
@@ -118,38 +108,27 @@ architecture_t architecture_find(const char *value) {
 }
 
 architecture_t architecture_find_l(const char *value, size_t l) {
-	architecture_t a;
-
-	for (a = architectures.count - 1 ; a > 0 ; a--) {
-		const char *name = atoms_architectures[a];
-		size_t len = strlen(name);
-
-		if (len == l && memcmp(name, value, len) == 0)
-			return a;
-	}
-	return atom_unknown;
+	int i = strindex_ofs_l(&architectures, value, l);
+	if (i < 0)
+		return atom_unknown;
+	else
+		return (architecture_t)i;
 }
 
-// TODO: this might be called a lot, perhaps optimize it...
 component_t component_find_l(const char *value, size_t l) {
-	component_t a;
-
-	for (a = components.count - 1 ; a > 0 ; a--) {
-		const char *name = atoms_components[a];
-		size_t len = strlen(name);
-
-		if (len == l && memcmp(name, value, len) == 0)
-			return a;
-	}
-	return atom_unknown;
+	int i = strindex_ofs_l(&components, value, l);
+	if (i < 0)
+		return atom_unknown;
+	else
+		return (component_t)i;
 }
 
 component_t component_find(const char *value) {
-	int i = strlist_ofs(&components, value);
+	int i = strindex_ofs(&components, value);
 	if (i < 0)
 		return atom_unknown;
 	else
-		return (architecture_t)i;
+		return (component_t)i;
 }
 
 packagetype_t packagetype_find(const char *value) {
@@ -358,7 +337,7 @@ retvalue atomlist_fprint(FILE *file, enum atom_type type, const struct atomlist
 }
 
 component_t components_count(void) {
-	return components.count;
+	return components.strings.count;
 }
 
 retvalue atomlist_filllist(enum atom_type type, struct atomlist *list, char *string, const char **missing) {
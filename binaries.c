@@ -216,10 +216,10 @@ static inline retvalue calcnewcontrol(const char *chunk, const char *packagename
 	return RET_OK;
 }
 
-retvalue binaries_getversion(const char *control, char **version) {
+retvalue binaries_getversion(const char *control, struct chunkarena *arena, char **version) {
 	retvalue r;
 
-	r = chunk_getvalue(control, "Version", version);
+	r = chunk_getvaluein(control, "Version", arena, version);
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (r == RET_NOTHING) {
@@ -231,7 +231,7 @@ retvalue binaries_getversion(const char *control, char **version) {
 	return r;
 }
 
-retvalue binaries_getinstalldata(const struct target *t, const char *packagename, const char *version, architecture_t package_architecture, const char *chunk, char **control, struct strlist *filekeys, struct checksumsarray *origfiles) {
+static retvalue getinstalldata(const struct target *t, const char *packagename, const char *version, architecture_t package_architecture, const char *chunk, char **control, struct strlist *filekeys, struct checksumsarray *origfiles) {
 	char *sourcename, *basefilename;
 	struct checksumsarray origfilekeys;
 	retvalue r;
@@ -264,7 +264,7 @@ retvalue binaries_getinstalldata(const struct target *t, const char *packagename
 	return r;
 }
 
-retvalue binaries_getchecksums(const char *chunk, struct checksumsarray *filekeys) {
+static retvalue getchecksums(const char *chunk, struct checksumsarray *filekeys) {
 	retvalue r;
 	struct checksumsarray a;
 
@@ -288,6 +288,28 @@ retvalue binaries_getchecksums(const char *chunk, struct checksumsarray *filekey
 	return RET_OK;
 }
 
+retvalue binaries_getchecksums(const char *chunk, struct checksumsarray *filekeys) {
+	struct chunkindex index;
+	retvalue r;
+
+	chunk_index(&index, chunk);
+	r = getchecksums(chunk, filekeys);
+	chunk_unindex(&index);
+	return r;
+}
+
+retvalue binaries_getinstalldata(const struct target *t, const char *packagename, const char *version, architecture_t package_architecture, const char *chunk, char **control, struct strlist *filekeys, struct checksumsarray *origfiles) {
+	struct chunkindex index;
+	retvalue r;
+
+	/* many fields are looked at, so only search for them once: */
+	chunk_index(&index, chunk);
+	r = getinstalldata(t, packagename, version, package_architecture,
+			chunk, control, filekeys, origfiles);
+	chunk_unindex(&index);
+	return r;
+}
+
 retvalue binaries_doreoverride(const struct target *target, const char *packagename, const char *controlchunk, /*@out@*/char **newcontrolchunk) {
 	const struct overridedata *o;
 	struct fieldtoadd *fields;
@@ -422,7 +444,7 @@ retvalue binaries_retrack(const char *packagename, const char *chunk, trackingdb
 	return tracking_save(tracks, pkg);
 }
 
-retvalue binaries_getsourceandversion(const char *chunk, const char *packagename, char **source, char **version) {
+retvalue binaries_getsourceandversion(const char *chunk, const char *packagename, struct chunkarena *arena, char **source, char **version) {
 	retvalue r;
 	char *sourcename, *sourceversion;
 
@@ -430,24 +452,30 @@ retvalue binaries_getsourceandversion(const char *chunk, const char *packagename
 	assert(packagename!=NULL);
 
 	/* is there a sourcename */
-	r = chunk_getnameandversion(chunk, "Source",
+	r = chunk_getnameandversionin(chunk, "Source", arena,
 			&sourcename, &sourceversion);
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (r == RET_NOTHING) {
 		sourceversion = NULL;
-		sourcename = strdup(packagename);
+		if (arena != NULL)
+			sourcename = chunkarena_strndup(arena, packagename,
+					strlen(packagename));
+		else
+			sourcename = strdup(packagename);
 		if (FAILEDTOALLOC(sourcename))
 			return RET_ERROR_OOM;
 	}
 	if (sourceversion == NULL) {
-		r = chunk_getvalue(chunk, "Version", &sourceversion);
+		r = chunk_getvaluein(chunk, "Version", arena, &sourceversion);
 		if (RET_WAS_ERROR(r)) {
-			free(sourcename);
+			if (arena == NULL)
+				free(sourcename);
 			return r;
 		}
 		if (r == RET_NOTHING) {
-			free(sourcename);
+			if (arena == NULL)
+				free(sourcename);
 			fprintf(stderr, "No Version field in chunk:'%s'\n",
 					chunk);
 			return RET_ERROR;
@@ -35,6 +35,7 @@
 #include "names.h"
 #include "dirs.h"
 #include "configparser.h"
+#include "timings.h"
 
 const char * const changes_checksum_names[] = {
 	"Files", "Checksums-Sha1", "Checksums-Sha256"
@@ -258,10 +259,13 @@ retvalue checksums_initialize(struct checksums **checksums_p, const struct hash_
 	return RET_OK;
 }
 
-retvalue checksums_setall(/*@out@*/struct checksums **checksums_p, const char *combinedchecksum, UNUSED(size_t len)) {
-	// This comes from our database, so it surely well formed
-	// (as alreadyassumed above), so this should be possible to
-	// do faster than that...
+static retvalue checksums_frombinary(/*@out@*/struct checksums **, const unsigned char *, size_t);
+
+retvalue checksums_setall(/*@out@*/struct checksums **checksums_p, const char *combinedchecksum, size_t len) {
+	/* checksums.db has both the binary and the older textual form */
+	if (len > 0 && combinedchecksum[0] == CHECKSUMS_BINARY)
+		return checksums_frombinary(checksums_p,
+				(const unsigned char *)combinedchecksum, len);
 	return checksums_parse(checksums_p, combinedchecksum);
 }
 
@@ -1129,6 +1133,7 @@ void checksumscontext_init(struct checksumscontext *context) {
 }
 
 void checksumscontext_update(struct checksumscontext *context, const unsigned char *data, size_t len) {
+	timing_count(tc_hashed, len);
 	MD5Update(&context->md5, data, len);
 // TODO: sha1 and sha256 share quite some stuff,
 // the code can most likely be combined with quite some synergies..
@@ -1197,6 +1202,161 @@ retvalue checksums_from_context(struct checksums **out, struct checksumscontext
 	return RET_OK;
 }
 
+/* The binary representation (as used in checksums.db) is the byte
+ * CHECKSUMS_BINARY (which no textual representation starts with), a byte
+ * with bit 1<<type set for every hash available, the size (7 bits per
+ * byte, lowest first, the high bit set in all but the last byte) and
+ * then the raw digests in the order of enum checksumtype. */
+
+static const size_t digestsize[cs_hashCOUNT] = {
+	MD5_DIGEST_SIZE, SHA1_DIGEST_SIZE, SHA256_DIGEST_SIZE
+};
+
+static inline int hexvalue(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+bool checksums_getbinary(const struct checksums *checksums, char *buffer, size_t *len_p) {
+	unsigned char *d = (unsigned char *)buffer, *bitmap;
+	enum checksumtype type;
+	unsigned long long size;
+	const char *p;
+	size_t i, textlen;
+
+	/* unknown hashes (only possible in the textual form) would be lost */
+	textlen = checksums->parts[cs_md5sum].len;
+	if (textlen == 0)
+		textlen = 1;
+	textlen += 1 + checksums->parts[cs_length].len;
+	for (type = cs_firstEXTENDED ; type < cs_hashCOUNT ; type++) {
+		if (checksums->parts[type].len != 0)
+			textlen += strlen(" :x:") + checksums->parts[type].len;
+	}
+	if (textlen != checksums_totallength(checksums))
+		return false;
+	if (checksums->parts[cs_length].len == 0 ||
+			checksums->parts[cs_length].len > 19)
+		return false;
+
+	*(d++) = CHECKSUMS_BINARY;
+	bitmap = d++;
+	*bitmap = 0;
+	size = 0;
+	p = checksums_hashpart(checksums, cs_length);
+	for (i = 0 ; i < checksums->parts[cs_length].len ; i++)
+		size = size * 10 + (p[i] - '0');
+	do {
+		*d = size & 0x7F;
+		size >>= 7;
+		if (size != 0)
+			*d |= 0x80;
+		d++;
+	} while (size != 0);
+	for (type = cs_md5sum ; type < cs_hashCOUNT ; type++) {
+		if (checksums->parts[type].len == 0)
+			continue;
+		/* only lower case hex digits can be restored exactly */
+		if (checksums->parts[type].len != 2 * digestsize[type])
+			return false;
+		p = checksums_hashpart(checksums, type);
+		for (i = 0 ; i < digestsize[type] ; i++) {
+			int high = hexvalue(p[2*i]), low = hexvalue(p[2*i+1]);
+
+			if (high < 0 || low < 0)
+				return false;
+			*(d++) = (high << 4) | low;
+		}
+		*bitmap |= 1 << type;
+	}
+	*d = '\0';
+	*len_p = d - (unsigned char *)buffer;
+	assert (*len_p < CHECKSUMS_MAXBINARY);
+	return true;
+}
+
+static retvalue checksums_frombinary(struct checksums **checksums_p, const unsigned char *data, size_t len) {
+	const unsigned char *p = data + 1, *e = data + len;
+	const unsigned char *digest[cs_hashCOUNT];
+	unsigned long long size = 0;
+	unsigned int bitmap, shift = 0;
+	enum checksumtype type;
+	struct checksums *n;
+	size_t i, maxlen;
+	char *d;
+
+	if (len < 3 || (data[1] & ~((1 << cs_hashCOUNT) - 1)) != 0) {
+		// TODO: how to get some context in this?
+		fputs("Malformed binary checksums representation!\n", stderr);
+		return RET_ERROR;
+	}
+	bitmap = *(p++);
+	do {
+		if (p >= e || shift > 63) {
+			fputs(
+"Malformed binary checksums representation (invalid size)!\n", stderr);
+			return RET_ERROR;
+		}
+		size |= (unsigned long long)(*p & 0x7F) << shift;
+		shift += 7;
+	} while ((*(p++) & 0x80) != 0);
+	for (type = cs_md5sum ; type < cs_hashCOUNT ; type++) {
+		if ((bitmap & (1 << type)) == 0) {
+			digest[type] = NULL;
+			continue;
+		}
+		digest[type] = p;
+		p += digestsize[type];
+	}
+	if (p != e) {
+		fputs(
+"Malformed binary checksums representation (wrong length)!\n", stderr);
+		return RET_ERROR;
+	}
+
+	maxlen = 2*MD5_DIGEST_SIZE + 2*SHA1_DIGEST_SIZE
+		+ 2*SHA256_DIGEST_SIZE + 30;
+	n = malloc(sizeof(struct checksums) + maxlen);
+	if (FAILEDTOALLOC(n))
+		return RET_ERROR_OOM;
+	setzero(struct checksums, n);
+	d = n->representation;
+	for (type = cs_firstEXTENDED ; type < cs_hashCOUNT ; type++) {
+		if (digest[type] == NULL)
+			continue;
+		*(d++) = ':';
+		*(d++) = '1' + (char)(type - cs_firstEXTENDED);
+		*(d++) = ':';
+		n->parts[type].ofs = d - n->representation;
+		n->parts[type].len = (hashlen_t)(2 * digestsize[type]);
+		for (i = 0 ; i < digestsize[type] ; i++) {
+			*(d++) = tab[digest[type][i] >> 4];
+			*(d++) = tab[digest[type][i] & 0xF];
+		}
+		*(d++) = ' ';
+	}
+	n->parts[cs_md5sum].ofs = d - n->representation;
+	if (digest[cs_md5sum] == NULL) {
+		n->parts[cs_md5sum].len = 0;
+		*(d++) = '-';
+	} else {
+		n->parts[cs_md5sum].len = 2*MD5_DIGEST_SIZE;
+		for (i = 0 ; i < MD5_DIGEST_SIZE ; i++) {
+			*(d++) = tab[digest[cs_md5sum][i] >> 4];
+			*(d++) = tab[digest[cs_md5sum][i] & 0xF];
+		}
+	}
+	*(d++) = ' ';
+	n->parts[cs_length].ofs = d - n->representation;
+	n->parts[cs_length].len = (hashlen_t)snprintf(d,
+			maxlen - (d - n->representation), "%llu", size);
+	*checksums_p = n;
+	return RET_OK;
+}
+
 bool checksums_iscomplete(const struct checksums *checksums) {
 	return checksums->parts[cs_md5sum].len != 0 &&
 	    checksums->parts[cs_sha1sum].len != 0 &&
@@ -41,6 +41,7 @@ void checksums_free(/*@only@*//*@null@*/struct checksums *);
 /* duplicate a checksum record, NULL means OOM */
 /*@null@*/struct checksums *checksums_dup(const struct checksums *);
 
+/* parse the textual or binary representation from checksums.db */
 retvalue checksums_setall(/*@out@*/struct checksums **checksums_p, const char *combinedchecksum, size_t len);
 
 retvalue checksums_initialize(/*@out@*/struct checksums **checksums_p, const struct hash_data *);
@@ -54,6 +55,14 @@ off_t checksums_getfilesize(const struct checksums *);
  * including the size (including the trailing '\0'): */
 retvalue checksums_getcombined(const struct checksums *, /*@out@*/const char **, /*@out@*/size_t *);
 
+/* the binary representation (only used in checksums.db) starts with: */
+#define CHECKSUMS_BINARY '\001'
+/* space needed for it (including a trailing '\0') */
+#define CHECKSUMS_MAXBINARY 96
+/* get the binary representation (with trailing '\0', not included in
+ * the length), false if it could not keep everything (like unknown hashes) */
+bool checksums_getbinary(const struct checksums *, /*@out@*/char *, /*@out@*/size_t *);
+
 /* get a static pointer to a specific part of a checksum (wihtout size) */
 bool checksums_getpart(const struct checksums *, enum checksumtype, /*@out@*/const char **, /*@out@*/size_t *);
 /* extract a single checksum from the combined data: */
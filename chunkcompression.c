@@ -0,0 +1,251 @@
+/*  This file is part of "reprepro"
+ *  Copyright (C) 2026 Bernhard R. Link <brlink@debian.org>
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include <config.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include "error.h"
+#include "chunkcompression.h"
+
+/* the size zstd suggests for dictionaries */
+#define CHUNK_DICTIONARYSIZE 112640
+/* the chunks are small and written rarely, so this can be high */
+#define CHUNK_COMPRESSIONLEVEL 12
+
+void chunkbuffer_done(struct chunkbuffer *buffer) {
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = 0;
+}
+
+static inline retvalue chunkbuffer_reserve(struct chunkbuffer *buffer, size_t size) {
+	char *n;
+
+	if (buffer->size >= size)
+		return RET_OK;
+	n = realloc(buffer->data, size);
+	if (FAILEDTOALLOC(n))
+		return RET_ERROR_OOM;
+	buffer->data = n;
+	buffer->size = size;
+	return RET_OK;
+}
+
+#ifdef HAVE_LIBZSTD
+struct chunkdictionary {
+	char *data;
+	size_t size;
+	ZSTD_DDict *ddict;
+	/* only created once something is to be compressed: */
+	/*@null@*/ZSTD_CDict *cdict;
+	/*@null@*/ZSTD_CCtx *cctx;
+	/*@null@*/ZSTD_DCtx *dctx;
+};
+
+bool chunkcompression_supported(void) {
+	return true;
+}
+
+retvalue chunkdictionary_new(const char *data, size_t size, struct chunkdictionary **dictionary_p) {
+	struct chunkdictionary *d;
+
+	d = zNEW(struct chunkdictionary);
+	if (FAILEDTOALLOC(d))
+		return RET_ERROR_OOM;
+	d->data = malloc(size);
+	if (FAILEDTOALLOC(d->data)) {
+		free(d);
+		return RET_ERROR_OOM;
+	}
+	memcpy(d->data, data, size);
+	d->size = size;
+	d->ddict = ZSTD_createDDict(d->data, d->size);
+	if (d->ddict == NULL) {
+		fputs("Error loading a zstd dictionary for control chunks!\n",
+				stderr);
+		free(d->data);
+		free(d);
+		return RET_ERROR;
+	}
+	*dictionary_p = d;
+	return RET_OK;
+}
+
+void chunkdictionary_free(struct chunkdictionary *d) {
+	if (d == NULL)
+		return;
+	if (d->cctx != NULL)
+		(void)ZSTD_freeCCtx(d->cctx);
+	if (d->dctx != NULL)
+		(void)ZSTD_freeDCtx(d->dctx);
+	if (d->cdict != NULL)
+		(void)ZSTD_freeCDict(d->cdict);
+	(void)ZSTD_freeDDict(d->ddict);
+	free(d->data);
+	free(d);
+}
+
+retvalue chunkdictionary_train(const char *samples, const size_t *samplesizes, unsigned int count, char **dictionary_p, size_t *size_p) {
+	size_t capacity, total = 0, size;
+	unsigned int i;
+	char *dictionary;
+
+	for (i = 0 ; i < count ; i++)
+		total += samplesizes[i];
+	/* a dictionary only pays off if it is much smaller than the data */
+	capacity = total / 8;
+	if (capacity > CHUNK_DICTIONARYSIZE)
+		capacity = CHUNK_DICTIONARYSIZE;
+	if (count < 16 || capacity < 1024)
+		return RET_NOTHING;
+	dictionary = malloc(capacity + 1);
+	if (FAILEDTOALLOC(dictionary))
+		return RET_ERROR_OOM;
+	size = ZDICT_trainFromBuffer(dictionary, capacity,
+			samples, samplesizes, count);
+	if (ZDICT_isError(size)) {
+		if (verbose > 0)
+			printf(
+"Could not train a dictionary from %u chunks: %s\n",
+					count, ZDICT_getErrorName(size));
+		free(dictionary);
+		return RET_NOTHING;
+	}
+	dictionary[size] = '\0';
+	*dictionary_p = dictionary;
+	*size_p = size;
+	return RET_OK;
+}
+
+retvalue chunk_compress(struct chunkdictionary *d, const char *data, size_t len, struct chunkbuffer *buffer, const char **result_p, size_t *resultlen_p) {
+	size_t bound, size;
+	retvalue r;
+
+	if (d->cctx == NULL) {
+		d->cctx = ZSTD_createCCtx();
+		if (FAILEDTOALLOC(d->cctx))
+			return RET_ERROR_OOM;
+	}
+	if (d->cdict == NULL) {
+		d->cdict = ZSTD_createCDict(d->data, d->size,
+				CHUNK_COMPRESSIONLEVEL);
+		if (FAILEDTOALLOC(d->cdict))
+			return RET_ERROR_OOM;
+	}
+	bound = ZSTD_compressBound(len);
+	/* marker before and '\0' after it */
+	r = chunkbuffer_reserve(buffer, bound + 2);
+	if (RET_WAS_ERROR(r))
+		return r;
+	size = ZSTD_compress_usingCDict(d->cctx, buffer->data + 1, bound,
+			data, len, d->cdict);
+	if (ZSTD_isError(size)) {
+		fprintf(stderr, "Error compressing a control chunk: %s\n",
+				ZSTD_getErrorName(size));
+		return RET_ERROR;
+	}
+	if (size + 1 >= len)
+		return RET_NOTHING;
+	buffer->data[0] = CHUNK_COMPRESSED;
+	buffer->data[size + 1] = '\0';
+	*result_p = buffer->data;
+	*resultlen_p = size + 1;
+	return RET_OK;
+}
+
+retvalue chunk_uncompress(struct chunkdictionary *d, const char *data, size_t len, struct chunkbuffer *buffer, const char **result_p, size_t *resultlen_p) {
+	unsigned long long contentsize;
+	size_t size;
+	retvalue r;
+
+	assert (chunk_iscompressed(data, len));
+	if (d == NULL) {
+		fputs(
+"Error: Found a compressed control chunk, but there is no dictionary for it!\n",
+				stderr);
+		return RET_ERROR;
+	}
+	if (d->dctx == NULL) {
+		d->dctx = ZSTD_createDCtx();
+		if (FAILEDTOALLOC(d->dctx))
+			return RET_ERROR_OOM;
+	}
+	contentsize = ZSTD_getFrameContentSize(data + 1, len - 1);
+	if (contentsize == ZSTD_CONTENTSIZE_ERROR ||
+			contentsize == ZSTD_CONTENTSIZE_UNKNOWN ||
+			contentsize >= (unsigned long long)(size_t)-1) {
+		fputs("Error: Corrupted compressed control chunk!\n", stderr);
+		return RET_ERROR;
+	}
+	r = chunkbuffer_reserve(buffer, (size_t)contentsize + 1);
+	if (RET_WAS_ERROR(r))
+		return r;
+	size = ZSTD_decompress_usingDDict(d->dctx, buffer->data,
+			(size_t)contentsize, data + 1, len - 1, d->ddict);
+	if (ZSTD_isError(size) || size != contentsize) {
+		fprintf(stderr,
+"Error uncompressing a control chunk: %s\n",
+				ZSTD_isError(size)?ZSTD_getErrorName(size)
+				:"unexpected size");
+		return RET_ERROR;
+	}
+	buffer->data[size] = '\0';
+	*result_p = buffer->data;
+	*resultlen_p = size;
+	return RET_OK;
+}
+
+#else /* HAVE_LIBZSTD */
+
+bool chunkcompression_supported(void) {
+	return false;
+}
+
+retvalue chunkdictionary_new(UNUSED(const char *data), UNUSED(size_t size), UNUSED(struct chunkdictionary **dictionary_p)) {
+	fputs(
+"Error: The packages database contains compressed control chunks, but this\n"
+"reprepro was compiled without libzstd!\n", stderr);
+	return RET_ERROR;
+}
+
+void chunkdictionary_free(struct chunkdictionary *d) {
+	assert (d == NULL);
+}
+
+retvalue chunkdictionary_train(UNUSED(const char *samples), UNUSED(const size_t *samplesizes), UNUSED(unsigned int count), UNUSED(char **dictionary_p), UNUSED(size_t *size_p)) {
+	fputs("Error: reprepro was compiled without libzstd!\n", stderr);
+	return RET_ERROR;
+}
+
+retvalue chunk_compress(UNUSED(struct chunkdictionary *d), UNUSED(const char *data), UNUSED(size_t len), UNUSED(struct chunkbuffer *buffer), UNUSED(const char **result_p), UNUSED(size_t *resultlen_p)) {
+	assert (false);
+	return RET_ERROR;
+}
+
+retvalue chunk_uncompress(UNUSED(struct chunkdictionary *d), UNUSED(const char *data), UNUSED(size_t len), UNUSED(struct chunkbuffer *buffer), UNUSED(const char **result_p), UNUSED(size_t *resultlen_p)) {
+	fputs(
+"Error: The packages database contains compressed control chunks, but this\n"
+"reprepro was compiled without libzstd!\n", stderr);
+	return RET_ERROR;
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef REPREPRO_CHUNKCOMPRESSION_H
+#define REPREPRO_CHUNKCOMPRESSION_H
+
+#ifndef REPREPRO_ERROR_H
+#include "error.h"
+#warning "What's hapening here?"
+#endif
+
+/* Control chunks in packages.db can be stored compressed (with zstd)
+ * using a dictionary trained from the chunks of that target.
+ * Such a record starts with this byte, followed by a zstd frame: */
+#define CHUNK_COMPRESSED '\002'
+
+static inline bool chunk_iscompressed(const char *data, size_t len) {
+	return len > 0 && data[0] == CHUNK_COMPRESSED;
+}
+
+/* memory (re)used for the result of chunk_compress/chunk_uncompress */
+struct chunkbuffer {
+	/*@null@*/char *data;
+	size_t size;
+};
+void chunkbuffer_done(struct chunkbuffer *);
+
+struct chunkdictionary;
+
+/* true if compiled with libzstd */
+bool chunkcompression_supported(void);
+
+/* dictionary as stored in the database (copied) */
+retvalue chunkdictionary_new(const char *, size_t, /*@out@*/struct chunkdictionary **);
+void chunkdictionary_free(/*@only@*//*@null@*/struct chunkdictionary *);
+
+/* train a new dictionary from count samples stored one after the
+ * other in samples, RET_NOTHING if there is not enough to train with.
+ * (the result has an additional '\0' to be stored in the database) */
+retvalue chunkdictionary_train(const char * /*samples*/, const size_t * /*samplesizes*/, unsigned int /*count*/, /*@out@*/char **, /*@out@*/size_t *);
+
+/* the result is '\0'-terminated and only valid till the next use of the
+ * buffer. chunk_compress returns RET_NOTHING if the result would not
+ * be smaller than the original. */
+retvalue chunk_compress(struct chunkdictionary *, const char *, size_t, struct chunkbuffer *, /*@out@*/const char **, /*@out@*/size_t *);
+retvalue chunk_uncompress(/*@null@*/struct chunkdictionary *, const char *, size_t, struct chunkbuffer *, /*@out@*/const char **, /*@out@*/size_t *);
+
+#endif
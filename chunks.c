@@ -25,6 +25,128 @@
 #include "chunks.h"
 #include "names.h"
 
+/* the index currently used (only for the chunk it was made for) */
+static const struct chunkindex *activeindex = NULL;
+
+void chunk_index(struct chunkindex *index, const char *chunk) {
+	const char *line, *colon, *end;
+
+	index->previous = activeindex;
+	if (activeindex != NULL && activeindex->chunk == chunk) {
+		/* already indexed by the caller, just use that one */
+		index->chunk = NULL;
+		return;
+	}
+	index->chunk = chunk;
+	index->count = 0;
+	index->complete = true;
+	line = chunk;
+	while (*line != '\0') {
+		end = strchrnul(line, '\n');
+		if (*line != ' ' && *line != '\t') {
+			colon = memchr(line, ':', end - line);
+			if (colon != NULL) {
+				if (index->count >= CHUNKINDEX_SIZE) {
+					index->complete = false;
+					break;
+				}
+				index->fields[index->count].name = line;
+				index->fields[index->count].len = colon - line;
+				index->count++;
+			}
+		}
+		if (*end == '\0')
+			break;
+		line = end + 1;
+	}
+	activeindex = index;
+}
+
+void chunk_unindex(struct chunkindex *index) {
+	if (index->chunk == NULL)
+		return;
+	assert (activeindex == index);
+	activeindex = index->previous;
+	index->chunk = NULL;
+}
+
+#define CHUNKARENA_MINSIZE 4096
+
+struct chunkarenablock {
+	struct chunkarenablock *next;
+	char data[];
+};
+
+void chunkarena_init(struct chunkarena *arena) {
+	memset(arena, 0, sizeof(*arena));
+}
+
+static void chunkarena_freeoverflow(struct chunkarena *arena) {
+	while (arena->overflow != NULL) {
+		struct chunkarenablock *b = arena->overflow;
+
+		arena->overflow = b->next;
+		free(b);
+	}
+}
+
+void chunkarena_reset(struct chunkarena *arena) {
+	if (arena->overflow != NULL) {
+		/* the buffer was too small, so make it large enough
+		 * to hold everything the last round needed */
+		size_t newsize = arena->size + arena->overflowsize;
+		char *n;
+
+		chunkarena_freeoverflow(arena);
+		if (newsize < CHUNKARENA_MINSIZE)
+			newsize = CHUNKARENA_MINSIZE;
+		n = malloc(newsize);
+		/* if that fails, just continue with the old one */
+		if (n != NULL) {
+			free(arena->buffer);
+			arena->buffer = n;
+			arena->size = newsize;
+		}
+	}
+	arena->overflowsize = 0;
+	arena->used = 0;
+}
+
+void chunkarena_done(struct chunkarena *arena) {
+	chunkarena_freeoverflow(arena);
+	free(arena->buffer);
+	memset(arena, 0, sizeof(*arena));
+}
+
+char *chunkarena_strndup(struct chunkarena *arena, const char *s, size_t len) {
+	char *p;
+
+	if (arena->size - arena->used > len) {
+		p = arena->buffer + arena->used;
+		arena->used += len + 1;
+	} else {
+		struct chunkarenablock *b;
+
+		b = malloc(sizeof(struct chunkarenablock) + len + 1);
+		if (FAILEDTOALLOC(b))
+			return NULL;
+		b->next = arena->overflow;
+		arena->overflow = b;
+		arena->overflowsize += len + 1;
+		p = b->data;
+	}
+	memcpy(p, s, len);
+	p[len] = '\0';
+	return p;
+}
+
+static inline char *dupvalue(/*@null@*/struct chunkarena *arena, const char *s, size_t len) {
+	if (arena == NULL)
+		return strndup(s, len);
+	else
+		return chunkarena_strndup(arena, s, len);
+}
+
 /* point to a specified field in a chunk */
 static const char *chunk_getfield(const char *name, const char *chunk) {
 	size_t l;
@@ -32,6 +154,18 @@ static const char *chunk_getfield(const char *name, const char *chunk) {
 	if (chunk == NULL)
 		return NULL;
 	l = strlen(name);
+	if (activeindex != NULL && activeindex->chunk == chunk &&
+			activeindex->complete) {
+		int i;
+
+		for (i = 0 ; i < activeindex->count ; i++) {
+			if (activeindex->fields[i].len == l &&
+			    strncasecmp(name, activeindex->fields[i].name,
+				    l) == 0)
+				return activeindex->fields[i].name + l + 1;
+		}
+		return NULL;
+	}
 	while (*chunk != '\0') {
 		if (strncasecmp(name, chunk, l) == 0 && chunk[l] == ':') {
 			chunk += l+1;
@@ -90,6 +224,10 @@ static retvalue chunk_getcontent(const char *chunk, const char *name, char **val
 
 /* look for name in chunk. returns RET_NOTHING if not found */
 retvalue chunk_getvalue(const char *chunk, const char *name, char **value) {
+	return chunk_getvaluein(chunk, name, NULL, value);
+}
+
+retvalue chunk_getvaluein(const char *chunk, const char *name, struct chunkarena *arena, char **value) {
 	const char *field;
 	char *val;
 	const char *b, *e;
@@ -111,9 +249,9 @@ retvalue chunk_getvalue(const char *chunk, const char *name, char **value) {
 	while (e > b && xisspace(*e))
 		e--;
 	if (!xisspace(*e))
-		val = strndup(b, e - b + 1);
+		val = dupvalue(arena, b, e - b + 1);
 	else
-		val = strdup("");
+		val = dupvalue(arena, "", 0);
 	if (FAILEDTOALLOC(val))
 		return RET_ERROR_OOM;
 	*value = val;
@@ -368,8 +506,14 @@ retvalue chunk_getname(const char *chunk, const char *name, char **pkgname, bool
 
 /* Parse a package/source-field: ' *value( ?\(version\))? *' */
 retvalue chunk_getnameandversion(const char *chunk, const char *name, char **pkgname, char **version) {
+	return chunk_getnameandversionin(chunk, name, NULL, pkgname, version);
+}
+
+retvalue chunk_getnameandversionin(const char *chunk, const char *name, struct chunkarena *arena, char **pkgname, char **version) {
 	const char *field, *name_end, *p;
-	char *v;
+	const char *version_begin = NULL;
+	size_t version_len = 0;
+	char *n, *v;
 
 	field = chunk_getfield(name, chunk);
 	if (field == NULL)
@@ -396,8 +540,6 @@ retvalue chunk_getnameandversion(const char *chunk, const char *name, char **pkg
 		return RET_ERROR;
 	}
 	if (*p == '(') {
-		const char *version_begin;
-
 		p++;
 		while (*p != '\0' && *p != '\n' && xisspace(*p))
 			p++;
@@ -405,13 +547,10 @@ retvalue chunk_getnameandversion(const char *chunk, const char *name, char **pkg
 		while (*p != '\0' && *p != '\n' && *p != ')'  && !xisspace(*p))
 			// TODO: perhaps check for wellformed version
 			p++;
-		v = strndup(version_begin, p - version_begin);
-		if (FAILEDTOALLOC(v))
-			return RET_ERROR_OOM;
+		version_len = p - version_begin;
 		while (*p != '\0' && *p != '\n' && *p != ')'  && xisspace(*p))
 			p++;
 		if (*p != ')') {
-			free(v);
 			if (*p == '\0' || *p == '\n')
 				fprintf(stderr,
 "Error: Field '%s' misses closing parenthesis!\n",
@@ -423,24 +562,29 @@ retvalue chunk_getnameandversion(const char *chunk, const char *name, char **pkg
 			return RET_ERROR;
 		}
 		p++;
-	} else {
-		v = NULL;
 	}
 	while (*p != '\0' && *p != '\n' && xisspace(*p))
 		p++;
 	if (*p != '\0' && *p != '\n') {
-		free(v);
 		fprintf(stderr,
 "Error: Field '%s' contains trailing junk starting with '%c'!\n",
 				name, *p);
 		return RET_ERROR;
 	}
 
-	*pkgname = strndup(field, name_end - field);
-	if (FAILEDTOALLOC(*pkgname)) {
-		free(v);
+	if (version_begin != NULL) {
+		v = dupvalue(arena, version_begin, version_len);
+		if (FAILEDTOALLOC(v))
+			return RET_ERROR_OOM;
+	} else
+		v = NULL;
+	n = dupvalue(arena, field, name_end - field);
+	if (FAILEDTOALLOC(n)) {
+		if (arena == NULL)
+			free(v);
 		return RET_ERROR_OOM;
 	}
+	*pkgname = n;
 	*version = v;
 	return RET_OK;
 
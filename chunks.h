@@ -9,8 +9,44 @@
 #include "strlist.h"
 #endif
 
+/* the positions of the fields of a chunk. While one is set up with
+ * chunk_index, the chunk_get* functions use it when looking into this
+ * chunk (which must not be changed or freed before chunk_unindex) */
+#define CHUNKINDEX_SIZE 64
+struct chunkindex {
+	const char *chunk;
+	const struct chunkindex *previous;
+	int count;
+	/* false if there were too many fields to remember */
+	bool complete;
+	struct {
+		const char *name;
+		size_t len;
+	} fields[CHUNKINDEX_SIZE];
+};
+void chunk_index(/*@out@*/struct chunkindex *, const char *);
+void chunk_unindex(struct chunkindex *);
+
+/* scratch memory for values extracted from chunks, to avoid a malloc
+ * for each of them when looking at many chunks in a row. All strings
+ * taken from it become invalid with the next chunkarena_reset */
+struct chunkarena {
+	char *buffer;
+	size_t size, used;
+	/* what did not fit into buffer, freed at the next reset */
+	/*@null@*/struct chunkarenablock *overflow;
+	size_t overflowsize;
+};
+void chunkarena_init(/*@out@*/struct chunkarena *);
+void chunkarena_reset(struct chunkarena *);
+void chunkarena_done(struct chunkarena *);
+/* returns NULL if out of memory */
+/*@null@*/char *chunkarena_strndup(struct chunkarena *, const char *, size_t);
+
 /* look for name in chunk. returns RET_NOTHING if not found */
 retvalue chunk_getvalue(const char *, const char *, /*@out@*/char **);
+/* the same, but the value is allocated in the arena unless it is NULL */
+retvalue chunk_getvaluein(const char *, const char *, /*@null@*/struct chunkarena *, /*@out@*/char **);
 retvalue chunk_getextralinelist(const char *, const char *, /*@out@*/struct strlist *);
 retvalue chunk_getwordlist(const char *, const char *, /*@out@*/struct strlist *);
 retvalue chunk_getuniqwordlist(const char *, const char *, /*@out@*/struct strlist *);
@@ -19,6 +55,7 @@ retvalue chunk_getwholedata(const char *, const char *, /*@out@*/char **value);
 /* Parse a package/source-field: ' *value( ?\(version\))? *' */
 retvalue chunk_getname(const char *, const char *, /*@out@*/char **, bool /*allowversion*/);
 retvalue chunk_getnameandversion(const char *, const char *, /*@out@*/char **, /*@out@*/char **);
+retvalue chunk_getnameandversionin(const char *, const char *, /*@null@*/struct chunkarena *, /*@out@*/char **, /*@out@*/char **);
 
 /* return RET_OK, if field is found, RET_NOTHING, if not (or value indicates false) */
 retvalue chunk_gettruth(const char *, const char *);
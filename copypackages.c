@@ -37,14 +37,15 @@
 #include "mprintf.h"
 #include "globmatch.h"
 #include "package.h"
+#include "reference.h"
 #include "copypackages.h"
 
 struct target_package_list {
 	struct target_package_list *next;
 	struct target *target;
 	struct target *fromtarget;
+	/* collected unsorted, sorted once all are there */
 	struct selectedpackage {
-		/*@null@*/struct selectedpackage *next;
 		char *name;
 		char *version;
 		char *sourcename;
@@ -53,7 +54,10 @@ struct target_package_list {
 		struct checksumsarray origfiles;
 		struct strlist filekeys;
 		architecture_t architecture;
-	} *packages;
+		/* result of checking its files (see packagelist_expectfiles) */
+		retvalue filesresult;
+	} **packages;
+	int count, size;
 };
 
 struct package_list {
@@ -74,11 +78,10 @@ static int cascade_strcmp(const char *s1, const char *s2, const char *t1, const
 
 static retvalue list_newpackage(struct package_list *list, struct target *desttarget, struct target *fromtarget, const char *sourcename, const char *sourceversion, const char *packagename, const char *packageversion, /*@out@*/struct selectedpackage **package_p) {
 	struct target_package_list *t, **t_p;
-	struct selectedpackage *package, **p_p;
-	int c;
+	struct selectedpackage *package;
 
 	t_p = &list->targets;
-	while (*t_p != NULL && (*t_p)->target != desttarget && (*t_p)->fromtarget != fromtarget)
+	while (*t_p != NULL && ((*t_p)->target != desttarget || (*t_p)->fromtarget != fromtarget))
 		t_p = &(*t_p)->next;
 	if (*t_p == NULL) {
 		t = zNEW(struct target_package_list);
@@ -91,14 +94,15 @@ static retvalue list_newpackage(struct package_list *list, struct target *destta
 	} else
 		t = *t_p;
 
-	p_p = &t->packages;
-	while (*p_p != NULL && (c = cascade_strcmp(packagename, (*p_p)->name, packageversion, (*p_p)->version)) < 0)
-		p_p = &(*p_p)->next;
-	if (*p_p != NULL && c == 0) {
-		// TODO: improve this message..., or some context elsewhere
-		fprintf(stderr, "Multiple occurrences of package '%s' with version '%s'!\n",
-				packagename, packageversion);
-		return RET_ERROR_EXIST;
+	if (t->count >= t->size) {
+		struct selectedpackage **n;
+		int newsize = (t->size == 0) ? 64 : 2 * t->size;
+
+		n = realloc(t->packages, newsize * sizeof(struct selectedpackage *));
+		if (FAILEDTOALLOC(n))
+			return RET_ERROR_OOM;
+		t->packages = n;
+		t->size = newsize;
 	}
 	package = zNEW(struct selectedpackage);
 	if (FAILEDTOALLOC(package))
@@ -129,8 +133,7 @@ static retvalue list_newpackage(struct package_list *list, struct target *destta
 		free(package);
 		return RET_ERROR_OOM;
 	}
-	package->next = *p_p;
-	*p_p = package;
+	t->packages[t->count++] = package;
 	*package_p = package;
 	return RET_OK;
 }
@@ -151,16 +154,14 @@ static void package_free(/*@only@*/struct selectedpackage *package) {
 
 static void list_cancelpackage(struct package_list *list, /*@only@*/struct selectedpackage *package) {
 	struct target_package_list *target;
-	struct selectedpackage **p_p;
 
 	assert (package != NULL);
 
+	/* only the last package added can be canceled */
 	for (target = list->targets ; target != NULL ; target = target->next) {
-		p_p = &target->packages;
-		while (*p_p != NULL && *p_p != package)
-			p_p = &(*p_p)->next;
-		if (*p_p == package) {
-			*p_p = package->next;
+		if (target->count > 0 &&
+		    target->packages[target->count - 1] == package) {
+			target->count--;
 			package_free(package);
 			return;
 		}
@@ -168,6 +169,39 @@ static void list_cancelpackage(struct package_list *list, /*@only@*/struct selec
 	assert (package == NULL);
 }
 
+static int selectedpackage_cmp(const void *a, const void *b) {
+	const struct selectedpackage *p1 = *(const struct selectedpackage * const *)a;
+	const struct selectedpackage *p2 = *(const struct selectedpackage * const *)b;
+
+	/* newest and last names first, as always done */
+	return cascade_strcmp(p2->name, p1->name, p2->version, p1->version);
+}
+
+/* sort the packages selected for each target (once), refusing duplicates */
+static retvalue list_sort(struct package_list *list) {
+	struct target_package_list *t;
+	int i;
+
+	for (t = list->targets ; t != NULL ; t = t->next) {
+		if (t->count <= 1)
+			continue;
+		qsort(t->packages, t->count, sizeof(struct selectedpackage *),
+				selectedpackage_cmp);
+		for (i = 1 ; i < t->count ; i++) {
+			if (selectedpackage_cmp(&t->packages[i-1],
+						&t->packages[i]) != 0)
+				continue;
+			// TODO: improve this message..., or some context elsewhere
+			fprintf(stderr,
+"Multiple occurrences of package '%s' with version '%s'!\n",
+					t->packages[i]->name,
+					t->packages[i]->version);
+			return RET_ERROR_EXIST;
+		}
+	}
+	return RET_OK;
+}
+
 static retvalue list_prepareadd(struct package_list *list, struct target *desttarget, struct target *fromtarget, struct package *package) {
 	struct selectedpackage *new SETBUTNOTUSED(= NULL);
 	retvalue r;
@@ -269,8 +303,8 @@ static retvalue package_add(struct distribution *into, /*@null@*/trackingdb trac
 				target->identifier);
 	}
 
-	r = files_expectfiles(&package->filekeys,
-			package->origfiles.checksums);
+	/* the files were already checked by packagelist_expectfiles */
+	r = package->filesresult;
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (interrupted())
@@ -308,16 +342,85 @@ static retvalue package_add(struct distribution *into, /*@null@*/trackingdb trac
 	return r;
 }
 
-static retvalue packagelist_add(struct distribution *into, const struct package_list *list, /*@null@*/struct distribution *from, bool remove_source) {
+struct expectedfile {
+	const char *filekey;
+	const struct checksums *checksums;
+	struct selectedpackage *package;
+};
+
+static int expectedfile_cmp(const void *a, const void *b) {
+	const struct expectedfile *f1 = a, *f2 = b;
+
+	return strcmp(f1->filekey, f2->filekey);
+}
+
+/* Check (and register if needed) the files of all packages to be added
+ * into the target sorted by their filekeys (i.e. in the order the files
+ * and references databases are stored in) instead of package by package.
+ * Packages with missing or broken files get that error remembered,
+ * so package_add does not add them. */
+static retvalue packagelist_expectfiles(struct target_package_list *tpl) {
+	struct expectedfile *files;
+	int i, j, count;
+	retvalue r;
+
+	count = 0;
+	for (i = 0 ; i < tpl->count ; i++)
+		count += tpl->packages[i]->filekeys.count;
+	if (count == 0)
+		return RET_NOTHING;
+	files = nNEW(count, struct expectedfile);
+	if (FAILEDTOALLOC(files))
+		return RET_ERROR_OOM;
+	count = 0;
+	for (i = 0 ; i < tpl->count ; i++) {
+		struct selectedpackage *package = tpl->packages[i];
+
+		package->filesresult = RET_OK;
+		for (j = 0 ; j < package->filekeys.count ; j++) {
+			files[count].filekey = package->filekeys.values[j];
+			files[count].checksums =
+				package->origfiles.checksums[j];
+			files[count].package = package;
+			count++;
+		}
+	}
+	qsort(files, count, sizeof(struct expectedfile), expectedfile_cmp);
+	for (i = 0 ; i < count ; i++) {
+		if (interrupted()) {
+			free(files);
+			return RET_ERROR_INTERRUPTED;
+		}
+		if (RET_WAS_ERROR(files[i].package->filesresult))
+			continue;
+		r = files_expect(files[i].filekey, files[i].checksums,
+				verbose >= 0);
+		if (r == RET_NOTHING) {
+			/* File missing */
+			fprintf(stderr, "Missing file %s\n", files[i].filekey);
+			r = RET_ERROR_MISSING;
+		}
+		if (RET_WAS_ERROR(r))
+			files[i].package->filesresult = r;
+	}
+	free(files);
+	return RET_OK;
+}
+
+static retvalue packagelist_add(struct distribution *into, struct package_list *list, /*@null@*/struct distribution *from, bool remove_source) {
 	retvalue result, r;
 	struct target_package_list *tpl;
-	struct selectedpackage *package;
 	trackingdb tracks;
+	int i;
 
 	if (verbose >= 15)
 		fprintf(stderr, "trace: packagelist_add(into.codename=%s, from.codename=%s) called.\n",
 		        into->codename, from != NULL ? from->codename : NULL);
 
+	r = list_sort(list);
+	if (RET_WAS_ERROR(r))
+		return r;
+
 	r = distribution_prepareforwriting(into);
 	if (RET_WAS_ERROR(r))
 		return r;
@@ -358,10 +461,17 @@ static retvalue packagelist_add(struct distribution *into, const struct package_
 			}
 		}
 
-		for (package = tpl->packages; package != NULL ;
-		                              package = package->next) {
-			r = package_add(into, tracks, target,
-					package, from, fromtarget, remove_source);
+		r = packagelist_expectfiles(tpl);
+		if (RET_WAS_ERROR(r)) {
+			RET_UPDATE(result, r);
+			if (remove_source)
+				(void)target_closepackagesdb(fromtarget);
+			(void)target_closepackagesdb(target);
+			break;
+		}
+		for (i = 0 ; i < tpl->count ; i++) {
+			r = package_add(into, tracks, target, tpl->packages[i],
+					from, fromtarget, remove_source);
 			RET_UPDATE(result, r);
 		}
 		if (remove_source) {
@@ -464,16 +574,14 @@ static retvalue by_name(struct package_list *list, struct target *desttarget, st
 
 static void packagelist_done(struct package_list *list) {
 	struct target_package_list *target;
-	struct selectedpackage *package;
+	int i;
 
 	while ((target = list->targets) != NULL) {
 		list->targets = target->next;
 
-		while ((package = target->packages) != NULL) {
-			target->packages = package->next;
-
-			package_free(package);
-		}
+		for (i = 0 ; i < target->count ; i++)
+			package_free(target->packages[i]);
+		free(target->packages);
 		free(target);
 	}
 }
@@ -1009,3 +1117,157 @@ retvalue restore_by_glob(struct distribution *into, const struct atomlist *compo
 			components, architectures, packagetypes,
 			snapshotname, choose_by_glob, (void*)glob);
 }
+
+struct clonedata {
+	struct target *target;
+	struct strlist filekeys;
+};
+
+static retvalue clone_collectfilekeys(void *privdata, const char *control, UNUSED(size_t len)) {
+	struct clonedata *d = privdata;
+	struct strlist filekeys;
+	retvalue r;
+	int i;
+
+	r = d->target->getfilekeys(control, &filekeys);
+	if (r == RET_NOTHING) {
+		fprintf(stderr, "Package without files in '%s'!\n",
+				d->target->identifier);
+		r = RET_ERROR;
+	}
+	if (RET_WAS_ERROR(r))
+		return r;
+	for (i = 0 ; i < filekeys.count ; i++) {
+		r = strlist_add_dup(&d->filekeys, filekeys.values[i]);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	strlist_done(&filekeys);
+	return r;
+}
+
+static int filekey_cmp(const void *a, const void *b) {
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+static retvalue clone_target(struct target *desttarget, struct target *fromtarget) {
+	struct package_cursor iterator;
+	struct clonedata d;
+	retvalue result, r;
+
+	if (verbose > 0)
+		printf("Cloning '%s' into '%s'...\n",
+				fromtarget->identifier,
+				desttarget->identifier);
+
+	/* remove everything there was before */
+	r = package_openiterator(desttarget, READWRITE, &iterator);
+	if (RET_WAS_ERROR(r))
+		return r;
+	result = RET_NOTHING;
+	while (package_next(&iterator)) {
+		r = package_remove_by_cursor(&iterator, NULL, NULL);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	r = package_closeiterator(&iterator);
+	RET_ENDUPDATE(result, r);
+	if (RET_WAS_ERROR(result))
+		return result;
+
+	r = target_initpackagesdb(desttarget, READWRITE);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = target_initpackagesdb(fromtarget, READONLY);
+	if (RET_WAS_ERROR(r)) {
+		(void)target_closepackagesdb(desttarget);
+		return r;
+	}
+	/* copy the package records as they are, only remembering
+	 * which files they need: */
+	d.target = desttarget;
+	strlist_init(&d.filekeys);
+	r = table_copyrecords(fromtarget->packages, desttarget->packages,
+			clone_collectfilekeys, &d);
+	RET_UPDATE(result, r);
+	r = target_markmodified(desttarget);
+	RET_ENDUPDATE(result, r);
+	r = target_closepackagesdb(fromtarget);
+	RET_ENDUPDATE(result, r);
+	r = target_closepackagesdb(desttarget);
+	RET_ENDUPDATE(result, r);
+	if (RET_WAS_ERROR(result)) {
+		strlist_done(&d.filekeys);
+		return result;
+	}
+	/* and add the references in one go, sorted so that they
+	 * are added in the order of the references database: */
+	if (d.filekeys.count > 0)
+		qsort(d.filekeys.values, d.filekeys.count, sizeof(char *),
+				filekey_cmp);
+	r = references_add(desttarget->identifier, &d.filekeys);
+	strlist_done(&d.filekeys);
+	RET_ENDUPDATE(result, r);
+	if (RET_WAS_ERROR(result))
+		return result;
+
+	/* if the index file will look the same, it can be taken from
+	 * the other distribution when exporting: */
+	if (strcmp(desttarget->relativedirectory,
+				fromtarget->relativedirectory) == 0 &&
+	    strcmp(desttarget->exportmode->filename,
+		    fromtarget->exportmode->filename) == 0 &&
+	    desttarget->exportmode->compressions
+	    == fromtarget->exportmode->compressions &&
+	    !fromtarget->noexport)
+		desttarget->clonedfrom = fromtarget;
+	return result;
+}
+
+retvalue clone_distribution(struct distribution *into, struct distribution *from, const struct atomlist *components, const struct atomlist *architectures, const struct atomlist *packagetypes) {
+	retvalue result, r;
+	struct target *origtarget, *desttarget;
+
+	if (into->tracking != dt_NONE) {
+		fprintf(stderr,
+"Cannot clone into '%s' as it has tracking enabled!\n"
+"(Use copymatched or pull instead.)\n",
+				into->codename);
+		return RET_ERROR;
+	}
+	if (into->logger != NULL) {
+		fprintf(stderr,
+"Cannot clone into '%s' as it has a Log: configured!\n"
+"(The changes would neither be logged nor notifiers be called.\n"
+"Use copymatched or pull instead.)\n",
+				into->codename);
+		return RET_ERROR;
+	}
+
+	result = RET_NOTHING;
+	for (origtarget = from->targets ; origtarget != NULL ;
+			origtarget = origtarget->next) {
+		if (!target_matches(origtarget,
+				components, architectures, packagetypes))
+			continue;
+		desttarget = distribution_gettarget(into,
+				origtarget->component,
+				origtarget->architecture,
+				origtarget->packagetype);
+		if (desttarget == NULL) {
+			if (verbose > 2)
+				printf(
+"Not looking into '%s' as no matching target in '%s'!\n",
+					origtarget->identifier,
+					into->codename);
+			continue;
+		}
+		r = clone_target(desttarget, origtarget);
+		RET_UPDATE(into->status, r);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(result))
+			return result;
+	}
+	return result;
+}
@@ -25,4 +25,7 @@ retvalue restore_by_source(struct distribution *, const struct atomlist *, const
 retvalue restore_by_formula(struct distribution *, const struct atomlist *, const struct atomlist *, const struct atomlist *, const char * /*snapshotname*/, const char *filter);
 retvalue restore_by_glob(struct distribution *, const struct atomlist *, const struct atomlist *, const struct atomlist *, const char * /*snapshotname*/, const char * /*glob*/);
 
+/* replace the packages of <into> with those of <from> */
+retvalue clone_distribution(struct distribution * /*into*/, struct distribution * /*from*/, const struct atomlist *, const struct atomlist *, const struct atomlist *);
+
 #endif
@@ -25,13 +25,20 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef HAVE_LMDB
+#include <lmdb.h>
+#else
 #include <db.h>
+#endif
 
 #include "globals.h"
 #include "error.h"
 #include "ignore.h"
 #include "strlist.h"
+#include "mprintf.h"
 #include "names.h"
 #include "database.h"
 #include "dirs.h"
@@ -39,18 +46,39 @@
 #include "files.h"
 #include "filelist.h"
 #include "reference.h"
+#include "sizes.h"
 #include "tracking.h"
 #include "dpkgversions.h"
 #include "distribution.h"
 #include "database_p.h"
 #include "chunks.h"
+#include "chunkcompression.h"
+#include "timings.h"
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
-#define LIBDB_VERSION_STRING "bdb" TOSTRING(DB_VERSION_MAJOR) "." TOSTRING(DB_VERSION_MINOR) "." TOSTRING(DB_VERSION_PATCH)
+#ifdef HAVE_LMDB
+#define LIBDB_NAME "lmdb"
+#define LIBDB_VERSION_MAJOR MDB_VERSION_MAJOR
+#define LIBDB_VERSION_MINOR MDB_VERSION_MINOR
+#define LIBDB_VERSION_PATCH MDB_VERSION_PATCH
+#define SETMDBV(val, datastr) {const char *my = datastr; val.mv_data = (void *)my; val.mv_size = strlen(my) + 1;}
+#define SETMDBVl(val, datastr, datasize) {const char *my = datastr; val.mv_data = (void *)my; val.mv_size = datasize;}
+/* the flags the table opening functions get, as with libdb: */
+#define DB_CREATE 1
+#define DB_RDONLY 2
+/* error code for primary keys without package name */
+#define DB_MALFORMED_KEY (MDB_LAST_ERRCODE + 1)
+#else
+#define LIBDB_NAME "bdb"
+#define LIBDB_VERSION_MAJOR DB_VERSION_MAJOR
+#define LIBDB_VERSION_MINOR DB_VERSION_MINOR
+#define LIBDB_VERSION_PATCH DB_VERSION_PATCH
 #define CLEARDBT(dbt) { memset(&dbt, 0, sizeof(dbt)); }
 #define SETDBT(dbt, datastr) {const char *my = datastr; memset(&dbt, 0, sizeof(dbt)); dbt.data = (void *)my; dbt.size = strlen(my) + 1;}
 #define SETDBTl(dbt, datastr, datasize) {const char *my = datastr; memset(&dbt, 0, sizeof(dbt)); dbt.data = (void *)my; dbt.size = datasize;}
+#endif
+#define LIBDB_VERSION_STRING LIBDB_NAME TOSTRING(LIBDB_VERSION_MAJOR) "." TOSTRING(LIBDB_VERSION_MINOR) "." TOSTRING(LIBDB_VERSION_PATCH)
 
 static bool rdb_initialized, rdb_used, rdb_locked, rdb_verbose;
 static int rdb_dircreationdepth;
@@ -58,11 +86,31 @@ static bool rdb_nopackages, rdb_readonly;
 static /*@null@*/ char *rdb_version, *rdb_lastsupportedversion,
 	*rdb_dbversion, *rdb_lastsupporteddbversion;
 
+/* Once something older versions cannot read is written, the first version
+ * that can is noted as the last supported version. Those features are not
+ * yet in a released version, so they get their own versions sorting after
+ * the last release (VERSION) and before the next one: */
+#define DBFORMAT_NEWTABLES "5.1.1+1"
+/* packageindex.db has to be updated with every change of packages.db: */
+#define DBFORMAT_PACKAGEINDEX "5.1.1+2"
+/* the newest of the above, i.e. what this version can read: */
+#define DBFORMAT_CURRENT DBFORMAT_PACKAGEINDEX
+
 struct table *rdb_checksums, *rdb_contents;
-struct table *rdb_references;
+struct table *rdb_descriptions;
+struct table *rdb_references, *rdb_referees;
+/* package name -> "<identifier> <version>" of all packages tables */
+static /*@null@*/struct table *rdb_packageindex;
 static struct {
 	bool createnewtables;
 } rdb_capabilities;
+/* what database_create got, to open it again after database_release */
+static struct {
+	struct distribution *distributions;
+	bool nopackages, allowunused, readonly, verbosedb;
+	size_t waitforlock;
+	bool references, files;
+} rdb_reopen;
 
 struct opened_tables {
 	struct opened_tables *next;
@@ -72,9 +120,51 @@ struct opened_tables {
 
 struct opened_tables *opened_tables = NULL;
 
+static retvalue table_uncompress(struct table *, struct chunkbuffer *, const char **, size_t, /*@null@*/size_t *);
+static retvalue table_uncompresscopy(struct table *, const char *, size_t, /*@out@*/char **, /*@out@*//*@null@*/size_t *);
+static retvalue table_compress(struct table *, const char **, size_t *);
+static void print_opened_tables(FILE *);
+static retvalue packageindex_update(const struct table *, const char *, /*@null@*/const char *, bool);
+static retvalue packageindex_drop(const char *);
+static retvalue packageindex_open(void);
+
+#ifdef HAVE_LMDB
+/* All tables are named databases of one lmdb environment (data.mdb in
+ * the database directory). Everything is done within a transaction,
+ * which is committed by table_sync and database_close and (so that
+ * it does not grow without bound) when a table is closed after more
+ * than LMDB_COMMITINTERVAL changes while no cursor is open. So readers
+ * (who do not need any lock) only ever see states between operations. */
+static /*@null@*/ MDB_env *rdb_env = NULL;
+static /*@null@*/ MDB_txn *rdb_txn = NULL;
+static bool rdb_envmissing = false;
+static int rdb_cursors = 0;
+static unsigned long rdb_uncommitted = 0;
+#define LMDB_COMMITINTERVAL 10000
+
+#if SIZE_MAX > 0xffffffff
+#define LMDB_MAPSIZE ((size_t)1 << 40)
+#else
+#define LMDB_MAPSIZE ((size_t)1 << 30)
+#endif
+#define LMDB_MAXDBS 16384
+#endif
+
 static void database_free(void) {
 	if (!rdb_initialized)
 		return;
+#ifdef HAVE_LMDB
+	if (rdb_txn != NULL) {
+		mdb_txn_abort(rdb_txn);
+		rdb_txn = NULL;
+	}
+	if (rdb_env != NULL) {
+		mdb_env_close(rdb_env);
+		rdb_env = NULL;
+	}
+	rdb_envmissing = false;
+	rdb_cursors = 0;
+#endif
 	free(rdb_version);
 	rdb_version = NULL;
 	free(rdb_lastsupportedversion);
@@ -94,99 +184,314 @@ static inline char *dbfilename(const char *filename) {
 /* lock file handling */
 /**********************/
 
-static retvalue database_lock(size_t waitforlock) {
-	char *lockfile;
-	int fd;
+/* The database is protected by a fcntl lock on db/lock: read-only actions
+ * take a shared lock (so any number of them can run at the same time),
+ * everything else an exclusive one.
+ * Additionally everything not read-only creates db/lockfile like older
+ * versions did (and checks it is not there when read-only), so older
+ * versions and the new ones still exclude each other. */
+
+static int rdb_lockfd = -1;
+static char *rdb_lockfile = NULL;
+
+static void lockwait_alarm(UNUSED(int s)) {
+	/* only there to let fcntl(F_SETLKW) return with EINTR */
+}
+
+static long long lock_msecsnow(void) {
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return (long long)time(NULL) * 1000;
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* get the lock, waiting till deadline, RET_NOTHING if not possible,
+ * *waited_p is set if it was not available at once */
+static retvalue lock_getfcntl(int fd, bool shared, long long deadline, const char *lockname, bool *waited_p) {
+	struct flock fl;
+	struct sigaction sa, oldsa;
+	retvalue r;
+	long long now;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = shared ? F_RDLCK : F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 0;
+
+	if (fcntl(fd, F_SETLK, &fl) == 0)
+		return RET_OK;
+	if (errno != EACCES && errno != EAGAIN) {
+		int e = errno;
+		fprintf(stderr, "Error %d locking '%s': %s\n",
+				e, lockname, strerror(e));
+		return RET_ERRNO(e);
+	}
+	*waited_p = true;
+	now = lock_msecsnow();
+	if (now >= deadline || interrupted())
+		return RET_NOTHING;
+	if (verbose >= 0)
+		printf(
+"Could not acquire lock: '%s' is locked by another reprepro instance.\n"
+"Waiting until it is released...\n", lockname);
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	/* no SA_RESTART, so that the alarm interrupts waiting */
+	sa.sa_flags = 0;
+	sa.sa_handler = lockwait_alarm;
+	(void)sigaction(SIGALRM, &sa, &oldsa);
+
+	r = RET_NOTHING;
+	while (now < deadline && !interrupted()) {
+		long long seconds = (deadline - now) / 1000 + 1;
+
+		/* alarm only takes an unsigned int, longer waits just
+		 * take more rounds: */
+		if (seconds > 3600)
+			seconds = 3600;
+		(void)alarm((unsigned int)seconds);
+		if (fcntl(fd, F_SETLKW, &fl) == 0) {
+			r = RET_OK;
+			break;
+		}
+		if (errno != EINTR) {
+			int e = errno;
+			fprintf(stderr, "Error %d locking '%s': %s\n",
+					e, lockname, strerror(e));
+			r = RET_ERRNO(e);
+			break;
+		}
+		now = lock_msecsnow();
+	}
+	(void)alarm(0);
+	(void)sigaction(SIGALRM, &oldsa, NULL);
+	return r;
+}
+
+static void lock_releasefcntl(void) {
+	assert (rdb_lockfd >= 0);
+	/* closing releases the lock */
+	(void)close(rdb_lockfd);
+	rdb_lockfd = -1;
+}
+
+static retvalue database_lock(size_t waitforlock, bool readonly) {
+	char *lockname;
 	retvalue r;
-	size_t tries = 0;
+	long long started, deadline;
+	bool waited = false;
 
 	assert (!rdb_locked);
 	rdb_dircreationdepth = 0;
+#ifdef HAVE_LMDB
+	/* readers of an lmdb database see the last committed state,
+	 * so they need neither wait for nor block the one writer */
+	if (readonly) {
+		rdb_locked = true;
+		return RET_OK;
+	}
+#endif
 	r = dir_create_needed(global.dbdir, &rdb_dircreationdepth);
 	if (RET_WAS_ERROR(r))
 		return r;
 
-	lockfile = dbfilename("lockfile");
-	if (FAILEDTOALLOC(lockfile))
+	lockname = dbfilename("lock");
+	if (FAILEDTOALLOC(lockname))
+		return RET_ERROR_OOM;
+	rdb_lockfile = dbfilename("lockfile");
+	if (FAILEDTOALLOC(rdb_lockfile)) {
+		free(lockname);
 		return RET_ERROR_OOM;
-	fd = open(lockfile, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_NOCTTY,
-			S_IRUSR|S_IWUSR);
-	while (fd < 0) {
+	}
+	rdb_lockfd = open(lockname, (readonly ? O_RDONLY : O_RDWR)
+			|O_CREAT|O_NOFOLLOW|O_NOCTTY|O_CLOEXEC,
+			S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+	if (rdb_lockfd < 0) {
 		int e = errno;
-		if (e == EEXIST) {
-			if (tries < waitforlock && ! interrupted()) {
-				unsigned int timetosleep = 10;
-				if (verbose >= 0)
-					printf(
-"Could not acquire lock: %s already exists!\nWaiting 10 seconds before trying again.\n",
-						lockfile);
-				while (timetosleep > 0)
-					timetosleep = sleep(timetosleep);
-				tries++;
-				fd = open(lockfile, O_WRONLY|O_CREAT|O_EXCL
-						|O_NOFOLLOW|O_NOCTTY,
-						S_IRUSR|S_IWUSR);
-				continue;
+		fprintf(stderr, "Error %d opening lock file '%s': %s!\n",
+				e, lockname, strerror(e));
+		free(lockname);
+		free(rdb_lockfile);
+		rdb_lockfile = NULL;
+		return RET_ERRNO(e);
+	}
+
+	started = lock_msecsnow();
+	/* waitforlock counts the 10 second waits of older versions */
+	if (waitforlock >= (size_t)((LLONG_MAX - started) / 10000))
+		deadline = LLONG_MAX;
+	else
+		deadline = started + 10000 * (long long)waitforlock;
+	while (true) {
+		int fd, e;
+
+		r = lock_getfcntl(rdb_lockfd, readonly, deadline, lockname,
+				&waited);
+		if (r == RET_NOTHING) {
+			fprintf(stderr,
+"Could not lock '%s', as another instance of reprepro using the same\n"
+"database dir is running.%s\n", lockname,
+				readonly ?
+"\n(Read-only commands like list or ls can run in parallel to each other,\n"
+"but not while the database is being modified)." : "");
+			if (waitforlock == 0)
+				fputs(
+"Use --waitforlock to wait for the other instance to finish.\n",
+					stderr);
+			r = RET_ERRNO(EAGAIN);
+		}
+		if (RET_WAS_ERROR(r))
+			break;
+
+		/* also exclude versions not using the fcntl lock: */
+		if (readonly) {
+			struct stat s;
 
+			if (lstat(rdb_lockfile, &s) != 0) {
+				e = errno;
+				if (e == ENOENT) {
+					r = RET_OK;
+					break;
+				}
+				fprintf(stderr,
+"Error %d checking lock file '%s': %s!\n",
+						e, rdb_lockfile, strerror(e));
+				r = RET_ERRNO(e);
+				break;
+			}
+			e = EEXIST;
+		} else {
+			fd = open(rdb_lockfile,
+					O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_NOCTTY,
+					S_IRUSR|S_IWUSR);
+			if (fd >= 0) {
+				// TODO: do some more locking of this file to avoid problems
+				// with the non-atomity of O_EXCL with nfs-filesystems...
+				if (close(fd) != 0) {
+					e = errno;
+					fprintf(stderr,
+"(Late) Error %d creating lock file '%s': %s!\n",
+						e, rdb_lockfile, strerror(e));
+					(void)unlink(rdb_lockfile);
+					r = RET_ERRNO(e);
+					break;
+				}
+				r = RET_OK;
+				break;
 			}
+			e = errno;
+		}
+		if (e != EEXIST) {
+			fprintf(stderr,
+"Error %d creating lock file '%s': %s!\n",
+					e, rdb_lockfile, strerror(e));
+			r = RET_ERRNO(e);
+			break;
+		}
+		/* the lockfile exists while we have the lock, so it is
+		 * either stale or from an version not knowing the new
+		 * lock, so only polling can help: */
+		lock_releasefcntl();
+		if (lock_msecsnow() < deadline && ! interrupted()) {
+			unsigned int timetosleep = 10;
+			if (verbose >= 0)
+				printf(
+"Could not acquire lock: %s already exists!\nWaiting 10 seconds before trying again.\n",
+					rdb_lockfile);
+			while (timetosleep > 0)
+				timetosleep = sleep(timetosleep);
+			waited = true;
+			rdb_lockfd = open(lockname, (readonly ? O_RDONLY : O_RDWR)
+					|O_CREAT|O_NOFOLLOW|O_NOCTTY|O_CLOEXEC,
+					S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+			if (rdb_lockfd >= 0)
+				continue;
+			e = errno;
 			fprintf(stderr,
+"Error %d opening lock file '%s': %s!\n",
+					e, lockname, strerror(e));
+			free(lockname);
+			free(rdb_lockfile);
+			rdb_lockfile = NULL;
+			return RET_ERRNO(e);
+		}
+		fprintf(stderr,
 "The lock file '%s' already exists. There might be another instance with the\n"
 "same database dir running. To avoid locking overhead, only one process\n"
 "can access the database at the same time. Do not delete the lock file unless\n"
-"you are sure no other version is still running!\n", lockfile);
-
-		} else
-			fprintf(stderr,
-"Error %d creating lock file '%s': %s!\n",
-					e, lockfile, strerror(e));
-		free(lockfile);
-		return RET_ERRNO(e);
+"you are sure no other version is still running!\n", rdb_lockfile);
+		free(lockname);
+		free(rdb_lockfile);
+		rdb_lockfile = NULL;
+		return RET_ERRNO(EEXIST);
 	}
-	// TODO: do some more locking of this file to avoid problems
-	// with the non-atomity of O_EXCL with nfs-filesystems...
-	if (close(fd) != 0) {
-		int e = errno;
-		fprintf(stderr,
-"(Late) Error %d creating lock file '%s': %s!\n",
-				e, lockfile, strerror(e));
-		(void)unlink(lockfile);
-		free(lockfile);
-		return RET_ERRNO(e);
+	if (RET_WAS_ERROR(r)) {
+		lock_releasefcntl();
+		free(lockname);
+		free(rdb_lockfile);
+		rdb_lockfile = NULL;
+		return r;
 	}
-	free(lockfile);
+	if (waited && verbose >= 0) {
+		long long waitedms = lock_msecsnow() - started;
+
+		printf("Got %s lock on '%s' after waiting %lld.%03lld seconds.\n",
+				readonly ? "shared" : "exclusive",
+				lockname, waitedms / 1000, waitedms % 1000);
+	} else if (verbose >= 15)
+		fprintf(stderr, "trace: got %s lock on '%s'.\n",
+				readonly ? "shared" : "exclusive", lockname);
+	free(lockname);
 	rdb_locked = true;
 	return RET_OK;
 }
 
 static void releaselock(void) {
-	char *lockfile;
-
 	assert (rdb_locked);
 
-	lockfile = dbfilename("lockfile");
-	if (lockfile == NULL)
-		return;
-	if (unlink(lockfile) != 0) {
+	if (!rdb_readonly && rdb_lockfile != NULL &&
+			unlink(rdb_lockfile) != 0) {
 		int e = errno;
 		fprintf(stderr, "Error %d deleting lock file '%s': %s!\n",
-				e, lockfile, strerror(e));
-		(void)unlink(lockfile);
+				e, rdb_lockfile, strerror(e));
+		(void)unlink(rdb_lockfile);
 	}
-	free(lockfile);
+	free(rdb_lockfile);
+	rdb_lockfile = NULL;
+	if (rdb_lockfd >= 0)
+		lock_releasefcntl();
 	dir_remove_new(global.dbdir, rdb_dircreationdepth);
 	rdb_locked = false;
 }
 
 static retvalue writeversionfile(void);
+#ifdef HAVE_LMDB
+static retvalue lmdb_commit(bool);
+#endif
 
 retvalue database_close(void) {
 	retvalue result = RET_OK, r;
 
+	/* nothing to do after database_release */
+	if (!rdb_initialized)
+		return RET_OK;
+	if (rdb_referees != NULL && !rdb_readonly) {
+		r = sizes_writeback();
+		RET_UPDATE(result, r);
+	}
 	if (rdb_references != NULL) {
 		r = table_close(rdb_references);
 		RET_UPDATE(result, r);
 		rdb_references = NULL;
 	}
+	if (rdb_referees != NULL) {
+		r = table_close(rdb_referees);
+		RET_UPDATE(result, r);
+		rdb_referees = NULL;
+	}
 	if (rdb_checksums != NULL) {
 		r = table_close(rdb_checksums);
 		RET_UPDATE(result, r);
@@ -197,14 +502,38 @@ retvalue database_close(void) {
 		RET_UPDATE(result, r);
 		rdb_contents = NULL;
 	}
-	r = writeversionfile();
+	if (rdb_descriptions != NULL) {
+		r = table_close(rdb_descriptions);
+		RET_UPDATE(result, r);
+		rdb_descriptions = NULL;
+	}
+	if (rdb_packageindex != NULL) {
+		r = table_close(rdb_packageindex);
+		RET_UPDATE(result, r);
+		rdb_packageindex = NULL;
+	}
+#ifdef HAVE_LMDB
+	r = lmdb_commit(false);
 	RET_UPDATE(result, r);
+#endif
+	if (!rdb_readonly) {
+		r = writeversionfile();
+		RET_UPDATE(result, r);
+	}
 	if (rdb_locked)
 		releaselock();
 	database_free();
 	return result;
 }
 
+enum database_type {
+	dbt_QUERY,
+	dbt_BTREE, dbt_BTREEDUP, dbt_BTREEPAIRS, dbt_BTREEVERSIONS,
+	dbt_HASH,
+	dbt_COUNT /* must be last */
+};
+
+#ifndef HAVE_LMDB
 static retvalue database_hasdatabasefile(const char *filename, /*@out@*/bool *exists_p) {
 	char *fullfilename;
 
@@ -216,12 +545,6 @@ static retvalue database_hasdatabasefile(const char *filename, /*@out@*/bool *ex
 	return RET_OK;
 }
 
-enum database_type {
-	dbt_QUERY,
-	dbt_BTREE, dbt_BTREEDUP, dbt_BTREEPAIRS, dbt_BTREEVERSIONS,
-	dbt_HASH,
-	dbt_COUNT /* must be last */
-};
 static const uint32_t types[dbt_COUNT] = {
 	DB_UNKNOWN,
 	DB_BTREE, DB_BTREE, DB_BTREE, DB_BTREE,
@@ -235,7 +558,8 @@ static int paireddatacompare(UNUSED(DB *db), const DBT *a, const DBT *b, size_t
 static int paireddatacompare(UNUSED(DB *db), const DBT *a, const DBT *b);
 #endif
 
-static retvalue database_opentable(const char *filename, /*@null@*/const char *subtable, enum database_type type, uint32_t flags, /*@out@*/DB **result) {
+/* pagesize is only used when creating a new file, 0 means the default */
+static retvalue database_opentable_paged(const char *filename, /*@null@*/const char *subtable, enum database_type type, uint32_t flags, uint32_t pagesize, /*@out@*/DB **result) {
 	char *fullfilename;
 	DB *table;
 	int dbret;
@@ -250,6 +574,16 @@ static retvalue database_opentable(const char *filename, /*@null@*/const char *s
 		free(fullfilename);
 		return RET_DBERR(dbret);
 	}
+	if (pagesize != 0) {
+		dbret = table->set_pagesize(table, pagesize);
+		if (dbret != 0) {
+			table->err(table, dbret, "db_set_pagesize(%lu):",
+					(unsigned long)pagesize);
+			(void)table->close(table, 0);
+			free(fullfilename);
+			return RET_DBERR(dbret);
+		}
+	}
 	if (type == dbt_BTREEDUP || type == dbt_BTREEPAIRS || type == dbt_BTREEVERSIONS) {
 		dbret = table->set_flags(table, DB_DUPSORT);
 		if (dbret != 0) {
@@ -316,6 +650,11 @@ static retvalue database_opentable(const char *filename, /*@null@*/const char *s
 	return RET_OK;
 }
 
+static inline retvalue database_opentable(const char *filename, /*@null@*/const char *subtable, enum database_type type, uint32_t flags, /*@out@*/DB **result) {
+	return database_opentable_paged(filename, subtable, type, flags, 0,
+			result);
+}
+
 retvalue database_listsubtables(const char *filename, struct strlist *result) {
 	DB *table;
 	DBC *cursor;
@@ -414,6 +753,244 @@ retvalue database_dropsubtable(const char *table, const char *subtable) {
 	return RET_OK;
 }
 
+#else /* HAVE_LMDB */
+
+/* open the environment and start the transaction if not yet done,
+ * RET_NOTHING if there is no database yet and we may not create one */
+static retvalue lmdb_begin(void) {
+	int dbret;
+
+	if (rdb_txn != NULL)
+		return RET_OK;
+	if (rdb_envmissing)
+		return RET_NOTHING;
+	if (rdb_env == NULL) {
+		dbret = mdb_env_create(&rdb_env);
+		if (dbret != 0) {
+			fprintf(stderr, "mdb_env_create: %s\n",
+					mdb_strerror(dbret));
+			rdb_env = NULL;
+			return RET_DBERR(dbret);
+		}
+		dbret = mdb_env_set_mapsize(rdb_env, LMDB_MAPSIZE);
+		if (dbret == 0)
+			dbret = mdb_env_set_maxdbs(rdb_env, LMDB_MAXDBS);
+		if (dbret == 0)
+			dbret = mdb_env_open(rdb_env, global.dbdir,
+					rdb_readonly ? MDB_RDONLY : 0, 0664);
+		if (dbret == ENOENT && rdb_readonly) {
+			mdb_env_close(rdb_env);
+			rdb_env = NULL;
+			rdb_envmissing = true;
+			return RET_NOTHING;
+		}
+		if (dbret != 0) {
+			fprintf(stderr, "mdb_env_open(%s): %s\n",
+					global.dbdir, mdb_strerror(dbret));
+			mdb_env_close(rdb_env);
+			rdb_env = NULL;
+			return RET_DBERR(dbret);
+		}
+		/* readers killed while reading would otherwise keep old
+		 * pages from being reused */
+		if (!rdb_readonly)
+			(void)mdb_reader_check(rdb_env, NULL);
+	}
+	dbret = mdb_txn_begin(rdb_env, NULL,
+			rdb_readonly ? MDB_RDONLY : 0, &rdb_txn);
+	if (dbret != 0) {
+		fprintf(stderr, "mdb_txn_begin(%s): %s\n",
+				global.dbdir, mdb_strerror(dbret));
+		rdb_txn = NULL;
+		return RET_DBERR(dbret);
+	}
+	return RET_OK;
+}
+
+/* commit everything done so far (if renew, start a new transaction) */
+static retvalue lmdb_commit(bool renew) {
+	int dbret;
+
+	if (rdb_txn == NULL)
+		return RET_NOTHING;
+	assert (!renew || rdb_cursors == 0);
+	if (rdb_readonly) {
+		if (!renew) {
+			mdb_txn_abort(rdb_txn);
+			rdb_txn = NULL;
+		}
+		return RET_OK;
+	}
+	dbret = mdb_txn_commit(rdb_txn);
+	rdb_txn = NULL;
+	rdb_uncommitted = 0;
+	if (dbret != 0) {
+		fprintf(stderr, "mdb_txn_commit(%s): %s\n",
+				global.dbdir, mdb_strerror(dbret));
+		if (dbret == MDB_MAP_FULL)
+			fputs(
+"(The database reached its maximum size, all changes since the last commit\n"
+"are lost.)\n", stderr);
+		return RET_DBERR(dbret);
+	}
+	if (renew)
+		return lmdb_begin();
+	return RET_OK;
+}
+
+static inline char *lmdb_dbname(const char *filename, /*@null@*/const char *subtable) {
+	if (subtable == NULL)
+		return strdup(filename);
+	return mprintf("%s:%s", filename, subtable);
+}
+
+/* look which named databases belong to the 'file' filename,
+ * RET_NOTHING if there are none */
+static retvalue lmdb_scannames(const char *filename, /*@null@*/struct strlist *subtables) {
+	MDB_dbi maindb;
+	MDB_cursor *cursor;
+	MDB_val Key, Data;
+	size_t len = strlen(filename);
+	int dbret;
+	retvalue result, r;
+
+	r = lmdb_begin();
+	if (!RET_IS_OK(r))
+		return r;
+	dbret = mdb_dbi_open(rdb_txn, NULL, 0, &maindb);
+	if (dbret == 0)
+		dbret = mdb_cursor_open(rdb_txn, maindb, &cursor);
+	if (dbret != 0) {
+		fprintf(stderr, "mdb_cursor_open(%s): %s\n",
+				global.dbdir, mdb_strerror(dbret));
+		return RET_DBERR(dbret);
+	}
+	result = RET_NOTHING;
+	SETMDBVl(Key, filename, len);
+	dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_SET_RANGE);
+	while (dbret == 0) {
+		const char *name = Key.mv_data;
+		char *subtable;
+
+		if (Key.mv_size < len || memcmp(name, filename, len) != 0)
+			break;
+		if (Key.mv_size == len)
+			result = RET_OK;
+		else if (name[len] == ':') {
+			result = RET_OK;
+			if (subtables == NULL)
+				break;
+			subtable = strndup(name + len + 1,
+					Key.mv_size - len - 1);
+			if (FAILEDTOALLOC(subtable)) {
+				result = RET_ERROR_OOM;
+				break;
+			}
+			r = strlist_add(subtables, subtable);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+		}
+		dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_NEXT);
+	}
+	mdb_cursor_close(cursor);
+	if (dbret != 0 && dbret != MDB_NOTFOUND && !RET_WAS_ERROR(result)) {
+		fprintf(stderr, "mdb_cursor_get(%s): %s\n",
+				global.dbdir, mdb_strerror(dbret));
+		result = RET_DBERR(dbret);
+	}
+	return result;
+}
+
+static retvalue database_hasdatabasefile(const char *filename, /*@out@*/bool *exists_p) {
+	retvalue r;
+
+	r = lmdb_scannames(filename, NULL);
+	if (RET_WAS_ERROR(r))
+		return r;
+	*exists_p = RET_IS_OK(r);
+	return RET_OK;
+}
+
+static int lmdb_versioncompare(const MDB_val *a, const MDB_val *b);
+
+static retvalue database_opentable(const char *filename, /*@null@*/const char *subtable, enum database_type type, uint32_t flags, /*@out@*/MDB_dbi *result) {
+	char *name;
+	unsigned int mdbflags = 0;
+	int dbret;
+	retvalue r;
+
+	r = lmdb_begin();
+	if (!RET_IS_OK(r))
+		return r;
+
+	name = lmdb_dbname(filename, subtable);
+	if (FAILEDTOALLOC(name))
+		return RET_ERROR_OOM;
+	/* paired tables store the value in the key instead, as lmdb
+	 * only allows small data items in tables with duplicates */
+	if (type == dbt_BTREEDUP || type == dbt_BTREEVERSIONS)
+		mdbflags |= MDB_DUPSORT;
+	if (ISSET(flags, DB_CREATE) && !rdb_readonly)
+		mdbflags |= MDB_CREATE;
+	dbret = mdb_dbi_open(rdb_txn, name, mdbflags, result);
+	if (dbret == MDB_NOTFOUND && !ISSET(mdbflags, MDB_CREATE)) {
+		free(name);
+		return RET_NOTHING;
+	}
+	if (dbret != 0) {
+		fprintf(stderr, "mdb_dbi_open(%s): %s\n",
+				name, mdb_strerror(dbret));
+		free(name);
+		return RET_DBERR(dbret);
+	}
+	if (type == dbt_BTREEVERSIONS) {
+		dbret = mdb_set_dupsort(rdb_txn, *result,
+				lmdb_versioncompare);
+		if (dbret != 0) {
+			fprintf(stderr, "mdb_set_dupsort(%s): %s\n",
+					name, mdb_strerror(dbret));
+			free(name);
+			return RET_DBERR(dbret);
+		}
+	}
+	free(name);
+	return RET_OK;
+}
+
+retvalue database_listsubtables(const char *filename, struct strlist *result) {
+	struct strlist ids;
+	retvalue r;
+
+	strlist_init(&ids);
+	r = lmdb_scannames(filename, &ids);
+	if (!RET_IS_OK(r)) {
+		strlist_done(&ids);
+		return r;
+	}
+	strlist_move(result, &ids);
+	return RET_OK;
+}
+
+retvalue database_dropsubtable(const char *table, const char *subtable) {
+	MDB_dbi dbi;
+	int dbret;
+	retvalue r;
+
+	r = database_opentable(table, subtable, dbt_QUERY, 0, &dbi);
+	if (!RET_IS_OK(r))
+		return r;
+	dbret = mdb_drop(rdb_txn, dbi, 1);
+	if (dbret != 0) {
+		fprintf(stderr, "Error removing '%s' from %s: %s!\n",
+				subtable, table, mdb_strerror(dbret));
+		return RET_DBERR(dbret);
+	}
+	return RET_OK;
+}
+#endif /* HAVE_LMDB */
+
 static inline bool targetisdefined(const char *identifier, struct distribution *distributions) {
 	struct distribution *d;
 	struct target *t;
@@ -680,6 +1257,9 @@ static retvalue readversionfile(bool nopackagesyet) {
 	/* ensure we can understand it */
 
 	r = dpkgversions_cmp(VERSION, rdb_lastsupportedversion, &c);
+	if (RET_IS_OK(r) && c < 0)
+		r = dpkgversions_cmp(DBFORMAT_CURRENT,
+				rdb_lastsupportedversion, &c);
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (c < 0) {
@@ -690,16 +1270,26 @@ static retvalue readversionfile(bool nopackagesyet) {
 		return RET_ERROR;
 	}
 
-	/* ensure it's a libdb database: */
+	/* ensure it's a database of the library we are built with: */
 
-	if (strncmp(rdb_dbversion, "bdb", 3) != 0) {
-		fprintf(stderr,
+	if (strncmp(rdb_dbversion, LIBDB_NAME, strlen(LIBDB_NAME)) != 0) {
+		if (strncmp(rdb_dbversion, "bdb", 3) == 0 ||
+		    strncmp(rdb_dbversion, "lmdb", 4) == 0)
+			fprintf(stderr,
+"According to %s/version this database was created with %s,\n"
+"while this binary uses " LIBDB_VERSION_STRING ". To convert it, run dumpdatabase\n"
+"with a reprepro built for the old library and loaddatabase with this one.\n"
+"Aborting...\n",
+				global.dbdir, rdb_dbversion);
+		else
+			fprintf(stderr,
 "According to %s/version this database was created with a yet unsupported\n"
 "database library. Aborting...\n",
 				global.dbdir);
 		return RET_ERROR;
 	}
-	if (strncmp(rdb_lastsupporteddbversion, "bdb", 3) != 0) {
+	if (strncmp(rdb_lastsupporteddbversion, LIBDB_NAME,
+				strlen(LIBDB_NAME)) != 0) {
 		fprintf(stderr,
 "According to %s/version this database was created with a yet unsupported\n"
 "database library. Aborting...\n",
@@ -713,9 +1303,9 @@ static retvalue readversionfile(bool nopackagesyet) {
 	if (c < 0) {
 		fprintf(stderr,
 "According to %s/version this database was created with a future version\n"
-"%s of libdb. The libdb version this binary is linked against cannot yet\n"
+"%s of " LIBDB_NAME ". The version this binary is linked against cannot yet\n"
 "handle this format. Aborting...\n",
-				global.dbdir, rdb_dbversion + 3);
+				global.dbdir, rdb_dbversion + strlen(LIBDB_NAME));
 		return RET_ERROR;
 	}
 	return RET_OK;
@@ -759,14 +1349,15 @@ static retvalue writeversionfile(void) {
 		}
 	}
 	if (rdb_dbversion == NULL)
-		fprintf(f, "bdb%d.%d.%d\n", DB_VERSION_MAJOR, DB_VERSION_MINOR,
-				DB_VERSION_PATCH);
+		fprintf(f, LIBDB_NAME "%d.%d.%d\n", LIBDB_VERSION_MAJOR,
+				LIBDB_VERSION_MINOR, LIBDB_VERSION_PATCH);
 	else {
 		(void)fputs(rdb_dbversion, f);
 		(void)fputc('\n', f);
 	}
 	if (rdb_lastsupporteddbversion == NULL)
-		fprintf(f, "bdb%d.%d.0\n", DB_VERSION_MAJOR, DB_VERSION_MINOR);
+		fprintf(f, LIBDB_NAME "%d.%d.0\n", LIBDB_VERSION_MAJOR,
+				LIBDB_VERSION_MINOR);
 	else {
 		(void)fputs(rdb_lastsupporteddbversion, f);
 		(void)fputc('\n', f);
@@ -858,13 +1449,20 @@ retvalue database_create(struct distribution *alldistributions, bool fast, bool
 	rdb_initialized = true;
 	rdb_used = true;
 
-	r = database_lock(waitforlock);
+	rdb_reopen.distributions = alldistributions;
+	rdb_reopen.nopackages = nopackages;
+	rdb_reopen.allowunused = allowunused;
+	rdb_reopen.readonly = readonly;
+	rdb_reopen.waitforlock = waitforlock;
+	rdb_reopen.verbosedb = verbosedb;
+
+	rdb_readonly = readonly;
+	r = database_lock(waitforlock, readonly);
 	assert (r != RET_NOTHING);
 	if (!RET_IS_OK(r)) {
 		database_free();
 		return r;
 	}
-	rdb_readonly = readonly;
 	rdb_verbose = verbosedb;
 
 	r = database_hasdatabasefile("packages.db", &packagesfileexists);
@@ -894,10 +1492,9 @@ retvalue database_create(struct distribution *alldistributions, bool fast, bool
 		return RET_OK;
 	}
 
-	if (nopackagesyet) {
-		// TODO: handle readonly, but only once packages files may no
-		// longer be generated when it is active...
-
+	/* read-only actions only have a shared lock, so they must not
+	 * create anything (missing tables are just treated as empty) */
+	if (nopackagesyet && !readonly) {
 		r = createnewdatabase(alldistributions);
 		if (RET_WAS_ERROR(r)) {
 			database_close();
@@ -909,6 +1506,14 @@ retvalue database_create(struct distribution *alldistributions, bool fast, bool
 	 * as other stuff was handled,
 	 * so writing the version file cannot harm (and not doing so could) */
 
+	if (!readonly) {
+		r = packageindex_open();
+		if (RET_WAS_ERROR(r)) {
+			database_close();
+			return r;
+		}
+	}
+
 	if (!allowunused && !fast && packagesfileexists)  {
 		struct strlist identifiers;
 
@@ -950,11 +1555,61 @@ retvalue database_create(struct distribution *alldistributions, bool fast, bool
 	return RET_OK;
 }
 
-/****************************************************************************
- * Stuff string parts                                                       *
+/* For commands running a long time (watchincoming): close everything and
+ * release the lock, so others can use the database until it is needed
+ * again. Only the tables opened by database_openreferences and
+ * database_openfiles are opened again by database_reacquire, every other
+ * table must already be closed. */
+retvalue database_release(void) {
+	retvalue r;
+
+	assert (rdb_initialized);
+	rdb_reopen.references = rdb_references != NULL;
+	rdb_reopen.files = rdb_checksums != NULL;
+	r = database_close();
+	if (opened_tables != NULL) {
+		fputs(
+"Internal Error: Tables still open while releasing the database!\n",
+				stderr);
+		print_opened_tables(stderr);
+		return RET_ERROR_INTERNAL;
+	}
+	rdb_used = false;
+	return r;
+}
+
+retvalue database_reacquire(void) {
+	retvalue r;
+
+	assert (!rdb_initialized);
+	/* the checks were already done when it was first opened: */
+	r = database_create(rdb_reopen.distributions, true,
+			rdb_reopen.nopackages, rdb_reopen.allowunused,
+			rdb_reopen.readonly, rdb_reopen.waitforlock,
+			rdb_reopen.verbosedb);
+	if (!RET_IS_OK(r)) {
+		if (r == RET_NOTHING)
+			r = RET_ERROR;
+		return r;
+	}
+	if (rdb_reopen.references)
+		r = database_openreferences();
+	if (RET_IS_OK(r) && rdb_reopen.files)
+		r = database_openfiles();
+	if (RET_WAS_ERROR(r))
+		(void)database_close();
+	return r;
+}
+
+/****************************************************************************
+ * Stuff string parts                                                       *
  ****************************************************************************/
 
+#ifdef HAVE_LMDB
+static const char databaseerror[] = "Internal error of the underlying lmdb database:\n";
+#else
 static const char databaseerror[] = "Internal error of the underlying BerkeleyDB database:\n";
+#endif
 
 /****************************************************************************
  * Stuff to handle data in tables                                           *
@@ -962,10 +1617,44 @@ static const char databaseerror[] = "Internal error of the underlying BerkeleyDB
  There is nothing that cannot be solved by another layer of indirection, except
  too many levels of indirection. (Source forgotten) */
 
+static void print_opened_tables(FILE *stream) {
+	if (opened_tables == NULL) {
+		fprintf(stream, "No tables are opened.\n");
+	} else {
+		fprintf(stream, "Opened tables:\n");
+		for (struct opened_tables *iter = opened_tables; iter != NULL; iter = iter->next) {
+			fprintf(stream, " * %s - '%s'\n", iter->name, iter->subname);
+		}
+	}
+}
+
+static void opened_tables_remove(const char *name, /*@null@*/const char *subname) {
+	struct opened_tables *prev = NULL;
+
+	for (struct opened_tables *iter = opened_tables; iter != NULL; iter = iter->next) {
+		if(strcmp2(iter->name, name) == 0 && strcmp2(iter->subname, subname) == 0) {
+			if (prev == NULL) {
+				opened_tables = iter->next;
+			} else {
+				prev->next = iter->next;
+			}
+			free(iter);
+			break;
+		}
+		prev = iter;
+	}
+
+	if (verbose >= 25)
+		print_opened_tables(stderr);
+}
+
+#ifndef HAVE_LMDB
 struct cursor {
 	DBC *cursor;
 	uint32_t flags;
 	retvalue r;
+	/* for uncompressed chunks */
+	struct chunkbuffer buffer;
 };
 
 struct table {
@@ -974,6 +1663,15 @@ struct table {
 	DB *sec_berkeleydb;
 	bool readonly, verbose;
 	uint32_t flags;
+	/* number of calls, for --timings */
+	unsigned long ops[to_COUNT];
+	/* packages tables may contain chunks compressed with this,
+	 * new ones are only compressed if compress is set */
+	bool chunks, compress;
+	/* changes are recorded in packageindex.db */
+	bool indexed;
+	/*@null@*/struct chunkdictionary *dictionary;
+	struct chunkbuffer buffer, compressbuffer;
 };
 
 static void table_printerror(struct table *table, int dbret, const char *action) {
@@ -1014,19 +1712,26 @@ static void table_printerror(struct table *table, int dbret, const char *action)
 	}
 }
 
-static void print_opened_tables(FILE *stream) {
-	if (opened_tables == NULL) {
-		fprintf(stream, "No tables are opened.\n");
-	} else {
-		fprintf(stream, "Opened tables:\n");
-		for (struct opened_tables *iter = opened_tables; iter != NULL; iter = iter->next) {
-			fprintf(stream, " * %s - '%s'\n", iter->name, iter->subname);
-		}
-	}
+#if DB_VERSION_MAJOR > 4 || (DB_VERSION_MAJOR == 4 && DB_VERSION_MINOR >= 3)
+/* without an environment every handle has its own page cache */
+static void table_cachestatistics(struct table *table, /*@null@*/DB *db) {
+	DB_MPOOL_STAT *stat;
+	DB_ENV *env;
+
+	if (db == NULL)
+		return;
+	env = db->get_env(db);
+	if (env == NULL || env->memp_stat(env, &stat, NULL, 0) != 0)
+		return;
+	table->ops[to_cachehit] += stat->st_cache_hit;
+	table->ops[to_cachemiss] += stat->st_cache_miss;
+	free(stat);
 }
+#else
+#define table_cachestatistics(table, db) do {} while (0)
+#endif
 
 retvalue table_close(struct table *table) {
-	struct opened_tables *prev = NULL;
 	int dbret;
 	retvalue result = RET_OK;
 
@@ -1035,6 +1740,11 @@ retvalue table_close(struct table *table) {
 		        table == NULL ? NULL : table->name, table == NULL ? NULL : table->subname);
 	if (table == NULL)
 		return RET_NOTHING;
+	if (timings_enabled) {
+		table_cachestatistics(table, table->berkeleydb);
+		table_cachestatistics(table, table->sec_berkeleydb);
+	}
+	timing_tableops(table->name, table->subname, table->ops);
 	if (table->sec_berkeleydb != NULL) {
 		dbret = table->sec_berkeleydb->close(table->sec_berkeleydb, 0);
 		if (dbret != 0) {
@@ -1056,34 +1766,42 @@ retvalue table_close(struct table *table) {
 		result = RET_DBERR(dbret);
 	}
 
-	for (struct opened_tables *iter = opened_tables; iter != NULL; iter = iter->next) {
-		if(strcmp2(iter->name, table->name) == 0 && strcmp2(iter->subname, table->subname) == 0) {
-			if (prev == NULL) {
-				opened_tables = iter->next;
-			} else {
-				prev->next = iter->next;
-			}
-			free(iter);
-			break;
-		}
-		prev = iter;
-	}
-
-	if (verbose >= 25)
-		print_opened_tables(stderr);
+	opened_tables_remove(table->name, table->subname);
 
+	chunkdictionary_free(table->dictionary);
+	chunkbuffer_done(&table->buffer);
+	chunkbuffer_done(&table->compressbuffer);
 	free(table->name);
 	free(table->subname);
 	free(table);
 	return result;
 }
 
+/* write all changes to disk, so that some progress can be recorded elsewhere */
+retvalue table_sync(struct table *table) {
+	int dbret;
+
+	assert (table != NULL);
+	if (table->readonly || table->berkeleydb == NULL)
+		return RET_NOTHING;
+	dbret = table->berkeleydb->sync(table->berkeleydb, 0);
+	if (dbret != 0) {
+		fprintf(stderr, "db_sync(%s, %s): %s\n",
+				table->name, table->subname,
+				db_strerror(dbret));
+		return RET_DBERR(dbret);
+	}
+	return RET_OK;
+}
+
 retvalue table_getrecord(struct table *table, bool secondary, const char *key, char **data_p, size_t *datalen_p) {
 	int dbret;
 	DBT Key, Data;
 	DB *db;
+	retvalue r;
 
 	assert (table != NULL);
+	table->ops[to_get]++;
 	if (table->berkeleydb == NULL) {
 		assert (table->readonly);
 		return RET_NOTHING;
@@ -1120,6 +1838,12 @@ retvalue table_getrecord(struct table *table, bool secondary, const char *key, c
 		free(Data.data);
 		return RET_ERROR;
 	}
+	if (table->chunks && chunk_iscompressed(Data.data, Data.size - 1)) {
+		r = table_uncompresscopy(table, Data.data, Data.size - 1,
+				data_p, datalen_p);
+		free(Data.data);
+		return r;
+	}
 	*data_p = Data.data;
 	if (datalen_p != NULL)
 		*datalen_p = Data.size-1;
@@ -1132,6 +1856,7 @@ retvalue table_getpair(struct table *table, const char *key, const char *value,
 	size_t valuelen = strlen(value);
 
 	assert (table != NULL);
+	table->ops[to_get]++;
 	if (table->berkeleydb == NULL) {
 		assert (table->readonly);
 		return RET_NOTHING;
@@ -1172,6 +1897,7 @@ retvalue table_gettemprecord(struct table *table, const char *key, const char **
 	DBT Key, Data;
 
 	assert (table != NULL);
+	table->ops[to_get]++;
 	if (table->berkeleydb == NULL) {
 		assert (table->readonly);
 		return RET_NOTHING;
@@ -1208,6 +1934,9 @@ retvalue table_gettemprecord(struct table *table, const char *key, const char **
 		return RET_ERROR;
 	}
 	*data_p = Data.data;
+	if (table->chunks && chunk_iscompressed(Data.data, Data.size - 1))
+		return table_uncompress(table, &table->buffer, data_p,
+				Data.size - 1, datalen_p);
 	if (datalen_p != NULL)
 		*datalen_p = Data.size - 1;
 	return RET_OK;
@@ -1219,6 +1948,7 @@ retvalue table_checkrecord(struct table *table, const char *key, const char *dat
 	DBC *cursor;
 	retvalue r;
 
+	table->ops[to_get]++;
 	SETDBT(Key, key);
 	SETDBT(Data, data);
 	dbret = table->berkeleydb->cursor(table->berkeleydb, NULL, &cursor, 0);
@@ -1250,6 +1980,7 @@ retvalue table_removerecord(struct table *table, const char *key, const char *da
 	DBC *cursor;
 	retvalue r;
 
+	table->ops[to_delete]++;
 	SETDBT(Key, key);
 	SETDBT(Data, data);
 	dbret = table->berkeleydb->cursor(table->berkeleydb, NULL, &cursor, 0);
@@ -1279,19 +2010,13 @@ retvalue table_removerecord(struct table *table, const char *key, const char *da
 	return r;
 }
 
-bool table_recordexists(struct table *table, const char *key) {
-	retvalue r;
-
-	r = table_gettemprecord(table, key, NULL, NULL);
-	return RET_IS_OK(r);
-}
-
 retvalue table_addrecord(struct table *table, const char *key, const char *data, size_t datalen, bool ignoredups) {
 	int dbret;
 	DBT Key, Data;
 
 	assert (table != NULL);
 	assert (!table->readonly && table->berkeleydb != NULL);
+	table->ops[to_add]++;
 
 	SETDBT(Key, key);
 	SETDBTl(Data, data, datalen + 1);
@@ -1315,10 +2040,18 @@ retvalue table_addrecord(struct table *table, const char *key, const char *data,
 retvalue table_adduniqsizedrecord(struct table *table, const char *key, const char *data, size_t data_size, bool allowoverwrite, bool nooverwrite) {
 	int dbret;
 	DBT Key, Data;
+	retvalue r;
 
 	assert (table != NULL);
 	assert (!table->readonly && table->berkeleydb != NULL);
 	assert (data_size > 0 && data[data_size-1] == '\0');
+	table->ops[to_add]++;
+
+	if (table->compress) {
+		r = table_compress(table, &data, &data_size);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
 
 	SETDBT(Key, key);
 	SETDBTl(Data, data, data_size);
@@ -1332,6 +2065,11 @@ retvalue table_adduniqsizedrecord(struct table *table, const char *key, const ch
 		table_printerror(table, dbret, "put(uniq)");
 		return RET_DBERR(dbret);
 	}
+	if (table->indexed) {
+		r = packageindex_update(table, key, NULL, true);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
 	if (table->verbose) {
 		if (table->subname != NULL)
 			printf("db: '%s' added to %s(%s).\n",
@@ -1342,20 +2080,14 @@ retvalue table_adduniqsizedrecord(struct table *table, const char *key, const ch
 	}
 	return RET_OK;
 }
-retvalue table_adduniqrecord(struct table *table, const char *key, const char *data) {
-	if (verbose >= 15)
-		fprintf(stderr, "trace: table_adduniqrecord(table=%s, key=%s) called.\n",
-		        table->name, key);
-	return table_adduniqsizedrecord(table, key, data, strlen(data)+1,
-			false, false);
-}
-
 retvalue table_deleterecord(struct table *table, const char *key, bool ignoremissing) {
 	int dbret;
 	DBT Key;
+	retvalue r;
 
 	assert (table != NULL);
 	assert (!table->readonly && table->berkeleydb != NULL);
+	table->ops[to_delete]++;
 
 	SETDBT(Key, key);
 	dbret = table->berkeleydb->del(table->berkeleydb, NULL, &Key, 0);
@@ -1368,6 +2100,11 @@ retvalue table_deleterecord(struct table *table, const char *key, bool ignoremis
 		else
 			return RET_DBERR(dbret);
 	}
+	if (table->indexed) {
+		r = packageindex_update(table, key, NULL, false);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
 	if (table->verbose) {
 		if (table->subname != NULL)
 			printf("db: '%s' removed from %s(%s).\n",
@@ -1379,18 +2116,6 @@ retvalue table_deleterecord(struct table *table, const char *key, bool ignoremis
 	return RET_OK;
 }
 
-retvalue table_replacerecord(struct table *table, const char *key, const char *data) {
-	retvalue r;
-
-	if (verbose >= 15)
-		fprintf(stderr, "trace: table_replacerecord(table=%s, key=%s) called.\n",
-		        table->name, key);
-	r = table_deleterecord(table, key, false);
-	if (r != RET_ERROR_MISSING && RET_WAS_ERROR(r))
-		return r;
-	return table_adduniqrecord(table, key, data);
-}
-
 static retvalue newcursor(struct table *table, uint32_t flags, struct cursor **cursor_p) {
 	DB *berkeleydb;
 	struct cursor *cursor;
@@ -1432,6 +2157,7 @@ static retvalue newcursor(struct table *table, uint32_t flags, struct cursor **c
 retvalue table_newglobalcursor(struct table *table, struct cursor **cursor_p) {
 	retvalue r;
 
+	table->ops[to_cursor]++;
 	r = newcursor(table, DB_NEXT, cursor_p);
 	if (r == RET_NOTHING) {
 		// table_newglobalcursor returned RET_OK when table->berkeleydb == NULL. Is that return value wanted?
@@ -1504,6 +2230,7 @@ retvalue table_newduplicatecursor(struct table *table, const char *key, long lon
 	DBT Key, Data;
 	retvalue r;
 
+	table->ops[to_cursor]++;
 	r = newcursor(table, DB_NEXT_DUP, &cursor);
 	if(!RET_IS_OK(r)) {
 		return r;
@@ -1544,8 +2271,13 @@ retvalue table_newduplicatecursor(struct table *table, const char *key, long lon
 	}
 
 	r = parse_data(table, Key, Data, key_p, data_p, datalen_p);
+	if (RET_IS_OK(r) && table->chunks &&
+			chunk_iscompressed(*data_p, Data.size - 1))
+		r = table_uncompress(table, &cursor->buffer, data_p,
+				Data.size - 1, datalen_p);
 	if (RET_WAS_ERROR(r)) {
 		(void)cursor->cursor->c_close(cursor->cursor);
+		chunkbuffer_done(&cursor->buffer);
 		free(cursor);
 		return r;
 	}
@@ -1559,6 +2291,7 @@ retvalue table_newduplicatepairedcursor(struct table *table, const char *key, st
 	DBT Key, Data;
 	retvalue r;
 
+	table->ops[to_cursor]++;
 	r = newcursor(table, DB_NEXT_DUP, cursor_p);
 	if(!RET_IS_OK(r)) {
 		return r;
@@ -1597,6 +2330,7 @@ retvalue table_newpairedcursor(struct table *table, const char *key, const char
 	retvalue r;
 	size_t valuelen = strlen(value);
 
+	table->ops[to_cursor]++;
 	/* cursor_next is not allowed with this type: */
 	r = newcursor(table, DB_GET_BOTH, cursor_p);
 	if(!RET_IS_OK(r)) {
@@ -1648,6 +2382,7 @@ retvalue cursor_close(struct table *table, struct cursor *cursor) {
 	r = cursor->r;
 	dbret = cursor->cursor->c_close(cursor->cursor);
 	cursor->cursor = NULL;
+	chunkbuffer_done(&cursor->buffer);
 	free(cursor);
 	if (dbret != 0) {
 		table_printerror(table, dbret, "c_close");
@@ -1688,10 +2423,15 @@ bool cursor_nexttempdata(struct table *table, struct cursor *cursor, const char
 	bool success;
 	retvalue r;
 
+	table->ops[to_next]++;
 	success = cursor_next(table, cursor, &Key, &Data);
 	if (!success)
 		return false;
 	r = parse_data(table, Key, Data, key, data, len_p);
+	if (RET_IS_OK(r) && table->chunks &&
+			chunk_iscompressed(*data, Data.size - 1))
+		r = table_uncompress(table, &cursor->buffer, data,
+				Data.size - 1, len_p);
 	if (RET_WAS_ERROR(r)) {
 		cursor->r = r;
 		return false;
@@ -1704,6 +2444,7 @@ bool cursor_nextpair(struct table *table, struct cursor *cursor, /*@null@*/const
 	bool success;
 	retvalue r;
 
+	table->ops[to_next]++;
 	success = cursor_next(table, cursor, &Key, &Data);
 	if (!success)
 		return false;
@@ -1717,13 +2458,21 @@ bool cursor_nextpair(struct table *table, struct cursor *cursor, /*@null@*/const
 
 retvalue cursor_replace(struct table *table, struct cursor *cursor, const char *data, size_t datalen) {
 	DBT Key, Data;
+	size_t size = datalen + 1;
 	int dbret;
+	retvalue r;
 
 	assert (cursor != NULL);
 	assert (!table->readonly);
+	table->ops[to_replace]++;
 
+	if (table->compress) {
+		r = table_compress(table, &data, &size);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
 	CLEARDBT(Key);
-	SETDBTl(Data, data, datalen + 1);
+	SETDBTl(Data, data, size);
 
 	dbret = cursor->cursor->c_put(cursor->cursor, &Key, &Data, DB_CURRENT);
 
@@ -1735,17 +2484,47 @@ retvalue cursor_replace(struct table *table, struct cursor *cursor, const char *
 }
 
 retvalue cursor_delete(struct table *table, struct cursor *cursor, const char *key, const char *value) {
+	char *pkey = NULL;
 	int dbret;
+	retvalue r;
 
 	assert (cursor != NULL);
 	assert (!table->readonly);
+	table->ops[to_delete]++;
+
+	if (table->indexed) {
+		DBT Skey, Pkey, Data;
+
+		/* the cursor is on the names, packageindex.db needs the
+		 * primary key */
+		CLEARDBT(Skey);
+		CLEARDBT(Pkey);
+		CLEARDBT(Data);
+		Data.flags = DB_DBT_PARTIAL;
+		dbret = cursor->cursor->c_pget(cursor->cursor,
+				&Skey, &Pkey, &Data, DB_CURRENT);
+		if (dbret != 0) {
+			table_printerror(table, dbret, "c_pget(DB_CURRENT)");
+			return RET_DBERR(dbret);
+		}
+		pkey = strndup(Pkey.data, Pkey.size);
+		if (FAILEDTOALLOC(pkey))
+			return RET_ERROR_OOM;
+	}
 
 	dbret = cursor->cursor->c_del(cursor->cursor, 0);
 
 	if (dbret != 0) {
+		free(pkey);
 		table_printerror(table, dbret, "c_del");
 		return RET_DBERR(dbret);
 	}
+	if (pkey != NULL) {
+		r = packageindex_update(table, pkey, NULL, false);
+		free(pkey);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
 	if (table->verbose) {
 		if (value != NULL)
 			if (table->subname != NULL)
@@ -1796,887 +2575,3707 @@ static bool table_isempty(struct table *table) {
 	return false;
 }
 
-retvalue database_haspackages(const char *identifier) {
-	struct table *packages;
+#else /* HAVE_LMDB */
+struct cursor {
+	MDB_cursor *cursor;
+	MDB_cursor_op op;
+	/* stop at the first key not starting with this: */
+	/*@null@*/char *prefix;
+	size_t prefixlen;
 	retvalue r;
-	bool empty;
+	/* for uncompressed chunks */
+	struct chunkbuffer buffer;
+};
 
-	r = database_openpackages(identifier, true, &packages);
-	if (RET_WAS_ERROR(r))
-		return r;
-	empty = table_isempty(packages);
-	(void)table_close(packages);
-	return empty?RET_NOTHING:RET_OK;
-}
+struct table {
+	char *name, *subname;
+	enum database_type type;
+	/* false for a missing table opened read-only */
+	bool exists;
+	MDB_dbi dbi;
+	/* package tables have a index from package names to primary keys,
+	 * which is kept up to date here (as libdb's associate does) */
+	bool hassecondary;
+	MDB_dbi sec_dbi;
+	bool readonly, verbose;
+	uint32_t flags;
+	/* number of calls, for --timings */
+	unsigned long ops[to_COUNT];
+	/* packages tables may contain chunks compressed with this,
+	 * new ones are only compressed if compress is set */
+	bool chunks, compress;
+	/* changes are recorded in packageindex.db */
+	bool indexed;
+	/*@null@*/struct chunkdictionary *dictionary;
+	struct chunkbuffer buffer, compressbuffer;
+};
 
-/****************************************************************************
- * Open the different types of tables with their needed flags:              *
- ****************************************************************************/
-static retvalue database_table_secondary(const char *filename, const char *subtable, enum database_type type, uint32_t flags,
-                                         const char *secondary_filename, enum database_type secondary_type, /*@out@*/struct table **table_p) {
-	struct table *table;
-	struct opened_tables *opened_table;
-	retvalue r;
+static void table_printerror(struct table *table, int dbret, const char *action) {
+	const char *error_msg;
+
+	if (dbret == DB_MALFORMED_KEY)
+		error_msg = "DB_MALFORMED_KEY: Primary key does not contain the separator '|'.";
+	else
+		error_msg = mdb_strerror(dbret);
 
+	if (table->subname != NULL)
+		fprintf(stderr, "%sWithin %s subtable %s at %s: %s\n",
+				databaseerror, table->name, table->subname,
+				action, error_msg);
+	else
+		fprintf(stderr, "%sWithin %s at %s: %s\n",
+				databaseerror, table->name, action, error_msg);
+}
+
+retvalue table_close(struct table *table) {
 	if (verbose >= 15)
-		fprintf(stderr, "trace: database_table(filename=%s, subtable=%s) called.\n",
-		        filename, subtable);
+		fprintf(stderr, "trace: table_close(table.name=%s, table.subname=%s) called.\n",
+		        table == NULL ? NULL : table->name, table == NULL ? NULL : table->subname);
+	if (table == NULL)
+		return RET_NOTHING;
+	timing_tableops(table->name, table->subname, table->ops);
+	/* the handles stay valid till the environment is closed,
+	 * closing them here is not needed and dangerous */
 
-	for (struct opened_tables *iter = opened_tables; iter != NULL; iter = iter->next) {
-		if(strcmp2(iter->name, filename) == 0 && strcmp2(iter->subname, subtable) == 0) {
-            fprintf(stderr,
- "Internal Error: Trying to open table '%s' from file '%s' multiple times.\n"
- "This should normally not happen (to avoid triggering bugs in the underlying BerkeleyDB)\n",
-                    subtable, filename);
-			return RET_ERROR;
-		}
+	opened_tables_remove(table->name, table->subname);
+
+	chunkdictionary_free(table->dictionary);
+	chunkbuffer_done(&table->buffer);
+	chunkbuffer_done(&table->compressbuffer);
+	free(table->name);
+	free(table->subname);
+	free(table);
+	/* nothing returned from this table can be used any more,
+	 * so this is a good place to not let the transaction grow
+	 * too much (if there are no cursors that would break) */
+	if (!rdb_readonly && rdb_cursors == 0 &&
+			rdb_uncommitted >= LMDB_COMMITINTERVAL)
+		return lmdb_commit(true);
+	return RET_OK;
+}
+
+/* write all changes to disk, so that some progress can be recorded elsewhere */
+retvalue table_sync(struct table *table) {
+	assert (table != NULL);
+	if (table->readonly || !table->exists)
+		return RET_NOTHING;
+	/* committing would invalidate the cursors,
+	 * so this has to wait for the next one */
+	if (rdb_cursors > 0)
+		return RET_NOTHING;
+	return lmdb_commit(true);
+}
+
+/* the name of a package is the part of the primary key before the '|' */
+static inline int package_name(const char *key, /*@out@*/MDB_val *name) {
+	const char *separator;
+
+	separator = strchr(key, '|');
+	if (unlikely(separator == NULL))
+		return DB_MALFORMED_KEY;
+	name->mv_data = strndup(key, separator - key);
+	if (FAILEDTOALLOC(name->mv_data))
+		return ENOMEM;
+	name->mv_size = separator - key + 1;
+	return 0;
+}
+
+/* the key of a paired table is "key\0value\0" */
+static inline int pair_key(const char *key, const char *value, size_t valuelen, /*@out@*/MDB_val *Key) {
+	size_t keylen = strlen(key);
+	char *k;
+
+	k = malloc(keylen + valuelen + 2);
+	if (FAILEDTOALLOC(k))
+		return ENOMEM;
+	memcpy(k, key, keylen + 1);
+	memcpy(k + keylen + 1, value, valuelen);
+	k[keylen + 1 + valuelen] = '\0';
+	Key->mv_data = k;
+	Key->mv_size = keylen + valuelen + 2;
+	return 0;
+}
+
+/* data_size includes the terminating '\0' */
+static int lmdb_put(struct table *table, const char *key, const char *data, size_t data_size, unsigned int flags) {
+	MDB_val Key, Data, Name;
+	int dbret;
+
+	assert (!table->readonly && table->exists);
+
+	if (table->type == dbt_BTREEPAIRS) {
+		/* data is "value\0rest\0", the value is part of the key */
+		const char *separator = memchr(data, '\0', data_size - 1);
+
+		if (separator == NULL)
+			return EINVAL;
+		dbret = pair_key(key, data, separator - data, &Key);
+		if (dbret != 0)
+			return dbret;
+		SETMDBVl(Data, separator + 1, data_size - (separator + 1 - data));
+		dbret = mdb_put(rdb_txn, table->dbi, &Key, &Data, flags);
+		free(Key.mv_data);
+		return dbret;
 	}
+	SETMDBV(Key, key);
+	SETMDBVl(Data, data, data_size);
+	if (!table->hassecondary)
+		return mdb_put(rdb_txn, table->dbi, &Key, &Data, flags);
 
-	table = zNEW(struct table);
-	if (FAILEDTOALLOC(table))
-		return RET_ERROR_OOM;
-	/* TODO: is filename always an static constant? then we could drop the dup */
-	table->name = strdup(filename);
-	if (FAILEDTOALLOC(table->name)) {
-		free(table);
-		return RET_ERROR_OOM;
+	dbret = package_name(key, &Name);
+	if (dbret != 0)
+		return dbret;
+	dbret = mdb_put(rdb_txn, table->dbi, &Key, &Data, flags);
+	if (dbret == 0) {
+		dbret = mdb_put(rdb_txn, table->sec_dbi, &Name, &Key,
+				MDB_NODUPDATA);
+		if (dbret == MDB_KEYEXIST)
+			dbret = 0;
 	}
-	if (subtable != NULL) {
-		table->subname = strdup(subtable);
-		if (FAILEDTOALLOC(table->subname)) {
-			free(table->name);
-			free(table);
-			return RET_ERROR_OOM;
-		}
-	} else
-		table->subname = NULL;
-	table->readonly = ISSET(flags, DB_RDONLY);
-	table->verbose = rdb_verbose;
-	table->flags = flags;
-	r = database_opentable(filename, subtable, type, flags,
-			&table->berkeleydb);
-	if (RET_WAS_ERROR(r)) {
-		free(table->subname);
-		free(table->name);
-		free(table);
-		return r;
-	}
-	if (r == RET_NOTHING) {
-		if (ISSET(flags, DB_RDONLY)) {
-			/* sometimes we don't want a return here, when? */
-			table->berkeleydb = NULL;
-			r = RET_OK;
-		} else {
-			free(table->subname);
-			free(table->name);
-			free(table);
-			return r;
+	free(Name.mv_data);
+	return dbret;
+}
+
+static int lmdb_del(struct table *table, const char *key) {
+	MDB_val Key, Data, Name;
+	MDB_cursor *cursor;
+	int dbret;
+
+	assert (!table->readonly && table->exists);
+
+	if (table->type == dbt_BTREEPAIRS) {
+		/* remove all values of this key */
+		size_t keylen = strlen(key) + 1;
+		bool found = false;
+
+		dbret = mdb_cursor_open(rdb_txn, table->dbi, &cursor);
+		if (dbret != 0)
+			return dbret;
+		SETMDBV(Key, key);
+		dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_SET_RANGE);
+		while (dbret == 0 && Key.mv_size > keylen &&
+				memcmp(Key.mv_data, key, keylen) == 0) {
+			dbret = mdb_cursor_del(cursor, 0);
+			if (dbret != 0)
+				break;
+			found = true;
+			/* after deleting this returns the following one */
+			dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_NEXT);
 		}
+		mdb_cursor_close(cursor);
+		if (dbret != 0 && dbret != MDB_NOTFOUND)
+			return dbret;
+		return found ? 0 : MDB_NOTFOUND;
+	}
+	SETMDBV(Key, key);
+	dbret = mdb_del(rdb_txn, table->dbi, &Key, NULL);
+	if (dbret != 0 || !table->hassecondary)
+		return dbret;
+	dbret = package_name(key, &Name);
+	if (dbret != 0)
+		return dbret;
+	dbret = mdb_del(rdb_txn, table->sec_dbi, &Name, &Key);
+	free(Name.mv_data);
+	return dbret;
+}
 
-	}
+/* get the data of a package table from its primary key */
+static inline int lmdb_primary(struct table *table, const MDB_val *Pkey, /*@out@*/MDB_val *Data) {
+	MDB_val Key = *Pkey;
+	int dbret;
 
-	if (secondary_filename != NULL) {
-		r = database_opentable(secondary_filename, subtable, secondary_type, flags,
-				&table->sec_berkeleydb);
-		if (RET_WAS_ERROR(r)) {
-			table->berkeleydb->close(table->berkeleydb, 0);
-			free(table->subname);
-			free(table->name);
-			free(table);
-			return r;
-		}
-		if (r == RET_NOTHING) {
-			if (ISSET(flags, DB_RDONLY)) {
-				/* sometimes we don't want a return here, when? */
-				table->sec_berkeleydb = NULL;
-				r = RET_OK;
-			} else {
-				table->berkeleydb->close(table->berkeleydb, 0);
-				free(table->subname);
-				free(table->name);
-				free(table);
-				return r;
-			}
+	dbret = mdb_get(rdb_txn, table->dbi, &Key, Data);
+	/* the index pointing to something not there: */
+	if (dbret == MDB_NOTFOUND)
+		return MDB_CORRUPTED;
+	return dbret;
+}
 
-		}
-	}
+retvalue table_getrecord(struct table *table, bool secondary, const char *key, char **data_p, size_t *datalen_p) {
+	int dbret;
+	MDB_val Key, Data;
+	char *data;
 
-	opened_table = zNEW(struct opened_tables);
-	if (FAILEDTOALLOC(opened_table)) {
-		free(table->subname);
-		free(table->name);
-		free(table);
-		return RET_ERROR_OOM;
+	assert (table != NULL);
+	table->ops[to_get]++;
+	if (!table->exists) {
+		assert (table->readonly);
+		return RET_NOTHING;
 	}
-	opened_table->name = table->name;
-	opened_table->subname = table->subname;
-	opened_table->next = opened_tables;
-	opened_tables = opened_table;
 
-	if (verbose >= 25)
-		print_opened_tables(stderr);
+	SETMDBV(Key, key);
+	if (secondary) {
+		MDB_val Pkey;
 
-	*table_p = table;
-	return r;
+		assert (table->hassecondary);
+		/* the first is the one with the highest version */
+		dbret = mdb_get(rdb_txn, table->sec_dbi, &Key, &Pkey);
+		if (dbret == 0)
+			dbret = lmdb_primary(table, &Pkey, &Data);
+	} else
+		dbret = mdb_get(rdb_txn, table->dbi, &Key, &Data);
+	if (dbret == MDB_NOTFOUND)
+		return RET_NOTHING;
+	if (dbret != 0) {
+		table_printerror(table, dbret, "get");
+		return RET_DBERR(dbret);
+	}
+	if (Data.mv_size <= 0 ||
+	    ((const char*)Data.mv_data)[Data.mv_size-1] != '\0') {
+		if (table->subname != NULL)
+			fprintf(stderr,
+"Database %s(%s) returned corrupted (not null-terminated) data!\n",
+					table->name, table->subname);
+		else
+			fprintf(stderr,
+"Database %s returned corrupted (not null-terminated) data!\n",
+					table->name);
+		return RET_ERROR;
+	}
+	if (table->chunks && chunk_iscompressed(Data.mv_data, Data.mv_size - 1))
+		return table_uncompresscopy(table, Data.mv_data,
+				Data.mv_size - 1, data_p, datalen_p);
+	data = malloc(Data.mv_size);
+	if (FAILEDTOALLOC(data))
+		return RET_ERROR_OOM;
+	memcpy(data, Data.mv_data, Data.mv_size);
+	*data_p = data;
+	if (datalen_p != NULL)
+		*datalen_p = Data.mv_size-1;
+	return RET_OK;
 }
 
-static retvalue database_table(const char *filename, const char *subtable, enum database_type type, uint32_t flags, /*@out@*/struct table **table_p) {
-	return database_table_secondary(filename, subtable, type, flags, NULL, 0, table_p);
-}
+retvalue table_getpair(struct table *table, const char *key, const char *value, /*@out@*/const char **data_p, /*@out@*/size_t *datalen_p) {
+	int dbret;
+	MDB_val Key, Data;
 
-retvalue database_openreferences(void) {
-	retvalue r;
+	assert (table != NULL);
+	assert (table->type == dbt_BTREEPAIRS);
+	table->ops[to_get]++;
+	if (!table->exists) {
+		assert (table->readonly);
+		return RET_NOTHING;
+	}
 
-	assert (rdb_references == NULL);
-	r = database_table("references.db", "references",
-			dbt_BTREEDUP, DB_CREATE, &rdb_references);
-	assert (r != RET_NOTHING);
-	if (RET_WAS_ERROR(r)) {
-		rdb_references = NULL;
-		return r;
-	} else
-		rdb_references->verbose = false;
+	dbret = pair_key(key, value, strlen(value), &Key);
+	if (dbret == 0) {
+		dbret = mdb_get(rdb_txn, table->dbi, &Key, &Data);
+		free(Key.mv_data);
+	}
+	if (dbret == MDB_NOTFOUND)
+		return RET_NOTHING;
+	if (dbret != 0) {
+		table_printerror(table, dbret, "get(pair)");
+		return RET_DBERR(dbret);
+	}
+	if (Data.mv_size == 0 ||
+	    ((const char*)Data.mv_data)[Data.mv_size-1] != '\0') {
+		if (table->subname != NULL)
+			fprintf(stderr,
+"Database %s(%s) returned corrupted (not paired) data!",
+					table->name, table->subname);
+		else
+			fprintf(stderr,
+"Database %s returned corrupted (not paired) data!",
+					table->name);
+		return RET_ERROR;
+	}
+	*data_p = Data.mv_data;
+	*datalen_p = Data.mv_size - 1;
 	return RET_OK;
 }
 
-static int debianversioncompare(UNUSED(DB *db), const DBT *a, const DBT *b) {
-	const char *a_version;
-	const char *b_version;
-	int versioncmp;
-	// There is no way to indicate an error to the caller
-	// Thus return -1 in case of an error
-	retvalue r = -1;
+/* the data returned points directly into the database map,
+ * so it is only valid till the next change */
+retvalue table_gettemprecord(struct table *table, const char *key, const char **data_p, size_t *datalen_p) {
+	int dbret;
+	MDB_val Key, Data;
 
-	if (a->size == 0 || ((char*)a->data)[a->size-1] != '\0') {
-		fprintf(stderr, "Database value '%.*s' empty or not NULL terminated.\n", a->size, (char*)a->data);
-		return r;
-	}
-	if (b->size == 0 || ((char*)b->data)[b->size-1] != '\0') {
-		fprintf(stderr, "Database value '%.*s' empty or not NULL terminated.\n", b->size, (char*)b->data);
-		return r;
+	assert (table != NULL);
+	table->ops[to_get]++;
+	if (!table->exists) {
+		assert (table->readonly);
+		return RET_NOTHING;
 	}
 
-	a_version = strchr(a->data, '|');
-	if (a_version == NULL) {
-		fprintf(stderr, "Database value '%s' malformed. It should be 'package|version'.\n", (char*)a->data);
-		return r;
+	SETMDBV(Key, key);
+	dbret = mdb_get(rdb_txn, table->dbi, &Key, &Data);
+	if (dbret == MDB_NOTFOUND)
+		return RET_NOTHING;
+	if (dbret != 0) {
+		table_printerror(table, dbret, "get");
+		return RET_DBERR(dbret);
 	}
-	a_version++;
-	b_version = strchr(b->data, '|');
-	if (b_version == NULL) {
-		fprintf(stderr, "Database value '%s' malformed. It should be 'package|version'.\n", (char*)b->data);
-		return r;
+	if (data_p == NULL) {
+		assert (datalen_p == NULL);
+		return RET_OK;
 	}
-	b_version++;
+	if (Data.mv_size <= 0 ||
+	    ((const char*)Data.mv_data)[Data.mv_size-1] != '\0') {
+		if (table->subname != NULL)
+			fprintf(stderr,
+"Database %s(%s) returned corrupted (not null-terminated) data!\n",
+					table->name, table->subname);
+		else
+			fprintf(stderr,
+"Database %s returned corrupted (not null-terminated) data!\n",
+					table->name);
+		return RET_ERROR;
+	}
+	*data_p = Data.mv_data;
+	if (table->chunks && chunk_iscompressed(Data.mv_data, Data.mv_size - 1))
+		return table_uncompress(table, &table->buffer, data_p,
+				Data.mv_size - 1, datalen_p);
+	if (datalen_p != NULL)
+		*datalen_p = Data.mv_size - 1;
+	return RET_OK;
+}
 
-	r = dpkgversions_cmp(a_version, b_version, &versioncmp);
-	if (RET_WAS_ERROR(r)) {
-		fprintf(stderr, "Parse errors processing versions.\n");
-		return r;
+retvalue table_checkrecord(struct table *table, const char *key, const char *data) {
+	int dbret;
+	MDB_val Key, Data;
+	MDB_cursor *cursor;
+
+	table->ops[to_get]++;
+	if (!table->exists)
+		return RET_NOTHING;
+	SETMDBV(Key, key);
+	SETMDBV(Data, data);
+	dbret = mdb_cursor_open(rdb_txn, table->dbi, &cursor);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "cursor");
+		return RET_DBERR(dbret);
 	}
+	dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_GET_BOTH);
+	mdb_cursor_close(cursor);
+	if (dbret == 0)
+		return RET_OK;
+	if (dbret == MDB_NOTFOUND)
+		return RET_NOTHING;
+	table_printerror(table, dbret, "c_get(MDB_GET_BOTH)");
+	return RET_DBERR(dbret);
+}
 
-	return -versioncmp;
+retvalue table_removerecord(struct table *table, const char *key, const char *data) {
+	int dbret;
+	MDB_val Key, Data;
+
+	assert (!table->readonly && table->exists);
+	table->ops[to_delete]++;
+	rdb_uncommitted++;
+	SETMDBV(Key, key);
+	SETMDBV(Data, data);
+	dbret = mdb_del(rdb_txn, table->dbi, &Key, &Data);
+	if (dbret == 0)
+		return RET_OK;
+	if (dbret == MDB_NOTFOUND)
+		return RET_NOTHING;
+	table_printerror(table, dbret, "del(both)");
+	return RET_DBERR(dbret);
 }
 
-/* only compare the first 0-terminated part of the data */
-static int paireddatacompare(UNUSED(DB *db), const DBT *a, const DBT *b
-#if DB_VERSION_MAJOR >= 6
-#warning Berkeley DB >= 6.0 is not yet tested and highly experimental
-	, UNUSED(size_t *locp)
-	/* "The locp parameter is currently unused, and must be set to NULL or corruption can occur."
-	 * What the ...! How am I supposed to handle that? */
-#endif
-) {
-	if (a->size < b->size)
-		return strncmp(a->data, b->data, a->size);
+retvalue table_addrecord(struct table *table, const char *key, const char *data, size_t datalen, bool ignoredups) {
+	int dbret;
+	unsigned int flags;
+
+	assert (table != NULL);
+	assert (!table->readonly && table->exists);
+	table->ops[to_add]++;
+	rdb_uncommitted++;
+
+	if (table->type == dbt_BTREEDUP)
+		flags = MDB_NODUPDATA;
+	else if (table->type == dbt_BTREEPAIRS)
+		flags = MDB_NOOVERWRITE;
 	else
-		return strncmp(a->data, b->data, b->size);
+		flags = 0;
+	dbret = lmdb_put(table, key, data, datalen + 1, flags);
+	if (dbret != 0 && !(ignoredups && dbret == MDB_KEYEXIST)) {
+		table_printerror(table, dbret, "put");
+		return RET_DBERR(dbret);
+	}
+	if (table->verbose) {
+		if (table->subname != NULL)
+			printf("db: '%s' added to %s(%s).\n",
+					key, table->name, table->subname);
+		else
+			printf("db: '%s' added to %s.\n",
+					key, table->name);
+	}
+	return RET_OK;
 }
 
-retvalue database_opentracking(const char *codename, bool readonly, struct table **table_p) {
-	struct table *table;
+retvalue table_adduniqsizedrecord(struct table *table, const char *key, const char *data, size_t data_size, bool allowoverwrite, bool nooverwrite) {
+	int dbret;
 	retvalue r;
 
-	if (rdb_nopackages) {
-		(void)fputs(
-"Internal Error: Accessing packages database while that was not prepared!\n",
-				stderr);
-		return RET_ERROR;
+	assert (table != NULL);
+	assert (!table->readonly && table->exists);
+	assert (data_size > 0 && data[data_size-1] == '\0');
+	table->ops[to_add]++;
+	rdb_uncommitted++;
+
+	if (table->compress) {
+		r = table_compress(table, &data, &data_size);
+		if (RET_WAS_ERROR(r))
+			return r;
 	}
 
-	r = database_table("tracking.db", codename,
-			dbt_BTREEPAIRS, readonly?DB_RDONLY:DB_CREATE, &table);
-	assert (r != RET_NOTHING);
-	if (RET_WAS_ERROR(r))
-		return r;
-	*table_p = table;
+	dbret = lmdb_put(table, key, data, data_size,
+			allowoverwrite?0:MDB_NOOVERWRITE);
+	if (nooverwrite && dbret == MDB_KEYEXIST) {
+		/* if nooverwrite is set, do nothing and ignore: */
+		return RET_NOTHING;
+	}
+	if (dbret != 0) {
+		table_printerror(table, dbret, "put(uniq)");
+		return RET_DBERR(dbret);
+	}
+	if (table->indexed) {
+		r = packageindex_update(table, key, NULL, true);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	if (table->verbose) {
+		if (table->subname != NULL)
+			printf("db: '%s' added to %s(%s).\n",
+					key, table->name, table->subname);
+		else
+			printf("db: '%s' added to %s.\n",
+					key, table->name);
+	}
 	return RET_OK;
 }
 
-static int get_package_name(DB *secondary, const DBT *pkey, const DBT *pdata, DBT *skey) {
-	const char *separator;
-	size_t length;
+retvalue table_deleterecord(struct table *table, const char *key, bool ignoremissing) {
+	int dbret;
+	retvalue r;
 
-	separator = memchr(pkey->data, '|', pkey->size);
-	if (unlikely(separator == NULL)) {
-		return DB_MALFORMED_KEY;
-	}
+	assert (table != NULL);
+	assert (!table->readonly && table->exists);
+	table->ops[to_delete]++;
+	rdb_uncommitted++;
 
-	length = (size_t)separator - (size_t)pkey->data;
-	skey->flags = DB_DBT_APPMALLOC;
-	skey->data = strndup(pkey->data, length);
-	if (FAILEDTOALLOC(skey->data)) {
-		return RET_ERROR_OOM;
+	dbret = lmdb_del(table, key);
+	if (dbret != 0) {
+		if (dbret == MDB_NOTFOUND && ignoremissing)
+			return RET_NOTHING;
+		table_printerror(table, dbret, "del");
+		if (dbret == MDB_NOTFOUND)
+			return RET_ERROR_MISSING;
+		else
+			return RET_DBERR(dbret);
 	}
-	skey->size = length + 1;
-	return 0;
+	if (table->indexed) {
+		r = packageindex_update(table, key, NULL, false);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	if (table->verbose) {
+		if (table->subname != NULL)
+			printf("db: '%s' removed from %s(%s).\n",
+					key, table->name, table->subname);
+		else
+			printf("db: '%s' removed from %s.\n",
+					key, table->name);
+	}
+	return RET_OK;
 }
 
-static retvalue database_translate_legacy_packages(void) {
-	struct cursor *databases_cursor, *cursor;
-	struct table *legacy_databases, *legacy_table, *packages;
-	const char *chunk, *packagename, *identifier;
-	char *key, *legacy_filename, *packages_filename, *packageversion;
-	retvalue r, result;
-	int ret, e;
-	size_t chunk_len;
-	DBT Key, Data;
+static retvalue newcursor(struct table *table, MDB_cursor_op op, struct cursor **cursor_p) {
+	struct cursor *cursor;
+	int dbret;
 
 	if (verbose >= 15)
-		fprintf(stderr, "trace: database_translate_legacy_packages() called.\n");
+		fprintf(stderr, "trace: newcursor(table={name: %s}) called.\n", table->name);
 
-	if (!isdir(global.dbdir)) {
-		fprintf(stderr, "Cannot find directory '%s'!\n", global.dbdir);
+	if (!table->exists) {
+		assert (table->readonly);
+		*cursor_p = NULL;
+		return RET_NOTHING;
+	}
+
+	cursor = zNEW(struct cursor);
+	if (FAILEDTOALLOC(cursor))
+		return RET_ERROR_OOM;
+
+	cursor->op = op;
+	cursor->r = RET_OK;
+	/* package tables are looked at by their package names */
+	dbret = mdb_cursor_open(rdb_txn,
+			table->hassecondary ? table->sec_dbi : table->dbi,
+			&cursor->cursor);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "cursor");
+		free(cursor);
+		return RET_DBERR(dbret);
+	}
+	rdb_cursors++;
+	*cursor_p = cursor;
+	return RET_OK;
+}
+
+retvalue table_newglobalcursor(struct table *table, struct cursor **cursor_p) {
+	retvalue r;
+
+	table->ops[to_cursor]++;
+	r = newcursor(table, MDB_NEXT, cursor_p);
+	if (r == RET_NOTHING) {
+		/* a missing read-only table is just empty */
+		r = RET_OK;
+	}
+	return r;
+}
+
+static int lmdb_cursor_get(struct table *table, struct cursor *cursor, MDB_val *Key, MDB_val *Data, MDB_cursor_op op) {
+	int dbret;
+
+	dbret = mdb_cursor_get(cursor->cursor, Key, Data, op);
+	if (dbret != 0)
+		return dbret;
+	if (cursor->prefix != NULL && (Key->mv_size < cursor->prefixlen ||
+			memcmp(Key->mv_data, cursor->prefix,
+				cursor->prefixlen) != 0))
+		return MDB_NOTFOUND;
+	if (table->hassecondary)
+		return lmdb_primary(table, Data, Data);
+	return 0;
+}
+
+static void lmdb_cursor_free(/*@only@*/struct cursor *cursor) {
+	mdb_cursor_close(cursor->cursor);
+	assert (rdb_cursors > 0);
+	rdb_cursors--;
+	free(cursor->prefix);
+	chunkbuffer_done(&cursor->buffer);
+	free(cursor);
+}
+
+static inline retvalue parse_data(struct table *table, MDB_val Key, MDB_val Data, /*@null@*//*@out@*/const char **key_p, /*@out@*/const char **data_p, /*@out@*/size_t *datalen_p) {
+	if (Key.mv_size <= 0 || Data.mv_size <= 0 ||
+	    ((const char*)Key.mv_data)[Key.mv_size-1] != '\0' ||
+	    ((const char*)Data.mv_data)[Data.mv_size-1] != '\0') {
+		if (table->subname != NULL)
+			fprintf(stderr,
+"Database %s(%s) returned corrupted (not null-terminated) data!",
+					table->name, table->subname);
+		else
+			fprintf(stderr,
+"Database %s returned corrupted (not null-terminated) data!",
+					table->name);
 		return RET_ERROR;
 	}
+	if (key_p != NULL)
+		*key_p = Key.mv_data;
+	*data_p = Data.mv_data;
+	if (datalen_p != NULL)
+		*datalen_p = Data.mv_size - 1;
+	return RET_OK;
+}
 
-	packages_filename = dbfilename("packages.db");
-	legacy_filename = dbfilename("packages.legacy.db");
-	ret = rename(packages_filename, legacy_filename);
-	if (ret != 0) {
-		e = errno;
-		fprintf(stderr, "error %d renaming %s to %s: %s\n",
-				e, packages_filename, legacy_filename, strerror(e));
-		return (e != 0)?e:EINVAL;
+static inline retvalue parse_pair(struct table *table, MDB_val Key, MDB_val Data, /*@null@*//*@out@*/const char **key_p, /*@out@*/const char **value_p, /*@out@*/const char **data_p, /*@out@*/size_t *datalen_p) {
+	/*@dependant@*/ const char *separator;
+
+	if (Key.mv_size < 2 || Data.mv_size == 0 ||
+	    ((const char*)Key.mv_data)[Key.mv_size-1] != '\0' ||
+	    ((const char*)Data.mv_data)[Data.mv_size-1] != '\0') {
+		if (table->subname != NULL)
+			fprintf(stderr,
+"Database %s(%s) returned corrupted (not null-terminated) data!",
+					table->name, table->subname);
+		else
+			fprintf(stderr,
+"Database %s returned corrupted (not null-terminated) data!",
+					table->name);
+		return RET_ERROR;
 	}
-	if (verbose >= 15)
-		fprintf(stderr, "trace: Moved '%s' to '%s'.\n", packages_filename, legacy_filename);
+	separator = memchr(Key.mv_data, '\0', Key.mv_size-1);
+	if (separator == NULL) {
+		if (table->subname != NULL)
+			fprintf(stderr,
+"Database %s(%s) returned corrupted data!\n",
+					table->name, table->subname);
+		else
+			fprintf(stderr,
+"Database %s returned corrupted data!\n",
+					table->name);
+		return RET_ERROR;
+	}
+	if (key_p != NULL)
+		*key_p = Key.mv_data;
+	*value_p = separator + 1;
+	*data_p = Data.mv_data;
+	*datalen_p = Data.mv_size - 1;
+	return RET_OK;
+}
 
-	r = database_table("packages.legacy.db", NULL, dbt_BTREE, DB_RDONLY, &legacy_databases);
-	assert (r != RET_NOTHING);
-	if (RET_WAS_ERROR(r))
+retvalue table_newduplicatecursor(struct table *table, const char *key, long long skip, struct cursor **cursor_p, const char **key_p, const char **data_p, size_t *datalen_p) {
+	struct cursor *cursor;
+	int dbret;
+	MDB_val Key, Data;
+	retvalue r;
+
+	table->ops[to_cursor]++;
+	r = newcursor(table, MDB_NEXT_DUP, &cursor);
+	if(!RET_IS_OK(r)) {
 		return r;
+	}
+	SETMDBV(Key, key);
+	dbret = lmdb_cursor_get(table, cursor, &Key, &Data, MDB_SET_KEY);
+	while (dbret == 0 && skip > 0) {
+		dbret = lmdb_cursor_get(table, cursor, &Key, &Data,
+				cursor->op);
+		skip--;
+	}
+	if (dbret == MDB_NOTFOUND) {
+		lmdb_cursor_free(cursor);
+		return RET_NOTHING;
+	}
+	if (dbret != 0) {
+		table_printerror(table, dbret, "c_get(MDB_NEXT_DUP)");
+		lmdb_cursor_free(cursor);
+		return RET_DBERR(dbret);
+	}
 
-	r = table_newglobalcursor(legacy_databases, &databases_cursor);
-	assert (r != RET_NOTHING);
+	r = parse_data(table, Key, Data, key_p, data_p, datalen_p);
+	if (RET_IS_OK(r) && table->chunks &&
+			chunk_iscompressed(*data_p, Data.mv_size - 1))
+		r = table_uncompress(table, &cursor->buffer, data_p,
+				Data.mv_size - 1, datalen_p);
 	if (RET_WAS_ERROR(r)) {
-		(void)table_close(legacy_databases);
+		lmdb_cursor_free(cursor);
 		return r;
 	}
-	result = RET_NOTHING;
-	// Iterate over all databases inside the packages.db file.
-	while (cursor_next(legacy_databases, databases_cursor, &Key, &Data)) {
-		identifier = Key.data;
-		if (verbose >= 15)
-			fprintf(stderr, "Converting table '%s' to new layout...\n", identifier);
+	*cursor_p = cursor;
+	return RET_OK;
+}
 
-		r = database_table("packages.legacy.db", identifier, dbt_BTREE, DB_RDONLY, &legacy_table);
-		assert (r != RET_NOTHING);
-		if (RET_WAS_ERROR(r)) {
-			RET_UPDATE(result, r);
-			break;
-		}
+/* paired cursors are cursors limited to keys starting with "key\0" */
+static retvalue newpairedcursor(struct table *table, const char *key, /*@null@*/const char *value, /*@out@*/struct cursor **cursor_p, /*@out@*/MDB_val *Key, /*@out@*/MDB_val *Data) {
+	struct cursor *cursor;
+	MDB_val Prefix;
+	int dbret;
+	retvalue r;
 
-		r = table_newglobalcursor(legacy_table, &cursor);
-		assert (r != RET_NOTHING);
-		if (RET_WAS_ERROR(r)) {
-			(void)table_close(legacy_table);
-			RET_UPDATE(result, r);
-			break;
-		}
+	assert (table->type == dbt_BTREEPAIRS);
+	r = newcursor(table, MDB_NEXT, &cursor);
+	if(!RET_IS_OK(r)) {
+		return r;
+	}
+	if (value != NULL)
+		dbret = pair_key(key, value, strlen(value), &Prefix);
+	else {
+		Prefix.mv_data = strdup(key);
+		Prefix.mv_size = strlen(key) + 1;
+		dbret = (Prefix.mv_data == NULL) ? ENOMEM : 0;
+	}
+	if (dbret != 0) {
+		lmdb_cursor_free(cursor);
+		return RET_ERROR_OOM;
+	}
+	cursor->prefix = Prefix.mv_data;
+	cursor->prefixlen = Prefix.mv_size;
+	*Key = Prefix;
+	dbret = lmdb_cursor_get(table, cursor, Key, Data, MDB_SET_RANGE);
+	if (dbret == MDB_NOTFOUND) {
+		lmdb_cursor_free(cursor);
+		return RET_NOTHING;
+	}
+	if (dbret != 0) {
+		table_printerror(table, dbret, "c_get(MDB_SET_RANGE)");
+		lmdb_cursor_free(cursor);
+		return RET_DBERR(dbret);
+	}
+	*cursor_p = cursor;
+	return RET_OK;
+}
 
-		r = database_openpackages(identifier, false, &packages);
-		if (RET_WAS_ERROR(r)) {
-			(void)cursor_close(legacy_databases, databases_cursor);
-			(void)table_close(legacy_table);
-			RET_UPDATE(result, r);
-			break;
-		}
+retvalue table_newduplicatepairedcursor(struct table *table, const char *key, struct cursor **cursor_p, const char **value_p, const char **data_p, size_t *datalen_p) {
+	MDB_val Key, Data;
+	retvalue r;
 
-		while (cursor_nexttempdata(legacy_table, cursor, &packagename, &chunk, &chunk_len)) {
-			r = chunk_getvalue(chunk, "Version", &packageversion);
-			if (!RET_IS_OK(r)) {
-				RET_UPDATE(result, r);
-				break;
-			}
-			key = package_primarykey(packagename, packageversion);
-			r = table_addrecord(packages, key, chunk, chunk_len, false);
-			free(key);
-			if (RET_WAS_ERROR(r)) {
-				RET_UPDATE(result, r);
-				break;
-			}
-		}
+	table->ops[to_cursor]++;
+	r = newpairedcursor(table, key, NULL, cursor_p, &Key, &Data);
+	if (!RET_IS_OK(r))
+		return r;
+	r = parse_pair(table, Key, Data, NULL, value_p, data_p, datalen_p);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		lmdb_cursor_free(*cursor_p);
+		return r;
+	}
+	return RET_OK;
+}
 
-		r = table_close(packages);
-		RET_UPDATE(result, r);
-		r = cursor_close(legacy_table, cursor);
-		RET_UPDATE(result, r);
-		r = table_close(legacy_table);
-		RET_UPDATE(result, r);
+retvalue table_newpairedcursor(struct table *table, const char *key, const char *value, struct cursor **cursor_p, const char **data_p, size_t *datalen_p) {
+	MDB_val Key, Data;
+	retvalue r;
 
-		if (RET_WAS_ERROR(result)) {
-			break;
-		}
-		result = RET_OK;
+	table->ops[to_cursor]++;
+	r = newpairedcursor(table, key, value, cursor_p, &Key, &Data);
+	if (!RET_IS_OK(r))
+		return r;
+	if (Key.mv_size != (*cursor_p)->prefixlen || Data.mv_size == 0 ||
+	    ((const char*)Data.mv_data)[Data.mv_size-1] != '\0') {
+		if (table->subname != NULL)
+			fprintf(stderr,
+"Database %s(%s) returned corrupted (not paired) data!",
+					table->name, table->subname);
+		else
+			fprintf(stderr,
+"Database %s returned corrupted (not paired) data!",
+					table->name);
+		lmdb_cursor_free(*cursor_p);
+		return RET_ERROR;
 	}
-	r = cursor_close(legacy_databases, databases_cursor);
-	RET_ENDUPDATE(result, r);
-	r = table_close(legacy_databases);
-	RET_ENDUPDATE(result, r);
+	if (data_p != NULL)
+		*data_p = Data.mv_data;
+	if (datalen_p != NULL)
+		*datalen_p = Data.mv_size - 1;
+	return RET_OK;
+}
 
-	if (RET_IS_OK(result)) {
-		e = deletefile(legacy_filename);
-		if (e != 0) {
-			fprintf(stderr, "Could not delete '%s'!\n"
-"It can now safely be deleted and it all that is left to be done!\n",
-					legacy_filename);
-			return RET_ERRNO(e);
+retvalue cursor_close(UNUSED(struct table *table), struct cursor *cursor) {
+	retvalue r;
+
+	if (cursor == NULL)
+		return RET_OK;
+
+	r = cursor->r;
+	lmdb_cursor_free(cursor);
+	return r;
+}
+
+static bool cursor_next(struct table *table, struct cursor *cursor, MDB_val *Key, MDB_val *Data) {
+	int dbret;
+
+	if (cursor == NULL)
+		return false;
+
+	dbret = lmdb_cursor_get(table, cursor, Key, Data, cursor->op);
+	if (dbret == MDB_NOTFOUND)
+		return false;
+
+	if (dbret != 0) {
+		table_printerror(table, dbret,
+				(cursor->op == MDB_NEXT)
+					? "c_get(MDB_NEXT)"
+					: "c_get(MDB_NEXT_DUP)");
+		cursor->r = RET_DBERR(dbret);
+		return false;
+	}
+	return true;
+}
+
+bool cursor_nexttempdata(struct table *table, struct cursor *cursor, const char **key, const char **data, size_t *len_p) {
+	MDB_val Key, Data;
+	bool success;
+	retvalue r;
+
+	table->ops[to_next]++;
+	success = cursor_next(table, cursor, &Key, &Data);
+	if (!success)
+		return false;
+	r = parse_data(table, Key, Data, key, data, len_p);
+	if (RET_IS_OK(r) && table->chunks &&
+			chunk_iscompressed(*data, Data.mv_size - 1))
+		r = table_uncompress(table, &cursor->buffer, data,
+				Data.mv_size - 1, len_p);
+	if (RET_WAS_ERROR(r)) {
+		cursor->r = r;
+		return false;
+	}
+	return true;
+}
+
+bool cursor_nextpair(struct table *table, struct cursor *cursor, /*@null@*/const char **key_p, const char **value_p, const char **data_p, size_t *datalen_p) {
+	MDB_val Key, Data;
+	bool success;
+	retvalue r;
+
+	table->ops[to_next]++;
+	success = cursor_next(table, cursor, &Key, &Data);
+	if (!success)
+		return false;
+	r = parse_pair(table, Key, Data, key_p, value_p, data_p, datalen_p);
+	if (RET_WAS_ERROR(r)) {
+		cursor->r = r;
+		return false;
+	}
+	return true;
+}
+
+retvalue cursor_replace(struct table *table, struct cursor *cursor, const char *data, size_t datalen) {
+	MDB_val Key, Data, Current;
+	int dbret;
+	retvalue r;
+
+	assert (cursor != NULL);
+	assert (!table->readonly);
+	table->ops[to_replace]++;
+	rdb_uncommitted++;
+
+	if (table->compress) {
+		size_t size = datalen + 1;
+
+		r = table_compress(table, &data, &size);
+		if (RET_WAS_ERROR(r))
+			return r;
+		datalen = size - 1;
+	}
+
+	dbret = mdb_cursor_get(cursor->cursor, &Key, &Current,
+			MDB_GET_CURRENT);
+	if (dbret == 0 && table->hassecondary) {
+		/* the cursor is on the name index, whose data
+		 * is the key of the record to replace */
+		char *pkey = strndup(Current.mv_data, Current.mv_size);
+
+		if (FAILEDTOALLOC(pkey))
+			return RET_ERROR_OOM;
+		SETMDBVl(Key, pkey, Current.mv_size);
+		SETMDBVl(Data, data, datalen + 1);
+		dbret = mdb_put(rdb_txn, table->dbi, &Key, &Data, 0);
+		free(pkey);
+	} else if (dbret == 0 && table->type == dbt_BTREEPAIRS) {
+		/* data starts with the value, which is part of the key */
+		const char *separator = memchr(data, '\0', datalen);
+
+		assert (separator != NULL);
+		SETMDBVl(Data, separator + 1, datalen - (separator - data));
+		dbret = mdb_cursor_put(cursor->cursor, &Key, &Data,
+				MDB_CURRENT);
+	} else if (dbret == 0) {
+		SETMDBVl(Data, data, datalen + 1);
+		dbret = mdb_cursor_put(cursor->cursor, &Key, &Data,
+				MDB_CURRENT);
+	}
+	if (dbret != 0) {
+		table_printerror(table, dbret, "c_put(MDB_CURRENT)");
+		return RET_DBERR(dbret);
+	}
+	return RET_OK;
+}
+
+retvalue cursor_delete(struct table *table, struct cursor *cursor, const char *key, const char *value) {
+	MDB_val Key, Pkey;
+	char *pkey = NULL, *msg = NULL;
+	int dbret;
+	retvalue r;
+
+	assert (cursor != NULL);
+	assert (!table->readonly);
+	table->ops[to_delete]++;
+	rdb_uncommitted++;
+
+	/* key and value might point into the record to be deleted,
+	 * so the message has to be prepared before deleting it */
+	if (table->verbose) {
+		if (value != NULL)
+			msg = mprintf("'%s' '%s'", key, value);
+		else
+			msg = mprintf("'%s'", key);
+		if (FAILEDTOALLOC(msg))
+			return RET_ERROR_OOM;
+	}
+
+	if (table->hassecondary) {
+		dbret = mdb_cursor_get(cursor->cursor, &Key, &Pkey,
+				MDB_GET_CURRENT);
+		if (dbret == 0) {
+			pkey = strndup(Pkey.mv_data, Pkey.mv_size);
+			if (FAILEDTOALLOC(pkey)) {
+				free(msg);
+				return RET_ERROR_OOM;
+			}
+			SETMDBVl(Pkey, pkey, Pkey.mv_size);
+		}
+	} else
+		dbret = 0;
+	if (dbret == 0)
+		dbret = mdb_cursor_del(cursor->cursor, 0);
+	if (dbret == 0 && pkey != NULL)
+		dbret = mdb_del(rdb_txn, table->dbi, &Pkey, NULL);
+	if (dbret == 0 && pkey != NULL && table->indexed)
+		r = packageindex_update(table, pkey, NULL, false);
+	else
+		r = RET_OK;
+	free(pkey);
+
+	if (dbret != 0) {
+		free(msg);
+		table_printerror(table, dbret, "c_del");
+		return RET_DBERR(dbret);
+	}
+	if (RET_WAS_ERROR(r)) {
+		free(msg);
+		return r;
+	}
+	if (msg != NULL) {
+		if (table->subname != NULL)
+			printf("db: %s removed from %s(%s).\n",
+					msg, table->name, table->subname);
+		else
+			printf("db: %s removed from %s.\n",
+					msg, table->name);
+		free(msg);
+	}
+	return RET_OK;
+}
+
+static bool table_isempty(struct table *table) {
+	MDB_stat stat;
+	int dbret;
+
+	if (!table->exists)
+		return true;
+	dbret = mdb_stat(rdb_txn, table->dbi, &stat);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "stat");
+		return true;
+	}
+	return stat.ms_entries == 0;
+}
+#endif /* HAVE_LMDB */
+
+/* control chunks in packages tables might be compressed: */
+
+static retvalue table_uncompress(struct table *table, struct chunkbuffer *buffer, const char **data_p, size_t len, size_t *datalen_p) {
+	const char *data;
+	size_t datalen;
+	retvalue r;
+
+	r = chunk_uncompress(table->dictionary, *data_p, len, buffer,
+			&data, &datalen);
+	if (RET_WAS_ERROR(r)) {
+		fprintf(stderr, "(within %s(%s))\n",
+				table->name, table->subname);
+		return r;
+	}
+	*data_p = data;
+	if (datalen_p != NULL)
+		*datalen_p = datalen;
+	return RET_OK;
+}
+
+static retvalue table_uncompresscopy(struct table *table, const char *data, size_t len, char **data_p, size_t *datalen_p) {
+	size_t datalen;
+	retvalue r;
+	char *copy;
+
+	r = table_uncompress(table, &table->buffer, &data, len, &datalen);
+	if (RET_WAS_ERROR(r))
+		return r;
+	copy = malloc(datalen + 1);
+	if (FAILEDTOALLOC(copy))
+		return RET_ERROR_OOM;
+	memcpy(copy, data, datalen + 1);
+	*data_p = copy;
+	if (datalen_p != NULL)
+		*datalen_p = datalen;
+	return RET_OK;
+}
+
+/* size includes the trailing '\0', both are only changed if
+ * the compressed data is smaller */
+static retvalue table_compress(struct table *table, const char **data_p, size_t *size_p) {
+	const char *data;
+	size_t datalen;
+	retvalue r;
+
+	assert (table->chunks && table->dictionary != NULL);
+	r = chunk_compress(table->dictionary, *data_p, *size_p - 1,
+			&table->compressbuffer, &data, &datalen);
+	if (!RET_IS_OK(r))
+		return r;
+	*data_p = data;
+	*size_p = datalen + 1;
+	return RET_OK;
+}
+
+bool table_recordexists(struct table *table, const char *key) {
+	retvalue r;
+
+	r = table_gettemprecord(table, key, NULL, NULL);
+	return RET_IS_OK(r);
+}
+
+retvalue table_adduniqrecord(struct table *table, const char *key, const char *data) {
+	if (verbose >= 15)
+		fprintf(stderr, "trace: table_adduniqrecord(table=%s, key=%s) called.\n",
+		        table->name, key);
+	return table_adduniqsizedrecord(table, key, data, strlen(data)+1,
+			false, false);
+}
+
+retvalue table_replacerecord(struct table *table, const char *key, const char *data) {
+	retvalue r;
+
+	if (verbose >= 15)
+		fprintf(stderr, "trace: table_replacerecord(table=%s, key=%s) called.\n",
+		        table->name, key);
+	r = table_deleterecord(table, key, false);
+	if (r != RET_ERROR_MISSING && RET_WAS_ERROR(r))
+		return r;
+	return table_adduniqrecord(table, key, data);
+}
+
+retvalue database_haspackages(const char *identifier) {
+	struct table *packages;
+	retvalue r;
+	bool empty;
+
+	r = database_openpackages(identifier, true, &packages);
+	if (RET_WAS_ERROR(r))
+		return r;
+	empty = table_isempty(packages);
+	(void)table_close(packages);
+	return empty?RET_NOTHING:RET_OK;
+}
+
+/****************************************************************************
+ * Open the different types of tables with their needed flags:              *
+ ****************************************************************************/
+static retvalue database_table_secondary(const char *filename, const char *subtable, enum database_type type, uint32_t flags,
+                                         const char *secondary_filename, enum database_type secondary_type, /*@out@*/struct table **table_p) {
+	struct table *table;
+	struct opened_tables *opened_table;
+	retvalue r;
+
+	if (verbose >= 15)
+		fprintf(stderr, "trace: database_table(filename=%s, subtable=%s) called.\n",
+		        filename, subtable);
+
+	for (struct opened_tables *iter = opened_tables; iter != NULL; iter = iter->next) {
+		if(strcmp2(iter->name, filename) == 0 && strcmp2(iter->subname, subtable) == 0) {
+            fprintf(stderr,
+ "Internal Error: Trying to open table '%s' from file '%s' multiple times.\n"
+ "This should normally not happen (to avoid triggering bugs in the underlying BerkeleyDB)\n",
+                    subtable, filename);
+			return RET_ERROR;
+		}
+	}
+
+	table = zNEW(struct table);
+	if (FAILEDTOALLOC(table))
+		return RET_ERROR_OOM;
+	/* TODO: is filename always an static constant? then we could drop the dup */
+	table->name = strdup(filename);
+	if (FAILEDTOALLOC(table->name)) {
+		free(table);
+		return RET_ERROR_OOM;
+	}
+	if (subtable != NULL) {
+		table->subname = strdup(subtable);
+		if (FAILEDTOALLOC(table->subname)) {
+			free(table->name);
+			free(table);
+			return RET_ERROR_OOM;
+		}
+	} else
+		table->subname = NULL;
+#ifdef HAVE_LMDB
+	/* there is only a read-only transaction then */
+	if (rdb_readonly)
+		flags = DB_RDONLY;
+#endif
+	table->readonly = ISSET(flags, DB_RDONLY);
+	table->verbose = rdb_verbose;
+	table->flags = flags;
+#ifndef HAVE_LMDB
+	r = database_opentable(filename, subtable, type, flags,
+			&table->berkeleydb);
+	if (RET_WAS_ERROR(r)) {
+		free(table->subname);
+		free(table->name);
+		free(table);
+		return r;
+	}
+	if (r == RET_NOTHING) {
+		if (ISSET(flags, DB_RDONLY)) {
+			/* sometimes we don't want a return here, when? */
+			table->berkeleydb = NULL;
+			r = RET_OK;
+		} else {
+			free(table->subname);
+			free(table->name);
+			free(table);
+			return r;
+		}
+
+	}
+
+	if (secondary_filename != NULL) {
+		r = database_opentable(secondary_filename, subtable, secondary_type, flags,
+				&table->sec_berkeleydb);
+		if (RET_WAS_ERROR(r)) {
+			table->berkeleydb->close(table->berkeleydb, 0);
+			free(table->subname);
+			free(table->name);
+			free(table);
+			return r;
+		}
+		if (r == RET_NOTHING) {
+			if (ISSET(flags, DB_RDONLY)) {
+				/* sometimes we don't want a return here, when? */
+				table->sec_berkeleydb = NULL;
+				r = RET_OK;
+			} else {
+				table->berkeleydb->close(table->berkeleydb, 0);
+				free(table->subname);
+				free(table->name);
+				free(table);
+				return r;
+			}
+
+		}
+	}
+#else
+	table->type = type;
+	r = database_opentable(filename, subtable, type, flags, &table->dbi);
+	if (r == RET_NOTHING && ISSET(flags, DB_RDONLY)) {
+		table->exists = false;
+		r = RET_OK;
+	} else if (RET_IS_OK(r)) {
+		table->exists = true;
+		if (secondary_filename != NULL) {
+			r = database_opentable(secondary_filename, subtable,
+					secondary_type, flags, &table->sec_dbi);
+			if (r == RET_NOTHING && ISSET(flags, DB_RDONLY)) {
+				/* the packages cannot be found without */
+				table->exists = false;
+				r = RET_OK;
+			} else if (RET_IS_OK(r))
+				table->hassecondary = true;
+		}
+	}
+	if (!RET_IS_OK(r)) {
+		free(table->subname);
+		free(table->name);
+		free(table);
+		return r;
+	}
+#endif
+
+	opened_table = zNEW(struct opened_tables);
+	if (FAILEDTOALLOC(opened_table)) {
+		free(table->subname);
+		free(table->name);
+		free(table);
+		return RET_ERROR_OOM;
+	}
+	opened_table->name = table->name;
+	opened_table->subname = table->subname;
+	opened_table->next = opened_tables;
+	opened_tables = opened_table;
+
+	if (verbose >= 25)
+		print_opened_tables(stderr);
+
+	*table_p = table;
+	return r;
+}
+
+static retvalue database_table(const char *filename, const char *subtable, enum database_type type, uint32_t flags, /*@out@*/struct table **table_p) {
+	return database_table_secondary(filename, subtable, type, flags, NULL, 0, table_p);
+}
+
+static retvalue database_needversion(const char *);
+static retvalue database_storedictionary(const char *, /*@null@*/const char *, size_t);
+
+/* convert the references.db of older versions (with the names of
+ * the referees instead of ids), it is only removed when done, so an
+ * interrupted conversion is just done again */
+static retvalue translatereferences(void) {
+	struct table *oldreferences;
+	retvalue r;
+
+	r = database_table("references.db", "references",
+			dbt_BTREEDUP, DB_RDONLY, &oldreferences);
+	if (!RET_IS_OK(r))
+		return r;
+	r = references_translate(oldreferences);
+	if (RET_WAS_ERROR(r)) {
+		(void)table_close(oldreferences);
+		return r;
+	}
+	r = table_close(oldreferences);
+	if (RET_WAS_ERROR(r))
+		return r;
+	return database_dropsubtable("references.db", "references");
+}
+
+retvalue database_openreferences(void) {
+	struct strlist subtables;
+	bool oldformat = false;
+	retvalue r;
+
+	assert (rdb_references == NULL);
+	r = database_listsubtables("references.db", &subtables);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (RET_IS_OK(r)) {
+		oldformat = strlist_in(&subtables, "references");
+		strlist_done(&subtables);
+	}
+	if (oldformat && rdb_readonly) {
+		fprintf(stderr,
+"Error: %s/references.db is still in the format of older versions.\n"
+"It is converted by the first command that may change the database\n"
+"(for example 'reprepro rereference'), but this command is read-only.\n",
+				global.dbdir);
+		return RET_ERROR;
+	}
+
+	r = database_table("referencedby.db", "references",
+			dbt_BTREEDUP, rdb_readonly?DB_RDONLY:DB_CREATE,
+			&rdb_references);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		rdb_references = NULL;
+		return r;
+	}
+	rdb_references->verbose = false;
+	r = database_table("referees.db", "referees",
+			dbt_BTREE, rdb_readonly?DB_RDONLY:DB_CREATE,
+			&rdb_referees);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		(void)table_close(rdb_references);
+		rdb_references = NULL;
+		rdb_referees = NULL;
+		return r;
+	}
+	rdb_referees->verbose = false;
+	if (rdb_readonly)
+		return RET_OK;
+
+	/* versions before this one do not know those files */
+	r = database_needversion(DBFORMAT_NEWTABLES);
+	if (!RET_WAS_ERROR(r) && oldformat)
+		r = translatereferences();
+	if (RET_WAS_ERROR(r)) {
+		(void)table_close(rdb_referees);
+		rdb_referees = NULL;
+		(void)table_close(rdb_references);
+		rdb_references = NULL;
+		return r;
+	}
+	return RET_OK;
+}
+
+/* compare "name|version" strings by version, highest first */
+static int packageversioncompare(const char *a, size_t asize, const char *b, size_t bsize) {
+	const char *a_version;
+	const char *b_version;
+	int versioncmp;
+	// There is no way to indicate an error to the caller
+	// Thus return -1 in case of an error
+	retvalue r = -1;
+
+	if (asize == 0 || a[asize-1] != '\0') {
+		fprintf(stderr, "Database value '%.*s' empty or not NULL terminated.\n", (int)asize, a);
+		return r;
+	}
+	if (bsize == 0 || b[bsize-1] != '\0') {
+		fprintf(stderr, "Database value '%.*s' empty or not NULL terminated.\n", (int)bsize, b);
+		return r;
+	}
+
+	a_version = strchr(a, '|');
+	if (a_version == NULL) {
+		fprintf(stderr, "Database value '%s' malformed. It should be 'package|version'.\n", a);
+		return r;
+	}
+	a_version++;
+	b_version = strchr(b, '|');
+	if (b_version == NULL) {
+		fprintf(stderr, "Database value '%s' malformed. It should be 'package|version'.\n", b);
+		return r;
+	}
+	b_version++;
+
+	r = dpkgversions_cmp(a_version, b_version, &versioncmp);
+	if (RET_WAS_ERROR(r)) {
+		fprintf(stderr, "Parse errors processing versions.\n");
+		return r;
+	}
+
+	return -versioncmp;
+}
+
+#ifndef HAVE_LMDB
+static int debianversioncompare(UNUSED(DB *db), const DBT *a, const DBT *b) {
+	return packageversioncompare(a->data, a->size, b->data, b->size);
+}
+
+/* only compare the first 0-terminated part of the data */
+static int paireddatacompare(UNUSED(DB *db), const DBT *a, const DBT *b
+#if DB_VERSION_MAJOR >= 6
+#warning Berkeley DB >= 6.0 is not yet tested and highly experimental
+	, UNUSED(size_t *locp)
+	/* "The locp parameter is currently unused, and must be set to NULL or corruption can occur."
+	 * What the ...! How am I supposed to handle that? */
+#endif
+) {
+	if (a->size < b->size)
+		return strncmp(a->data, b->data, a->size);
+	else
+		return strncmp(a->data, b->data, b->size);
+}
+#else
+static int lmdb_versioncompare(const MDB_val *a, const MDB_val *b) {
+	return packageversioncompare(a->mv_data, a->mv_size,
+			b->mv_data, b->mv_size);
+}
+#endif
+
+retvalue database_opentracking(const char *codename, bool readonly, struct table **table_p) {
+	struct table *table;
+	retvalue r;
+
+	if (rdb_nopackages) {
+		(void)fputs(
+"Internal Error: Accessing packages database while that was not prepared!\n",
+				stderr);
+		return RET_ERROR;
+	}
+
+	r = database_table("tracking.db", codename,
+			dbt_BTREEPAIRS, readonly?DB_RDONLY:DB_CREATE, &table);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
+		return r;
+	*table_p = table;
+	return RET_OK;
+}
+
+#ifndef HAVE_LMDB
+static int get_package_name(DB *secondary, const DBT *pkey, const DBT *pdata, DBT *skey) {
+	const char *separator;
+	size_t length;
+
+	separator = memchr(pkey->data, '|', pkey->size);
+	if (unlikely(separator == NULL)) {
+		return DB_MALFORMED_KEY;
+	}
+
+	length = (size_t)separator - (size_t)pkey->data;
+	skey->flags = DB_DBT_APPMALLOC;
+	skey->data = strndup(pkey->data, length);
+	if (FAILEDTOALLOC(skey->data)) {
+		return RET_ERROR_OOM;
+	}
+	skey->size = length + 1;
+	return 0;
+}
+
+static retvalue database_translate_legacy_packages(void) {
+	struct cursor *databases_cursor, *cursor;
+	struct table *legacy_databases, *legacy_table, *packages;
+	const char *chunk, *packagename, *identifier;
+	char *key, *legacy_filename, *packages_filename, *packageversion;
+	retvalue r, result;
+	int ret, e;
+	size_t chunk_len;
+	DBT Key, Data;
+
+	if (verbose >= 15)
+		fprintf(stderr, "trace: database_translate_legacy_packages() called.\n");
+
+	if (!isdir(global.dbdir)) {
+		fprintf(stderr, "Cannot find directory '%s'!\n", global.dbdir);
+		return RET_ERROR;
+	}
+
+	packages_filename = dbfilename("packages.db");
+	legacy_filename = dbfilename("packages.legacy.db");
+	ret = rename(packages_filename, legacy_filename);
+	if (ret != 0) {
+		e = errno;
+		fprintf(stderr, "error %d renaming %s to %s: %s\n",
+				e, packages_filename, legacy_filename, strerror(e));
+		return (e != 0)?e:EINVAL;
+	}
+	if (verbose >= 15)
+		fprintf(stderr, "trace: Moved '%s' to '%s'.\n", packages_filename, legacy_filename);
+
+	r = database_table("packages.legacy.db", NULL, dbt_BTREE, DB_RDONLY, &legacy_databases);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
+		return r;
+
+	r = table_newglobalcursor(legacy_databases, &databases_cursor);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		(void)table_close(legacy_databases);
+		return r;
+	}
+	result = RET_NOTHING;
+	// Iterate over all databases inside the packages.db file.
+	while (cursor_next(legacy_databases, databases_cursor, &Key, &Data)) {
+		identifier = Key.data;
+		if (verbose >= 15)
+			fprintf(stderr, "Converting table '%s' to new layout...\n", identifier);
+
+		r = database_table("packages.legacy.db", identifier, dbt_BTREE, DB_RDONLY, &legacy_table);
+		assert (r != RET_NOTHING);
+		if (RET_WAS_ERROR(r)) {
+			RET_UPDATE(result, r);
+			break;
+		}
+
+		r = table_newglobalcursor(legacy_table, &cursor);
+		assert (r != RET_NOTHING);
+		if (RET_WAS_ERROR(r)) {
+			(void)table_close(legacy_table);
+			RET_UPDATE(result, r);
+			break;
+		}
+
+		r = database_openpackages(identifier, false, &packages);
+		if (RET_WAS_ERROR(r)) {
+			(void)cursor_close(legacy_databases, databases_cursor);
+			(void)table_close(legacy_table);
+			RET_UPDATE(result, r);
+			break;
+		}
+
+		while (cursor_nexttempdata(legacy_table, cursor, &packagename, &chunk, &chunk_len)) {
+			r = chunk_getvalue(chunk, "Version", &packageversion);
+			if (!RET_IS_OK(r)) {
+				RET_UPDATE(result, r);
+				break;
+			}
+			key = package_primarykey(packagename, packageversion);
+			r = table_addrecord(packages, key, chunk, chunk_len, false);
+			free(key);
+			if (RET_WAS_ERROR(r)) {
+				RET_UPDATE(result, r);
+				break;
+			}
+		}
+
+		r = table_close(packages);
+		RET_UPDATE(result, r);
+		r = cursor_close(legacy_table, cursor);
+		RET_UPDATE(result, r);
+		r = table_close(legacy_table);
+		RET_UPDATE(result, r);
+
+		if (RET_WAS_ERROR(result)) {
+			break;
+		}
+		result = RET_OK;
+	}
+	r = cursor_close(legacy_databases, databases_cursor);
+	RET_ENDUPDATE(result, r);
+	r = table_close(legacy_databases);
+	RET_ENDUPDATE(result, r);
+
+	if (RET_IS_OK(result)) {
+		e = deletefile(legacy_filename);
+		if (e != 0) {
+			fprintf(stderr, "Could not delete '%s'!\n"
+"It can now safely be deleted and it all that is left to be done!\n",
+					legacy_filename);
+			return RET_ERRNO(e);
+		}
+	}
+
+	return result;
+}
+#endif
+
+/* the dictionary the control chunks of a target are compressed with */
+static retvalue database_getdictionary(const char *identifier, /*@out@*/struct chunkdictionary **dictionary_p) {
+	struct table *table;
+	const char *data;
+	size_t len;
+	retvalue r, r2;
+
+	r = database_table("dictionaries.db", "packages", dbt_BTREE,
+			DB_RDONLY, &table);
+	if (!RET_IS_OK(r))
+		return r;
+	r = table_gettemprecord(table, identifier, &data, &len);
+	if (RET_IS_OK(r))
+		r = chunkdictionary_new(data, len, dictionary_p);
+	r2 = table_close(table);
+	RET_ENDUPDATE(r, r2);
+	return r;
+}
+
+retvalue database_openpackages(const char *identifier, bool readonly, struct table **table_p) {
+	struct table *table;
+	retvalue r;
+
+	if (rdb_nopackages) {
+		(void)fputs(
+"Internal Error: Accessing packages database while that was not prepared!\n",
+				stderr);
+		return RET_ERROR;
+	}
+
+	r = database_table_secondary("packages.db", identifier,
+			dbt_BTREE, readonly?DB_RDONLY:DB_CREATE,
+			"packagenames.db", dbt_BTREEVERSIONS, &table);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
+		return r;
+
+#ifndef HAVE_LMDB
+	if (table->berkeleydb != NULL && table->sec_berkeleydb == NULL) {
+		r = table_close(table);
+		if (RET_WAS_ERROR(r)) {
+			return r;
+		}
+		if (rdb_readonly) {
+			fputs(
+"Error: The packages database still needs to be translated into the new\n"
+"format, which is not possible while only having a shared lock.\n"
+"Please run some command modifying the database (like export) first.\n",
+					stderr);
+			return RET_ERROR;
+		}
+		r = database_translate_legacy_packages();
+		if (RET_WAS_ERROR(r)) {
+			return r;
+		}
+		return database_openpackages(identifier, readonly, table_p);
+	}
+
+	if (table->berkeleydb != NULL && table->sec_berkeleydb != NULL) {
+		r = table->berkeleydb->associate(table->berkeleydb, NULL,
+				table->sec_berkeleydb, get_package_name, 0);
+		if (RET_WAS_ERROR(r)) {
+			return r;
+		}
+	}
+#endif
+
+	table->chunks = true;
+	r = database_getdictionary(identifier, &table->dictionary);
+	if (RET_WAS_ERROR(r)) {
+		(void)table_close(table);
+		return r;
+	}
+	table->compress = table->dictionary != NULL && !table->readonly;
+	table->indexed = rdb_packageindex != NULL && !table->readonly;
+	*table_p = table;
+	return RET_OK;
+}
+
+/* Get a list of all identifiers having a package list */
+retvalue database_listpackages(struct strlist *identifiers) {
+	return database_listsubtables("packages.db", identifiers);
+}
+
+/* drop a database */
+retvalue database_droppackages(const char *identifier) {
+	retvalue r, r2;
+
+	r = database_dropsubtable("packages.db", identifier);
+	if (RET_IS_OK(r))
+		r = database_dropsubtable("packagenames.db", identifier);
+	if (RET_IS_OK(r)) {
+		r2 = database_storedictionary(identifier, NULL, 0);
+		if (RET_WAS_ERROR(r2))
+			r = r2;
+	}
+	if (RET_IS_OK(r) && rdb_packageindex != NULL) {
+		r2 = packageindex_drop(identifier);
+		if (RET_WAS_ERROR(r2))
+			r = r2;
+	}
+	return r;
+}
+
+/****************************************************************************
+ * The index of all packages by name                                        *
+ ****************************************************************************/
+
+/* packageindex.db has for every package name the packages tables it is in
+ * (as "<identifier> <version>"), so finding a package does not need to look
+ * into every packages table. It is updated with every change of a packages
+ * table and built by the first command that may change the database, after
+ * which this marker (which cannot be a package name) is added: */
+static const char packageindex_complete[] = "!complete";
+
+/* add or remove a package, given its primary key or name and version */
+static retvalue packageindex_update(const struct table *table, const char *key, const char *version, bool add) {
+	char *name, *entry;
+	retvalue r;
+
+	assert (rdb_packageindex != NULL);
+	if (version == NULL) {
+		const char *separator = strchr(key, '|');
+
+		if (separator == NULL) {
+			fprintf(stderr,
+"Database key '%s' in %s(%s) malformed. It should be 'package|version'.\n",
+					key, table->name, table->subname);
+			return RET_ERROR;
+		}
+		name = strndup(key, separator - key);
+		version = separator + 1;
+	} else
+		name = strdup(key);
+	if (FAILEDTOALLOC(name))
+		return RET_ERROR_OOM;
+	entry = mprintf("%s %s", table->subname, version);
+	if (FAILEDTOALLOC(entry)) {
+		free(name);
+		return RET_ERROR_OOM;
+	}
+	if (add)
+		r = table_addrecord(rdb_packageindex, name, entry,
+				strlen(entry), true);
+	else
+		r = table_removerecord(rdb_packageindex, name, entry);
+	free(entry);
+	free(name);
+	return r;
+}
+
+/* remove all entries of a packages table that is dropped */
+static retvalue packageindex_drop(const char *identifier) {
+	struct cursor *cursor;
+	const char *key, *data;
+	size_t l = strlen(identifier);
+	retvalue result, r;
+
+	r = table_newglobalcursor(rdb_packageindex, &cursor);
+	if (!RET_IS_OK(r))
+		return r;
+	result = RET_NOTHING;
+	while (cursor_nexttempdata(rdb_packageindex, cursor,
+				&key, &data, NULL)) {
+		if (strncmp(data, identifier, l) != 0 || data[l] != ' ')
+			continue;
+		r = cursor_delete(rdb_packageindex, cursor, key, NULL);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	r = cursor_close(rdb_packageindex, cursor);
+	RET_ENDUPDATE(result, r);
+	return result;
+}
+
+/* add all packages of a packages table, looking only at the keys */
+#ifndef HAVE_LMDB
+static retvalue packageindex_addtable(struct table *table) {
+	DBC *cursor;
+	DBT Key, Data;
+	int dbret;
+	retvalue result, r;
+
+	if (table->berkeleydb == NULL)
+		return RET_NOTHING;
+	dbret = table->berkeleydb->cursor(table->berkeleydb, NULL,
+			&cursor, 0);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "cursor");
+		return RET_DBERR(dbret);
+	}
+	result = RET_NOTHING;
+	CLEARDBT(Key);
+	CLEARDBT(Data);
+	Data.flags = DB_DBT_PARTIAL;
+	while ((dbret = cursor->c_get(cursor, &Key, &Data, DB_NEXT)) == 0) {
+		const char *key = Key.data;
+
+		if (Key.size == 0 || key[Key.size - 1] != '\0') {
+			fprintf(stderr,
+"Database key in %s(%s) empty or not NULL terminated.\n",
+					table->name, table->subname);
+			result = RET_ERROR;
+			break;
+		}
+		r = packageindex_update(table, key, NULL, true);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+		CLEARDBT(Key);
+		CLEARDBT(Data);
+		Data.flags = DB_DBT_PARTIAL;
+	}
+	if (dbret != 0 && dbret != DB_NOTFOUND && !RET_WAS_ERROR(result)) {
+		table_printerror(table, dbret, "c_get(DB_NEXT)");
+		result = RET_DBERR(dbret);
+	}
+	dbret = cursor->c_close(cursor);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "c_close");
+		RET_UPDATE(result, RET_DBERR(dbret));
+	}
+	return result;
+}
+#else
+static retvalue packageindex_addtable(struct table *table) {
+	MDB_cursor *cursor;
+	MDB_val Key, Data;
+	int dbret;
+	retvalue result, r;
+
+	if (!table->exists)
+		return RET_NOTHING;
+	dbret = mdb_cursor_open(rdb_txn, table->dbi, &cursor);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "cursor");
+		return RET_DBERR(dbret);
+	}
+	result = RET_NOTHING;
+	while ((dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_NEXT)) == 0) {
+		const char *key = Key.mv_data;
+
+		if (Key.mv_size == 0 || key[Key.mv_size - 1] != '\0') {
+			fprintf(stderr,
+"Database key in %s(%s) empty or not NULL terminated.\n",
+					table->name, table->subname);
+			result = RET_ERROR;
+			break;
+		}
+		r = packageindex_update(table, key, NULL, true);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	if (dbret != 0 && dbret != MDB_NOTFOUND && !RET_WAS_ERROR(result)) {
+		table_printerror(table, dbret, "c_get(MDB_NEXT)");
+		result = RET_DBERR(dbret);
+	}
+	mdb_cursor_close(cursor);
+	return result;
+}
+#endif
+
+static retvalue packageindex_build(void) {
+	struct strlist identifiers;
+	struct table *table;
+	retvalue result, r;
+	int i;
+
+	r = database_listpackages(&identifiers);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (r == RET_NOTHING)
+		strlist_init(&identifiers);
+	if (identifiers.count > 0 && verbose > 0)
+		printf(
+"Adding the packages of %d packages tables to packageindex.db...\n",
+				identifiers.count);
+	result = RET_NOTHING;
+	for (i = 0 ; i < identifiers.count ; i++) {
+		r = database_openpackages(identifiers.values[i], true, &table);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
+		r = packageindex_addtable(table);
+		RET_UPDATE(result, r);
+		r = table_close(table);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(result))
+			break;
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			break;
+		}
+	}
+	strlist_done(&identifiers);
+	if (RET_WAS_ERROR(result))
+		return result;
+	return table_addrecord(rdb_packageindex, packageindex_complete,
+			"", 0, false);
+}
+
+/* opened for writing before any packages table is */
+static retvalue packageindex_open(void) {
+	const char *data;
+	retvalue r;
+
+	r = database_table("packageindex.db", "packages", dbt_BTREEDUP,
+			DB_CREATE, &rdb_packageindex);
+	if (RET_WAS_ERROR(r)) {
+		rdb_packageindex = NULL;
+		return r;
+	}
+	/* as with packagenames.db, the changes are not worth a message */
+	rdb_packageindex->verbose = false;
+	/* an older version changing packages.db without updating this
+	 * would make it silently wrong, so they may no longer do so */
+	r = database_needversion(DBFORMAT_PACKAGEINDEX);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = table_gettemprecord(rdb_packageindex, packageindex_complete,
+			&data, NULL);
+	if (r == RET_NOTHING)
+		r = packageindex_build();
+	return r;
+}
+
+/* the files cannot be compacted while it is open */
+static retvalue packageindex_close(void) {
+	retvalue r;
+
+	if (rdb_packageindex == NULL)
+		return RET_NOTHING;
+	r = table_close(rdb_packageindex);
+	rdb_packageindex = NULL;
+	return r;
+}
+
+retvalue database_haspackageindex(void) {
+	const char *data;
+	retvalue r;
+
+	if (rdb_nopackages)
+		return RET_NOTHING;
+	if (rdb_packageindex == NULL) {
+		r = database_table("packageindex.db", "packages",
+				dbt_BTREEDUP, DB_RDONLY, &rdb_packageindex);
+		if (RET_WAS_ERROR(r)) {
+			rdb_packageindex = NULL;
+			return r;
+		}
+	}
+	return table_gettemprecord(rdb_packageindex, packageindex_complete,
+			&data, NULL);
+}
+
+/* call action with identifier and version of every package of that name */
+retvalue database_findpackages(const char *name, packageindex_action *action, void *privdata) {
+	struct cursor *cursor;
+	const char *key, *data, *version;
+	char *identifier;
+	retvalue result, r;
+
+	assert (rdb_packageindex != NULL);
+	r = table_newduplicatecursor(rdb_packageindex, name, 0,
+			&cursor, &key, &data, NULL);
+	if (!RET_IS_OK(r))
+		return r;
+	result = RET_NOTHING;
+	do {
+		version = strrchr(data, ' ');
+		if (version == NULL) {
+			fprintf(stderr,
+"Malformed entry '%s' for '%s' in packageindex.db!\n", data, name);
+			result = RET_ERROR;
+			break;
+		}
+		identifier = strndup(data, version - data);
+		if (FAILEDTOALLOC(identifier)) {
+			result = RET_ERROR_OOM;
+			break;
+		}
+		r = action(privdata, identifier, version + 1);
+		free(identifier);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+	} while (cursor_nexttempdata(rdb_packageindex, cursor,
+				&key, &data, NULL));
+	r = cursor_close(rdb_packageindex, cursor);
+	RET_ENDUPDATE(result, r);
+	return result;
+}
+
+/****************************************************************************
+ * Compressing the control chunks in packages.db                            *
+ ****************************************************************************/
+
+/* at most that much is looked at to train a dictionary */
+#define CHUNK_TRAININGSIZE (16 * 1024 * 1024)
+
+struct chunkstatistics {
+	unsigned long records, compressed;
+	unsigned long long rawsize, storedsize;
+};
+
+/* store (or with NULL remove) the dictionary of a target */
+static retvalue database_storedictionary(const char *identifier, /*@null@*/const char *dictionary, size_t size) {
+	struct table *table;
+	retvalue r, r2;
+
+	if (dictionary == NULL) {
+		bool exists;
+
+		r = database_hasdatabasefile("dictionaries.db", &exists);
+		if (RET_WAS_ERROR(r))
+			return r;
+		if (!exists)
+			return RET_NOTHING;
+	} else {
+		/* older versions cannot read the compressed chunks */
+		r = database_needversion(DBFORMAT_NEWTABLES);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	r = database_table("dictionaries.db", "packages", dbt_BTREE,
+			DB_CREATE, &table);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (dictionary == NULL)
+		r = table_deleterecord(table, identifier, true);
+	else
+		r = table_adduniqsizedrecord(table, identifier,
+				dictionary, size + 1, true, false);
+	r2 = table_close(table);
+	RET_ENDUPDATE(r, r2);
+	return r;
+}
+
+/* store every record again, compressed if table->compress is set
+ * (and it makes it smaller), uncompressed otherwise */
+#ifndef HAVE_LMDB
+static retvalue table_rewritechunks(struct table *table, struct chunkstatistics *stats) {
+	DBC *cursor;
+	DBT Key, Data;
+	int dbret;
+	retvalue r = RET_OK;
+
+	assert (!table->readonly);
+	if (table->berkeleydb == NULL)
+		return RET_NOTHING;
+	/* the primary database, as the secondary cannot be written to */
+	dbret = table->berkeleydb->cursor(table->berkeleydb, NULL,
+			&cursor, 0);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "cursor");
+		return RET_DBERR(dbret);
+	}
+	CLEARDBT(Key);
+	CLEARDBT(Data);
+	while ((dbret = cursor->c_get(cursor, &Key, &Data, DB_NEXT)) == 0) {
+		const char *data;
+		size_t len, size;
+
+		table->ops[to_next]++;
+		r = parse_data(table, Key, Data, NULL, &data, &len);
+		if (RET_IS_OK(r) && chunk_iscompressed(data, len))
+			r = table_uncompress(table, &table->buffer,
+					&data, len, &len);
+		if (RET_WAS_ERROR(r))
+			break;
+		stats->records++;
+		stats->rawsize += len;
+		size = len + 1;
+		if (table->compress) {
+			r = table_compress(table, &data, &size);
+			if (RET_WAS_ERROR(r))
+				break;
+			if (RET_IS_OK(r))
+				stats->compressed++;
+		}
+		stats->storedsize += size - 1;
+		if (data != Data.data) {
+			table->ops[to_replace]++;
+			CLEARDBT(Key);
+			SETDBTl(Data, data, size);
+			dbret = cursor->c_put(cursor, &Key, &Data, DB_CURRENT);
+			if (dbret != 0) {
+				table_printerror(table, dbret,
+						"c_put(DB_CURRENT)");
+				r = RET_DBERR(dbret);
+				break;
+			}
+		}
+		if (interrupted()) {
+			r = RET_ERROR_INTERRUPTED;
+			break;
+		}
+		CLEARDBT(Key);
+		CLEARDBT(Data);
+	}
+	if (dbret != 0 && dbret != DB_NOTFOUND && !RET_WAS_ERROR(r)) {
+		table_printerror(table, dbret, "c_get(DB_NEXT)");
+		r = RET_DBERR(dbret);
+	}
+	dbret = cursor->c_close(cursor);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "c_close");
+		RET_UPDATE(r, RET_DBERR(dbret));
+	}
+	return r;
+}
+#else
+static retvalue table_rewritechunks(struct table *table, struct chunkstatistics *stats) {
+	MDB_cursor *cursor;
+	MDB_val Key, Data;
+	int dbret;
+	retvalue r = RET_OK;
+
+	assert (!table->readonly);
+	if (!table->exists)
+		return RET_NOTHING;
+	/* the records themselves, not the index of the names */
+	dbret = mdb_cursor_open(rdb_txn, table->dbi, &cursor);
+	if (dbret != 0) {
+		table_printerror(table, dbret, "cursor");
+		return RET_DBERR(dbret);
+	}
+	while ((dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_NEXT)) == 0) {
+		const char *data;
+		size_t len, size;
+
+		table->ops[to_next]++;
+		r = parse_data(table, Key, Data, NULL, &data, &len);
+		if (RET_IS_OK(r) && chunk_iscompressed(data, len))
+			r = table_uncompress(table, &table->buffer,
+					&data, len, &len);
+		if (RET_WAS_ERROR(r))
+			break;
+		stats->records++;
+		stats->rawsize += len;
+		size = len + 1;
+		if (table->compress) {
+			r = table_compress(table, &data, &size);
+			if (RET_WAS_ERROR(r))
+				break;
+			if (RET_IS_OK(r))
+				stats->compressed++;
+		}
+		stats->storedsize += size - 1;
+		if (data != Data.mv_data) {
+			table->ops[to_replace]++;
+			SETMDBVl(Data, data, size);
+			dbret = mdb_cursor_put(cursor, &Key, &Data,
+					MDB_CURRENT);
+			if (dbret != 0) {
+				table_printerror(table, dbret,
+						"c_put(MDB_CURRENT)");
+				r = RET_DBERR(dbret);
+				break;
+			}
+		}
+		if (interrupted()) {
+			r = RET_ERROR_INTERRUPTED;
+			break;
+		}
+	}
+	if (dbret != 0 && dbret != MDB_NOTFOUND && !RET_WAS_ERROR(r)) {
+		table_printerror(table, dbret, "c_get(MDB_NEXT)");
+		r = RET_DBERR(dbret);
+	}
+	mdb_cursor_close(cursor);
+	return r;
+}
+#endif
+
+/* train a dictionary from (evenly spread) chunks of the table */
+static retvalue table_traindictionary(struct table *table, const struct chunkstatistics *stats, /*@out@*/char **dictionary_p, /*@out@*/size_t *size_p) {
+	struct cursor *cursor;
+	const char *key, *data;
+	size_t len, *sizes, used = 0;
+	unsigned long step, i = 0;
+	unsigned int count = 0;
+	char *samples;
+	retvalue r;
+
+	step = stats->rawsize / CHUNK_TRAININGSIZE + 1;
+	samples = malloc(CHUNK_TRAININGSIZE);
+	sizes = nzNEW(stats->records / step + 1, size_t);
+	if (FAILEDTOALLOC(samples) || FAILEDTOALLOC(sizes)) {
+		free(samples);
+		free(sizes);
+		return RET_ERROR_OOM;
+	}
+	r = table_newglobalcursor(table, &cursor);
+	if (RET_WAS_ERROR(r)) {
+		free(samples);
+		free(sizes);
+		return r;
+	}
+	while (cursor_nexttempdata(table, cursor, &key, &data, &len)) {
+		if (i++ % step != 0)
+			continue;
+		if (used + len > CHUNK_TRAININGSIZE ||
+				count > stats->records / step)
+			break;
+		memcpy(samples + used, data, len);
+		used += len;
+		sizes[count++] = len;
+	}
+	r = cursor_close(table, cursor);
+	if (!RET_WAS_ERROR(r))
+		r = chunkdictionary_train(samples, sizes, count,
+				dictionary_p, size_p);
+	free(samples);
+	free(sizes);
+	return r;
+}
+
+static void compress_report(const char *identifier, const struct chunkstatistics *stats, size_t dictionarysize) {
+	if (dictionarysize == 0) {
+		printf(
+"%s: %lu packages, %llu bytes of control data, stored uncompressed\n",
+				identifier, stats->records, stats->rawsize);
+		return;
+	}
+	printf(
+"%s: %lu packages (%lu compressed), %llu bytes of control data stored in %llu bytes (+ dictionary of %lu bytes)\n",
+			identifier, stats->records, stats->compressed,
+			stats->rawsize, stats->storedsize,
+			(unsigned long)dictionarysize);
+}
+
+/* (re)compress the control chunks of a target with a new dictionary
+ * trained from them, or store all uncompressed again */
+retvalue database_compresschunks(const char *identifier, bool compress) {
+	struct chunkstatistics stats;
+	struct table *table;
+	char *dictionary;
+	size_t dictionarysize;
+	retvalue result, r;
+
+	if (compress && !chunkcompression_supported()) {
+		fputs(
+"Error: Compressing control chunks needs reprepro compiled with libzstd!\n",
+				stderr);
+		return RET_ERROR;
+	}
+	r = database_openpackages(identifier, false, &table);
+	if (RET_WAS_ERROR(r))
+		return r;
+	/* First store everything uncompressed and remove the old
+	 * dictionary, so that everything stays readable if this
+	 * is interrupted at any point. */
+	table->compress = false;
+	memset(&stats, 0, sizeof(stats));
+	result = table_rewritechunks(table, &stats);
+	if (!RET_WAS_ERROR(result) && table->dictionary != NULL) {
+		r = database_storedictionary(identifier, NULL, 0);
+		RET_UPDATE(result, r);
+		chunkdictionary_free(table->dictionary);
+		table->dictionary = NULL;
+	}
+	if (RET_WAS_ERROR(result) || !compress) {
+		if (!RET_WAS_ERROR(result))
+			compress_report(identifier, &stats, 0);
+		r = table_close(table);
+		RET_UPDATE(result, r);
+		return result;
+	}
+
+	r = table_traindictionary(table, &stats, &dictionary, &dictionarysize);
+	if (r == RET_NOTHING) {
+		if (verbose >= 0)
+			printf(
+"%s: not enough packages to train a dictionary, leaving them uncompressed.\n",
+					identifier);
+		return table_close(table);
+	}
+	if (RET_IS_OK(r)) {
+		r = database_storedictionary(identifier,
+				dictionary, dictionarysize);
+		if (RET_IS_OK(r))
+			r = chunkdictionary_new(dictionary, dictionarysize,
+					&table->dictionary);
+		free(dictionary);
+	}
+	if (RET_IS_OK(r)) {
+		table->compress = true;
+		memset(&stats, 0, sizeof(stats));
+		r = table_rewritechunks(table, &stats);
+		if (!RET_WAS_ERROR(r))
+			compress_report(identifier, &stats, dictionarysize);
+	}
+	RET_UPDATE(result, r);
+	r = table_close(table);
+	RET_UPDATE(result, r);
+	return result;
+}
+
+/* older versions must not use the database once something was written
+ * they cannot read */
+static retvalue database_needversion(const char *version) {
+	char *v;
+	int c;
+	retvalue r;
+
+	if (rdb_lastsupportedversion != NULL) {
+		r = dpkgversions_cmp(rdb_lastsupportedversion, version, &c);
+		if (RET_WAS_ERROR(r))
+			return r;
+		if (c >= 0)
+			return RET_NOTHING;
+	}
+	v = strdup(version);
+	if (FAILEDTOALLOC(v))
+		return RET_ERROR_OOM;
+	free(rdb_lastsupportedversion);
+	rdb_lastsupportedversion = v;
+	return RET_OK;
+}
+
+retvalue database_openfiles(void) {
+	retvalue r;
+	struct strlist identifiers;
+	bool checksumsexisted, oldfiles;
+
+	assert (rdb_checksums == NULL);
+	assert (rdb_contents == NULL);
+
+	r = database_listsubtables("contents.cache.db", &identifiers);
+	if (RET_IS_OK(r)) {
+		if (strlist_in(&identifiers, "filelists")) {
+			fprintf(stderr,
+"Your %s/contents.cache.db file still contains a table of cached file lists\n"
+"in the old (pre 3.0.0) format. You have to either delete that file (and lose\n"
+"all caches of file lists) or run reprepro with argument translatefilelists\n"
+"to translate the old caches into the new format.\n",
+					global.dbdir);
+			strlist_done(&identifiers);
+			return RET_ERROR;
+		}
+		strlist_done(&identifiers);
+	}
+
+	r = database_hasdatabasefile("checksums.db", &checksumsexisted);
+	r = database_table("checksums.db", "pool",
+			dbt_BTREE, DB_CREATE,
+			&rdb_checksums);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		rdb_checksums = NULL;
+		return r;
+	}
+	/* new records in checksums.db are stored in binary form,
+	 * which versions before this one cannot parse */
+	if (!rdb_readonly) {
+		r = database_needversion(DBFORMAT_NEWTABLES);
+		if (RET_WAS_ERROR(r)) {
+			(void)table_close(rdb_checksums);
+			rdb_checksums = NULL;
+			return r;
+		}
+	}
+	r = database_hasdatabasefile("files.db", &oldfiles);
+	if (RET_WAS_ERROR(r)) {
+		(void)table_close(rdb_checksums);
+		rdb_checksums = NULL;
+		return r;
+	}
+	if (oldfiles) {
+		fprintf(stderr,
+"Error: database uses deprecated format.\n"
+"Please run translatelegacychecksums to update to the new format first.\n");
+		return RET_ERROR;
+	}
+
+	// TODO: only create this file once it is actually needed...
+	r = database_table("contents.cache.db", "compressedfilelists",
+			dbt_BTREE, DB_CREATE, &rdb_contents);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		(void)table_close(rdb_checksums);
+		rdb_checksums = NULL;
+		rdb_contents = NULL;
+	}
+	return r;
+}
+
+/* long descriptions by their Description-md5, opened when first needed */
+retvalue database_opendescriptions(void) {
+	retvalue r;
+
+	if (rdb_descriptions != NULL)
+		return RET_OK;
+	if (rdb_readonly) {
+		bool exists;
+
+		r = database_hasdatabasefile("descriptions.db", &exists);
+		if (RET_WAS_ERROR(r))
+			return r;
+		if (!exists)
+			return RET_NOTHING;
+	}
+	r = database_table("descriptions.db", "descriptions",
+			dbt_BTREE, rdb_readonly?DB_RDONLY:DB_CREATE,
+			&rdb_descriptions);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		rdb_descriptions = NULL;
+		return r;
+	}
+	rdb_descriptions->verbose = false;
+	return RET_OK;
+}
+
+/* descriptions.db is only a cache, so it can simply be emptied */
+retvalue database_cleardescriptions(void) {
+	retvalue r;
+
+	if (rdb_descriptions != NULL) {
+		r = table_close(rdb_descriptions);
+		rdb_descriptions = NULL;
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	r = database_dropsubtable("descriptions.db", "descriptions");
+	if (RET_WAS_ERROR(r))
+		return r;
+	return database_opendescriptions();
+}
+
+retvalue database_openreleasecache(const char *codename, struct table **cachedb_p) {
+	retvalue r;
+	char *oldcachefilename;
+
+	/* Since 3.1.0 it's release.caches.db, before release.cache.db.
+	 * The new file also contains the sha1 checksums and is extensible
+	 * for more in the future. Thus if there is only the old variant,
+	 * rename to the new. (So no old version by accident uses it and
+	 * puts the additional sha1 data into the md5sum fields.)
+	 * If both files are there, just delete both, as neither will
+	 * be very current then.
+	 * */
+
+	oldcachefilename = dbfilename("release.cache.db");
+	if (FAILEDTOALLOC(oldcachefilename))
+		return RET_ERROR_OOM;
+	if (isregularfile(oldcachefilename)) {
+		char *newcachefilename;
+
+		newcachefilename = dbfilename("release.caches.db");
+		if (FAILEDTOALLOC(newcachefilename)) {
+			free(oldcachefilename);
+			return RET_ERROR_OOM;
+		}
+		if (isregularfile(newcachefilename)
+		    || rename(oldcachefilename, newcachefilename) != 0) {
+			fprintf(stderr,
+"Deleting old-style export cache file %s!\n"
+"This means that all index files (even unchanged) will be rewritten the\n"
+"next time parts of their distribution are changed. This should only\n"
+"happen once while migration from pre-3.1.0 to later versions.\n",
+					oldcachefilename);
+
+			if (unlink(oldcachefilename) != 0) {
+				int e = errno;
+				fprintf(stderr, "Cannot delete '%s': %s!",
+						oldcachefilename,
+						strerror(e));
+				free(oldcachefilename);
+				free(newcachefilename);
+				return RET_ERRNO(e);
+			}
+			(void)unlink(oldcachefilename);
+		}
+		free(newcachefilename);
+	}
+	free(oldcachefilename);
+
+	r = database_table("release.caches.db", codename,
+			 dbt_HASH, DB_CREATE, cachedb_p);
+	if (RET_IS_OK(r))
+		(*cachedb_p)->verbose = false;
+	return r;
+}
+
+#ifndef HAVE_LMDB
+static retvalue table_copy(struct table *oldtable, struct table *newtable) {
+	retvalue r;
+	struct cursor *cursor;
+	const char *filekey, *data;
+	size_t data_len;
+
+	r = table_newglobalcursor(oldtable, &cursor);
+	if (!RET_IS_OK(r))
+		return r;
+	while (cursor_nexttempdata(oldtable, cursor, &filekey,
+				&data, &data_len)) {
+		r = table_adduniqsizedrecord(newtable, filekey,
+				data, data_len+1, false, true);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	return RET_OK;
+}
+#endif
+
+/* Copy all records of the primary database of one table into another one
+ * (secondary databases of the new one are updated by libdb), in the order
+ * of their keys, without looking at them. Compressed chunks are
+ * uncompressed with the dictionary of the old table and compressed again
+ * with the dictionary of the new one (if it has one). The action is
+ * called with the (uncompressed) data of each record copied. */
+#ifndef HAVE_LMDB
+retvalue table_copyrecords(struct table *oldtable, struct table *newtable, table_record_action *action, void *privdata) {
+	DBC *cursor;
+	DBT Key, Data;
+	const char *data;
+	size_t data_len;
+	int dbret;
+	retvalue result, r;
+
+	assert (!newtable->readonly && newtable->berkeleydb != NULL);
+	if (oldtable->berkeleydb == NULL)
+		return RET_NOTHING;
+	dbret = oldtable->berkeleydb->cursor(oldtable->berkeleydb, NULL,
+			&cursor, 0);
+	if (dbret != 0) {
+		table_printerror(oldtable, dbret, "cursor");
+		return RET_DBERR(dbret);
+	}
+	result = RET_NOTHING;
+	CLEARDBT(Key);
+	CLEARDBT(Data);
+	while ((dbret = cursor->c_get(cursor, &Key, &Data, DB_NEXT)) == 0) {
+		const char *newdata;
+		size_t newsize;
+		DBT NewData;
+
+		r = parse_data(oldtable, Key, Data, NULL, &data, &data_len);
+		if (RET_IS_OK(r) && oldtable->chunks &&
+				chunk_iscompressed(data, data_len))
+			r = table_uncompress(oldtable, &oldtable->buffer,
+					&data, data_len, &data_len);
+		newdata = data;
+		newsize = data_len + 1;
+		if (RET_IS_OK(r) && newtable->compress)
+			r = table_compress(newtable, &newdata, &newsize);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
+		SETDBTl(NewData, newdata, newsize);
+		dbret = newtable->berkeleydb->put(newtable->berkeleydb, NULL,
+				&Key, &NewData, DB_NOOVERWRITE);
+		if (dbret != 0) {
+			table_printerror(newtable, dbret, "put(uniq)");
+			result = RET_DBERR(dbret);
+			break;
+		}
+		if (newtable->indexed) {
+			r = packageindex_update(newtable, Key.data, NULL, true);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+		}
+		result = RET_OK;
+		if (action != NULL) {
+			r = action(privdata, data, data_len);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+		}
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			break;
+		}
+		CLEARDBT(Key);
+		CLEARDBT(Data);
+	}
+	if (dbret != 0 && dbret != DB_NOTFOUND && !RET_WAS_ERROR(result)) {
+		table_printerror(oldtable, dbret, "c_get(DB_NEXT)");
+		result = RET_DBERR(dbret);
+	}
+	dbret = cursor->c_close(cursor);
+	if (dbret != 0) {
+		table_printerror(oldtable, dbret, "c_close");
+		RET_UPDATE(result, RET_DBERR(dbret));
+	}
+	return result;
+}
+#else
+retvalue table_copyrecords(struct table *oldtable, struct table *newtable, table_record_action *action, void *privdata) {
+	MDB_cursor *cursor;
+	MDB_val Key, Data;
+	const char *key, *data;
+	size_t data_len;
+	int dbret;
+	retvalue result, r;
+
+	assert (!newtable->readonly && newtable->exists);
+	if (!oldtable->exists)
+		return RET_NOTHING;
+	dbret = mdb_cursor_open(rdb_txn, oldtable->dbi, &cursor);
+	if (dbret != 0) {
+		table_printerror(oldtable, dbret, "cursor");
+		return RET_DBERR(dbret);
+	}
+	result = RET_NOTHING;
+	while ((dbret = mdb_cursor_get(cursor, &Key, &Data, MDB_NEXT)) == 0) {
+		const char *newdata;
+		size_t newsize;
+
+		r = parse_data(oldtable, Key, Data, &key, &data, &data_len);
+		if (RET_IS_OK(r) && oldtable->chunks &&
+				chunk_iscompressed(data, data_len))
+			r = table_uncompress(oldtable, &oldtable->buffer,
+					&data, data_len, &data_len);
+		newdata = data;
+		newsize = data_len + 1;
+		if (RET_IS_OK(r) && newtable->compress)
+			r = table_compress(newtable, &newdata, &newsize);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
+		dbret = lmdb_put(newtable, key, newdata, newsize,
+				MDB_NOOVERWRITE);
+		if (dbret != 0) {
+			table_printerror(newtable, dbret, "put(uniq)");
+			result = RET_DBERR(dbret);
+			break;
+		}
+		if (newtable->indexed) {
+			r = packageindex_update(newtable, key, NULL, true);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+		}
+		result = RET_OK;
+		if (action != NULL) {
+			r = action(privdata, data, data_len);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+		}
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			break;
+		}
+	}
+	if (dbret != 0 && dbret != MDB_NOTFOUND && !RET_WAS_ERROR(result)) {
+		table_printerror(oldtable, dbret, "c_get(MDB_NEXT)");
+		result = RET_DBERR(dbret);
+	}
+	mdb_cursor_close(cursor);
+	return result;
+}
+#endif
+
+#ifndef HAVE_LMDB
+retvalue database_translate_filelists(void) {
+	char *dbname, *tmpdbname;
+	struct table *oldtable, *newtable;
+	struct strlist identifiers;
+	int ret;
+	retvalue r, r2;
+
+	r = database_listsubtables("contents.cache.db", &identifiers);
+	if (RET_IS_OK(r)) {
+		if (!strlist_in(&identifiers, "filelists")) {
+			fprintf(stderr,
+"Your %s/contents.cache.db file does not contain an old style database!\n",
+					global.dbdir);
+			strlist_done(&identifiers);
+			return RET_NOTHING;
+		}
+		strlist_done(&identifiers);
+	}
+
+	dbname = dbfilename("contents.cache.db");
+	if (FAILEDTOALLOC(dbname))
+		return RET_ERROR_OOM;
+	tmpdbname = dbfilename("old.contents.cache.db");
+	if (FAILEDTOALLOC(tmpdbname)) {
+		free(dbname);
+		return RET_ERROR_OOM;
+	}
+	ret = rename(dbname, tmpdbname);
+	if (ret != 0) {
+		int e = errno;
+		fprintf(stderr, "Could not rename '%s' into '%s': %s(%d)\n",
+				dbname, tmpdbname, strerror(e), e);
+		free(dbname);
+		free(tmpdbname);
+		return RET_ERRNO(e);
+	}
+	newtable = NULL;
+	r = database_table("contents.cache.db", "compressedfilelists",
+			dbt_BTREE, DB_CREATE, &newtable);
+	assert (r != RET_NOTHING);
+	oldtable = NULL;
+	if (RET_IS_OK(r)) {
+		r = database_table("old.contents.cache.db", "filelists",
+				dbt_BTREE, DB_RDONLY, &oldtable);
+		if (r == RET_NOTHING) {
+			fprintf(stderr, "Could not find old-style database!\n");
+			r = RET_ERROR;
+		}
+	}
+	if (RET_IS_OK(r)) {
+		r = filelists_translate(oldtable, newtable);
+		if (r == RET_NOTHING)
+			r = RET_OK;
+	}
+	r2 = table_close(oldtable);
+	RET_ENDUPDATE(r, r2);
+	oldtable = NULL;
+	if (RET_IS_OK(r)) {
+		/* copy the new-style database, */
+		r = database_table("old.contents.cache.db", "compressedfilelists",
+				dbt_BTREE, DB_RDONLY, &oldtable);
+		if (RET_IS_OK(r)) {
+			/* if there is one... */
+			r = table_copy(oldtable, newtable);
+			r2 = table_close(oldtable);
+			RET_ENDUPDATE(r, r2);
+		}
+		if (r == RET_NOTHING) {
+			r = RET_OK;
+		}
+	}
+	r2 = table_close(newtable);
+	RET_ENDUPDATE(r, r2);
+	if (RET_IS_OK(r))
+		(void)unlink(tmpdbname);
+
+	if (RET_WAS_ERROR(r)) {
+		ret = rename(tmpdbname, dbname);
+		if (ret != 0) {
+			int e = errno;
+			fprintf(stderr,
+"Could not rename '%s' back into '%s': %s(%d)\n",
+					dbname, tmpdbname, strerror(e), e);
+			free(tmpdbname);
+			free(dbname);
+			return RET_ERRNO(e);
+		}
+		free(tmpdbname);
+		free(dbname);
+		return r;
+	}
+	free(tmpdbname);
+	free(dbname);
+	return RET_OK;
+}
+
+/* This is already implemented as standalone functions duplicating a bit
+ * of database_create and from files.c,
+ * because database_create is planed to error out if * there is still an old
+ * files.db and files.c is supposed to lose all support for it in the next
+ * major version */
+
+static inline retvalue translate(struct table *oldmd5sums, struct table *newchecksums) {
+	long numold = 0, numnew = 0, numreplace = 0, numretro = 0;
+	struct cursor *cursor, *newcursor;
+	const char *filekey, *md5sum, *all;
+	size_t alllen;
+	retvalue r;
+
+	/* first add all md5sums to checksums if not there yet */
+
+	r = table_newglobalcursor(oldmd5sums, &cursor);
+	if (RET_WAS_ERROR(r))
+		return r;
+	while (cursor_nexttempdata(oldmd5sums, cursor,
+				&filekey, &md5sum, NULL)) {
+		struct checksums *n = NULL;
+		const char *combined;
+		size_t combinedlen;
+
+		r = table_gettemprecord(newchecksums, filekey,
+				&all, &alllen);
+		if (RET_IS_OK(r))
+			r = checksums_setall(&n, all, alllen);
+		if (RET_IS_OK(r)) {
+			if (checksums_matches(n, cs_md5sum, md5sum)) {
+				/* already there, nothing to do */
+				checksums_free(n);
+				numnew++;
+				continue;
+			}
+			/* new item does not match */
+			if (verbose > 0)
+				printf(
+"Overwriting stale new-checksums entry '%s'!\n",
+						filekey);
+			numreplace++;
+			checksums_free(n);
+			n = NULL;
+		}
+		if (RET_WAS_ERROR(r)) {
+			(void)cursor_close(oldmd5sums, cursor);
+			return r;
+		}
+		/* parse and recreate, to only have sanitized strings
+		 * in the database */
+		r = checksums_parse(&n, md5sum);
+		assert (r != RET_NOTHING);
+		if (RET_WAS_ERROR(r)) {
+			(void)cursor_close(oldmd5sums, cursor);
+			return r;
+		}
+
+		r = checksums_getcombined(n, &combined, &combinedlen);
+		assert (r != RET_NOTHING);
+		if (!RET_IS_OK(r)) {
+			(void)cursor_close(oldmd5sums, cursor);
+			return r;
+		}
+		numold++;
+		r = table_adduniqsizedrecord(newchecksums, filekey,
+				combined, combinedlen + 1, true, false);
+		assert (r != RET_NOTHING);
+		if (!RET_IS_OK(r)) {
+			(void)cursor_close(oldmd5sums, cursor);
+			return r;
 		}
 	}
-
-	return result;
+	r = cursor_close(oldmd5sums, cursor);
+	if (RET_WAS_ERROR(r))
+		return r;
+
+	/* then delete everything from checksums that is not in md5sums */
+
+	r = table_newglobalcursor(oldmd5sums, &cursor);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = table_newglobalcursor(newchecksums, &newcursor);
+	if (RET_WAS_ERROR(r)) {
+		cursor_close(oldmd5sums, cursor);
+		return r;
+	}
+	while (cursor_nexttempdata(oldmd5sums, cursor,
+				&filekey, &md5sum, NULL)) {
+		bool more;
+		int cmp;
+		const char *newfilekey, *dummy;
+
+		do {
+			more = cursor_nexttempdata(newchecksums, newcursor,
+				&newfilekey, &dummy, NULL);
+			/* should have been added in the last step */
+			assert (more);
+			cmp = strcmp(filekey, newfilekey);
+			/* should have been added in the last step */
+			assert (cmp >= 0);
+			more = cmp > 0;
+			if (more) {
+				numretro++;
+				if (verbose > 0)
+					printf(
+"Deleting stale new-checksums entry '%s'!\n",
+						newfilekey);
+				r = cursor_delete(newchecksums, newcursor,
+						newfilekey, dummy);
+				if (RET_WAS_ERROR(r)) {
+					cursor_close(oldmd5sums, cursor);
+					cursor_close(newchecksums, newcursor);
+					return r;
+				}
+			}
+		} while (more);
+	}
+	r = cursor_close(oldmd5sums, cursor);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = cursor_close(newchecksums, newcursor);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (verbose >= 0) {
+		printf("%ld packages were already in the new checksums.db\n",
+				numnew);
+		printf("%ld packages were added to the new checksums.db\n",
+				numold - numreplace);
+		if (numretro != 0)
+			printf(
+"%ld were only in checksums.db and not in files.db\n"
+"This should only have happened if you added them with a newer version\n"
+"and then deleted them with an older version of reprepro.\n",
+				numretro);
+		if (numreplace != 0)
+			printf(
+"%ld were different checksums.db and not in files.db\n"
+"This should only have happened if you added them with a newer version\n"
+"and then deleted them with an older version of reprepro and\n"
+"then readded them with a old version.\n",
+				numreplace);
+		if (numretro != 0 || numreplace != 0)
+			printf(
+"If you never run a old version after a new version,\n"
+"you might want to check with check and checkpool if something went wrong.\n");
+	}
+	return RET_OK;
 }
 
-retvalue database_openpackages(const char *identifier, bool readonly, struct table **table_p) {
-	struct table *table;
+retvalue database_translate_legacy_checksums(bool verbosedb) {
+	struct table *newchecksums, *oldmd5sums;
+	char *fullfilename;
 	retvalue r;
+	int e;
 
-	if (rdb_nopackages) {
-		(void)fputs(
-"Internal Error: Accessing packages database while that was not prepared!\n",
+	if (rdb_initialized || rdb_used) {
+		fputs("Internal Error: database initialized a 2nd time!\n",
 				stderr);
+		return RET_ERROR_INTERNAL;
+	}
+
+	if (!isdir(global.dbdir)) {
+		fprintf(stderr, "Cannot find directory '%s'!\n",
+				global.dbdir);
 		return RET_ERROR;
 	}
 
-	r = database_table_secondary("packages.db", identifier,
-			dbt_BTREE, readonly?DB_RDONLY:DB_CREATE,
-			"packagenames.db", dbt_BTREEVERSIONS, &table);
+	rdb_initialized = true;
+	rdb_used = true;
+
+	rdb_readonly = READWRITE;
+	r = database_lock(0, READWRITE);
 	assert (r != RET_NOTHING);
-	if (RET_WAS_ERROR(r))
+	if (!RET_IS_OK(r)) {
+		database_free();
 		return r;
-
-	if (table->berkeleydb != NULL && table->sec_berkeleydb == NULL) {
-		r = table_close(table);
-		if (RET_WAS_ERROR(r)) {
-			return r;
-		}
-		r = database_translate_legacy_packages();
-		if (RET_WAS_ERROR(r)) {
-			return r;
-		}
-		return database_openpackages(identifier, readonly, table_p);
 	}
+	rdb_verbose = verbosedb;
 
-	if (table->berkeleydb != NULL && table->sec_berkeleydb != NULL) {
-		r = table->berkeleydb->associate(table->berkeleydb, NULL,
-				table->sec_berkeleydb, get_package_name, 0);
-		if (RET_WAS_ERROR(r)) {
-			return r;
-		}
+	r = readversionfile(false);
+	if (RET_WAS_ERROR(r)) {
+		releaselock();
+		database_free();
+		return r;
 	}
 
-	*table_p = table;
-	return RET_OK;
-}
-
-/* Get a list of all identifiers having a package list */
-retvalue database_listpackages(struct strlist *identifiers) {
-	return database_listsubtables("packages.db", identifiers);
-}
-
-/* drop a database */
-retvalue database_droppackages(const char *identifier) {
-	retvalue r;
-
-	r = database_dropsubtable("packages.db", identifier);
-	if (RET_IS_OK(r))
-		r = database_dropsubtable("packagenames.db", identifier);
-	return r;
-}
-
-retvalue database_openfiles(void) {
-	retvalue r;
-	struct strlist identifiers;
-	bool checksumsexisted, oldfiles;
-
-	assert (rdb_checksums == NULL);
-	assert (rdb_contents == NULL);
-
-	r = database_listsubtables("contents.cache.db", &identifiers);
-	if (RET_IS_OK(r)) {
-		if (strlist_in(&identifiers, "filelists")) {
-			fprintf(stderr,
-"Your %s/contents.cache.db file still contains a table of cached file lists\n"
-"in the old (pre 3.0.0) format. You have to either delete that file (and lose\n"
-"all caches of file lists) or run reprepro with argument translatefilelists\n"
-"to translate the old caches into the new format.\n",
-					global.dbdir);
-			strlist_done(&identifiers);
-			return RET_ERROR;
-		}
-		strlist_done(&identifiers);
+	r = database_table("files.db", "md5sums", dbt_BTREE, 0, &oldmd5sums);
+	if (r == RET_NOTHING) {
+		fprintf(stderr,
+"There is no old files.db in %s. Nothing to translate!\n",
+				global.dbdir);
+		releaselock();
+		database_free();
+		return RET_NOTHING;
+	} else if (RET_WAS_ERROR(r)) {
+		releaselock();
+		database_free();
+		return r;
 	}
 
-	r = database_hasdatabasefile("checksums.db", &checksumsexisted);
-	r = database_table("checksums.db", "pool",
-			dbt_BTREE, DB_CREATE,
-			&rdb_checksums);
+	r = database_table("checksums.db", "pool", dbt_BTREE, DB_CREATE,
+			&newchecksums);
 	assert (r != RET_NOTHING);
 	if (RET_WAS_ERROR(r)) {
-		rdb_checksums = NULL;
+		(void)table_close(oldmd5sums);
+		releaselock();
+		database_free();
 		return r;
 	}
-	r = database_hasdatabasefile("files.db", &oldfiles);
+
+	r = translate(oldmd5sums, newchecksums);
 	if (RET_WAS_ERROR(r)) {
-		(void)table_close(rdb_checksums);
-		rdb_checksums = NULL;
+		(void)table_close(oldmd5sums);
+		(void)table_close(newchecksums);
+		releaselock();
+		database_free();
 		return r;
 	}
-	if (oldfiles) {
-		fprintf(stderr,
-"Error: database uses deprecated format.\n"
-"Please run translatelegacychecksums to update to the new format first.\n");
-		return RET_ERROR;
-	}
 
-	// TODO: only create this file once it is actually needed...
-	r = database_table("contents.cache.db", "compressedfilelists",
-			dbt_BTREE, DB_CREATE, &rdb_contents);
-	assert (r != RET_NOTHING);
+	(void)table_close(oldmd5sums);
+	r = table_close(newchecksums);
 	if (RET_WAS_ERROR(r)) {
-		(void)table_close(rdb_checksums);
-		rdb_checksums = NULL;
-		rdb_contents = NULL;
+		releaselock();
+		database_free();
+		return r;
+	}
+	fullfilename = dbfilename("files.db");
+	if (FAILEDTOALLOC(fullfilename)) {
+		releaselock();
+		database_free();
+		return RET_ERROR_OOM;
+	}
+	e = deletefile(fullfilename);
+	if (e != 0) {
+		fprintf(stderr, "Could not delete '%s'!\n"
+"It can now safely be deleted and it all that is left to be done!\n",
+				fullfilename);
+		database_free();
+		return RET_ERRNO(e);
 	}
+	r = writeversionfile();
+	releaselock();
+	database_free();
 	return r;
 }
+#else
+/* lmdb databases never had those old formats */
+retvalue database_translate_filelists(void) {
+	fprintf(stderr,
+"Your %s/contents.cache.db file does not contain an old style database!\n",
+			global.dbdir);
+	return RET_NOTHING;
+}
 
-retvalue database_openreleasecache(const char *codename, struct table **cachedb_p) {
-	retvalue r;
-	char *oldcachefilename;
+retvalue database_translate_legacy_checksums(UNUSED(bool verbosedb)) {
+	fprintf(stderr,
+"There is no old files.db in %s. Nothing to translate!\n",
+			global.dbdir);
+	return RET_NOTHING;
+}
+#endif
 
-	/* Since 3.1.0 it's release.caches.db, before release.cache.db.
-	 * The new file also contains the sha1 checksums and is extensible
-	 * for more in the future. Thus if there is only the old variant,
-	 * rename to the new. (So no old version by accident uses it and
-	 * puts the additional sha1 data into the md5sum fields.)
-	 * If both files are there, just delete both, as neither will
-	 * be very current then.
-	 * */
+/****************************************************************************
+ * Dumping and loading everything (to switch the database library)         *
+ ****************************************************************************/
 
-	oldcachefilename = dbfilename("release.cache.db");
-	if (FAILEDTOALLOC(oldcachefilename))
-		return RET_ERROR_OOM;
-	if (isregularfile(oldcachefilename)) {
-		char *newcachefilename;
+/* The dump is a text header, then for every table a line
+ * "table <file> <subtable>", followed by lines "record <keylen> <datalen>"
+ * each followed by key and data (without their terminating '\0' but with
+ * a newline after both), and finally a line "end". */
+
+static const char dumpheader[] = "reprepro database dump\n";
+
+static const struct dumpedtable {
+	const char *filename, *subtable;
+	enum database_type type;
+} dumpedtables[] = {
+	{"checksums.db", "pool", dbt_BTREE},
+	{"contents.cache.db", "compressedfilelists", dbt_BTREE},
+	{"references.db", "references", dbt_BTREEDUP},
+	{"referencedby.db", "references", dbt_BTREEDUP},
+	{"referees.db", "referees", dbt_BTREE},
+	{"descriptions.db", "descriptions", dbt_BTREE},
+	{NULL, NULL, dbt_QUERY}
+};
 
-		newcachefilename = dbfilename("release.caches.db");
-		if (FAILEDTOALLOC(newcachefilename)) {
-			free(oldcachefilename);
-			return RET_ERROR_OOM;
-		}
-		if (isregularfile(newcachefilename)
-		    || rename(oldcachefilename, newcachefilename) != 0) {
-			fprintf(stderr,
-"Deleting old-style export cache file %s!\n"
-"This means that all index files (even unchanged) will be rewritten the\n"
-"next time parts of their distribution are changed. This should only\n"
-"happen once while migration from pre-3.1.0 to later versions.\n",
-					oldcachefilename);
+static inline void dump_record(FILE *f, const char *key, const char *value, size_t valuelen, const char *data, size_t datalen) {
+	size_t keylen = strlen(key);
 
-			if (unlink(oldcachefilename) != 0) {
-				int e = errno;
-				fprintf(stderr, "Cannot delete '%s': %s!",
-						oldcachefilename,
-						strerror(e));
-				free(oldcachefilename);
-				free(newcachefilename);
-				return RET_ERRNO(e);
-			}
-			(void)unlink(oldcachefilename);
+	if (value != NULL)
+		fprintf(f, "record %lu %lu\n", (unsigned long)keylen,
+				(unsigned long)(valuelen + 1 + datalen));
+	else
+		fprintf(f, "record %lu %lu\n", (unsigned long)keylen,
+				(unsigned long)datalen);
+	(void)fwrite(key, 1, keylen, f);
+	if (value != NULL)
+		(void)fwrite(value, 1, valuelen + 1, f);
+	(void)fwrite(data, 1, datalen, f);
+	(void)putc('\n', f);
+}
+
+static retvalue dump_table(FILE *f, const char *filename, const char *subtable, struct table *table, enum database_type type, unsigned long *count_p) {
+	struct cursor *cursor;
+	const char *key, *value, *data;
+	size_t datalen;
+	retvalue r;
+
+	r = table_newglobalcursor(table, &cursor);
+	if (!RET_IS_OK(r))
+		return r;
+	fprintf(f, "table %s %s\n", filename, subtable);
+	if (type == dbt_BTREEPAIRS) {
+		while (cursor_nextpair(table, cursor, &key, &value,
+					&data, &datalen)) {
+			dump_record(f, key, value, strlen(value),
+					data, datalen);
+			(*count_p)++;
+		}
+	} else {
+		while (cursor_nexttempdata(table, cursor, &key,
+					&data, &datalen)) {
+			dump_record(f, key, NULL, 0, data, datalen);
+			(*count_p)++;
 		}
-		free(newcachefilename);
 	}
-	free(oldcachefilename);
-
-	r = database_table("release.caches.db", codename,
-			 dbt_HASH, DB_CREATE, cachedb_p);
-	if (RET_IS_OK(r))
-		(*cachedb_p)->verbose = false;
-	return r;
+	return cursor_close(table, cursor);
 }
 
-static retvalue table_copy(struct table *oldtable, struct table *newtable) {
-	retvalue r;
-	struct cursor *cursor;
-	const char *filekey, *data;
-	size_t data_len;
+static retvalue dump_tables(FILE *f, const char *filename, enum database_type type, unsigned long *count_p) {
+	struct strlist subtables;
+	struct table *table;
+	retvalue result, r;
+	int i;
 
-	r = table_newglobalcursor(oldtable, &cursor);
+	r = database_listsubtables(filename, &subtables);
 	if (!RET_IS_OK(r))
 		return r;
-	while (cursor_nexttempdata(oldtable, cursor, &filekey,
-				&data, &data_len)) {
-		r = table_adduniqsizedrecord(newtable, filekey,
-				data, data_len+1, false, true);
-		if (RET_WAS_ERROR(r))
-			return r;
+	result = RET_NOTHING;
+	for (i = 0 ; i < subtables.count ; i++) {
+		const char *subtable = subtables.values[i];
+
+		if (strcmp(filename, "packages.db") == 0)
+			r = database_openpackages(subtable, true, &table);
+		else
+			r = database_table(filename, subtable, type,
+					DB_RDONLY, &table);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
+		r = dump_table(f, filename, subtable, table, type, count_p);
+		RET_UPDATE(result, r);
+		r = table_close(table);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(result))
+			break;
 	}
-	return RET_OK;
+	strlist_done(&subtables);
+	return result;
 }
 
-retvalue database_translate_filelists(void) {
-	char *dbname, *tmpdbname;
-	struct table *oldtable, *newtable;
-	struct strlist identifiers;
-	int ret;
-	retvalue r, r2;
+retvalue database_dump(const char *dumpfilename) {
+	const struct dumpedtable *d;
+	struct table *table;
+	unsigned long count = 0;
+	retvalue result, r;
+	FILE *f;
+	int e;
 
-	r = database_listsubtables("contents.cache.db", &identifiers);
-	if (RET_IS_OK(r)) {
-		if (!strlist_in(&identifiers, "filelists")) {
-			fprintf(stderr,
-"Your %s/contents.cache.db file does not contain an old style database!\n",
-					global.dbdir);
-			strlist_done(&identifiers);
-			return RET_NOTHING;
+	f = fopen(dumpfilename, "w");
+	if (f == NULL) {
+		e = errno;
+		fprintf(stderr, "Error %d creating '%s': %s\n",
+				e, dumpfilename, strerror(e));
+		return RET_ERRNO(e);
+	}
+	(void)fputs(dumpheader, f);
+	result = RET_NOTHING;
+	for (d = dumpedtables ; d->filename != NULL ; d++) {
+		r = database_table(d->filename, d->subtable, d->type,
+				DB_RDONLY, &table);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
 		}
-		strlist_done(&identifiers);
+		r = dump_table(f, d->filename, d->subtable, table, d->type,
+				&count);
+		RET_UPDATE(result, r);
+		r = table_close(table);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(result))
+			break;
 	}
-
-	dbname = dbfilename("contents.cache.db");
-	if (FAILEDTOALLOC(dbname))
-		return RET_ERROR_OOM;
-	tmpdbname = dbfilename("old.contents.cache.db");
-	if (FAILEDTOALLOC(tmpdbname)) {
-		free(dbname);
-		return RET_ERROR_OOM;
+	if (!RET_WAS_ERROR(result)) {
+		r = dump_tables(f, "packages.db", dbt_BTREE, &count);
+		RET_UPDATE(result, r);
 	}
-	ret = rename(dbname, tmpdbname);
-	if (ret != 0) {
-		int e = errno;
-		fprintf(stderr, "Could not rename '%s' into '%s': %s(%d)\n",
-				dbname, tmpdbname, strerror(e), e);
-		free(dbname);
-		free(tmpdbname);
-		return RET_ERRNO(e);
+	if (!RET_WAS_ERROR(result)) {
+		r = dump_tables(f, "tracking.db", dbt_BTREEPAIRS, &count);
+		RET_UPDATE(result, r);
 	}
-	newtable = NULL;
-	r = database_table("contents.cache.db", "compressedfilelists",
-			dbt_BTREE, DB_CREATE, &newtable);
-	assert (r != RET_NOTHING);
-	oldtable = NULL;
-	if (RET_IS_OK(r)) {
-		r = database_table("old.contents.cache.db", "filelists",
-				dbt_BTREE, DB_RDONLY, &oldtable);
-		if (r == RET_NOTHING) {
-			fprintf(stderr, "Could not find old-style database!\n");
-			r = RET_ERROR;
-		}
+	if (!RET_WAS_ERROR(result)) {
+		r = dump_tables(f, "release.caches.db", dbt_HASH, &count);
+		RET_UPDATE(result, r);
 	}
-	if (RET_IS_OK(r)) {
-		r = filelists_translate(oldtable, newtable);
-		if (r == RET_NOTHING)
-			r = RET_OK;
+	(void)fputs("end\n", f);
+	if (ferror(f) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d writing '%s': %s\n",
+				e, dumpfilename, strerror(e));
+		(void)fclose(f);
+		return RET_ERRNO(e);
 	}
-	r2 = table_close(oldtable);
-	RET_ENDUPDATE(r, r2);
-	oldtable = NULL;
-	if (RET_IS_OK(r)) {
-		/* copy the new-style database, */
-		r = database_table("old.contents.cache.db", "compressedfilelists",
-				dbt_BTREE, DB_RDONLY, &oldtable);
-		if (RET_IS_OK(r)) {
-			/* if there is one... */
-			r = table_copy(oldtable, newtable);
-			r2 = table_close(oldtable);
-			RET_ENDUPDATE(r, r2);
-		}
-		if (r == RET_NOTHING) {
-			r = RET_OK;
-		}
+	if (fclose(f) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d writing '%s': %s\n",
+				e, dumpfilename, strerror(e));
+		return RET_ERRNO(e);
 	}
-	r2 = table_close(newtable);
-	RET_ENDUPDATE(r, r2);
-	if (RET_IS_OK(r))
-		(void)unlink(tmpdbname);
+	if (RET_WAS_ERROR(result))
+		return result;
+	if (verbose > 0)
+		printf("Dumped %lu records into '%s'.\n", count, dumpfilename);
+	return RET_OK;
+}
 
-	if (RET_WAS_ERROR(r)) {
-		ret = rename(tmpdbname, dbname);
-		if (ret != 0) {
-			int e = errno;
+/* open a table to load a dump into, which must still be empty */
+static retvalue load_opentable(const char *filename, const char *subtable, /*@out@*/struct table **table_p, /*@out@*/enum database_type *type_p) {
+	const struct dumpedtable *d;
+	retvalue r;
+
+	if (strcmp(filename, "packages.db") == 0) {
+		*type_p = dbt_BTREE;
+		r = database_openpackages(subtable, false, table_p);
+	} else if (strcmp(filename, "tracking.db") == 0) {
+		*type_p = dbt_BTREEPAIRS;
+		r = database_opentracking(subtable, false, table_p);
+	} else if (strcmp(filename, "release.caches.db") == 0) {
+		*type_p = dbt_HASH;
+		r = database_table(filename, subtable, dbt_HASH, DB_CREATE,
+				table_p);
+	} else {
+		for (d = dumpedtables ; d->filename != NULL ; d++) {
+			if (strcmp(d->filename, filename) == 0 &&
+					strcmp(d->subtable, subtable) == 0)
+				break;
+		}
+		if (d->filename == NULL) {
 			fprintf(stderr,
-"Could not rename '%s' back into '%s': %s(%d)\n",
-					dbname, tmpdbname, strerror(e), e);
-			free(tmpdbname);
-			free(dbname);
-			return RET_ERRNO(e);
+"Unknown table '%s' of '%s' in the database dump!\n",
+					subtable, filename);
+			return RET_ERROR;
 		}
-		free(tmpdbname);
-		free(dbname);
+		*type_p = d->type;
+		r = database_table(filename, subtable, d->type, DB_CREATE,
+				table_p);
+	}
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
 		return r;
+	if (!table_isempty(*table_p)) {
+		fprintf(stderr,
+"Error: table '%s' of '%s' is not empty. A dump can only be loaded\n"
+"into a new database.\n", subtable, filename);
+		(void)table_close(*table_p);
+		return RET_ERROR;
 	}
-	free(tmpdbname);
-	free(dbname);
 	return RET_OK;
 }
 
-/* This is already implemented as standalone functions duplicating a bit
- * of database_create and from files.c,
- * because database_create is planed to error out if * there is still an old
- * files.db and files.c is supposed to lose all support for it in the next
- * major version */
-
-static inline retvalue translate(struct table *oldmd5sums, struct table *newchecksums) {
-	long numold = 0, numnew = 0, numreplace = 0, numretro = 0;
-	struct cursor *cursor, *newcursor;
-	const char *filekey, *md5sum, *all;
-	size_t alllen;
+static retvalue load_record(struct table *table, enum database_type type, bool packages, const char *key, const char *data, size_t datalen) {
+	char *version, *primarykey;
 	retvalue r;
 
-	/* first add all md5sums to checksums if not there yet */
-
-	r = table_newglobalcursor(oldmd5sums, &cursor);
+	if (type == dbt_BTREEDUP || type == dbt_BTREEPAIRS)
+		return table_addrecord(table, key, data, datalen, false);
+	if (!packages)
+		return table_adduniqsizedrecord(table, key, data, datalen + 1,
+				false, false);
+	r = chunk_getvalue(data, "Version", &version);
+	if (r == RET_NOTHING) {
+		fprintf(stderr,
+"Package '%s' in the database dump has no Version!\n", key);
+		r = RET_ERROR;
+	}
 	if (RET_WAS_ERROR(r))
 		return r;
-	while (cursor_nexttempdata(oldmd5sums, cursor,
-				&filekey, &md5sum, NULL)) {
-		struct checksums *n = NULL;
-		const char *combined;
-		size_t combinedlen;
+	primarykey = package_primarykey(key, version);
+	free(version);
+	if (FAILEDTOALLOC(primarykey))
+		return RET_ERROR_OOM;
+	r = table_adduniqsizedrecord(table, primarykey, data, datalen + 1,
+			false, false);
+	free(primarykey);
+	return r;
+}
 
-		r = table_gettemprecord(newchecksums, filekey,
-				&all, &alllen);
-		if (RET_IS_OK(r))
-			r = checksums_setall(&n, all, alllen);
-		if (RET_IS_OK(r)) {
-			if (checksums_matches(n, cs_md5sum, md5sum)) {
-				/* already there, nothing to do */
-				checksums_free(n);
-				numnew++;
-				continue;
+retvalue database_load(const char *dumpfilename) {
+	struct table *table = NULL;
+	enum database_type type = dbt_QUERY;
+	bool packages = false;
+	char buffer[1024], *key = NULL, *data = NULL;
+	unsigned long keylen, datalen, count = 0, tables = 0;
+	retvalue result, r;
+	FILE *f;
+
+	f = fopen(dumpfilename, "r");
+	if (f == NULL) {
+		int e = errno;
+		fprintf(stderr, "Error %d opening '%s': %s\n",
+				e, dumpfilename, strerror(e));
+		return RET_ERRNO(e);
+	}
+	if (fgets(buffer, sizeof(buffer), f) == NULL ||
+			strcmp(buffer, dumpheader) != 0) {
+		fprintf(stderr, "'%s' is not a reprepro database dump!\n",
+				dumpfilename);
+		(void)fclose(f);
+		return RET_ERROR;
+	}
+	/* stays RET_NOTHING if something unexpected is found */
+	result = RET_NOTHING;
+	while (fgets(buffer, sizeof(buffer), f) != NULL) {
+		size_t l = strlen(buffer);
+		char *filename, *subtable;
+
+		if (l == 0 || buffer[l-1] != '\n')
+			break;
+		buffer[--l] = '\0';
+		if (strcmp(buffer, "end") == 0) {
+			result = RET_OK;
+			break;
+		}
+		if (strncmp(buffer, "table ", 6) == 0) {
+			if (table != NULL) {
+				r = table_close(table);
+				table = NULL;
+				if (RET_WAS_ERROR(r))
+					break;
 			}
-			/* new item does not match */
-			if (verbose > 0)
-				printf(
-"Overwriting stale new-checksums entry '%s'!\n",
-						filekey);
-			numreplace++;
-			checksums_free(n);
-			n = NULL;
+			filename = buffer + 6;
+			subtable = strchr(filename, ' ');
+			if (subtable == NULL)
+				break;
+			*(subtable++) = '\0';
+			r = load_opentable(filename, subtable, &table, &type);
+			if (RET_WAS_ERROR(r)) {
+				table = NULL;
+				result = r;
+				break;
+			}
+			packages = strcmp(filename, "packages.db") == 0;
+			tables++;
+			continue;
 		}
-		if (RET_WAS_ERROR(r)) {
-			(void)cursor_close(oldmd5sums, cursor);
-			return r;
+		if (table == NULL || sscanf(buffer, "record %lu %lu",
+					&keylen, &datalen) != 2)
+			break;
+		key = malloc(keylen + 1);
+		data = malloc(datalen + 1);
+		if (FAILEDTOALLOC(key) || FAILEDTOALLOC(data)) {
+			result = RET_ERROR_OOM;
+			break;
 		}
-		/* parse and recreate, to only have sanitized strings
-		 * in the database */
-		r = checksums_parse(&n, md5sum);
-		assert (r != RET_NOTHING);
+		if (fread(key, 1, keylen, f) != keylen ||
+				fread(data, 1, datalen, f) != datalen ||
+				getc(f) != '\n')
+			break;
+		key[keylen] = '\0';
+		data[datalen] = '\0';
+		if (strlen(key) != keylen) {
+			fprintf(stderr,
+"Malformed key in database dump '%s'!\n", dumpfilename);
+			break;
+		}
+		r = load_record(table, type, packages, key, data, datalen);
 		if (RET_WAS_ERROR(r)) {
-			(void)cursor_close(oldmd5sums, cursor);
-			return r;
+			result = r;
+			break;
+		}
+		free(key);
+		key = NULL;
+		free(data);
+		data = NULL;
+		count++;
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			break;
 		}
+	}
+	free(key);
+	free(data);
+	if (result == RET_NOTHING) {
+		fprintf(stderr, "Unexpected data in database dump '%s'!\n",
+				dumpfilename);
+		result = RET_ERROR;
+	}
+	if (table != NULL) {
+		r = table_close(table);
+		RET_UPDATE(result, r);
+	}
+	(void)fclose(f);
+	if (RET_IS_OK(result) && verbose > 0)
+		printf("Loaded %lu records into %lu tables.\n", count, tables);
+	return result;
+}
 
-		r = checksums_getcombined(n, &combined, &combinedlen);
-		assert (r != RET_NOTHING);
-		if (!RET_IS_OK(r)) {
-			(void)cursor_close(oldmd5sums, cursor);
-			return r;
+/****************************************************************************
+ * Compacting the database files                                            *
+ ****************************************************************************/
+
+static const struct compactedfile {
+	const char *filename;
+	enum database_type type;
+} compactedfiles[] = {
+	{"packages.db", dbt_BTREE},
+	{"packagenames.db", dbt_BTREEVERSIONS},
+	{"references.db", dbt_BTREEDUP},
+	{"referencedby.db", dbt_BTREEDUP},
+	{"referees.db", dbt_BTREE},
+	{"checksums.db", dbt_BTREE},
+	{"contents.cache.db", dbt_BTREE},
+	{"descriptions.db", dbt_BTREE},
+	{"tracking.db", dbt_BTREEPAIRS},
+	{"release.caches.db", dbt_HASH},
+	{"dictionaries.db", dbt_BTREE},
+	{"packageindex.db", dbt_BTREEDUP},
+	{NULL, dbt_QUERY}
+};
+
+static long long compact_filesize(const char *filename) {
+	struct stat s;
+	char *fullfilename;
+	int i;
+
+	fullfilename = dbfilename(filename);
+	if (FAILEDTOALLOC(fullfilename))
+		return -1;
+	i = stat(fullfilename, &s);
+	free(fullfilename);
+	if (i != 0)
+		return -1;
+	return s.st_size;
+}
+
+/* read every record of every table of a file (to see how long that takes) */
+static retvalue compact_scan(const char *filename, enum database_type type, unsigned long *count_p, long long *usecs_p) {
+	struct strlist subtables;
+	struct table *table;
+	struct cursor *cursor;
+	const char *key, *value, *data;
+	size_t datalen;
+	struct timespec start, end;
+	retvalue result, r;
+	int i;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	r = database_listsubtables(filename, &subtables);
+	if (!RET_IS_OK(r))
+		return r;
+	result = RET_NOTHING;
+	for (i = 0 ; i < subtables.count ; i++) {
+		r = database_table(filename, subtables.values[i], type,
+				DB_RDONLY, &table);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
 		}
-		numold++;
-		r = table_adduniqsizedrecord(newchecksums, filekey,
-				combined, combinedlen + 1, true, false);
-		assert (r != RET_NOTHING);
-		if (!RET_IS_OK(r)) {
-			(void)cursor_close(oldmd5sums, cursor);
-			return r;
+		r = table_newglobalcursor(table, &cursor);
+		if (RET_IS_OK(r)) {
+			if (type == dbt_BTREEPAIRS) {
+				while (cursor_nextpair(table, cursor, &key,
+						&value, &data, &datalen))
+					(*count_p)++;
+			} else {
+				while (cursor_nexttempdata(table, cursor,
+						&key, &data, &datalen))
+					(*count_p)++;
+			}
+			r = cursor_close(table, cursor);
 		}
+		RET_UPDATE(result, r);
+		r = table_close(table);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(result))
+			break;
 	}
-	r = cursor_close(oldmd5sums, cursor);
-	if (RET_WAS_ERROR(r))
-		return r;
+	strlist_done(&subtables);
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+	*usecs_p += (long long)(end.tv_sec - start.tv_sec) * 1000000
+		+ (end.tv_nsec - start.tv_nsec) / 1000;
+	return result;
+}
 
-	/* then delete everything from checksums that is not in md5sums */
+static void compact_report(const char *name, long long sizebefore, long long sizeafter, unsigned long count, long long usecsbefore, long long usecsafter) {
+	printf(
+"%s: %lld -> %lld bytes, reading %lu records took %lld.%03lld -> %lld.%03lld seconds\n",
+			name, sizebefore, sizeafter, count,
+			usecsbefore / 1000000, (usecsbefore / 1000) % 1000,
+			usecsafter / 1000000, (usecsafter / 1000) % 1000);
+}
 
-	r = table_newglobalcursor(oldmd5sums, &cursor);
-	if (RET_WAS_ERROR(r))
+#ifndef HAVE_LMDB
+/* copy a table in key order into a new file, so every page
+ * but the last is filled completely */
+static retvalue compact_copytable(const char *filename, const char *newfilename, const char *subtable, enum database_type type, uint32_t pagesize) {
+	DB *from, *to;
+	DBC *cursor;
+	DBT key, data;
+	int dbret;
+	retvalue r;
+
+	r = database_opentable(filename, subtable, type, DB_RDONLY, &from);
+	if (!RET_IS_OK(r))
 		return r;
-	r = table_newglobalcursor(newchecksums, &newcursor);
+	r = database_opentable_paged(newfilename, subtable, type, DB_CREATE,
+			pagesize, &to);
+	assert (r != RET_NOTHING);
 	if (RET_WAS_ERROR(r)) {
-		cursor_close(oldmd5sums, cursor);
+		(void)from->close(from, 0);
 		return r;
 	}
-	while (cursor_nexttempdata(oldmd5sums, cursor,
-				&filekey, &md5sum, NULL)) {
-		bool more;
-		int cmp;
-		const char *newfilekey, *dummy;
-
-		do {
-			more = cursor_nexttempdata(newchecksums, newcursor,
-				&newfilekey, &dummy, NULL);
-			/* should have been added in the last step */
-			assert (more);
-			cmp = strcmp(filekey, newfilekey);
-			/* should have been added in the last step */
-			assert (cmp >= 0);
-			more = cmp > 0;
-			if (more) {
-				numretro++;
-				if (verbose > 0)
-					printf(
-"Deleting stale new-checksums entry '%s'!\n",
-						newfilekey);
-				r = cursor_delete(newchecksums, newcursor,
-						newfilekey, dummy);
-				if (RET_WAS_ERROR(r)) {
-					cursor_close(oldmd5sums, cursor);
-					cursor_close(newchecksums, newcursor);
-					return r;
-				}
-			}
-		} while (more);
+	cursor = NULL;
+	if ((dbret = from->cursor(from, NULL, &cursor, 0)) != 0) {
+		from->err(from, dbret, "cursor(%s:%s):", filename, subtable);
+		(void)to->close(to, 0);
+		(void)from->close(from, 0);
+		return RET_DBERR(dbret);
 	}
-	r = cursor_close(oldmd5sums, cursor);
-	if (RET_WAS_ERROR(r))
-		return r;
-	r = cursor_close(newchecksums, newcursor);
-	if (RET_WAS_ERROR(r))
-		return r;
-	if (verbose >= 0) {
-		printf("%ld packages were already in the new checksums.db\n",
-				numnew);
-		printf("%ld packages were added to the new checksums.db\n",
-				numold - numreplace);
-		if (numretro != 0)
-			printf(
-"%ld were only in checksums.db and not in files.db\n"
-"This should only have happened if you added them with a newer version\n"
-"and then deleted them with an older version of reprepro.\n",
-				numretro);
-		if (numreplace != 0)
-			printf(
-"%ld were different checksums.db and not in files.db\n"
-"This should only have happened if you added them with a newer version\n"
-"and then deleted them with an older version of reprepro and\n"
-"then readded them with a old version.\n",
-				numreplace);
-		if (numretro != 0 || numreplace != 0)
-			printf(
-"If you never run a old version after a new version,\n"
-"you might want to check with check and checkpool if something went wrong.\n");
+	CLEARDBT(key);
+	CLEARDBT(data);
+	while ((dbret=cursor->c_get(cursor, &key, &data, DB_NEXT)) == 0) {
+		dbret = to->put(to, NULL, &key, &data, 0);
+		if (dbret != 0) {
+			to->err(to, dbret, "put(%s:%s):",
+					newfilename, subtable);
+			break;
+		}
+		CLEARDBT(key);
+		CLEARDBT(data);
+		if (interrupted()) {
+			(void)cursor->c_close(cursor);
+			(void)to->close(to, 0);
+			(void)from->close(from, 0);
+			return RET_ERROR_INTERRUPTED;
+		}
+	}
+	if (dbret != 0 && dbret != DB_NOTFOUND) {
+		from->err(from, dbret, "c_get(%s:%s):", filename, subtable);
+		(void)cursor->c_close(cursor);
+		(void)to->close(to, 0);
+		(void)from->close(from, 0);
+		return RET_DBERR(dbret);
+	}
+	(void)cursor->c_close(cursor);
+	(void)from->close(from, 0);
+	dbret = to->close(to, 0);
+	if (dbret != 0) {
+		fprintf(stderr, "db_close(%s:%s): %s\n",
+				newfilename, subtable, db_strerror(dbret));
+		return RET_DBERR(dbret);
 	}
 	return RET_OK;
 }
 
-retvalue database_translate_legacy_checksums(bool verbosedb) {
-	struct table *newchecksums, *oldmd5sums;
-	char *fullfilename;
+/* write all tables into a new file and replace the old with it */
+static retvalue compact_rebuild(const char *filename, enum database_type type, uint32_t pagesize) {
+	struct strlist subtables;
+	char *newfilename, *fullfilename, *fullnewfilename;
 	retvalue r;
-	int e;
+	int i, e;
 
-	if (rdb_initialized || rdb_used) {
-		fputs("Internal Error: database initialized a 2nd time!\n",
-				stderr);
-		return RET_ERROR_INTERNAL;
+	r = database_listsubtables(filename, &subtables);
+	if (!RET_IS_OK(r))
+		return r;
+	newfilename = calc_addsuffix(filename, "new");
+	if (FAILEDTOALLOC(newfilename)) {
+		strlist_done(&subtables);
+		return RET_ERROR_OOM;
 	}
-
-	if (!isdir(global.dbdir)) {
-		fprintf(stderr, "Cannot find directory '%s'!\n",
-				global.dbdir);
-		return RET_ERROR;
+	fullfilename = dbfilename(filename);
+	fullnewfilename = dbfilename(newfilename);
+	if (FAILEDTOALLOC(fullfilename) || FAILEDTOALLOC(fullnewfilename)) {
+		free(fullnewfilename);
+		free(fullfilename);
+		free(newfilename);
+		strlist_done(&subtables);
+		return RET_ERROR_OOM;
 	}
-
-	rdb_initialized = true;
-	rdb_used = true;
-
-	r = database_lock(0);
-	assert (r != RET_NOTHING);
-	if (!RET_IS_OK(r)) {
-		database_free();
-		return r;
+	/* a leftover from an interrupted earlier run */
+	(void)unlink(fullnewfilename);
+	for (i = 0 ; i < subtables.count ; i++) {
+		r = compact_copytable(filename, newfilename,
+				subtables.values[i], type, pagesize);
+		if (RET_WAS_ERROR(r))
+			break;
 	}
-	rdb_readonly = READWRITE;
-	rdb_verbose = verbosedb;
-
-	r = readversionfile(false);
+	strlist_done(&subtables);
+	free(newfilename);
 	if (RET_WAS_ERROR(r)) {
-		releaselock();
-		database_free();
+		(void)unlink(fullnewfilename);
+		free(fullnewfilename);
+		free(fullfilename);
 		return r;
 	}
-
-	r = database_table("files.db", "md5sums", dbt_BTREE, 0, &oldmd5sums);
-	if (r == RET_NOTHING) {
-		fprintf(stderr,
-"There is no old files.db in %s. Nothing to translate!\n",
-				global.dbdir);
-		releaselock();
-		database_free();
-		return RET_NOTHING;
-	} else if (RET_WAS_ERROR(r)) {
-		releaselock();
-		database_free();
-		return r;
+	if (rename(fullnewfilename, fullfilename) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d moving '%s' to '%s': %s\n",
+				e, fullnewfilename, fullfilename, strerror(e));
+		(void)unlink(fullnewfilename);
+		free(fullnewfilename);
+		free(fullfilename);
+		return RET_ERRNO(e);
 	}
+	free(fullnewfilename);
+	free(fullfilename);
+	return RET_OK;
+}
 
-	r = database_table("checksums.db", "pool", dbt_BTREE, DB_CREATE,
-			&newchecksums);
-	assert (r != RET_NOTHING);
-	if (RET_WAS_ERROR(r)) {
-		(void)table_close(oldmd5sums);
-		releaselock();
-		database_free();
+#if DB_VERSION_MAJOR > 4 || (DB_VERSION_MAJOR == 4 && DB_VERSION_MINOR >= 4)
+#define HAVE_DB_COMPACT 1
+/* let libdb merge sparsely filled pages and give free ones back
+ * to the filesystem, without needing space for a second copy */
+static retvalue compact_inplace(const char *filename, enum database_type type, int fillpercent) {
+	struct strlist subtables;
+	DB_COMPACT c_data;
+	DB *table;
+	int dbret, i;
+	retvalue result, r;
+
+	r = database_listsubtables(filename, &subtables);
+	if (!RET_IS_OK(r))
 		return r;
+	result = RET_NOTHING;
+	for (i = 0 ; i < subtables.count ; i++) {
+		const char *subtable = subtables.values[i];
+
+		r = database_opentable(filename, subtable, type, 0, &table);
+		if (!RET_IS_OK(r)) {
+			RET_UPDATE(result, r);
+			if (RET_WAS_ERROR(r))
+				break;
+			continue;
+		}
+		memset(&c_data, 0, sizeof(c_data));
+		c_data.compact_fillpercent = fillpercent;
+		dbret = table->compact(table, NULL, NULL, NULL, &c_data,
+				DB_FREE_SPACE, NULL);
+		if (dbret != 0) {
+			table->err(table, dbret, "compact(%s:%s):",
+					filename, subtable);
+			(void)table->close(table, 0);
+			result = RET_DBERR(dbret);
+			break;
+		}
+		dbret = table->close(table, 0);
+		if (dbret != 0) {
+			fprintf(stderr, "db_close(%s:%s): %s\n",
+					filename, subtable, db_strerror(dbret));
+			result = RET_DBERR(dbret);
+			break;
+		}
+		result = RET_OK;
 	}
+	strlist_done(&subtables);
+	return result;
+}
+#endif
 
-	r = translate(oldmd5sums, newchecksums);
-	if (RET_WAS_ERROR(r)) {
-		(void)table_close(oldmd5sums);
-		(void)table_close(newchecksums);
-		releaselock();
-		database_free();
+retvalue database_compact(unsigned long pagesize, int fillpercent) {
+	const struct compactedfile *c;
+	retvalue result, r;
+
+	r = packageindex_close();
+	if (RET_WAS_ERROR(r))
 		return r;
+	result = RET_NOTHING;
+	for (c = compactedfiles ; c->filename != NULL ; c++) {
+		long long sizebefore, sizeafter;
+		long long usecsbefore = 0, usecsafter = 0;
+		unsigned long countbefore = 0, countafter = 0;
+
+		sizebefore = compact_filesize(c->filename);
+		if (sizebefore < 0)
+			continue;
+		r = compact_scan(c->filename, c->type,
+				&countbefore, &usecsbefore);
+		if (RET_WAS_ERROR(r))
+			return r;
+#ifdef HAVE_DB_COMPACT
+		/* libdb cannot compact hash tables in place */
+		if (fillpercent > 0 && c->type != dbt_HASH)
+			r = compact_inplace(c->filename, c->type,
+					fillpercent);
+		else
+#endif
+			r = compact_rebuild(c->filename, c->type, pagesize);
+		if (RET_WAS_ERROR(r))
+			return r;
+		r = compact_scan(c->filename, c->type,
+				&countafter, &usecsafter);
+		if (RET_WAS_ERROR(r))
+			return r;
+		if (countafter != countbefore) {
+			fprintf(stderr,
+"Internal Error: %s has %lu records after compacting, but had %lu before!\n",
+					c->filename, countafter, countbefore);
+			return RET_ERROR_INTERNAL;
+		}
+		sizeafter = compact_filesize(c->filename);
+		if (verbose >= 0)
+			compact_report(c->filename, sizebefore, sizeafter,
+					countafter, usecsbefore, usecsafter);
+		result = RET_OK;
 	}
+	return result;
+}
+#else
+/* lmdb can only compact by copying the whole environment, which always
+ * writes the records in key order and fills all pages */
+retvalue database_compact(unsigned long pagesize, int fillpercent) {
+	const struct compactedfile *c;
+	long long sizebefore, sizeafter;
+	long long usecsbefore = 0, usecsafter = 0;
+	unsigned long countbefore = 0, countafter = 0;
+	char *tempdir, *tempfilename, *fullfilename;
+	retvalue r;
+	int dbret, e;
 
-	(void)table_close(oldmd5sums);
-	r = table_close(newchecksums);
-	if (RET_WAS_ERROR(r)) {
-		releaselock();
-		database_free();
+	if (pagesize != 0 || fillpercent > 0)
+		fputs(
+"Warning: pagesize= and fill= have no effect with lmdb, which uses the\n"
+"system's page size and always fills pages when compacting.\n", stderr);
+	r = packageindex_close();
+	if (RET_WAS_ERROR(r))
 		return r;
+	sizebefore = compact_filesize("data.mdb");
+	if (sizebefore < 0)
+		return RET_NOTHING;
+	for (c = compactedfiles ; c->filename != NULL ; c++) {
+		r = compact_scan(c->filename, c->type,
+				&countbefore, &usecsbefore);
+		if (RET_WAS_ERROR(r))
+			return r;
 	}
-	fullfilename = dbfilename("files.db");
-	if (FAILEDTOALLOC(fullfilename)) {
-		releaselock();
-		database_free();
+	r = lmdb_begin();
+	if (!RET_IS_OK(r))
+		return r;
+	/* mdb_env_copy2 needs its own read transaction */
+	r = lmdb_commit(false);
+	if (RET_WAS_ERROR(r))
+		return r;
+
+	tempdir = dbfilename("compact.tmp");
+	if (FAILEDTOALLOC(tempdir))
+		return RET_ERROR_OOM;
+	tempfilename = calc_dirconcat(tempdir, "data.mdb");
+	fullfilename = dbfilename("data.mdb");
+	if (FAILEDTOALLOC(tempfilename) || FAILEDTOALLOC(fullfilename)) {
+		free(fullfilename);
+		free(tempfilename);
+		free(tempdir);
 		return RET_ERROR_OOM;
 	}
-	e = deletefile(fullfilename);
-	if (e != 0) {
-		fprintf(stderr, "Could not delete '%s'!\n"
-"It can now safely be deleted and it all that is left to be done!\n",
-				fullfilename);
-		database_free();
+	/* a leftover from an interrupted earlier run */
+	(void)unlink(tempfilename);
+	if (mkdir(tempdir, 0755) != 0 && errno != EEXIST) {
+		e = errno;
+		fprintf(stderr, "Error %d creating directory '%s': %s\n",
+				e, tempdir, strerror(e));
+		free(fullfilename);
+		free(tempfilename);
+		free(tempdir);
 		return RET_ERRNO(e);
 	}
-	r = writeversionfile();
-	releaselock();
-	database_free();
-	return r;
+	dbret = mdb_env_copy2(rdb_env, tempdir, MDB_CP_COMPACT);
+	if (dbret != 0) {
+		fprintf(stderr, "mdb_env_copy2(%s): %s\n",
+				tempdir, mdb_strerror(dbret));
+		(void)unlink(tempfilename);
+		(void)rmdir(tempdir);
+		free(fullfilename);
+		free(tempfilename);
+		free(tempdir);
+		return RET_DBERR(dbret);
+	}
+	/* reopened for the next access */
+	mdb_env_close(rdb_env);
+	rdb_env = NULL;
+	if (rename(tempfilename, fullfilename) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d moving '%s' to '%s': %s\n",
+				e, tempfilename, fullfilename, strerror(e));
+		(void)unlink(tempfilename);
+		(void)rmdir(tempdir);
+		free(fullfilename);
+		free(tempfilename);
+		free(tempdir);
+		return RET_ERRNO(e);
+	}
+	(void)rmdir(tempdir);
+	free(fullfilename);
+	free(tempfilename);
+	free(tempdir);
+
+	for (c = compactedfiles ; c->filename != NULL ; c++) {
+		r = compact_scan(c->filename, c->type,
+				&countafter, &usecsafter);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	if (countafter != countbefore) {
+		fprintf(stderr,
+"Internal Error: data.mdb has %lu records after compacting, but had %lu before!\n",
+				countafter, countbefore);
+		return RET_ERROR_INTERNAL;
+	}
+	sizeafter = compact_filesize("data.mdb");
+	if (verbose >= 0)
+		compact_report("data.mdb", sizebefore, sizeafter, countafter,
+				usecsbefore, usecsafter);
+	return RET_OK;
 }
+#endif
 
 bool database_allcreated(void) {
 	return rdb_capabilities.createnewtables;
@@ -17,19 +17,34 @@ struct cursor;
 
 retvalue database_create(struct distribution *, bool fast, bool /*nopackages*/, bool /*allowunused*/, bool /*readonly*/, size_t /*waitforlock*/, bool /*verbosedb*/);
 retvalue database_close(void);
+/* close and unlock till needed again (only for long running commands) */
+retvalue database_release(void);
+retvalue database_reacquire(void);
 
 retvalue database_openfiles(void);
 retvalue database_openreferences(void);
 retvalue database_listpackages(/*@out@*/struct strlist *);
 retvalue database_droppackages(const char *);
+/* packageindex.db knows in which packages tables packages of some name are,
+ * database_haspackageindex returns RET_NOTHING if it is not usable (yet): */
+retvalue database_haspackageindex(void);
+typedef retvalue packageindex_action(void *, const char * /*identifier*/, const char * /*version*/);
+retvalue database_findpackages(const char * /*name*/, packageindex_action *, void *);
 retvalue database_openpackages(const char *, bool /*readonly*/, /*@out@*/struct table **);
 retvalue database_openreleasecache(const char *, /*@out@*/struct table **);
 retvalue database_opentracking(const char *, bool /*readonly*/, /*@out@*/struct table **);
 retvalue database_translate_filelists(void);
 retvalue database_translate_legacy_checksums(bool /*verbosedb*/);
+retvalue database_dump(const char *);
+retvalue database_load(const char *);
+retvalue database_compact(unsigned long /*pagesize*/, int /*fillpercent*/);
+retvalue database_compresschunks(const char *, bool /*compress*/);
 bool database_allcreated(void);
 
 retvalue table_close(/*@only@*/struct table *);
+retvalue table_sync(struct table *);
+typedef retvalue table_record_action(void *, const char * /*data*/, size_t /*len*/);
+retvalue table_copyrecords(struct table *, struct table *, /*@null@*/table_record_action *, void *);
 
 retvalue database_haspackages(const char *);
 
@@ -6,9 +6,12 @@
 #endif
 
 extern /*@null@*/ struct table *rdb_checksums, *rdb_contents;
-extern /*@null@*/ struct table *rdb_references;
+extern /*@null@*/ struct table *rdb_references, *rdb_referees;
+extern /*@null@*/ struct table *rdb_descriptions;
 
 retvalue database_listsubtables(const char *, /*@out@*/struct strlist *);
 retvalue database_dropsubtable(const char *, const char *);
+retvalue database_opendescriptions(void);
+retvalue database_cleardescriptions(void);
 
 #endif
@@ -25,8 +25,10 @@
 #include "strlist.h"
 #include "chunks.h"
 #include "files.h"
+#include "database_p.h"
 #include "debfile.h"
 #include "binaries.h"
+#include "package.h"
 #include "descriptions.h"
 #include "md5.h"
 
@@ -95,9 +97,174 @@ static void description_genmd5(const char *description, /*@out@*/ char *d, size_
 	*d = '\0';
 }
 
+/* Long descriptions seen are remembered in descriptions.db by their md5,
+ * so they need not be extracted from the .deb files again.
+ * As everything in there can be read from the .deb files again,
+ * there is no reference counting but it is emptied again when it has
+ * grown to MAXCACHEDDESCRIPTIONS entries. (Its number of entries is stored
+ * under a key that cannot be a md5sum).
+ * Failing to use it is only a warning, as nothing depends on it. */
+
+#define MAXCACHEDDESCRIPTIONS 250000
+static const char countkey[] = "!count";
+
+static retvalue description_count(void) {
+	char *data, buffer[30];
+	unsigned long count;
+	retvalue r;
+
+	r = table_getrecord(rdb_descriptions, false, countkey, &data, NULL);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (RET_IS_OK(r)) {
+		count = strtoul(data, NULL, 10);
+		free(data);
+	} else
+		count = 0;
+	count++;
+	if (count >= MAXCACHEDDESCRIPTIONS) {
+		if (verbose > 1)
+			printf(
+"descriptions.db has grown to %lu entries, emptying it.\n", count);
+		return database_cleardescriptions();
+	}
+	snprintf(buffer, sizeof(buffer), "%lu", count);
+	return table_adduniqsizedrecord(rdb_descriptions, countkey,
+			buffer, strlen(buffer) + 1, true, false);
+}
+
+static void description_remember(const char *description) {
+	char md5[2 * MD5_DIGEST_SIZE + 1];
+	retvalue r;
+
+	r = database_opendescriptions();
+	if (RET_IS_OK(r)) {
+		description_genmd5(description, md5, sizeof(md5));
+		r = table_adduniqsizedrecord(rdb_descriptions, md5,
+				description, strlen(description) + 1,
+				false, true);
+		if (RET_IS_OK(r))
+			r = description_count();
+	}
+	if (RET_WAS_ERROR(r))
+		fprintf(stderr,
+"Warning: could not store long description in descriptions.db, ignoring that.\n");
+}
+
+static retvalue description_lookup(const char *description_md5, /*@out@*/char **description_p) {
+	retvalue r;
+
+	r = database_opendescriptions();
+	if (RET_IS_OK(r))
+		r = table_getrecord(rdb_descriptions, false, description_md5,
+				description_p, NULL);
+	if (RET_WAS_ERROR(r)) {
+		fprintf(stderr,
+"Warning: could not look into descriptions.db, ignoring that.\n");
+		r = RET_NOTHING;
+	}
+	return r;
+}
+
+/* repairdescriptions needs to read the control chunk of every .deb file
+ * whose long description is neither in the package's control chunk
+ * nor in descriptions.db. Extract all of those of a target at once
+ * (using multiple processes) and remember their descriptions, so that
+ * description_addpackage finds them in descriptions.db afterwards. */
+
+static retvalue description_needsdeb(const char *control, struct strlist *filekeys) {
+	char *description, *description_md5;
+	struct strlist files;
+	bool found;
+	retvalue r;
+
+	r = chunk_getwholedata(control, "Description", &description);
+	if (!RET_IS_OK(r))
+		return r;
+	found = strchr(description, '\n') != NULL;
+	free(description);
+	if (found)
+		return RET_NOTHING;
+	r = chunk_getwholedata(control, "Description-md5", &description_md5);
+	if (!RET_IS_OK(r))
+		return r;
+	r = database_opendescriptions();
+	if (RET_IS_OK(r))
+		found = table_recordexists(rdb_descriptions, description_md5);
+	else
+		/* no need to extract anything that cannot be remembered */
+		found = true;
+	free(description_md5);
+	if (found)
+		return RET_NOTHING;
+	r = binaries_getfilekeys(control, &files);
+	if (!RET_IS_OK(r))
+		return r;
+	if (files.count != 1) {
+		/* left to description_addpackage to complain */
+		strlist_done(&files);
+		return RET_NOTHING;
+	}
+	r = strlist_add(filekeys, files.values[0]);
+	files.values[0] = NULL;
+	strlist_done(&files);
+	return r;
+}
+
+static retvalue description_extracted(UNUSED(void *privdata), UNUSED(const char *filekey), retvalue r, const char *control, UNUSED(size_t len)) {
+	char *description;
+
+	/* errors are reported again when description_addpackage
+	 * retries to extract it, so only remember what was found */
+	if (!RET_IS_OK(r))
+		return RET_NOTHING;
+	r = chunk_getwholedata(control, "Description", &description);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (RET_IS_OK(r)) {
+		if (strchr(description, '\n') != NULL)
+			description_remember(description);
+		free(description);
+	}
+	return RET_NOTHING;
+}
+
+retvalue description_prefetch(struct target *target) {
+	struct package_cursor iterator;
+	struct strlist filekeys;
+	retvalue result, r;
+
+	if (target->packagetype == pt_dsc)
+		return RET_NOTHING;
+
+	r = package_openiterator(target, READONLY, &iterator);
+	if (!RET_IS_OK(r))
+		return r;
+	strlist_init(&filekeys);
+	result = RET_NOTHING;
+	while (package_next(&iterator)) {
+		r = description_needsdeb(iterator.current.control, &filekeys);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
+	}
+	r = package_closeiterator(&iterator);
+	RET_ENDUPDATE(result, r);
+	if (!RET_WAS_ERROR(result) && filekeys.count > 0) {
+		if (verbose > 2)
+			printf(
+"Extracting the control data of %d files for '%s'...\n",
+					filekeys.count, target->identifier);
+		result = files_extractbatch(&filekeys, false,
+				description_extracted, NULL);
+	}
+	strlist_done(&filekeys);
+	return result;
+}
+
 /* Currently only normalizing towards a full Description is supported,
- * the cached description is not yet used, long descriptions are not stored elsewhere
- * and thus also no reference counting is done. */
+ * the cached description is not yet used. */
 
 retvalue description_addpackage(struct target *target, const char *package, const char *control, const char *oldcontrol, struct description *cached, char **control_p) {
 	char *description, *description_md5, *deb_description, *newcontrol;
@@ -119,7 +286,9 @@ retvalue description_addpackage(struct target *target, const char *package, cons
 		return RET_NOTHING;
 	}
 	if (strchr(description, '\n') != NULL) {
-		/* there already is a long description, nothing to do */
+		/* there already is a long description, nothing to do
+		 * but to remember it for packages only having the md5 */
+		description_remember(description);
 		free(description);
 		return RET_NOTHING;
 	}
@@ -136,7 +305,13 @@ retvalue description_addpackage(struct target *target, const char *package, cons
 		free(description);
 		return RET_NOTHING;
 	}
-	r = description_from_package(control, &deb_description);
+	r = description_lookup(description_md5, &deb_description);
+	if (RET_IS_OK(r)) {
+		/* stored by its md5, so no need to check that again */
+		free(description_md5);
+		description_md5 = NULL;
+	} else
+		r = description_from_package(control, &deb_description);
 	assert (r != RET_NOTHING);
 	if (RET_WAS_ERROR(r)) {
 		fprintf(stderr, "Cannot retrieve long description for package '%s' out of package's files!\n",
@@ -187,6 +362,7 @@ retvalue description_addpackage(struct target *target, const char *package, cons
 			//}
 		}
 		free(description_md5);
+		description_remember(deb_description);
 	}
 
 	todo = deletefield_new("Description-md5", NULL);
@@ -18,4 +18,8 @@ retvalue description_preparepackage(struct target*, const char */*package*/, con
  */
 
 retvalue description_addpackage(struct target*, const char */*package*/, const char */*control*/,/*@null@*/const char */*oldcontrol*/, /*@null@*/struct description*, /*@out@*/char **/*newcontrol_p*/);
+
+/* extract (in parallel) and remember the long descriptions of all packages
+ * of the target description_addpackage would need to read from the .deb */
+retvalue description_prefetch(struct target *);
 #endif
@@ -8,8 +8,6 @@ struct diffindex {
 		struct checksums *frompackages;
 		char *name;
 		struct checksums *checksums;
-		/* safe-guard against cycles */
-		bool done;
 	} patches[];
 };
 
@@ -785,7 +785,8 @@ retvalue distribution_snapshot(struct distribution *distribution, const char *na
 
 	assert (distribution != NULL);
 
-	r = release_initsnapshot(distribution->codename, name, &release);
+	r = release_initsnapshot(distribution->codename, name,
+			global.linksnapshots, &release);
 	if (RET_WAS_ERROR(r))
 		return r;
 
@@ -1105,8 +1106,12 @@ retvalue distribution_loadalloverrides(struct distribution *distribution) {
 
 retvalue distribution_loaduploaders(struct distribution *distribution) {
 	if (distribution->uploaders != NULL) {
-		if (distribution->uploaderslist != NULL)
-			return RET_OK;
+		if (distribution->uploaderslist != NULL) {
+			if (!uploaders_outdated(distribution->uploaderslist))
+				return RET_OK;
+			uploaders_unlock(distribution->uploaderslist);
+			distribution->uploaderslist = NULL;
+		}
 		return uploaders_get(&distribution->uploaderslist,
 				distribution->uploaders);
 	} else {
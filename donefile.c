@@ -119,6 +119,11 @@ void markdone_target(struct markdonefile *done, const char *identifier) {
 	fprintf(done->file, "Target %s\n", identifier);
 }
 
+/* the configuration the target was processed with */
+void markdone_config(struct markdonefile *done, const char *confighash) {
+	fprintf(done->file, "Config %s\n", confighash);
+}
+
 void markdone_index(struct markdonefile *done, const char *file, const struct checksums *checksums) {
 	retvalue r;
 	size_t s;
@@ -240,3 +245,16 @@ bool donefile_iscleaner(struct donefile *done) {
 	done->linebuffer[s-1] = '\0';
 	return strcmp(done->linebuffer, "Delete") == 0;
 }
+
+bool donefile_isconfig(struct donefile *done, const char *confighash) {
+	ssize_t s;
+
+	s = getline(&done->linebuffer, &done->linebuffer_size, done->file);
+	if (s <= 0 || done->linebuffer[s-1] != '\n') {
+		done->linebuffer[0] = '\0';
+		return false;
+	}
+	done->linebuffer[s-1] = '\0';
+	return strncmp(done->linebuffer, "Config ", 7) == 0 &&
+		strcmp(done->linebuffer + 7, confighash) == 0;
+}
@@ -11,6 +11,7 @@ struct markdonefile;
 retvalue markdone_create(const char *, /*@out@*/struct markdonefile **);
 void markdone_finish(/*@only@*/struct markdonefile *);
 void markdone_target(struct markdonefile *, const char *);
+void markdone_config(struct markdonefile *, const char *);
 void markdone_index(struct markdonefile *, const char *, const struct checksums *);
 void markdone_cleaner(struct markdonefile *);
 
@@ -20,5 +21,6 @@ void donefile_close(/*@only@*/struct donefile *);
 retvalue donefile_nexttarget(struct donefile *, /*@out@*/const char **);
 bool donefile_nextindex(struct donefile *, /*@out@*/const char **, /*@out@*/struct checksums **);
 bool donefile_iscleaner(struct donefile *);
+bool donefile_isconfig(struct donefile *, const char *);
 
 #endif
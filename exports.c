@@ -38,6 +38,7 @@
 #include "filecntl.h"
 #include "hooks.h"
 #include "package.h"
+#include "distribution.h"
 
 static const char *exportdescription(const struct exportmode *mode, char *buffer, size_t buffersize) {
 	char *result = buffer;
@@ -458,6 +459,20 @@ static retvalue callexporthook(/*@null@*/const char *hook, const char *relfilena
 	}
 }
 
+/* the files exported for a target are no longer to be trusted
+ * (as the target is modified), so forget their cached checksums */
+retvalue export_forget(const char *relativedir, struct target *target, const struct exportmode *exportmode) {
+	retvalue r;
+	char *relfilename;
+
+	relfilename = calc_dirconcat(relativedir, exportmode->filename);
+	if (FAILEDTOALLOC(relfilename))
+		return RET_ERROR_OOM;
+	r = release_forgetcached(target->distribution->codename, relfilename);
+	free(relfilename);
+	return r;
+}
+
 retvalue export_target(const char *relativedir, struct target *target,  const struct exportmode *exportmode, struct release *release, bool onlyifmissing, bool snapshot) {
 	retvalue r;
 	struct filetorelease *file;
@@ -465,18 +480,42 @@ retvalue export_target(const char *relativedir, struct target *target,  const st
 	char *relfilename;
 	char buffer[100];
 	struct package_cursor iterator;
+	bool copied = false;
 
 	relfilename = calc_dirconcat(relativedir, exportmode->filename);
 	if (FAILEDTOALLOC(relfilename))
 		return RET_ERROR_OOM;
 
-	r = release_startfile(release, relfilename, exportmode->compressions,
-		       onlyifmissing, &file);
-	if (RET_WAS_ERROR(r)) {
-		free(relfilename);
-		return r;
+	/* the other distribution's files can only be used if they are
+	 * current, i.e. nothing changed there since they were exported
+	 * (the cache of those is cleared when something changes) */
+	if (target->clonedfrom != NULL && !snapshot &&
+			!target->clonedfrom->wasmodified) {
+		r = release_usefromother(release,
+				target->clonedfrom->distribution->codename,
+				relfilename, exportmode->compressions);
+		if (RET_WAS_ERROR(r)) {
+			free(relfilename);
+			return r;
+		}
+		copied = RET_IS_OK(r);
+	}
+	if (!copied) {
+		r = release_startfile(release, relfilename,
+				exportmode->compressions, onlyifmissing, &file);
+		if (RET_WAS_ERROR(r)) {
+			free(relfilename);
+			return r;
+		}
 	}
-	if (RET_IS_OK(r)) {
+	if (copied) {
+		if (verbose > 5)
+			printf("  copying '%s/%s' from '%s'%s\n",
+				release_dirofdist(release), relfilename,
+				target->clonedfrom->distribution->codename,
+				exportdescription(exportmode, buffer, 100));
+		status = "change";
+	} else if (RET_IS_OK(r)) {
 		if (release_oldexists(file)) {
 			if (verbose > 5)
 				printf("  replacing '%s/%s'%s\n",
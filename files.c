@@ -19,6 +19,7 @@
 #include <assert.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +36,7 @@
 #include "ignore.h"
 #include "filelist.h"
 #include "debfile.h"
+#include "readtextfile.h"
 #include "pool.h"
 #include "database_p.h"
 
@@ -50,33 +52,32 @@ static retvalue files_get_checksums(const char *filekey, /*@out@*/struct checksu
 	return checksums_setall(checksums_p, checksums, checksumslen);
 }
 
-retvalue files_add_checksums(const char *filekey, const struct checksums *checksums) {
+/* store the binary representation if possible, the textual otherwise */
+static retvalue files_replace_checksums(const char *filekey, const struct checksums *checksums) {
 	retvalue r;
+	char binary[CHECKSUMS_MAXBINARY];
 	const char *combined;
 	size_t combinedlen;
 
 	assert (rdb_checksums != NULL);
-	r = checksums_getcombined(checksums, &combined, &combinedlen);
-	if (!RET_IS_OK(r))
-		return r;
-	r = table_adduniqsizedrecord(rdb_checksums, filekey,
+	if (checksums_getbinary(checksums, binary, &combinedlen))
+		combined = binary;
+	else {
+		r = checksums_getcombined(checksums, &combined, &combinedlen);
+		if (!RET_IS_OK(r))
+			return r;
+	}
+	return table_adduniqsizedrecord(rdb_checksums, filekey,
 			combined, combinedlen + 1, true, false);
-	if (!RET_IS_OK(r))
-		return r;
-	return pool_markadded(filekey);
 }
 
-static retvalue files_replace_checksums(const char *filekey, const struct checksums *checksums) {
+retvalue files_add_checksums(const char *filekey, const struct checksums *checksums) {
 	retvalue r;
-	const char *combined;
-	size_t combinedlen;
 
-	assert (rdb_checksums != NULL);
-	r = checksums_getcombined(checksums, &combined, &combinedlen);
+	r = files_replace_checksums(filekey, checksums);
 	if (!RET_IS_OK(r))
 		return r;
-	return table_adduniqsizedrecord(rdb_checksums, filekey,
-			combined, combinedlen + 1, true, false);
+	return pool_markadded(filekey);
 }
 
 /* remove file's md5sum from database */
@@ -274,14 +275,22 @@ retvalue files_checkorimprove(const struct strlist *filekeys, struct checksums *
 retvalue files_printmd5sums(void) {
 	retvalue result, r;
 	struct cursor *cursor;
-	const char *filekey, *checksum;
+	const char *filekey, *data, *checksum;
+	size_t datalen;
+	struct checksums *checksums;
 
 	r = table_newglobalcursor(rdb_checksums, &cursor);
 	if (!RET_IS_OK(r))
 		return r;
 	result = RET_NOTHING;
-	while (cursor_nexttempdata(rdb_checksums, cursor, &filekey, &checksum, NULL)) {
+	while (cursor_nexttempdata(rdb_checksums, cursor, &filekey, &data, &datalen)) {
+		r = checksums_setall(&checksums, data, datalen);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
 		result = RET_OK;
+		(void)checksums_getcombined(checksums, &checksum, &datalen);
 		(void)fputs(filekey, stdout);
 		(void)putchar(' ');
 		while (*checksum == ':') {
@@ -292,6 +301,7 @@ retvalue files_printmd5sums(void) {
 		}
 		(void)fputs(checksum, stdout);
 		(void)putchar('\n');
+		checksums_free(checksums);
 	}
 	r = cursor_close(rdb_checksums, cursor);
 	RET_ENDUPDATE(result, r);
@@ -301,18 +311,27 @@ retvalue files_printmd5sums(void) {
 retvalue files_printchecksums(void) {
 	retvalue result, r;
 	struct cursor *cursor;
-	const char *filekey, *checksum;
+	const char *filekey, *data, *checksum;
+	size_t datalen;
+	struct checksums *checksums;
 
 	r = table_newglobalcursor(rdb_checksums, &cursor);
 	if (!RET_IS_OK(r))
 		return r;
 	result = RET_NOTHING;
-	while (cursor_nexttempdata(rdb_checksums, cursor, &filekey, &checksum, NULL)) {
+	while (cursor_nexttempdata(rdb_checksums, cursor, &filekey, &data, &datalen)) {
+		r = checksums_setall(&checksums, data, datalen);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
 		result = RET_OK;
+		(void)checksums_getcombined(checksums, &checksum, &datalen);
 		(void)fputs(filekey, stdout);
 		(void)putchar(' ');
 		(void)fputs(checksum, stdout);
 		(void)putchar('\n');
+		checksums_free(checksums);
 		if (interrupted()) {
 			result = RET_ERROR_INTERRUPTED;
 			break;
@@ -432,6 +451,11 @@ retvalue files_collectnewchecksums(void) {
 			continue;
 		}
 		if (checksums_iscomplete(expected)) {
+			/* convert records still in the old textual form */
+			if (alllen > 0 && all[0] != CHECKSUMS_BINARY) {
+				r = files_replace_checksums(filekey, expected);
+				RET_UPDATE(result, r);
+			}
 			checksums_free(expected);
 			continue;
 		}
@@ -487,28 +511,252 @@ retvalue files_detect(const char *filekey) {
 	return r;
 }
 
-struct rfd { bool reread; };
+/* Extracting control chunks or file lists out of many .deb files
+ * is distributed over some worker processes. (Processes and not threads,
+ * as the uncompression code keeps track of its helper children and
+ * error reporting is not prepared for threads either).
+ * The i-th file is done by worker i % workers, each sending
+ * its results through its own pipe, so they can be read in order. */
 
-static retvalue regenerate_filelist(void *data, const char *filekey) {
-	bool reread = ((struct rfd*)data)->reread;
-	size_t l = strlen(filekey);
-	char *debfilename;
-	char *filelist;
-	size_t fls;
+#define EXTRACTBATCH_MAXWORKERS 8
+
+struct extractresult {
 	retvalue r;
+	size_t len;
+};
+
+static unsigned int extractbatch_workers(int count) {
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		n = 1;
+	if (n > EXTRACTBATCH_MAXWORKERS)
+		n = EXTRACTBATCH_MAXWORKERS;
+	if (n > count)
+		n = count;
+	return n;
+}
 
-	if (l <= 4 || memcmp(filekey+l-4, ".deb", 4) != 0)
-		return RET_NOTHING;
+static retvalue extractone(const char *filekey, bool filelists, /*@out@*/char **data_p, /*@out@*/size_t *len_p) {
+	char *fullfilename;
+	retvalue r;
 
-	if (!reread && !table_recordexists(rdb_contents, filekey))
-		return RET_NOTHING;
+	fullfilename = files_calcfullfilename(filekey);
+	if (FAILEDTOALLOC(fullfilename))
+		return RET_ERROR_OOM;
+	if (filelists)
+		r = getfilelist(data_p, len_p, fullfilename);
+	else {
+		r = extractcontrol(data_p, fullfilename);
+		if (RET_IS_OK(r))
+			*len_p = strlen(*data_p) + 1;
+	}
+	free(fullfilename);
+	return r;
+}
+
+static bool writeall(int fd, const void *data, size_t len) {
+	const char *p = data;
 
-	debfilename = files_calcfullfilename(filekey);
-	if (FAILEDTOALLOC(debfilename))
+	while (len > 0) {
+		ssize_t written = write(fd, p, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += written;
+		len -= written;
+	}
+	return true;
+}
+
+static bool readall(int fd, void *data, size_t len) {
+	char *p = data;
+
+	while (len > 0) {
+		ssize_t got = read(fd, p, len);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		if (got == 0)
+			return false;
+		p += got;
+		len -= got;
+	}
+	return true;
+}
+
+static void extractbatch_worker(int fd, const struct strlist *filekeys, int first, unsigned int step, bool filelists) {
+	int i;
+
+	for (i = first ; i < filekeys->count ; i += step) {
+		struct extractresult result;
+		char *data = NULL;
+
+		result.len = 0;
+		if (interrupted())
+			result.r = RET_ERROR_INTERRUPTED;
+		else
+			result.r = extractone(filekeys->values[i], filelists,
+					&data, &result.len);
+		if (!RET_IS_OK(result.r))
+			result.len = 0;
+		if (!writeall(fd, &result, sizeof(result)) ||
+		    !writeall(fd, data, result.len)) {
+			free(data);
+			break;
+		}
+		free(data);
+	}
+	(void)fflush(stdout);
+	(void)fflush(stderr);
+	_exit(EXIT_SUCCESS);
+}
+
+/* get the control chunks (or file lists) of the .deb files with the given
+ * filekeys and call action for each of them in the order given */
+retvalue files_extractbatch(const struct strlist *filekeys, bool filelists, files_extracted_action action, void *privdata) {
+	unsigned int workers, w;
+	int *fds, i;
+	pid_t *pids;
+	retvalue result, r;
+
+	workers = extractbatch_workers(filekeys->count);
+	if (workers <= 1) {
+		result = RET_NOTHING;
+		for (i = 0 ; i < filekeys->count ; i++) {
+			char *data = NULL;
+			size_t len = 0;
+
+			if (interrupted()) {
+				RET_UPDATE(result, RET_ERROR_INTERRUPTED);
+				break;
+			}
+			r = extractone(filekeys->values[i], filelists,
+					&data, &len);
+			r = action(privdata, filekeys->values[i], r, data, len);
+			free(data);
+			RET_UPDATE(result, r);
+		}
+		return result;
+	}
+
+	fds = nzNEW(workers, int);
+	pids = nzNEW(workers, pid_t);
+	if (FAILEDTOALLOC(fds) || FAILEDTOALLOC(pids)) {
+		free(fds);
+		free(pids);
 		return RET_ERROR_OOM;
+	}
+	(void)fflush(stdout);
+	(void)fflush(stderr);
+	result = RET_NOTHING;
+	for (w = 0 ; w < workers ; w++) {
+		int p[2];
+
+		if (pipe(p) != 0) {
+			int e = errno;
+			fprintf(stderr, "Error %d creating pipe: %s\n",
+					e, strerror(e));
+			result = RET_ERRNO(e);
+			break;
+		}
+		pids[w] = fork();
+		if (pids[w] < 0) {
+			int e = errno;
+			fprintf(stderr, "Error %d forking: %s\n",
+					e, strerror(e));
+			(void)close(p[0]);
+			(void)close(p[1]);
+			result = RET_ERRNO(e);
+			break;
+		}
+		if (pids[w] == 0) {
+			unsigned int o;
+
+			for (o = 0 ; o < w ; o++)
+				(void)close(fds[o]);
+			(void)close(p[0]);
+			extractbatch_worker(p[1], filekeys, w, workers,
+					filelists);
+		}
+		(void)close(p[1]);
+		fds[w] = p[0];
+	}
+	if (!RET_WAS_ERROR(result)) {
+		for (i = 0 ; i < filekeys->count ; i++) {
+			struct extractresult got;
+			char *data = NULL;
+
+			if (!readall(fds[i % workers], &got, sizeof(got))) {
+				fprintf(stderr,
+"Error: worker process extracting '%s' ended prematurely!\n",
+						filekeys->values[i]);
+				RET_UPDATE(result, RET_ERROR);
+				break;
+			}
+			if (got.len > 0) {
+				data = malloc(got.len);
+				if (FAILEDTOALLOC(data)) {
+					RET_UPDATE(result, RET_ERROR_OOM);
+					break;
+				}
+				if (!readall(fds[i % workers], data, got.len)) {
+					free(data);
+					fprintf(stderr,
+"Error: worker process extracting '%s' ended prematurely!\n",
+						filekeys->values[i]);
+					RET_UPDATE(result, RET_ERROR);
+					break;
+				}
+			}
+			r = action(privdata, filekeys->values[i], got.r,
+					data, got.len);
+			free(data);
+			RET_UPDATE(result, r);
+			if (got.r == RET_ERROR_INTERRUPTED)
+				break;
+		}
+	}
+	/* closing the pipes also stops workers if aborted early */
+	for (w = 0 ; w < workers ; w++) {
+		int status;
 
-	r = getfilelist(&filelist, &fls, debfilename);
-	free(debfilename);
+		if (pids[w] <= 0)
+			break;
+		(void)close(fds[w]);
+		while (waitpid(pids[w], &status, 0) < 0 && errno == EINTR)
+			;
+	}
+	free(fds);
+	free(pids);
+	return result;
+}
+
+/* number of file lists to extract at once */
+#define FILELIST_BATCHSIZE 256
+
+/* File lists are regenerated in the order of the filekeys.
+ * The filekeys to do are collected first (as a cursor in checksums.db
+ * would keep the lmdb backend from committing), then extracted in
+ * parallel in batches and stored in one go.
+ * After each batch the database is synced and the last filekey done
+ * noted in a checkpoint file, so that an aborted run can continue there.
+ * After a batch with errors the checkpoint is no longer moved, so that
+ * a run continued later retries the failed files. */
+
+struct rfd {
+	bool reread;
+	struct strlist todo;
+	/* skip everything up to and including this filekey */
+	/*@null@*/char *resumeafter;
+};
+
+static retvalue store_filelist(UNUSED(void *data), const char *filekey, retvalue r, const char *filelist, size_t fls) {
 	if (RET_IS_OK(r)) {
 		if (verbose > 0)
 			(void)puts(filekey);
@@ -522,16 +770,139 @@ static retvalue regenerate_filelist(void *data, const char *filekey) {
 		}
 		r = table_adduniqsizedrecord(rdb_contents,
 				filekey, filelist, fls, true, true);
-		free(filelist);
 	}
 	return r;
 }
 
+static retvalue writecheckpoint(const char *checkpointfile, const char *filekey) {
+	char *tmpfile;
+	FILE *f;
+	int e;
+
+	tmpfile = calc_addsuffix(checkpointfile, "new");
+	if (FAILEDTOALLOC(tmpfile))
+		return RET_ERROR_OOM;
+	f = fopen(tmpfile, "w");
+	if (f == NULL) {
+		e = errno;
+		fprintf(stderr, "Error %d creating '%s': %s\n",
+				e, tmpfile, strerror(e));
+		free(tmpfile);
+		return RET_ERRNO(e);
+	}
+	(void)fputs(filekey, f);
+	(void)fputc('\n', f);
+	if (ferror(f) != 0 || fclose(f) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d writing '%s': %s\n",
+				e, tmpfile, strerror(e));
+		(void)unlink(tmpfile);
+		free(tmpfile);
+		return RET_ERRNO(e);
+	}
+	if (rename(tmpfile, checkpointfile) != 0) {
+		e = errno;
+		fprintf(stderr, "Error %d moving '%s' to '%s': %s\n",
+				e, tmpfile, checkpointfile, strerror(e));
+		(void)unlink(tmpfile);
+		free(tmpfile);
+		return RET_ERRNO(e);
+	}
+	free(tmpfile);
+	return RET_OK;
+}
+
+static retvalue regenerate_batch(const char *checkpointfile, const struct strlist *todo, int first, int count, bool *failed_p) {
+	struct strlist batch;
+	retvalue r, r2;
+
+	/* a view of part of the list, not to be freed */
+	batch.values = todo->values + first;
+	batch.count = count;
+	batch.size = count;
+	r = files_extractbatch(&batch, true, store_filelist, NULL);
+	if (r == RET_ERROR_INTERRUPTED)
+		return r;
+	if (RET_WAS_ERROR(r))
+		*failed_p = true;
+	r2 = table_sync(rdb_contents);
+	if (RET_WAS_ERROR(r2))
+		*failed_p = true;
+	/* only note files as done that are actually committed */
+	if (RET_IS_OK(r2) && !*failed_p)
+		r2 = writecheckpoint(checkpointfile,
+				batch.values[batch.count - 1]);
+	RET_UPDATE(r, r2);
+	return r;
+}
+
+static retvalue regenerate_filelist(void *data, const char *filekey) {
+	struct rfd *d = data;
+	size_t l = strlen(filekey);
+
+	if (d->resumeafter != NULL) {
+		if (strcmp(filekey, d->resumeafter) <= 0)
+			return RET_NOTHING;
+		free(d->resumeafter);
+		d->resumeafter = NULL;
+	}
+
+	if (l <= 4 || memcmp(filekey+l-4, ".deb", 4) != 0)
+		return RET_NOTHING;
+
+	if (!d->reread && !table_recordexists(rdb_contents, filekey))
+		return RET_NOTHING;
+
+	return strlist_add_dup(&d->todo, filekey);
+}
+
 retvalue files_regenerate_filelist(bool reread) {
 	struct rfd d;
+	char *checkpointfile;
+	bool failed = false, stopped;
+	int i, count;
+	retvalue result, r;
 
 	d.reread = reread;
-	return files_foreach(regenerate_filelist, &d);
+	strlist_init(&d.todo);
+	d.resumeafter = NULL;
+	checkpointfile = calc_dirconcat(global.dbdir,
+			"generatefilelists.checkpoint");
+	if (FAILEDTOALLOC(checkpointfile))
+		return RET_ERROR_OOM;
+	if (isregularfile(checkpointfile)) {
+		r = readtextfile(checkpointfile, checkpointfile,
+				&d.resumeafter, NULL);
+		if (RET_WAS_ERROR(r)) {
+			free(checkpointfile);
+			return r;
+		}
+		if (RET_IS_OK(r)) {
+			d.resumeafter[strcspn(d.resumeafter, "\n")] = '\0';
+			fprintf(stderr,
+"Continuing an aborted generatefilelists after '%s'.\n"
+"(Remove '%s' to start from the beginning again.)\n",
+					d.resumeafter, checkpointfile);
+		}
+	}
+	result = files_foreach(regenerate_filelist, &d);
+	free(d.resumeafter);
+	stopped = RET_WAS_ERROR(result);
+	for (i = 0 ; !stopped && i < d.todo.count ; i += FILELIST_BATCHSIZE) {
+		count = d.todo.count - i;
+		if (count > FILELIST_BATCHSIZE)
+			count = FILELIST_BATCHSIZE;
+		r = regenerate_batch(checkpointfile, &d.todo, i, count,
+				&failed);
+		RET_UPDATE(result, r);
+		stopped = r == RET_ERROR_INTERRUPTED;
+	}
+	/* only keep the checkpoint if not everything was looked at */
+	if (!stopped)
+		(void)unlink(checkpointfile);
+	strlist_done(&d.todo);
+	free(checkpointfile);
+	return result;
 }
 
 /* Include a yet unknown file into the pool */
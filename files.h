@@ -70,6 +70,12 @@ retvalue files_detect(const char *);
 
 retvalue files_regenerate_filelist(bool redo);
 
+/* called with the extracted control chunk (or file list) of each file */
+typedef retvalue files_extracted_action(void *, const char * /*filekey*/, retvalue, /*@null@*/const char * /*data*/, size_t /*len*/);
+/* extract control chunks (or file lists if the bool is true) of many .deb
+ * files, using multiple processes, calling the action in the given order */
+retvalue files_extractbatch(const struct strlist *, bool /*filelists*/, files_extracted_action, void *);
+
 /* hardlink file with known checksums and add it to database */
 retvalue files_hardlinkandadd(const char * /*tempfile*/, const char * /*filekey*/, const struct checksums *);
 
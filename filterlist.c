@@ -387,6 +387,32 @@ retvalue filterlist_load(struct filterlist *list, struct configiterator *iter) {
 	return RET_OK;
 }
 
+/* fold the content of the list into hash, so changes can be noticed */
+unsigned long long filterlist_hash(const struct filterlist *list, unsigned long long hash) {
+	const struct filterlistitem *item;
+	size_t i;
+	char what[2];
+
+	if (!list->set)
+		return hash_add(hash, "unset");
+	what[1] = '\0';
+	what[0] = 'a' + (int)list->defaulttype;
+	hash = hash_add(hash, what);
+	for (i = 0 ; i < list->count ; i++) {
+		if (list->files[i]->filename != NULL)
+			hash = hash_add(hash, list->files[i]->filename);
+		for (item = list->files[i]->root ; item != NULL ;
+				item = item->next) {
+			hash = hash_add(hash, item->packagename);
+			if (item->version != NULL)
+				hash = hash_add(hash, item->version);
+			what[0] = 'a' + (int)item->what;
+			hash = hash_add(hash, what);
+		}
+	}
+	return hash;
+}
+
 static inline bool find(const char *name, /*@null@*/struct filterlistfile *list) {
 	int cmp;
 	/*@dependent@*/const struct filterlistitem *last = list->last;
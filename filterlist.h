@@ -33,6 +33,7 @@ retvalue filterlist_load(/*@out@*/struct filterlist *, struct configiterator *);
 void filterlist_release(struct filterlist *list);
 
 enum filterlisttype filterlist_find(const char *name, const char *version, const struct filterlist *);
+unsigned long long filterlist_hash(const struct filterlist *, unsigned long long);
 
 extern struct filterlist cmdline_bin_filter, cmdline_src_filter;
 retvalue filterlist_cmdline_add_pkg(bool, const char *);
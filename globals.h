@@ -80,6 +80,7 @@ extern struct global_config {
 	bool keepdirectories;
 	bool keeptemporaries;
 	bool onlysmalldeletes;
+	bool linksnapshots;
 	/* verbosity of downloading statistics */
 	int showdownloadpercent;
 } global;
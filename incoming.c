@@ -28,6 +28,10 @@
 #include <dirent.h>
 #include <time.h>
 #include <sys/stat.h>
+#ifdef HAVE_INOTIFY_INIT1
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 #include "error.h"
 #include "ignore.h"
 #include "mprintf.h"
@@ -98,7 +102,7 @@ struct incoming {
 	struct distribution **allow_into;
 	struct distribution *default_into;
 	/* by incoming_prepare: */
-	struct strlist files;
+	struct strindex files;
 	bool *processed;
 	bool *delete;
 	bool permit[pmf_COUNT];
@@ -108,7 +112,7 @@ struct incoming {
 	const char *filename; /* only valid while parsing! */
 	size_t lineno;
 };
-#define BASENAME(i, ofs) (i)->files.values[ofs]
+#define BASENAME(i, ofs) (i)->files.strings.values[ofs]
 /* the changes file is always the first one listed */
 #define changesfile(c) (c->files)
 
@@ -122,7 +126,7 @@ static void incoming_free(/*@only@*/ struct incoming *i) {
 	free(i->directory);
 	strlist_done(&i->allow);
 	free(i->allow_into);
-	strlist_done(&i->files);
+	strindex_done(&i->files);
 	free(i->processed);
 	free(i->delete);
 	free(i);
@@ -132,7 +136,7 @@ static retvalue incoming_prepare(struct incoming *i) {
 	DIR *dir;
 	struct dirent *ent;
 	retvalue r;
-	int ret;
+	int ret, ofs;
 
 	/* TODO: decide whether to clean this directory first ... */
 	r = dirs_make_recursive(i->tempdir);
@@ -153,7 +157,8 @@ static retvalue incoming_prepare(struct incoming *i) {
 		 * overlong slashes, better check than be sorry */
 		if (strchr(ent->d_name, '/') != NULL)
 			continue;
-		r = strlist_add_dup(&i->files, ent->d_name) ;
+		r = strindex_intern(&i->files, ent->d_name,
+				strlen(ent->d_name), &ofs);
 		if (RET_WAS_ERROR(r)) {
 			(void)closedir(dir);
 			return r;
@@ -166,10 +171,10 @@ static retvalue incoming_prepare(struct incoming *i) {
 				i->directory, strerror(e));
 		return RET_ERRNO(e);
 	}
-	i->processed = nzNEW(i->files.count, bool);
+	i->processed = nzNEW(i->files.strings.count, bool);
 	if (FAILEDTOALLOC(i->processed))
 		return RET_ERROR_OOM;
-	i->delete = nzNEW(i->files.count, bool);
+	i->delete = nzNEW(i->files.strings.count, bool);
 	if (FAILEDTOALLOC(i->delete))
 		return RET_ERROR_OOM;
 	return RET_OK;
@@ -680,11 +685,11 @@ static retvalue candidate_addfileline(struct incoming *i, struct candidate *c, c
 		free(n);
 		return r;
 	}
-	n->ofs = strlist_ofs(&i->files, basefilename);
+	n->ofs = strindex_ofs(&i->files, basefilename);
 	if (n->ofs < 0) {
 		fprintf(stderr,
 "In '%s': file '%s' not found in the incoming dir!\n",
-				i->files.values[c->ofs], basefilename);
+				i->files.strings.values[c->ofs], basefilename);
 		free(basefilename);
 		candidate_file_free(n);
 		return RET_ERROR_MISSING;
@@ -2437,7 +2442,7 @@ static retvalue process_changes(struct incoming *i, int ofs) {
 	if (c->perdistribution == NULL) {
 		fprintf(stderr, tried?"No distribution accepting '%s' (i.e. none of the candidate distributions allowed inclusion)!\n":
 				      "No distribution found for '%s'!\n",
-			i->files.values[ofs]);
+			i->files.strings.values[ofs]);
 		if (i->cleanup[cuf_on_deny]) {
 			struct candidate_file *file;
 
@@ -2456,7 +2461,7 @@ static retvalue process_changes(struct incoming *i, int ofs) {
 "'%s' is signed with only invalid signatures.\n"
 "If this was not corruption but willfull modification,\n"
 "remove the signatures and try again.\n",
-				i->files.values[ofs]);
+				i->files.strings.values[ofs]);
 			r = RET_ERROR;
 		} else
 			r = candidate_add(i, c);
@@ -2514,21 +2519,15 @@ static inline /*@null@*/char *create_uniq_subdir(const char *basedir) {
 	return NULL;
 }
 
-/* tempdir should ideally be on the same partition like the pooldir */
-retvalue process_incoming(struct distribution *distributions, const char *name, const char *changesfilename) {
-	struct incoming *i;
+static retvalue incoming_processfiles(struct incoming *i, /*@null@*/const char *changesfilename) {
 	retvalue result, r;
 	int j;
 	char *morguedir;
 
 	result = RET_NOTHING;
 
-	r = incoming_init(distributions, name, &i);
-	if (RET_WAS_ERROR(r))
-		return r;
-
-	for (j = 0 ; j < i->files.count ; j ++) {
-		const char *basefilename = i->files.values[j];
+	for (j = 0 ; j < i->files.strings.count ; j ++) {
+		const char *basefilename = i->files.strings.values[j];
 		size_t l = strlen(basefilename);
 #define C_SUFFIX ".changes"
 		const size_t c_len = strlen(C_SUFFIX);
@@ -2548,20 +2547,20 @@ retvalue process_incoming(struct distribution *distributions, const char *name,
 	else {
 		morguedir = create_uniq_subdir(i->morguedir);
 	}
-	for (j = 0 ; j < i->files.count ; j ++) {
+	for (j = 0 ; j < i->files.strings.count ; j ++) {
 		char *fullfilename;
 
 		if (!i->delete[j])
 			continue;
 
-		fullfilename = calc_dirconcat(i->directory, i->files.values[j]);
+		fullfilename = calc_dirconcat(i->directory, i->files.strings.values[j]);
 		if (FAILEDTOALLOC(fullfilename)) {
 			result = RET_ERROR_OOM;
 			continue;
 		}
 		if (morguedir != NULL && !i->processed[j]) {
 			char *newname = calc_dirconcat(morguedir,
-					i->files.values[j]);
+					i->files.strings.values[j]);
 			if (newname != NULL &&
 					rename(fullfilename, newname) == 0) {
 				free(newname);
@@ -2574,7 +2573,7 @@ retvalue process_incoming(struct distribution *distributions, const char *name,
 
 				fprintf(stderr,
 "Error %d moving '%s' to '%s': %s\n",
-						e, i->files.values[j],
+						e, i->files.strings.values[j],
 						morguedir, strerror(e));
 				RET_UPDATE(result, RET_ERRNO(e));
 				/* no continue, instead
@@ -2591,6 +2590,207 @@ retvalue process_incoming(struct distribution *distributions, const char *name,
 		(void)rmdir(morguedir);
 		free(morguedir);
 	}
+	return result;
+}
+
+/* tempdir should ideally be on the same partition like the pooldir */
+retvalue process_incoming(struct distribution *distributions, const char *name, const char *changesfilename) {
+	struct incoming *i;
+	retvalue r;
+
+	r = incoming_init(distributions, name, &i);
+	if (RET_WAS_ERROR(r))
+		return r;
+
+	r = incoming_processfiles(i, changesfilename);
+	incoming_free(i);
+	return r;
+}
+
+#ifdef HAVE_INOTIFY_INIT1
+/* wait that long without new files before looking at the new files,
+ * so that all files of an upload are there and multiple uploads
+ * arriving at about the same time only cause a single export: */
+#define WATCH_SETTLE_MSECS 2000
+/* but do not wait longer than this when files keep arriving: */
+#define WATCH_MAXDELAY_MSECS 30000
+
+static void incoming_forgetfiles(struct incoming *i) {
+	strindex_done(&i->files);
+	free(i->processed);
+	i->processed = NULL;
+	free(i->delete);
+	i->delete = NULL;
+}
+
+static retvalue watch_readevents(int fd, const char *directory, bool *changesseen_p) {
+	char buffer[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	const size_t c_len = strlen(C_SUFFIX);
+	ssize_t got;
+	const char *p;
+
+	while (true) {
+		got = read(fd, buffer, sizeof(buffer));
+		if (got < 0) {
+			int e = errno;
+			if (e == EAGAIN || e == EINTR)
+				return RET_OK;
+			fprintf(stderr,
+"Error %d reading inotify events for '%s': %s\n",
+					e, directory, strerror(e));
+			return RET_ERRNO(e);
+		}
+		if (got == 0)
+			return RET_OK;
+		for (p = buffer ; p < buffer + got ;
+				p += sizeof(struct inotify_event) + event->len) {
+			size_t l;
+
+			event = (const struct inotify_event *)p;
+			if ((event->mask & IN_Q_OVERFLOW) != 0) {
+				*changesseen_p = true;
+				continue;
+			}
+			if ((event->mask & IN_IGNORED) != 0) {
+				fprintf(stderr,
+"Directory '%s' vanished while watching it!\n",
+						directory);
+				return RET_ERROR;
+			}
+			if (event->len == 0)
+				continue;
+			l = strlen(event->name);
+			if (l > c_len && memcmp(event->name + (l - c_len),
+						C_SUFFIX, c_len) == 0)
+				*changesseen_p = true;
+		}
+	}
+}
+
+static long long watch_msecsnow(void) {
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* block until new .changes files arrived (returns RET_OK) or
+ * interrupted (returns RET_NOTHING) */
+static retvalue watch_waitforchanges(int fd, const char *directory) {
+	struct pollfd pfd;
+	bool changesseen = false;
+	long long firstseen = 0;
+	retvalue r;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (!interrupted()) {
+		int ret;
+
+		pfd.revents = 0;
+		ret = poll(&pfd, 1, changesseen ? WATCH_SETTLE_MSECS : -1);
+		if (ret < 0) {
+			int e = errno;
+			if (e == EINTR)
+				continue;
+			fprintf(stderr,
+"Error %d waiting for changes in '%s': %s\n",
+					e, directory, strerror(e));
+			return RET_ERRNO(e);
+		}
+		if (ret == 0) {
+			/* nothing new for some time, process what is there */
+			assert (changesseen);
+			return RET_OK;
+		}
+		r = watch_readevents(fd, directory, &changesseen);
+		if (RET_WAS_ERROR(r))
+			return r;
+		if (!changesseen)
+			continue;
+		if (firstseen == 0)
+			firstseen = watch_msecsnow();
+		else if (watch_msecsnow() - firstseen >= WATCH_MAXDELAY_MSECS)
+			return RET_OK;
+	}
+	return RET_NOTHING;
+}
+
+retvalue watch_incoming(struct distribution *distributions, const char *name, retvalue (*beforebatch)(void *), retvalue (*afterbatch)(void *), void *privdata) {
+	struct incoming *i;
+	retvalue result, r;
+	int fd;
+
+	r = incoming_init(distributions, name, &i);
+	if (RET_WAS_ERROR(r))
+		return r;
+
+	fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (fd < 0) {
+		int e = errno;
+		fprintf(stderr, "Error %d initializing inotify: %s\n",
+				e, strerror(e));
+		incoming_free(i);
+		return RET_ERRNO(e);
+	}
+	/* only files completely written or moved into the directory are
+	 * of interest, half-uploaded files should not be looked at: */
+	if (inotify_add_watch(fd, i->directory,
+				IN_CLOSE_WRITE|IN_MOVED_TO|IN_ONLYDIR) < 0) {
+		int e = errno;
+		fprintf(stderr, "Error %d watching directory '%s': %s\n",
+				e, i->directory, strerror(e));
+		(void)close(fd);
+		incoming_free(i);
+		return RET_ERRNO(e);
+	}
+
+	result = RET_NOTHING;
+	/* first process what is already there, then wait for more: */
+	while (true) {
+		r = incoming_processfiles(i, NULL);
+		RET_UPDATE(result, r);
+		/* an upload being rejected is no reason to stop,
+		 * but running out of memory is: */
+		if (r == RET_ERROR_OOM)
+			break;
+		r = afterbatch(privdata);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r) || interrupted())
+			break;
+
+		incoming_forgetfiles(i);
+		if (verbose >= 1)
+			printf("Waiting for new .changes files in '%s'...\n",
+					i->directory);
+		r = watch_waitforchanges(fd, i->directory);
+		if (RET_WAS_ERROR(r))
+			RET_UPDATE(result, r);
+		if (!RET_IS_OK(r))
+			break;
+		r = beforebatch(privdata);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+		r = incoming_prepare(i);
+		RET_UPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	(void)close(fd);
 	incoming_free(i);
+	if (interrupted())
+		return RET_ERROR_INTERRUPTED;
 	return result;
 }
+#else
+retvalue watch_incoming(UNUSED(struct distribution *distributions), UNUSED(const char *name), UNUSED(retvalue (*beforebatch)(void *)), UNUSED(retvalue (*afterbatch)(void *)), UNUSED(void *privdata)) {
+	fputs(
+"Error: this reprepro was compiled without inotify support,\n"
+"so watchincoming is not available.\n", stderr);
+	return RET_ERROR;
+}
+#endif
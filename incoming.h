@@ -7,4 +7,8 @@
 #endif
 
 retvalue process_incoming(struct distribution *distributions, const char *name, /*@null@*/const char *onlychangesfilename);
+/* like process_incoming, but keep running (until interrupted) and process
+ * new .changes files as they arrive, calling afterbatch after each round
+ * and beforebatch before every round but the first */
+retvalue watch_incoming(struct distribution *distributions, const char *name, retvalue (*beforebatch)(void *), retvalue (*afterbatch)(void *), void *);
 #endif
@@ -40,6 +40,7 @@
 #include "configparser.h"
 #include "log.h"
 #include "filecntl.h"
+#include "timings.h"
 
 /*@null@*/ static /*@refcounted@*/ struct logfile {
 	/*@null@*/struct logfile *next;
@@ -918,6 +919,11 @@ static retvalue notificator_enqueue(struct notificator *n, struct target *target
 }
 
 void logger_wait(void) {
+	struct timing tm;
+
+	if (processes == NULL)
+		return;
+	timing_start(&tm);
 	while (processes != NULL) {
 		catchchildren();
 		if (interrupted())
@@ -931,6 +937,7 @@ void logger_wait(void) {
 			select(0, NULL, NULL, NULL, &tv);
 		}
 	}
+	timing_stop(tp_notify, NULL, &tm);
 }
 
 void logger_warn_waiting(void) {
@@ -27,6 +27,7 @@
 #include <strings.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
 #include "error.h"
 #define DEFINE_IGNORE_VARIABLES
 #include "ignore.h"
@@ -75,6 +76,7 @@
 #include "descriptions.h"
 #include "outhook.h"
 #include "package.h"
+#include "timings.h"
 
 #ifndef STD_BASE_DIR
 #define STD_BASE_DIR "."
@@ -121,6 +123,8 @@ static int 	listmax = -1;
 static int 	listskip = 0;
 static int	delete = D_COPY;
 static bool	nothingiserror = false;
+static bool	timings = false;
+static char	*statsjson = NULL;
 static bool	nolistsdownload = false;
 static bool	keepunreferenced = false;
 static bool	keepunusednew = false;
@@ -131,6 +135,7 @@ static size_t   waitforlock = 0;
 static enum exportwhen export = EXPORT_CHANGED;
 int		verbose = 0;
 static bool	fast = false;
+static bool	verify = false;
 static bool	verbosedatabase = false;
 static enum spacecheckmode spacecheckmode = scm_FULL;
 /* default: 100 MB for database to grow */
@@ -142,7 +147,7 @@ static off_t reservedotherspace = 1024*1024;
  * to change something owned by lower owners. */
 enum config_option_owner config_state,
 #define O(x) owner_ ## x = CONFIG_OWNER_DEFAULT
-O(fast), O(x_morguedir), O(x_outdir), O(x_basedir), O(x_distdir), O(x_dbdir), O(x_listdir), O(x_confdir), O(x_logdir), O(x_methoddir), O(x_section), O(x_priority), O(x_component), O(x_architecture), O(x_packagetype), O(nothingiserror), O(nolistsdownload), O(keepunusednew), O(keepunreferenced), O(keeptemporaries), O(keepdirectories), O(askforpassphrase), O(skipold), O(export), O(waitforlock), O(spacecheckmode), O(reserveddbspace), O(reservedotherspace), O(guessgpgtty), O(verbosedatabase), O(gunzip), O(bunzip2), O(unlzma), O(unxz), O(lunzip), O(gnupghome), O(listformat), O(listmax), O(listskip), O(onlysmalldeletes), O(endhook), O(outhook);
+O(fast), O(verify), O(x_morguedir), O(x_outdir), O(x_basedir), O(x_distdir), O(x_dbdir), O(x_listdir), O(x_confdir), O(x_logdir), O(x_methoddir), O(x_section), O(x_priority), O(x_component), O(x_architecture), O(x_packagetype), O(nothingiserror), O(nolistsdownload), O(keepunusednew), O(keepunreferenced), O(keeptemporaries), O(keepdirectories), O(askforpassphrase), O(skipold), O(export), O(waitforlock), O(spacecheckmode), O(reserveddbspace), O(reservedotherspace), O(guessgpgtty), O(verbosedatabase), O(gunzip), O(bunzip2), O(unlzma), O(unxz), O(lunzip), O(gnupghome), O(listformat), O(listmax), O(listskip), O(onlysmalldeletes), O(linksnapshots), O(timings), O(statsjson), O(endhook), O(outhook);
 #undef O
 
 #define CONFIGSET(variable, value) if (owner_ ## variable <= config_state) { \
@@ -533,6 +538,99 @@ ACTION_N(n, n, n, translatelegacychecksums) {
 			verbosedatabase || verbose > 10);
 }
 
+ACTION_B(n, n, n, dumpdatabase) {
+
+	assert (argc == 2);
+
+	return database_dump(argv[1]);
+}
+
+ACTION_B(n, n, n, loaddatabase) {
+
+	assert (argc == 2);
+
+	return database_load(argv[1]);
+}
+
+ACTION_B(n, n, n, compactdb) {
+	unsigned long pagesize = 0;
+	long fillpercent = 0;
+	char *e;
+	int i;
+
+	for (i = 1 ; i < argc ; i++) {
+		if (strncmp(argv[i], "pagesize=", 9) == 0) {
+			pagesize = strtoul(argv[i] + 9, &e, 10);
+			if (*e != '\0' || pagesize < 512 || pagesize > 65536
+					|| (pagesize & (pagesize - 1)) != 0) {
+				fprintf(stderr,
+"Invalid '%s': the page size must be a power of two between 512 and 65536!\n",
+						argv[i]);
+				return RET_ERROR;
+			}
+		} else if (strncmp(argv[i], "fill=", 5) == 0) {
+			fillpercent = strtol(argv[i] + 5, &e, 10);
+			if (*e != '\0' || fillpercent < 1 || fillpercent > 100) {
+				fprintf(stderr,
+"Invalid '%s': the fill factor must be a percentage between 1 and 100!\n",
+						argv[i]);
+				return RET_ERROR;
+			}
+		} else {
+			fprintf(stderr,
+"Unknown argument '%s' to compactdb (expected pagesize=<bytes> or fill=<percent>)!\n",
+					argv[i]);
+			return RET_ERROR;
+		}
+	}
+	if (pagesize != 0 && fillpercent != 0) {
+		fputs(
+"Error: compactdb cannot combine pagesize= (rebuilding the files)\n"
+"with fill= (compacting them in place)!\n", stderr);
+		return RET_ERROR;
+	}
+	return database_compact(pagesize, (int)fillpercent);
+}
+
+static retvalue compresschunks(struct distribution *alldistributions, const struct atomlist *architectures, const struct atomlist *components, const struct atomlist *packagetypes, int argc, const char *argv[], bool compress) {
+	retvalue result, r;
+	struct distribution *d;
+	struct target *t;
+
+	result = distribution_match(alldistributions, argc-1, argv+1,
+			false, READWRITE);
+	assert (result != RET_NOTHING);
+	if (RET_WAS_ERROR(result))
+		return result;
+	result = RET_NOTHING;
+	for (d = alldistributions ; d != NULL ; d = d->next) {
+		if (!d->selected)
+			continue;
+		for (t = d->targets ; t != NULL ; t = t->next) {
+			if (!target_matches(t,
+			      components, architectures, packagetypes))
+				continue;
+			r = database_compresschunks(t->identifier, compress);
+			RET_UPDATE(result, r);
+			if (RET_WAS_ERROR(r))
+				return r;
+		}
+	}
+	return result;
+}
+
+ACTION_B(y, n, y, compresschunks) {
+	return compresschunks(alldistributions,
+			architectures, components, packagetypes,
+			argc, argv, true);
+}
+
+ACTION_B(y, n, y, uncompresschunks) {
+	return compresschunks(alldistributions,
+			architectures, components, packagetypes,
+			argc, argv, false);
+}
+
 
 ACTION_F(n, n, n, n, addmd5sums) {
 	char buffer[2000], *c, *m;
@@ -1288,11 +1386,11 @@ struct lspart {
 	struct lsversion *versions;
 };
 
-static retvalue newlsversion(struct lsversion **versions_p, struct package *package, architecture_t architecture) {
+static retvalue newlsversion(struct lsversion **versions_p, const char *version, architecture_t architecture) {
 	struct lsversion *v, **v_p;
 
 	for (v_p = versions_p ; (v = *v_p) != NULL ; v_p = &v->next) {
-		if (strcmp(v->version, package->version) != 0)
+		if (strcmp(v->version, version) != 0)
 			continue;
 		return atomlist_add_uniq(&v->architectures, architecture);
 	}
@@ -1300,23 +1398,102 @@ static retvalue newlsversion(struct lsversion **versions_p, struct package *pack
 	if (FAILEDTOALLOC(v))
 		return RET_ERROR_OOM;
 	*v_p = v;
-	v->version = package_dupversion(package);
+	v->version = strdup(version);
 	if (FAILEDTOALLOC(v->version))
 		return RET_ERROR_OOM;
 	return atomlist_add(&v->architectures, architecture);
 }
 
-static retvalue ls_in_target(struct target *target, const char *packagename, struct lsversion **versions_p) {
+/* what packageindex.db knows about a package name, with the versions
+ * within one target sorted as in the target (newest first) */
+struct lsfound {
+	/*@null@*/struct lsfound *next;
+	char *identifier;
+	char *version;
+};
+
+static void lsfound_free(/*@null@*/struct lsfound *found) {
+	while (found != NULL) {
+		struct lsfound *f = found;
+
+		found = f->next;
+		free(f->identifier);
+		free(f->version);
+		free(f);
+	}
+}
+
+static retvalue lsfound_add(void *data, const char *identifier, const char *version) {
+	struct lsfound **found_p = data, *f;
+	retvalue r;
+	int c;
+
+	for ( ; (f = *found_p) != NULL ; found_p = &f->next) {
+		c = strcmp(identifier, f->identifier);
+		if (c == 0) {
+			r = dpkgversions_cmp(f->version, version, &c);
+			if (RET_WAS_ERROR(r))
+				return r;
+		}
+		if (c < 0)
+			break;
+	}
+	f = zNEW(struct lsfound);
+	if (FAILEDTOALLOC(f))
+		return RET_ERROR_OOM;
+	f->next = *found_p;
+	*found_p = f;
+	f->identifier = strdup(identifier);
+	f->version = strdup(version);
+	if (FAILEDTOALLOC(f->identifier) || FAILEDTOALLOC(f->version))
+		return RET_ERROR_OOM;
+	return RET_OK;
+}
+
+/* look into packageindex.db, so only targets having such a package need
+ * to be looked at. *indexed_p is false if there is no usable index */
+static retvalue ls_find(const char *packagename, /*@out@*/bool *indexed_p, /*@out@*/struct lsfound **found_p) {
+	retvalue r;
+
+	*found_p = NULL;
+	r = database_haspackageindex();
+	if (RET_WAS_ERROR(r))
+		return r;
+	*indexed_p = RET_IS_OK(r);
+	if (!*indexed_p)
+		return RET_NOTHING;
+	r = database_findpackages(packagename, lsfound_add, found_p);
+	if (RET_WAS_ERROR(r)) {
+		lsfound_free(*found_p);
+		*found_p = NULL;
+	}
+	return r;
+}
+
+static retvalue ls_in_target(struct target *target, const char *packagename, bool indexed, /*@null@*/const struct lsfound *found, struct lsversion **versions_p) {
 	retvalue r, result;
 	struct package_cursor iterator;
 
+	if (indexed) {
+		result = RET_NOTHING;
+		for ( ; found != NULL ; found = found->next) {
+			if (strcmp(found->identifier, target->identifier) != 0)
+				continue;
+			r = newlsversion(versions_p, found->version,
+					target->architecture);
+			if (RET_WAS_ERROR(r))
+				return r;
+			result = RET_OK;
+		}
+		return result;
+	}
 	result = package_openduplicateiterator(target, packagename, 0, &iterator);
 	if (!RET_IS_OK(result))
 		return result;
 	do {
 		r = package_getversion(&iterator.current);
 		if (RET_IS_OK(r))
-			r = newlsversion(versions_p, &iterator.current,
+			r = newlsversion(versions_p, iterator.current.version,
 					target->architecture);
 		RET_UPDATE(result, r);
 	} while (package_next(&iterator));
@@ -1387,9 +1564,15 @@ ACTION_B(y, n, y, ls) {
 	struct distribution *d;
 	struct target *t;
 	struct lspart *first, *last;
+	struct lsfound *found;
+	bool indexed;
 
 	assert (argc == 2);
 
+	r = ls_find(argv[1], &indexed, &found);
+	if (RET_WAS_ERROR(r))
+		return r;
+
 	first = zNEW(struct lspart);
 	last = first;
 
@@ -1398,9 +1581,12 @@ ACTION_B(y, n, y, ls) {
 			if (!target_matches(t, components, architectures,
 						packagetypes))
 				continue;
-			r = ls_in_target(t, argv[1], &last->versions);
-			if (RET_WAS_ERROR(r))
+			r = ls_in_target(t, argv[1], indexed, found,
+					&last->versions);
+			if (RET_WAS_ERROR(r)) {
+				lsfound_free(found);
 				return r;
+			}
 		}
 		if (last->versions != NULL) {
 			last->codename = d->codename;
@@ -1408,6 +1594,7 @@ ACTION_B(y, n, y, ls) {
 			last = last->next;
 		}
 	}
+	lsfound_free(found);
 	return printlsparts(argv[1], first);
 }
 
@@ -1416,10 +1603,16 @@ ACTION_B(y, n, y, lsbycomponent) {
 	struct distribution *d;
 	struct target *t;
 	struct lspart *first, *last;
+	struct lsfound *found;
+	bool indexed;
 	int i;
 
 	assert (argc == 2);
 
+	r = ls_find(argv[1], &indexed, &found);
+	if (RET_WAS_ERROR(r))
+		return r;
+
 	first = zNEW(struct lspart);
 	last = first;
 
@@ -1438,9 +1631,12 @@ ACTION_B(y, n, y, lsbycomponent) {
 				if (limitations_missed(packagetypes,
 							t->packagetype))
 					continue;
-				r = ls_in_target(t, argv[1], &last->versions);
-				if (RET_WAS_ERROR(r))
+				r = ls_in_target(t, argv[1], indexed, found,
+						&last->versions);
+				if (RET_WAS_ERROR(r)) {
+					lsfound_free(found);
 					return r;
+				}
 			}
 			if (last->versions != NULL) {
 				last->codename = d->codename;
@@ -1450,6 +1646,7 @@ ACTION_B(y, n, y, lsbycomponent) {
 			}
 		}
 	}
+	lsfound_free(found);
 	return printlsparts(argv[1], first);
 }
 
@@ -2128,6 +2325,39 @@ ACTION_D(y, n, y, movematched) {
 	return copy_or_move_matched(alldistributions, architectures, components, packagetypes, argc, argv, true);
 }
 
+ACTION_D(y, n, y, clonedistribution) {
+	struct distribution *destination, *source;
+	retvalue result;
+
+	assert (argc == 3);
+
+	if (strcmp(argv[1], argv[2]) == 0) {
+		fprintf(stderr,
+"Cannot clone distribution '%s' into itself!\n", argv[1]);
+		return RET_ERROR;
+	}
+	result = distribution_get(alldistributions, argv[1], true, &destination);
+	assert (result != RET_NOTHING);
+	if (RET_WAS_ERROR(result))
+		return result;
+	result = distribution_get(alldistributions, argv[2], false, &source);
+	assert (result != RET_NOTHING);
+	if (RET_WAS_ERROR(result))
+		return result;
+	if (destination->readonly) {
+		fprintf(stderr,
+"Cannot clone into read-only distribution '%s'.\n",
+				destination->codename);
+		return RET_ERROR;
+	}
+	result = distribution_prepareforwriting(destination);
+	if (RET_WAS_ERROR(result))
+		return result;
+
+	return clone_distribution(destination, source,
+			components, architectures, packagetypes);
+}
+
 ACTION_D(y, n, y, restore) {
 	struct distribution *destination;
 	retvalue result;
@@ -2309,8 +2539,12 @@ ACTION_R(n, n, y, y, rereference) {
 			printf("Referencing %s...\n", d->codename);
 		}
 		for (t = d->targets ; t != NULL ; t = t->next) {
+			struct timing tm;
+
+			timing_start(&tm);
 			r = target_rereference(t);
 			RET_UPDATE(result, r);
+			timing_stop(tp_rereference, t->identifier, &tm);
 		}
 		r = tracking_rereference(d);
 		RET_UPDATE(result, r);
@@ -2509,6 +2743,7 @@ ACTION_B(n, n, y, dumptracks) {
 ACTION_RF(y, n, y, y, check) {
 	retvalue result, r;
 	struct distribution *d;
+	struct target *t;
 
 	result = distribution_match(alldistributions, argc-1, argv+1,
 			false, READONLY);
@@ -2525,11 +2760,20 @@ ACTION_RF(y, n, y, y, check) {
 			printf("Checking %s...\n", d->codename);
 		}
 
-		r = package_foreach(d,
-				components, architectures, packagetypes,
-				package_check, NULL, NULL);
-		RET_UPDATE(result, r);
-		if (RET_WAS_ERROR(r))
+		for (t = d->targets ; t != NULL ; t = t->next) {
+			struct timing tm;
+
+			if (!target_matches(t, components, architectures,
+						packagetypes))
+				continue;
+			timing_start(&tm);
+			r = target_check(t);
+			RET_UPDATE(result, r);
+			if (RET_WAS_ERROR(r))
+				break;
+			timing_stop(tp_check, t->identifier, &tm);
+		}
+		if (RET_WAS_ERROR(result))
 			break;
 	}
 	return result;
@@ -2619,6 +2863,11 @@ static retvalue repair_descriptions(struct target *target) {
 				target->identifier);
 	}
 
+	/* read the .deb files needed in parallel first */
+	r = description_prefetch(target);
+	if (RET_WAS_ERROR(r))
+		return r;
+
 	r = package_openiterator(target, READWRITE, &iterator);
 	if (!RET_IS_OK(r))
 		return r;
@@ -2650,7 +2899,11 @@ static retvalue repair_descriptions(struct target *target) {
 				result = r;
 				break;
 			}
-			target->wasmodified = true;
+			r = target_markmodified(target);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
 		}
 	}
 	r = package_closeiterator(&iterator);
@@ -2750,7 +3003,7 @@ ACTION_RF(n, n, y, y, sizes) {
 	if (RET_WAS_ERROR(result)) {
 		return result;
 	}
-	return sizes_distributions(alldistributions, argc > 1);
+	return sizes_distributions(alldistributions, argc > 1, fast, verify);
 }
 
 /***********************include******************************************/
@@ -3728,6 +3981,68 @@ ACTION_D(n, n, y, processincoming) {
 	return process_incoming(alldistributions, argv[1],
 			(argc==3) ? argv[2] : NULL);
 }
+
+/* what callaction does after an action, but done after every batch
+ * of uploads, as watchincoming does not return before interrupted */
+static retvalue watchincoming_batchdone(void *data) {
+	struct distribution *alldistributions = data, *d;
+	struct target *t;
+	retvalue result, r;
+	bool deletederef = !keepunreferenced;
+
+	logger_wait();
+	pool_tidyadded(!keepunusednew);
+	if (outhook != NULL)
+		pool_sendnewfiles();
+	result = distribution_exportlist(export, alldistributions);
+	if (deletederef && RET_WAS_ERROR(result)) {
+		deletederef = false;
+		if (pool_havedereferenced) {
+			fprintf(stderr,
+"Not deleting possibly left over files due to previous errors.\n"
+"(To keep the files in the still existing index files from vanishing)\n"
+"Use dumpunreferenced/deleteunreferenced to show/delete files without references.\n");
+		}
+	}
+	r = pool_removeunreferenced(deletederef);
+	RET_UPDATE(result, r);
+	if (outhook != NULL) {
+		r = outhook_call(outhook);
+		RET_UPDATE(result, r);
+		r = outhook_start();
+		RET_UPDATE(result, r);
+	}
+	logger_wait();
+
+	/* start the next batch with a clean slate: */
+	pool_free();
+	pool_havedereferenced = false;
+	for (d = alldistributions ; d != NULL ; d = d->next) {
+		d->lookedat = false;
+		d->status = RET_NOTHING;
+		for (t = d->targets ; t != NULL ; t = t->next)
+			t->saved_wasmodified = false;
+	}
+	/* do not block others while waiting for new uploads: */
+	r = database_release();
+	RET_UPDATE(result, r);
+	return result;
+}
+
+static retvalue watchincoming_batchstart(UNUSED(void *data)) {
+	return database_reacquire();
+}
+
+ACTION_D(n, n, y, watchincoming) {
+	struct distribution *d;
+
+	for (d = alldistributions ; d != NULL ; d = d->next)
+		d->selected = true;
+
+	return watch_incoming(alldistributions, argv[1],
+			watchincoming_batchstart, watchincoming_batchdone,
+			alldistributions);
+}
 /***********************gensnapshot********************************/
 ACTION_R(n, n, y, y, gensnapshot) {
 	retvalue result;
@@ -4042,7 +4357,7 @@ static const struct action {
 		0, 1, "checkpool [fast]"},
 	{"rereference", 	A_R(rereference),
 		0, -1, "rereference [<distributions>]"},
-	{"dumpreferences", 	A_R(dumpreferences)|MAY_UNUSED,
+	{"dumpreferences", 	A_R(dumpreferences)|MAY_UNUSED|IS_RO,
 		0, 0, "dumpreferences", },
 	{"dumpunreferenced", 	A_RF(dumpunreferenced),
 		0, 0, "dumpunreferenced", },
@@ -4074,6 +4389,8 @@ static const struct action {
 		3, -1, "[-C <component> ] [-A <architecture>] [-T <packagetype>] copy <destination-distribution> <source-distribution> <package-names to pull>"},
 	{"copysrc",		A_Dact(copysrc),
 		3, -1, "[-C <component> ] [-A <architecture>] [-T <packagetype>] copysrc <destination-distribution> <source-distribution> <source-package-name> [<source versions>]"},
+	{"clonedistribution",	A_Dact(clonedistribution),
+		2, 2, "[-C <component> ] [-A <architecture>] [-T <packagetype>] clonedistribution <destination-distribution> <source-distribution>"},
 	{"copymatched",		A_Dact(copymatched),
 		3, 3, "[-C <component> ] [-A <architecture>] [-T <packagetype>] copymatched <destination-distribution> <source-distribution> <glob>"},
 	{"copyfilter",		A_Dact(copyfilter),
@@ -4112,6 +4429,16 @@ static const struct action {
 		0, 0, "translatefilelists"},
 	{"translatelegacychecksums",	A_N(translatelegacychecksums),
 		0, 0, "translatelegacychecksums"},
+	{"dumpdatabase",	A_ROB(dumpdatabase)|MAY_UNUSED,
+		1, 1, "dumpdatabase <file>"},
+	{"loaddatabase",	A_B(loaddatabase)|MAY_UNUSED,
+		1, 1, "loaddatabase <file>"},
+	{"compactdb",		A_B(compactdb)|MAY_UNUSED,
+		0, 2, "compactdb [pagesize=<bytes>] [fill=<percent>]"},
+	{"compresschunks",	A_Bact(compresschunks),
+		0, -1, "[-C <component> ] [-A <architecture>] [-T <packagetype>] compresschunks [<distributions>]"},
+	{"uncompresschunks",	A_Bact(uncompresschunks),
+		0, -1, "[-C <component> ] [-A <architecture>] [-T <packagetype>] uncompresschunks [<distributions>]"},
 	{"_listconfidentifiers",	A_C(listconfidentifiers),
 		0, -1, "_listconfidentifiers"},
 	{"_listdbidentifiers",	A_ROB(listdbidentifiers)|MAY_UNUSED,
@@ -4120,6 +4447,8 @@ static const struct action {
 		0, 0, "[--delete] clearvanished"},
 	{"processincoming",	A_D(processincoming)|NEED_DELNEW,
 		1, 2, "processincoming <rule-name> [<.changes file>]"},
+	{"watchincoming",	A_D(watchincoming)|NEED_DELNEW,
+		1, 1, "watchincoming <rule-name>"},
 	{"gensnapshot",		A_R(gensnapshot),
 		2, 2, "gensnapshot <distribution> <date or other name>"},
 	{"unreferencesnapshot",	A__R(unreferencesnapshot),
@@ -4158,6 +4487,7 @@ static retvalue callaction(command_t command, const struct action *action, int a
 	struct atomlist as, *architectures = NULL;
 	struct atomlist cs, *components = NULL;
 	struct atomlist ps, *packagetypes = NULL;
+	struct timing tm;
 
 	assert(action != NULL);
 
@@ -4224,7 +4554,9 @@ static retvalue callaction(command_t command, const struct action *action, int a
 	if (ISSET(needs, NEED_DATABASE))
 		needs |= NEED_CONFIG;
 	if (ISSET(needs, NEED_CONFIG)) {
+		timing_start(&tm);
 		r = distribution_readall(&alldistributions);
+		timing_stop(tp_config, NULL, &tm);
 		if (RET_WAS_ERROR(r))
 			return r;
 	}
@@ -4322,10 +4654,12 @@ static retvalue callaction(command_t command, const struct action *action, int a
 	deletederef = ISSET(needs, NEED_DEREF) && !keepunreferenced;
 	deletenew = ISSET(needs, NEED_DELNEW) && !keepunusednew;
 
+	timing_start(&tm);
 	result = database_create(alldistributions,
 			fast, ISSET(needs, NEED_NO_PACKAGES),
 			ISSET(needs, MAY_UNUSED), ISSET(needs, IS_RO),
 			waitforlock, verbosedatabase || (verbose >= 30));
+	timing_stop(tp_database, NULL, &tm);
 	if (!RET_IS_OK(result)) {
 		(void)distribution_freelist(alldistributions);
 		return result;
@@ -4417,7 +4751,9 @@ static retvalue callaction(command_t command, const struct action *action, int a
 		atomlist_done(&ps);
 	}
 	logger_warn_waiting();
+	timing_start(&tm);
 	r = database_close();
+	timing_stop(tp_database, NULL, &tm);
 	RET_ENDUPDATE(result, r);
 	r = distribution_freelist(alldistributions);
 	RET_ENDUPDATE(result, r);
@@ -4435,6 +4771,7 @@ LO_ONLYSMALLDELETES,
 LO_KEEPDIRECTORIES,
 LO_KEEPTEMPORARIES,
 LO_FAST,
+LO_VERIFY,
 LO_SKIPOLD,
 LO_GUESSGPGTTY,
 LO_NODELETE,
@@ -4448,6 +4785,7 @@ LO_NOONLYSMALLDELETES,
 LO_NOKEEPDIRECTORIES,
 LO_NOKEEPTEMPORARIES,
 LO_NOFAST,
+LO_NOVERIFY,
 LO_NOSKIPOLD,
 LO_NOGUESSGPGTTY,
 LO_VERBOSEDB,
@@ -4483,6 +4821,11 @@ LO_RESTRICT_FILE_BIN,
 LO_RESTRICT_FILE_SRC,
 LO_ENDHOOK,
 LO_OUTHOOK,
+LO_LINKSNAPSHOTS,
+LO_NOLINKSNAPSHOTS,
+LO_TIMINGS,
+LO_NOTIMINGS,
+LO_STATSJSON,
 LO_UNIGNORE};
 static int longoption = 0;
 const char *programname;
@@ -4646,6 +4989,21 @@ static void handle_option(int c, const char *argument) {
 				case LO_NOKEEPDIRECTORIES:
 					CONFIGGSET(keepdirectories, false);
 					break;
+				case LO_LINKSNAPSHOTS:
+					CONFIGGSET(linksnapshots, true);
+					break;
+				case LO_NOLINKSNAPSHOTS:
+					CONFIGGSET(linksnapshots, false);
+					break;
+				case LO_TIMINGS:
+					CONFIGSET(timings, true);
+					break;
+				case LO_NOTIMINGS:
+					CONFIGSET(timings, false);
+					break;
+				case LO_STATSJSON:
+					CONFIGDUP(statsjson, argument);
+					break;
 				case LO_NOTHINGISERROR:
 					CONFIGSET(nothingiserror, true);
 					break;
@@ -4682,6 +5040,12 @@ static void handle_option(int c, const char *argument) {
 				case LO_NOFAST:
 					CONFIGSET(fast, false);
 					break;
+				case LO_VERIFY:
+					CONFIGSET(verify, true);
+					break;
+				case LO_NOVERIFY:
+					CONFIGSET(verify, false);
+					break;
 				case LO_VERBOSEDB:
 					CONFIGSET(verbosedatabase, true);
 					break;
@@ -4934,6 +5298,7 @@ static void myexit(int status) {
 	free(gnupghome);
 	free(endhook);
 	free(outhook);
+	free(statsjson);
 	pool_free();
 	exit(status);
 }
@@ -5052,12 +5417,19 @@ int main(int argc, char *argv[]) {
 		{"noonlysmalldeletes", no_argument, &longoption, LO_NOONLYSMALLDELETES},
 		{"nokeepdirectories", no_argument, &longoption, LO_NOKEEPDIRECTORIES},
 		{"nokeeptemporaries", no_argument, &longoption, LO_NOKEEPTEMPORARIES},
+		{"linksnapshots", no_argument, &longoption, LO_LINKSNAPSHOTS},
+		{"nolinksnapshots", no_argument, &longoption, LO_NOLINKSNAPSHOTS},
+		{"timings", no_argument, &longoption, LO_TIMINGS},
+		{"notimings", no_argument, &longoption, LO_NOTIMINGS},
+		{"stats-json", required_argument, &longoption, LO_STATSJSON},
 		{"noask-passphrase", no_argument, &longoption, LO_NOASKPASSPHRASE},
 		{"guessgpgtty", no_argument, &longoption, LO_GUESSGPGTTY},
 		{"noguessgpgtty", no_argument, &longoption, LO_NOGUESSGPGTTY},
 		{"nonoguessgpgtty", no_argument, &longoption, LO_GUESSGPGTTY},
 		{"fast", no_argument, &longoption, LO_FAST},
 		{"nofast", no_argument, &longoption, LO_NOFAST},
+		{"verify", no_argument, &longoption, LO_VERIFY},
+		{"noverify", no_argument, &longoption, LO_NOVERIFY},
 		{"verbosedb", no_argument, &longoption, LO_VERBOSEDB},
 		{"noverbosedb", no_argument, &longoption, LO_NOVERBOSEDB},
 		{"verbosedatabase", no_argument, &longoption, LO_VERBOSEDB},
@@ -5279,9 +5651,14 @@ int main(int argc, char *argv[]) {
 	a = all_actions;
 	while (a->name != NULL) {
 		if (strcasecmp(a->name, argv[optind]) == 0) {
+			retvalue r2;
+
 			signature_init(askforpassphrase);
+			timings_enabled = timings || statsjson != NULL;
 			r = callaction(1 + (a - all_actions), a,
 					argc-optind, (const char**)argv+optind);
+			r2 = timing_report(timings, statsjson);
+			RET_ENDUPDATE(r, r2);
 			/* yeah, freeing all this stuff before exiting is
 			 * stupid, but it makes valgrind logs easier
 			 * readable */
@@ -35,4 +35,23 @@ static inline bool endswith(const char *name, const char *suffix) {
 	return ln > ls && strcmp(name + (ln - ls), suffix) == 0;
 }
 
+/* FNV-1a, used for hash tables and to notice when some configuration
+ * changed (so the results must never change) */
+#define HASH_INIT 14695981039346656037ULL
+
+static inline unsigned long long hash_bytes(unsigned long long hash, const char *s, size_t len) {
+	while (len-- > 0) {
+		hash ^= (unsigned char)*(s++);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/* fold a string (including the final '\0', NULL as "") into a hash */
+static inline unsigned long long hash_add(unsigned long long hash, /*@null@*/const char *s) {
+	if (s == NULL)
+		s = "";
+	return hash_bytes(hash, s, strlen(s) + 1);
+}
+
 #endif
@@ -190,6 +190,7 @@ retvalue outhook_call(const char *scriptname) {
 		result = callouthook(scriptname, outlogfilename);
 	}
 	outlogfile = NULL;
+	outlognonempty = false;
 	free(outlogfilename);
 	outlogfilename = NULL;
 	return result;
@@ -46,16 +46,36 @@ struct overridepackage {
 struct overridepattern {
 	struct overridepattern *next;
 	char *pattern;
+	/* literal start and end of the pattern, to rule out most
+	 * names without having to call globmatch */
+	size_t prefixlen, suffixlen;
+	const char *suffix;
+	/* position in the file */
+	size_t number;
 	struct overridedata data;
 };
 
+/* patterns with a literal first character are sorted into the list of
+ * that character, all others (starting with *, ? or [) into the last */
+#define PATTERNLISTS 257
+
 struct overridefile {
 	/* a <search.h> tree root of struct overridepackage */
 	void *packages;
-	struct overridepattern *patterns;
+	struct overridepattern *patterns, **lastpattern;
+	size_t patterncount;
+	/* a <search.h> tree root of struct overridepattern */
+	void *patterntree;
+	/* all patterns in file order, grouped by first character:
+	 * patterns of list c are bystart[start[c]..start[c+1]-1] */
+	struct overridepattern **bystart;
+	size_t start[PATTERNLISTS + 1];
 };
 
 #ifdef HAVE_TDESTROY
+static void nofree(UNUSED(void *n)) {
+}
+
 static void freeoverridepackage(void *n) {
 	struct overridepackage *p = n;
 
@@ -73,7 +93,10 @@ void override_free(struct overridefile *info) {
 
 #ifdef HAVE_TDESTROY
 	tdestroy(info->packages, freeoverridepackage);
+	/* the patterns themselves are freed from the list below */
+	tdestroy(info->patterntree, nofree);
 #endif
+	free(info->bystart);
 	while ((i = info->patterns) != NULL) {
 		if (i == NULL)
 			return;
@@ -172,42 +195,124 @@ static int opackage_compare(const void *a, const void *b) {
 	return strcmp(p1->packagename, p2->packagename);
 }
 
+static inline bool isglobspecial(char c) {
+	return c == '*' || c == '?' || c == '[' || c == ']';
+}
+
+static struct overridepattern *new_pattern(const char *pattern) {
+	struct overridepattern *p;
+	size_t len;
+
+	p = zNEW(struct overridepattern);
+	if (FAILEDTOALLOC(p))
+		return NULL;
+	p->pattern = strdup(pattern);
+	if (FAILEDTOALLOC(p->pattern)) {
+		free(p);
+		return NULL;
+	}
+	/* characters before the first special one must be at the start
+	 * of the name, those after the last at its end: */
+	len = strlen(pattern);
+	while (p->prefixlen < len && !isglobspecial(pattern[p->prefixlen]))
+		p->prefixlen++;
+	while (p->suffixlen < len - p->prefixlen &&
+			!isglobspecial(pattern[len - p->suffixlen - 1]))
+		p->suffixlen++;
+	p->suffix = p->pattern + len - p->suffixlen;
+	return p;
+}
+
+static int opattern_compare(const void *a, const void *b) {
+	const struct overridepattern *p1 = a, *p2 = b;
+
+	return strcmp(p1->pattern, p2->pattern);
+}
+
+static inline bool before(const struct overridepattern *a, const struct overridepattern *b) {
+	return a->number < b->number;
+}
+
+static retvalue index_patterns(struct overridefile *i) {
+	struct overridepattern *p;
+	size_t count[PATTERNLISTS], c, n;
+
+	memset(count, 0, sizeof(count));
+	n = 0;
+	for (p = i->patterns ; p != NULL ; p = p->next) {
+		c = (p->prefixlen > 0) ? (unsigned char)p->pattern[0] : 256;
+		count[c]++;
+		n++;
+	}
+	i->bystart = nNEW(n, struct overridepattern *);
+	if (FAILEDTOALLOC(i->bystart))
+		return RET_ERROR_OOM;
+	i->start[0] = 0;
+	for (c = 0 ; c < PATTERNLISTS ; c++) {
+		i->start[c + 1] = i->start[c] + count[c];
+		count[c] = i->start[c];
+	}
+	for (p = i->patterns ; p != NULL ; p = p->next) {
+		c = (p->prefixlen > 0) ? (unsigned char)p->pattern[0] : 256;
+		i->bystart[count[c]++] = p;
+	}
+	return RET_OK;
+}
+
+static inline bool pattern_matches(const struct overridepattern *p, const char *package, size_t len) {
+	if (len < p->prefixlen + p->suffixlen)
+		return false;
+	if (memcmp(package, p->pattern, p->prefixlen) != 0)
+		return false;
+	if (memcmp(package + len - p->suffixlen, p->suffix,
+				p->suffixlen) != 0)
+		return false;
+	return globmatch(package, p->pattern);
+}
+
 static retvalue add_override(struct overridefile *i, const char *firstpart, const char *secondpart, const char *thirdpart, bool source) {
 	struct overridepackage *pkg, **node;
 	retvalue r;
 	const char *c;
-	struct overridepattern *p, **l;
+	struct overridepattern *p;
 
 	c = firstpart;
 	while (*c != '\0' && *c != '*' && *c != '[' && *c != '?')
 		c++;
 	if (*c != '\0') {
+		struct overridepattern key, **pnode;
+
 		/* This is a pattern, put into the pattern list */
-		l = &i->patterns;
-		while ((p = *l) != NULL
-				&& strcmp(p->pattern, firstpart) != 0) {
-			l = &p->next;
-		}
-		if (p == NULL) {
-			p = zNEW(struct overridepattern);
-			if (FAILEDTOALLOC(p))
-				return RET_ERROR_OOM;
-			p->pattern = strdup(firstpart);
-			if (FAILEDTOALLOC(p->pattern)) {
-				free(p);
-				return RET_ERROR_OOM;
-			}
-		}
+		key.pattern = (char *)firstpart;
+		pnode = tfind(&key, &i->patterntree, opattern_compare);
+		if (pnode != NULL)
+			return add_override_field(&(*pnode)->data,
+					secondpart, thirdpart, source);
+
+		p = new_pattern(firstpart);
+		if (FAILEDTOALLOC(p))
+			return RET_ERROR_OOM;
 		r = add_override_field(&p->data,
 				secondpart, thirdpart, source);
 		if (RET_WAS_ERROR(r)) {
-			if (*l != p) {
-				free(p->pattern);
-				free(p);
-			}
+			strlist_done(&p->data.fields);
+			free(p->pattern);
+			free(p);
 			return r;
 		}
-		*l = p;
+		pnode = tsearch(p, &i->patterntree, opattern_compare);
+		if (FAILEDTOALLOC(pnode)) {
+			strlist_done(&p->data.fields);
+			free(p->pattern);
+			free(p);
+			return RET_ERROR_OOM;
+		}
+		assert (*pnode == p);
+		p->number = i->patterncount++;
+		if (i->lastpattern == NULL)
+			i->lastpattern = &i->patterns;
+		*i->lastpattern = p;
+		i->lastpattern = &p->next;
 		return RET_OK;
 	}
 
@@ -306,6 +411,14 @@ retvalue override_read(const char *filename, struct overridefile **info, bool so
 		}
 	}
 	(void)fclose(file);
+	if (i->patterns != NULL) {
+		retvalue r = index_patterns(i);
+
+		if (RET_WAS_ERROR(r)) {
+			override_free(i);
+			return r;
+		}
+	}
 	if (i->packages != NULL || i->patterns != NULL) {
 		*info = i;
 		return RET_OK;
@@ -318,7 +431,8 @@ retvalue override_read(const char *filename, struct overridefile **info, bool so
 
 const struct overridedata *override_search(const struct overridefile *overrides, const char *package) {
 	struct overridepackage pkg, **node;
-	struct overridepattern *p;
+	struct overridepattern * const *p, * const *pend, * const *w, * const *wend;
+	size_t len;
 
 	if (overrides == NULL)
 		return NULL;
@@ -327,9 +441,26 @@ const struct overridedata *override_search(const struct overridefile *overrides,
 	node = tfind(&pkg, &overrides->packages, opackage_compare);
 	if (node != NULL && *node != NULL)
 		return &(*node)->data;
-	for (p = overrides->patterns ; p != NULL ; p = p->next) {
-		if (globmatch(package, p->pattern))
-			return &p->data;
+	if (overrides->bystart == NULL)
+		return NULL;
+	/* only patterns starting with the first character of the name
+	 * or with something special can match. Look at both lists at
+	 * the same time, so the first pattern in the file wins: */
+	len = strlen(package);
+	p = overrides->bystart + overrides->start[(unsigned char)package[0]];
+	pend = overrides->bystart +
+		overrides->start[(unsigned char)package[0] + 1];
+	w = overrides->bystart + overrides->start[256];
+	wend = overrides->bystart + overrides->start[257];
+	while (p < pend || w < wend) {
+		const struct overridepattern *next;
+
+		if (w >= wend || (p < pend && before(*p, *w)))
+			next = *(p++);
+		else
+			next = *(w++);
+		if (pattern_matches(next, package, len))
+			return &next->data;
 	}
 	return NULL;
 }
@@ -2,6 +2,9 @@
 #define REPREPRO_PACKAGE_H
 
 #include "atoms.h"
+#ifndef REPREPRO_CHUNKS_H
+#include "chunks.h"
+#endif
 
 struct package {
 	/*@temp@*/ struct target *target;
@@ -17,6 +20,9 @@ struct package {
 	/* used to keep the memory that might be needed for the above,
 	 * only to be used to free once this struct is abandoned */
 	char *pkgchunk, *pkgname, *pkgversion, *pkgsource, *pkgsrcversion;
+	/* if not NULL, version and source are extracted into this instead
+	 * (only valid until the cursor moves on) */
+	/*@null@*/struct chunkarena *arena;
 };
 struct distribution;
 struct target;
@@ -69,6 +75,7 @@ struct package_cursor {
 	struct cursor *cursor;
 	struct package current;
 	bool close_database;
+	struct chunkarena arena;
 };
 
 retvalue package_openiterator(struct target *, bool /*readonly*/, /*@out@*/struct package_cursor *);
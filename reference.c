@@ -26,23 +26,161 @@
 #include "error.h"
 #include "strlist.h"
 #include "names.h"
+#include "mprintf.h"
 #include "dirs.h"
 #include "database_p.h"
 #include "pool.h"
 #include "reference.h"
+#include "sizes.h"
+
+/* referencedby.db lists for every filekey the ids of everything needing
+ * it, referees.db has for every referee (like "codename|component|arch"
+ * or "s=codename=name") its id as "=<name>" and the name as "#<id>"
+ * (and the next free id as "nextid", and the sizes of each distribution
+ * as "+<codename>" if they are kept, see sizes.c).
+ * Ids are stored as REFEREEID_LEN bytes of 7 bits each (highest first,
+ * the top bit always set, so there is no '\0' and they sort by number).
+ * (Older versions had only references.db with the names as data,
+ * which is converted by references_translate). */
+
+#define REFEREEID_LEN 4
+#define REFEREEID_MAX ((1UL << (7 * REFEREEID_LEN)) - 1)
+typedef char refereeid[REFEREEID_LEN + 1];
+
+static const char nextidkey[] = "nextid";
+
+static void encodeid(unsigned long id, refereeid encoded) {
+	int i;
+
+	assert (id <= REFEREEID_MAX);
+	for (i = REFEREEID_LEN - 1 ; i >= 0 ; i--) {
+		encoded[i] = (char)(0x80 | (id & 0x7F));
+		id >>= 7;
+	}
+	encoded[REFEREEID_LEN] = '\0';
+}
+
+static inline void idkey(unsigned long id, char key[REFEREEID_LEN + 2]) {
+	key[0] = '#';
+	encodeid(id, key + 1);
+}
+
+bool references_decodeid(const char *data, size_t len, unsigned long *id_p) {
+	unsigned long id = 0;
+	size_t i;
+
+	if (len != REFEREEID_LEN)
+		return false;
+	for (i = 0 ; i < REFEREEID_LEN ; i++) {
+		unsigned char c = data[i];
+
+		if ((c & 0x80) == 0)
+			return false;
+		id = (id << 7) | (c & 0x7F);
+	}
+	*id_p = id;
+	return true;
+}
+
+/* get the id of a referee, RET_NOTHING if it has none and create is false */
+static retvalue referee_getid(const char *referee, bool create, refereeid encoded) {
+	const char *data;
+	size_t len;
+	unsigned long id;
+	retvalue r;
+	char buffer[30], key[REFEREEID_LEN + 2], *namekey;
+
+	namekey = mprintf("=%s", referee);
+	if (FAILEDTOALLOC(namekey))
+		return RET_ERROR_OOM;
+	r = table_gettemprecord(rdb_referees, namekey, &data, &len);
+	if (RET_IS_OK(r)) {
+		free(namekey);
+		if (!references_decodeid(data, len, &id)) {
+			fprintf(stderr,
+"Corrupted id of '%s' in referees.db!\n", referee);
+			return RET_ERROR;
+		}
+		memcpy(encoded, data, REFEREEID_LEN + 1);
+		return RET_OK;
+	}
+	if (RET_WAS_ERROR(r) || !create) {
+		free(namekey);
+		return r;
+	}
+
+	r = table_gettemprecord(rdb_referees, nextidkey, &data, NULL);
+	if (RET_WAS_ERROR(r)) {
+		free(namekey);
+		return r;
+	}
+	id = 1;
+	if (RET_IS_OK(r))
+		id = strtoul(data, NULL, 10);
+	if (id == 0 || id > REFEREEID_MAX) {
+		fprintf(stderr,
+"No more ids available for new referees in referees.db!\n");
+		free(namekey);
+		return RET_ERROR;
+	}
+	encodeid(id, encoded);
+	idkey(id, key);
+	snprintf(buffer, sizeof(buffer), "%lu", id + 1);
+	r = table_adduniqsizedrecord(rdb_referees, nextidkey,
+			buffer, strlen(buffer) + 1, true, false);
+	if (!RET_WAS_ERROR(r))
+		r = table_adduniqsizedrecord(rdb_referees, key,
+				referee, strlen(referee) + 1, false, false);
+	if (!RET_WAS_ERROR(r))
+		r = table_adduniqsizedrecord(rdb_referees, namekey,
+				encoded, REFEREEID_LEN + 1, false, false);
+	free(namekey);
+	return r;
+}
+
+retvalue references_refereename(unsigned long id, char **name_p) {
+	char key[REFEREEID_LEN + 2];
+	const char *name;
+	retvalue r;
+
+	idkey(id, key);
+	r = table_gettemprecord(rdb_referees, key, &name, NULL);
+	if (r == RET_NOTHING) {
+		fprintf(stderr, "Unknown referee id %lu in referees.db!\n",
+				id);
+		return RET_ERROR;
+	}
+	if (RET_WAS_ERROR(r))
+		return r;
+	*name_p = strdup(name);
+	if (FAILEDTOALLOC(*name_p))
+		return RET_ERROR_OOM;
+	return RET_OK;
+}
 
 retvalue references_isused( const char *what) {
 	return table_gettemprecord(rdb_references, what, NULL, NULL);
 }
 
 retvalue references_check(const char *referee, const struct strlist *filekeys) {
+	refereeid id;
 	int i;
 	retvalue result, r;
 
+	r = referee_getid(referee, false, id);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (r == RET_NOTHING)
+		/* with no id it cannot be found anywhere */
+		id[0] = '\0';
+
 	result = RET_NOTHING;
 	for (i = 0 ; i < filekeys->count ; i++) {
-		r = table_checkrecord(rdb_references,
-				filekeys->values[i], referee);
+		if (id[0] != '\0')
+			r = table_checkrecord(rdb_references,
+					filekeys->values[i], id);
+		else
+			r = RET_NOTHING;
 		if (r == RET_NOTHING) {
 			fprintf(stderr, "Missing reference to '%s' by '%s'\n",
 					filekeys->values[i], referee);
@@ -53,22 +191,43 @@ retvalue references_check(const char *referee, const struct strlist *filekeys) {
 	return result;
 }
 
-/* add an reference to a file for an identifier. multiple calls */
-retvalue references_increment(const char *needed, const char *neededby) {
+/* tell the size accounting about an added or removed reference */
+static retvalue sizechanged(const char *filekey, const refereeid id, bool added) {
+	unsigned long n;
+
+	if (!references_decodeid(id, REFEREEID_LEN, &n))
+		return RET_ERROR;
+	return sizes_referencechanged(filekey, n, added);
+}
+
+static retvalue increment(const char *needed, const refereeid id, const char *neededby) {
 	retvalue r;
 
 	r = table_addrecord(rdb_references, needed,
-			neededby, strlen(neededby), false);
+			id, REFEREEID_LEN, false);
 	if (RET_IS_OK(r) && verbose > 8)
 		printf("Adding reference to '%s' by '%s'\n", needed, neededby);
+	if (RET_IS_OK(r))
+		r = sizechanged(needed, id, true);
 	return r;
 }
 
-/* remove reference for a file from a given reference */
-retvalue references_decrement(const char *needed, const char *neededby) {
+/* add an reference to a file for an identifier. multiple calls */
+retvalue references_increment(const char *needed, const char *neededby) {
+	refereeid id;
+	retvalue r;
+
+	r = referee_getid(neededby, true, id);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
+		return r;
+	return increment(needed, id, neededby);
+}
+
+static retvalue decrement(const char *needed, const refereeid id, const char *neededby) {
 	retvalue r;
 
-	r = table_removerecord(rdb_references, needed, neededby);
+	r = table_removerecord(rdb_references, needed, id);
 	if (r == RET_NOTHING)
 		return r;
 	if (RET_WAS_ERROR(r)) {
@@ -82,16 +241,30 @@ retvalue references_decrement(const char *needed, const char *neededby) {
 				needed, neededby);
 	if (RET_IS_OK(r)) {
 		retvalue r2;
+		r2 = sizechanged(needed, id, false);
+		RET_UPDATE(r, r2);
 		r2 = pool_dereferenced(needed);
 		RET_UPDATE(r, r2);
 	}
 	return r;
 }
 
+/* remove reference for a file from a given reference */
+retvalue references_decrement(const char *needed, const char *neededby) {
+	refereeid id;
+	retvalue r;
+
+	r = referee_getid(neededby, false, id);
+	if (!RET_IS_OK(r))
+		return r;
+	return decrement(needed, id, neededby);
+}
+
 /* Add an reference by <identifier> for the given <files>,
  * excluding <exclude>, if it is nonNULL. */
 retvalue references_insert(const char *identifier,
 		const struct strlist *files, const struct strlist *exclude) {
+	refereeid id;
 	retvalue result, r;
 	int i;
 
@@ -101,7 +274,13 @@ retvalue references_insert(const char *identifier,
 		const char *filename = files->values[i];
 
 		if (exclude == NULL || !strlist_in(exclude, filename)) {
-			r = references_increment(filename, identifier);
+			if (result == RET_NOTHING) {
+				r = referee_getid(identifier, true, id);
+				assert (r != RET_NOTHING);
+				if (RET_WAS_ERROR(r))
+					return r;
+			}
+			r = increment(filename, id, identifier);
 			RET_UPDATE(result, r);
 		}
 	}
@@ -110,15 +289,41 @@ retvalue references_insert(const char *identifier,
 
 /* add possible already existing references */
 retvalue references_add(const char *identifier, const struct strlist *files) {
+	refereeid id;
 	int i;
+	bool accountsizes;
 	retvalue r;
 
+	if (files->count == 0)
+		return RET_OK;
+	r = referee_getid(identifier, true, id);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
+		return r;
+	r = sizes_needupdates();
+	if (RET_WAS_ERROR(r))
+		return r;
+	accountsizes = RET_IS_OK(r);
 	for (i = 0 ; i < files->count ; i++) {
 		const char *filekey = files->values[i];
+
+		if (accountsizes) {
+			/* only new ones change the sizes */
+			r = table_checkrecord(rdb_references, filekey, id);
+			if (RET_WAS_ERROR(r))
+				return r;
+			if (RET_IS_OK(r))
+				continue;
+		}
 		r = table_addrecord(rdb_references, filekey,
-				identifier, strlen(identifier), true);
+				id, REFEREEID_LEN, true);
 		if (RET_WAS_ERROR(r))
 			return r;
+		if (accountsizes) {
+			r = sizechanged(filekey, id, true);
+			if (RET_WAS_ERROR(r))
+				return r;
+		}
 	}
 	return RET_OK;
 }
@@ -126,18 +331,23 @@ retvalue references_add(const char *identifier, const struct strlist *files) {
 /* Remove reference by <identifier> for the given <oldfiles>,
  * excluding <exclude>, if it is nonNULL. */
 retvalue references_delete(const char *identifier, struct strlist *files, const struct strlist *exclude) {
+	refereeid id;
 	retvalue result, r;
 	int i;
 
 	assert (files != NULL);
 
+	r = referee_getid(identifier, false, id);
+	if (!RET_IS_OK(r))
+		return r;
+
 	result = RET_NOTHING;
 
 	for (i = 0 ; i < files->count ; i++) {
 		const char *filekey = files->values[i];
 
 		if (exclude == NULL || !strlist_in(exclude, filekey)) {
-			r = references_decrement(filekey, identifier);
+			r = decrement(filekey, id, identifier);
 			RET_UPDATE(result, r);
 		}
 	}
@@ -145,40 +355,124 @@ retvalue references_delete(const char *identifier, struct strlist *files, const
 
 }
 
-/* remove all references from a given identifier */
+static int compareids(const void *a, const void *b) {
+	unsigned long ia = *(const unsigned long*)a;
+	unsigned long ib = *(const unsigned long*)b;
+
+	return (ia > ib) - (ia < ib);
+}
+
+/* remove all references from a given identifier
+ * (and from all identifiers starting with it followed by a space) */
 retvalue references_remove(const char *neededby) {
 	struct cursor *cursor;
 	retvalue result, r;
 	const char *found_to, *found_by;
+	char *filekey;
 	size_t datalen, l;
+	unsigned long id, *ids = NULL;
+	int count = 0, size = 0, i;
 
-	r = table_newglobalcursor(rdb_references, &cursor);
+	l = strlen(neededby);
+
+	/* first look which ids are to be removed */
+	r = table_newglobalcursor(rdb_referees, &cursor);
 	if (!RET_IS_OK(r))
 		return r;
+	while (cursor_nexttempdata(rdb_referees, cursor,
+				&found_by, &found_to, &datalen)) {
+		if (*(found_by++) != '=')
+			continue;
+		if (strncmp(found_by, neededby, l) != 0 ||
+		    (found_by[l] != '\0' && found_by[l] != ' '))
+			continue;
+		if (!references_decodeid(found_to, datalen, &id))
+			continue;
+		if (count >= size) {
+			unsigned long *n;
 
-	l = strlen(neededby);
+			size = size * 2 + 8;
+			n = realloc(ids, size * sizeof(unsigned long));
+			if (FAILEDTOALLOC(n)) {
+				(void)cursor_close(rdb_referees, cursor);
+				free(ids);
+				return RET_ERROR_OOM;
+			}
+			ids = n;
+		}
+		ids[count++] = id;
+	}
+	r = cursor_close(rdb_referees, cursor);
+	if (RET_WAS_ERROR(r) || count == 0) {
+		free(ids);
+		return r;
+	}
+	qsort(ids, count, sizeof(unsigned long), compareids);
+
+	r = table_newglobalcursor(rdb_references, &cursor);
+	if (!RET_IS_OK(r)) {
+		free(ids);
+		return r;
+	}
 
 	result = RET_NOTHING;
 	while (cursor_nexttempdata(rdb_references, cursor,
 				&found_to, &found_by, &datalen)) {
 
-		if (datalen >= l && strncmp(found_by, neededby, l) == 0 &&
-		    (found_by[l] == '\0' || found_by[l] == ' ')) {
-			if (verbose > 8)
-				fprintf(stderr,
+		if (!references_decodeid(found_by, datalen, &id) ||
+				bsearch(&id, ids, count,
+					sizeof(unsigned long),
+					compareids) == NULL)
+			continue;
+		if (verbose > 8)
+			fprintf(stderr,
 "Removing reference to '%s' by '%s'\n",
-					found_to, neededby);
-			r = cursor_delete(rdb_references, cursor,
-					found_to, NULL);
-			RET_UPDATE(result, r);
-			if (RET_IS_OK(r)) {
-				r = pool_dereferenced(found_to);
-				RET_ENDUPDATE(result, r);
-			}
+				found_to, neededby);
+		/* found_to might point into the deleted record */
+		filekey = strdup(found_to);
+		if (FAILEDTOALLOC(filekey)) {
+			result = RET_ERROR_OOM;
+			break;
+		}
+		r = cursor_delete(rdb_references, cursor, filekey, NULL);
+		RET_UPDATE(result, r);
+		if (RET_IS_OK(r)) {
+			r = sizes_referencechanged(filekey, id, false);
+			RET_ENDUPDATE(result, r);
+		}
+		if (RET_IS_OK(r)) {
+			r = pool_dereferenced(filekey);
+			RET_ENDUPDATE(result, r);
 		}
+		free(filekey);
 	}
 	r = cursor_close(rdb_references, cursor);
 	RET_ENDUPDATE(result, r);
+
+	/* nothing refers to them any more, so forget their names */
+	for (i = 0 ; i < count && !RET_WAS_ERROR(result) ; i++) {
+		char key[REFEREEID_LEN + 2], *name, *namekey;
+
+		r = references_refereename(ids[i], &name);
+		if (RET_IS_OK(r)) {
+			namekey = mprintf("=%s", name);
+			free(name);
+			if (FAILEDTOALLOC(namekey))
+				r = RET_ERROR_OOM;
+			else {
+				r = table_deleterecord(rdb_referees,
+						namekey, true);
+				free(namekey);
+			}
+		}
+		RET_ENDUPDATE(result, r);
+		if (RET_WAS_ERROR(r))
+			break;
+		idkey(ids[i], key);
+		r = table_deleterecord(rdb_referees, key, true);
+		RET_ENDUPDATE(result, r);
+	}
+	free(ids);
 	return result;
 }
 
@@ -187,6 +481,9 @@ retvalue references_dump(void) {
 	struct cursor *cursor;
 	retvalue result, r;
 	const char *found_to, *found_by;
+	size_t datalen;
+	unsigned long id, lastid = 0;
+	char *name = NULL;
 
 	r = table_newglobalcursor(rdb_references, &cursor);
 	if (!RET_IS_OK(r))
@@ -194,8 +491,24 @@ retvalue references_dump(void) {
 
 	result = RET_OK;
 	while (cursor_nexttempdata(rdb_references, cursor,
-	                               &found_to, &found_by, NULL)) {
-		if (fputs(found_by, stdout) == EOF ||
+	                               &found_to, &found_by, &datalen)) {
+		if (!references_decodeid(found_by, datalen, &id)) {
+			fprintf(stderr,
+"Corrupted reference to '%s' in referencedby.db!\n", found_to);
+			result = RET_ERROR;
+			break;
+		}
+		if (name == NULL || id != lastid) {
+			free(name);
+			name = NULL;
+			r = references_refereename(id, &name);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+			lastid = id;
+		}
+		if (fputs(name, stdout) == EOF ||
 		    putchar(' ') == EOF ||
 		    puts(found_to) == EOF) {
 			result = RET_ERROR;
@@ -207,7 +520,58 @@ retvalue references_dump(void) {
 			break;
 		}
 	}
+	free(name);
 	r = cursor_close(rdb_references, cursor);
 	RET_ENDUPDATE(result, r);
 	return result;
 }
+
+/* convert the table "references" of older versions */
+retvalue references_translate(struct table *oldreferences) {
+	struct cursor *cursor;
+	retvalue result, r;
+	const char *filekey, *referee;
+	char *lastreferee = NULL;
+	refereeid id;
+	unsigned long count = 0;
+
+	r = table_newglobalcursor(oldreferences, &cursor);
+	if (!RET_IS_OK(r))
+		return r;
+	result = RET_NOTHING;
+	while (cursor_nexttempdata(oldreferences, cursor,
+				&filekey, &referee, NULL)) {
+		if (lastreferee == NULL || strcmp(lastreferee, referee) != 0) {
+			free(lastreferee);
+			lastreferee = strdup(referee);
+			if (FAILEDTOALLOC(lastreferee)) {
+				result = RET_ERROR_OOM;
+				break;
+			}
+			r = referee_getid(referee, true, id);
+			assert (r != RET_NOTHING);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
+		}
+		r = table_addrecord(rdb_references, filekey,
+				id, REFEREEID_LEN, true);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
+		result = RET_OK;
+		count++;
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			break;
+		}
+	}
+	free(lastreferee);
+	r = cursor_close(oldreferences, cursor);
+	RET_ENDUPDATE(result, r);
+	if (RET_IS_OK(result) && verbose > 0)
+		printf("Converted %lu references to the new format.\n", count);
+	return result;
+}
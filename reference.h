@@ -47,4 +47,12 @@ retvalue references_check(const char * /*referee*/, const struct strlist */*what
 /* output all references to stdout */
 retvalue references_dump(void);
 
+/* get the referee id from the data of a record in rdb_references */
+bool references_decodeid(const char *, size_t, /*@out@*/unsigned long *);
+/* get the name of a referee from its id */
+retvalue references_refereename(unsigned long, /*@out@*/char **);
+
+/* fill the tables from the one of older versions */
+retvalue references_translate(struct table *);
+
 #endif
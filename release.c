@@ -28,6 +28,10 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #include <zlib.h>
 #ifdef HAVE_LIBBZ2
 #include <bzlib.h>
@@ -49,6 +53,7 @@
 #include "distribution.h"
 #include "outhook.h"
 #include "release.h"
+#include "timings.h"
 
 #define INPUT_BUFFER_SIZE 1024
 #define GZBUFSIZE 40960
@@ -87,6 +92,10 @@ struct release {
 	struct signedfile *signedfile;
 	/* the cache database for old files */
 	struct table *cachedb;
+	/* for snapshots: the exported distribution to take
+	 * unchanged files from and its cache database */
+	/*@null@*/char *linkfromdir;
+	/*@null@*/struct table *linkcachedb;
 };
 
 static void release_freeentry(struct release_entry *e) {
@@ -116,6 +125,10 @@ void release_free(struct release *release) {
 	if (release->cachedb != NULL) {
 		table_close(release->cachedb);
 	}
+	free(release->linkfromdir);
+	if (release->linkcachedb != NULL) {
+		table_close(release->linkcachedb);
+	}
 	free(release);
 }
 
@@ -229,8 +242,9 @@ retvalue release_init(struct release **release, const char *codename, const char
 	return RET_OK;
 }
 
-retvalue release_initsnapshot(const char *codename, const char *name, struct release **release) {
+retvalue release_initsnapshot(const char *codename, const char *name, bool linkfiles, struct release **release) {
 	struct release *n;
+	retvalue r;
 
 	n = zNEW(struct release);
 	if (FAILEDTOALLOC(n))
@@ -259,6 +273,20 @@ retvalue release_initsnapshot(const char *codename, const char *name, struct rel
 		free(n);
 		return RET_ERROR_OOM;
 	}
+	if (linkfiles) {
+		n->linkfromdir = calc_dirconcat(global.distdir, codename);
+		if (FAILEDTOALLOC(n->linkfromdir)) {
+			release_free(n);
+			return RET_ERROR_OOM;
+		}
+		r = database_openreleasecache(codename, &n->linkcachedb);
+		assert (r != RET_NOTHING);
+		if (RET_WAS_ERROR(r)) {
+			n->linkcachedb = NULL;
+			release_free(n);
+			return r;
+		}
+	}
 	*release = n;
 	return RET_OK;
 }
@@ -379,16 +407,15 @@ static char *calc_compressedname(const char *name, enum indexcompression ic) {
 	}
 }
 
-static retvalue release_usecached(struct release *release,
-				const char *relfilename,
-				compressionset compressions) {
+/* look if all files (the uncompressed and every compression asked for)
+ * are in dir and the cache database knows their checksums.
+ * Returns RET_NOTHING if anything is missing or looks outdated */
+static retvalue getcachedchecksums(const char *dir, /*@null@*/struct table *cachedb, const char *relfilename, compressionset compressions, /*@out@*/char *filename[ic_count], /*@out@*/struct checksums *checksums[ic_count]) {
 	retvalue result, r;
 	enum indexcompression ic;
-	char *filename[ic_count];
-	struct checksums *checksums[ic_count];
 
-	memset(filename, 0, sizeof(filename));
-	memset(checksums, 0, sizeof(checksums));
+	memset(filename, 0, sizeof(char *) * ic_count);
+	memset(checksums, 0, sizeof(struct checksums *) * ic_count);
 	result = RET_OK;
 
 	for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
@@ -411,8 +438,7 @@ static retvalue release_usecached(struct release *release,
 			if ((compressions & IC_FLAG(ic)) == 0)
 				continue;
 			assert (filename[ic] != NULL);
-			fullfilename = calc_dirconcat(release->dirofdist,
-					filename[ic]);
+			fullfilename = calc_dirconcat(dir, filename[ic]);
 			if (FAILEDTOALLOC(fullfilename)) {
 				result = RET_ERROR_OOM;
 				break;
@@ -425,11 +451,13 @@ static retvalue release_usecached(struct release *release,
 			free(fullfilename);
 		}
 	}
-	if (RET_IS_OK(result) && release->cachedb == NULL)
+	if (RET_IS_OK(result) && cachedb == NULL)
 		result = RET_NOTHING;
 	if (!RET_IS_OK(result)) {
-		for (ic = ic_uncompressed ; ic < ic_count ; ic++)
+		for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
 			free(filename[ic]);
+			filename[ic] = NULL;
+		}
 		return result;
 	}
 
@@ -441,7 +469,7 @@ static retvalue release_usecached(struct release *release,
 
 		if (filename[ic] == NULL)
 			continue;
-		r = table_getrecord(release->cachedb, false, filename[ic],
+		r = table_getrecord(cachedb, false, filename[ic],
 				&combinedchecksum, NULL);
 		if (!RET_IS_OK(r)) {
 			result = r;
@@ -462,8 +490,7 @@ static retvalue release_usecached(struct release *release,
 			char *fullfilename;
 			if (filename[ic] == NULL)
 				continue;
-			fullfilename = calc_dirconcat(release->dirofdist,
-					filename[ic]);
+			fullfilename = calc_dirconcat(dir, filename[ic]);
 			if (FAILEDTOALLOC(fullfilename))
 				r = RET_ERROR_OOM;
 			else
@@ -485,15 +512,29 @@ static retvalue release_usecached(struct release *release,
 	}
 	if (!RET_IS_OK(result)) {
 		for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
-			if (filename[ic] == NULL)
-				continue;
 			free(filename[ic]);
+			filename[ic] = NULL;
 			checksums_free(checksums[ic]);
+			checksums[ic] = NULL;
 		}
-		return result;
 	}
+	return result;
+}
+
+static retvalue release_usecached(struct release *release,
+				const char *relfilename,
+				compressionset compressions) {
+	retvalue result, r;
+	enum indexcompression ic;
+	char *filename[ic_count];
+	struct checksums *checksums[ic_count];
+
+	result = getcachedchecksums(release->dirofdist, release->cachedb,
+			relfilename, compressions, filename, checksums);
+	if (!RET_IS_OK(result))
+		return result;
+
 	/* everything found, commit it: */
-	result = RET_OK;
 	for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
 		if (filename[ic] == NULL)
 			continue;
@@ -505,6 +546,238 @@ static retvalue release_usecached(struct release *release,
 	return result;
 }
 
+/* place a file already exported somewhere else (for snapshots or
+ * distributions with the same content) as hardlink or (if that is not
+ * possible) as reflink */
+static retvalue linkexported(const char *from, const char *to) {
+	int e;
+#ifdef FICLONE
+	int fromfd, tofd;
+#endif
+
+	(void)unlink(to);
+	if (link(from, to) == 0)
+		return RET_OK;
+	e = errno;
+#ifdef FICLONE
+	if (e != EXDEV && e != EPERM && e != EMLINK)
+		goto failed;
+	fromfd = open(from, O_RDONLY|O_NOCTTY);
+	if (fromfd < 0) {
+		e = errno;
+		goto failed;
+	}
+	tofd = open(to, O_WRONLY|O_CREAT|O_EXCL|O_NOCTTY, 0666);
+	if (tofd < 0) {
+		e = errno;
+		(void)close(fromfd);
+		goto failed;
+	}
+	if (ioctl(tofd, FICLONE, fromfd) == 0) {
+		(void)close(fromfd);
+		if (close(tofd) == 0)
+			return RET_OK;
+		e = errno;
+	} else {
+		e = errno;
+		(void)close(fromfd);
+		(void)close(tofd);
+	}
+	(void)unlink(to);
+failed:
+#endif
+	if (verbose > 1)
+		fprintf(stderr,
+"Could not link '%s' to '%s': %s. Regenerating it instead.\n",
+				from, to, strerror(e));
+	return RET_NOTHING;
+}
+
+static retvalue release_linkcached(struct release *release,
+				const char *relfilename,
+				compressionset compressions) {
+	retvalue result, r;
+	enum indexcompression ic;
+	char *filename[ic_count];
+	struct checksums *checksums[ic_count];
+
+	assert (release->linkfromdir != NULL);
+
+	result = getcachedchecksums(release->linkfromdir, release->linkcachedb,
+			relfilename, compressions, filename, checksums);
+	if (!RET_IS_OK(result))
+		return result;
+
+	for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
+		char *from, *to;
+
+		struct stat s;
+
+		/* the uncompressed file might only be listed in Release */
+		if ((compressions & IC_FLAG(ic)) == 0)
+			continue;
+		assert (filename[ic] != NULL);
+		from = calc_dirconcat(release->linkfromdir, filename[ic]);
+		to = calc_dirconcat(release->dirofdist, filename[ic]);
+		if (FAILEDTOALLOC(from) || FAILEDTOALLOC(to))
+			result = RET_ERROR_OOM;
+		else if (stat(from, &s) != 0 || s.st_size !=
+				checksums_getfilesize(checksums[ic]))
+			/* changed since the cache was written */
+			result = RET_NOTHING;
+		else
+			result = linkexported(from, to);
+		free(from);
+		free(to);
+		if (!RET_IS_OK(result))
+			break;
+	}
+	if (!RET_IS_OK(result)) {
+		/* files already linked are simply replaced
+		 * when generating this file normally */
+		for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
+			free(filename[ic]);
+			checksums_free(checksums[ic]);
+		}
+		return result;
+	}
+	for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
+		if (filename[ic] == NULL)
+			continue;
+		r = newreleaseentry(release, filename[ic],
+				checksums[ic],
+				NULL, NULL, NULL);
+		RET_UPDATE(result, r);
+	}
+	return result;
+}
+
+/* forget the cached checksums of some file of a distribution, so that
+ * it is neither kept (onlyifmissing) nor reused by --linksnapshots or
+ * by clones before it was exported again */
+retvalue release_forgetcached(const char *codename, const char *relfilename) {
+	retvalue result, r;
+	enum indexcompression ic;
+	struct table *cachedb;
+
+	r = database_openreleasecache(codename, &cachedb);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r))
+		return r;
+	result = RET_OK;
+	for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
+		char *filename;
+
+		filename = calc_compressedname(relfilename, ic);
+		if (FAILEDTOALLOC(filename)) {
+			result = RET_ERROR_OOM;
+			break;
+		}
+		r = table_deleterecord(cachedb, filename, true);
+		free(filename);
+		RET_UPDATE(result, r);
+	}
+	r = table_close(cachedb);
+	RET_ENDUPDATE(result, r);
+	return result;
+}
+
+/* use the file as exported for another distribution (which is known to
+ * have the same content) instead of generating it again.
+ * Only files still in the other distribution's cache are used, which
+ * are those exported after the last change there (see release_forgetcached).
+ * Returns RET_NOTHING if that is not available */
+retvalue release_usefromother(struct release *release, const char *othercodename, const char *relfilename, compressionset compressions) {
+	retvalue result, r;
+	enum indexcompression ic;
+	char *filename[ic_count];
+	struct checksums *checksums[ic_count];
+	char *tmpfilename[ic_count];
+	struct table *othercachedb;
+	char *otherdir;
+
+	otherdir = calc_dirconcat(global.distdir, othercodename);
+	if (FAILEDTOALLOC(otherdir))
+		return RET_ERROR_OOM;
+	r = database_openreleasecache(othercodename, &othercachedb);
+	assert (r != RET_NOTHING);
+	if (RET_WAS_ERROR(r)) {
+		free(otherdir);
+		return r;
+	}
+	result = getcachedchecksums(otherdir, othercachedb,
+			relfilename, compressions, filename, checksums);
+	r = table_close(othercachedb);
+	RET_ENDUPDATE(result, r);
+	if (!RET_IS_OK(result)) {
+		free(otherdir);
+		return result;
+	}
+
+	memset(tmpfilename, 0, sizeof(tmpfilename));
+	for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
+		char *from;
+		struct stat s;
+
+		/* the uncompressed file might only be listed in Release */
+		if ((compressions & IC_FLAG(ic)) == 0)
+			continue;
+		assert (filename[ic] != NULL);
+		from = calc_dirconcat(otherdir, filename[ic]);
+		tmpfilename[ic] = mprintf("%s/%s.new", release->dirofdist,
+				filename[ic]);
+		if (FAILEDTOALLOC(from) || FAILEDTOALLOC(tmpfilename[ic]))
+			result = RET_ERROR_OOM;
+		else if (stat(from, &s) != 0 || s.st_size !=
+				checksums_getfilesize(checksums[ic]))
+			/* changed since the cache was written */
+			result = RET_NOTHING;
+		else
+			result = linkexported(from, tmpfilename[ic]);
+		free(from);
+		if (!RET_IS_OK(result))
+			break;
+	}
+	free(otherdir);
+	if (!RET_IS_OK(result)) {
+		for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
+			if (tmpfilename[ic] != NULL) {
+				(void)unlink(tmpfilename[ic]);
+				free(tmpfilename[ic]);
+			}
+			free(filename[ic]);
+			checksums_free(checksums[ic]);
+		}
+		return result;
+	}
+	release->new = true;
+	for (ic = ic_uncompressed ; ic < ic_count ; ic++) {
+		char *finalfilename;
+
+		if (filename[ic] == NULL)
+			continue;
+		if (tmpfilename[ic] == NULL) {
+			r = newreleaseentry(release, filename[ic],
+					checksums[ic], NULL, NULL, NULL);
+			RET_UPDATE(result, r);
+			continue;
+		}
+		finalfilename = calc_dirconcat(release->dirofdist,
+				filename[ic]);
+		if (FAILEDTOALLOC(finalfilename)) {
+			(void)unlink(tmpfilename[ic]);
+			free(tmpfilename[ic]);
+			free(filename[ic]);
+			checksums_free(checksums[ic]);
+			result = RET_ERROR_OOM;
+			continue;
+		}
+		r = newreleaseentry(release, filename[ic], checksums[ic],
+				finalfilename, tmpfilename[ic], NULL);
+		RET_UPDATE(result, r);
+	}
+	return result;
+}
 
 struct filetorelease {
 	retvalue state;
@@ -785,6 +1058,14 @@ static retvalue startfile(struct release *release, const char *filename, /*@null
 				return RET_NOTHING;
 			return r;
 		}
+	} else if (release->linkfromdir != NULL && symlinkas == NULL) {
+		retvalue r = release_linkcached(release, filename,
+				compressions);
+		if (r != RET_NOTHING) {
+			if (RET_IS_OK(r))
+				return RET_NOTHING;
+			return r;
+		}
 	}
 
 	n = zNEW(struct filetorelease);
@@ -1267,6 +1548,7 @@ static retvalue finishxz(struct filetorelease *f) {
 retvalue release_finishfile(struct release *release, struct filetorelease *file) {
 	retvalue result, r;
 	enum indexcompression i;
+	struct timing tm;
 
 	if (RET_WAS_ERROR(file->state)) {
 		r = file->state;
@@ -1290,7 +1572,10 @@ retvalue release_finishfile(struct release *release, struct filetorelease *file)
 		file->f[ic_uncompressed].fd = -1;
 	}
 	if (file->f[ic_gzip].fd >= 0) {
+		timing_start(&tm);
 		r = finishgz(file);
+		timing_stop(tp_compress, "gzip", &tm);
+		timing_count(tc_compressed, file->waiting_bytes);
 		if (RET_WAS_ERROR(r)) {
 			release_abortfile(file);
 			return r;
@@ -1305,7 +1590,10 @@ retvalue release_finishfile(struct release *release, struct filetorelease *file)
 	}
 #ifdef HAVE_LIBBZ2
 	if (file->f[ic_bzip2].fd >= 0) {
+		timing_start(&tm);
 		r = finishbz(file);
+		timing_stop(tp_compress, "bzip2", &tm);
+		timing_count(tc_compressed, file->waiting_bytes);
 		if (RET_WAS_ERROR(r)) {
 			release_abortfile(file);
 			return r;
@@ -1321,7 +1609,10 @@ retvalue release_finishfile(struct release *release, struct filetorelease *file)
 #endif
 #ifdef HAVE_LIBLZMA
 	if (file->f[ic_xz].fd >= 0) {
+		timing_start(&tm);
 		r = finishxz(file);
+		timing_stop(tp_compress, "xz", &tm);
+		timing_count(tc_compressed, file->waiting_bytes);
 		if (RET_WAS_ERROR(r)) {
 			release_abortfile(file);
 			return r;
@@ -1360,6 +1651,7 @@ retvalue release_finishfile(struct release *release, struct filetorelease *file)
 
 static retvalue release_processbuffer(struct filetorelease *file) {
 	retvalue result, r;
+	struct timing tm;
 
 	result = RET_OK;
 	assert (file->waiting_bytes == INPUT_BUFFER_SIZE);
@@ -1371,20 +1663,29 @@ static retvalue release_processbuffer(struct filetorelease *file) {
 	RET_UPDATE(result, r);
 
 	if (file->f[ic_gzip].relativefilename != NULL) {
+		timing_start(&tm);
 		r = writegz(file);
+		timing_stop(tp_compress, "gzip", &tm);
+		timing_count(tc_compressed, INPUT_BUFFER_SIZE);
 		RET_UPDATE(result, r);
 	}
 	RET_UPDATE(file->state, result);
 #ifdef HAVE_LIBBZ2
 	if (file->f[ic_bzip2].relativefilename != NULL) {
+		timing_start(&tm);
 		r = writebz(file);
+		timing_stop(tp_compress, "bzip2", &tm);
+		timing_count(tc_compressed, INPUT_BUFFER_SIZE);
 		RET_UPDATE(result, r);
 	}
 	RET_UPDATE(file->state, result);
 #endif
 #ifdef HAVE_LIBLZMA
 	if (file->f[ic_xz].relativefilename != NULL) {
+		timing_start(&tm);
 		r = writexz(file);
+		timing_stop(tp_compress, "xz", &tm);
+		timing_count(tc_compressed, INPUT_BUFFER_SIZE);
 		RET_UPDATE(result, r);
 	}
 	RET_UPDATE(file->state, result);
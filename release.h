@@ -30,7 +30,7 @@ typedef unsigned int compressionset; /* 1 << indexcompression */
 /* Initialize Release generation */
 retvalue release_init(struct release **, const char * /*codename*/, /*@null@*/const char * /*suite*/, /*@null@*/const char * /*fakeprefix*/);
 /* same but for a snapshot */
-retvalue release_initsnapshot(const char *codename, const char *name, struct release **);
+retvalue release_initsnapshot(const char *codename, const char *name, bool /*linkfiles*/, struct release **);
 
 retvalue release_mkdir(struct release *, const char * /*relativedirectory*/);
 
@@ -45,6 +45,10 @@ struct filetorelease;
 
 retvalue release_startfile(struct release *, const char * /*filename*/, compressionset, bool /*usecache*/, struct filetorelease **);
 retvalue release_startlinkedfile(struct release *, const char * /*filename*/, const char * /*symlinkas*/, compressionset, bool /*usecache*/, struct filetorelease **);
+/* reuse a file as exported by another distribution (RET_NOTHING if not possible) */
+retvalue release_usefromother(struct release *, const char * /*othercodename*/, const char * /*filename*/, compressionset);
+/* no longer trust the cached checksums of that file */
+retvalue release_forgetcached(const char * /*codename*/, const char * /*filename*/);
 void release_warnoldfileorlink(struct release *, const char *, compressionset);
 
 /* return true if an old file is already there */
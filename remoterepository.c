@@ -147,10 +147,15 @@ struct remote_index {
 
 	/* if using pdiffs, the content of the Packages.diff/Index: */
 	struct diffindex *diffindex;
-	/* the last patch queued to be applied */
-	char *patchfilename;
-	/*@dependant@*/const struct diffindex_patch *selectedpatch;
-	bool deletecompressedpatch;
+	/* the patches queued to be applied (all at once when all arrived) */
+	struct remote_patch {
+		/*@dependant@*/struct remote_index *index;
+		/*@dependant@*/const struct diffindex_patch *patch;
+		char *filename;
+		bool deletecompressed;
+	} *patches;
+	int patchcount, patchesmissing;
+	bool patchesfailed;
 
 	bool queued;
 	bool needed;
@@ -169,11 +174,22 @@ struct cachedlistfile {
 };
 
 
+static void remote_index_freepatches(struct remote_index *i) {
+	int k;
+
+	for (k = 0 ; k < i->patchcount ; k++)
+		free(i->patches[k].filename);
+	free(i->patches);
+	i->patches = NULL;
+	i->patchcount = 0;
+	i->patchesmissing = 0;
+}
+
 static void remote_index_free(/*@only@*/struct remote_index *i) {
 	if (i == NULL)
 		return;
 	free(i->cachefilename);
-	free(i->patchfilename);
+	remote_index_freepatches(i);
 	free(i->filename_in_release);
 	diffindex_free(i->diffindex);
 	checksums_free(i->oldchecksums);
@@ -927,25 +943,42 @@ retvalue remote_preparemetalists(struct aptmethodrun *run, bool nodownload) {
 	return RET_OK;
 }
 
+/* The checksums to remember in the done file: those of the uncompressed
+ * file if the Release file lists them, otherwise those of the first
+ * compressed form it lists. c_COUNT if there are none at all. */
+static enum compression remote_index_donecompression(const struct remote_index *ri) {
+	enum compression c;
+
+	for (c = 0 ; c < c_COUNT ; c++)
+		if (ri->ofs[c] >= 0)
+			return c;
+	return c_COUNT;
+}
+
 bool remote_index_isnew(/*@null@*/const struct remote_index *ri, struct donefile *done) {
 	const char *basefilename;
 	struct checksums *checksums;
 	bool hashes_missing, improves;
+	enum compression c;
+	size_t l;
 
-	/* files without uncompressed checksum cannot be tested */
-	if (ri->ofs[c_none] < 0)
+	/* files without any checksum cannot be tested */
+	c = remote_index_donecompression(ri);
+	if (c == c_COUNT)
 		return true;
 	/* if not there or the wrong files comes next, then something
 	 * has changed and we better reload everything */
 	if (!donefile_nextindex(done, &basefilename, &checksums))
 		return true;
-	if (strcmp(basefilename, ri->cachebasename) != 0) {
+	l = strlen(ri->cachebasename);
+	if (strncmp(basefilename, ri->cachebasename, l) != 0 ||
+			strcmp(basefilename + l, uncompression_suffix[c]) != 0) {
 		checksums_free(checksums);
 		return true;
 	}
 	/* otherwise check if the file checksums match */
 	if (!checksums_check(checksums,
-			ri->from->remotefiles.checksums[ri->ofs[c_none]],
+			ri->from->remotefiles.checksums[ri->ofs[c]],
 			&hashes_missing)) {
 		checksums_free(checksums);
 		return true;
@@ -956,7 +989,7 @@ bool remote_index_isnew(/*@null@*/const struct remote_index *ri, struct donefile
 		checksums_free(checksums);
 		return true;
 	}
-	if (!checksums_check(ri->from->remotefiles.checksums[ri->ofs[c_none]],
+	if (!checksums_check(ri->from->remotefiles.checksums[ri->ofs[c]],
 				checksums, &improves)) {
 		/* this should not happen, but ... */
 		checksums_free(checksums);
@@ -972,7 +1005,7 @@ bool remote_index_isnew(/*@null@*/const struct remote_index *ri, struct donefile
 		 * But that is quite inlikely unless on attack, so getting some
 		 * hint in that case cannot harm.*/
 		(void)checksums_combine(&ri->from->remotefiles.checksums[
-				ri->ofs[c_none]], checksums, NULL);
+				ri->ofs[c]], checksums, NULL);
 	}
 	checksums_free(checksums);
 	return false;
@@ -1615,10 +1648,22 @@ struct aptmethod *remote_aptmethod(const struct remote_distribution *rd) {
 }
 
 void remote_index_markdone(const struct remote_index *ri, struct markdonefile *done) {
-	if (ri->ofs[c_none] < 0)
+	enum compression c = remote_index_donecompression(ri);
+	char *name;
+
+	if (c == c_COUNT)
+		return;
+	if (c == c_none) {
+		markdone_index(done, ri->cachebasename,
+				ri->from->remotefiles.checksums[ri->ofs[c]]);
 		return;
-	markdone_index(done, ri->cachebasename,
-			ri->from->remotefiles.checksums[ri->ofs[c_none]]);
+	}
+	name = mprintf("%s%s", ri->cachebasename, uncompression_suffix[c]);
+	if (FAILEDTOALLOC(name))
+		return;
+	markdone_index(done, name,
+			ri->from->remotefiles.checksums[ri->ofs[c]]);
+	free(name);
 }
 void remote_index_needed(struct remote_index *ri) {
 	ri->needed = true;
@@ -1830,35 +1875,69 @@ static retvalue index_callback(enum queue_action action, void *privdata, UNUSED(
 
 static queue_callback diff_got_callback;
 
-static retvalue queue_next_diff(struct remote_index *ri) {
+/* queue all patches needed to get from the old file to the current one,
+ * they are only applied (combined into one) once all have arrived */
+static retvalue queue_diffs(struct remote_index *ri) {
 	struct remote_distribution *rd = ri->from;
 	struct remote_repository *rr = rd->repository;
-	int i;
+	int i, first, k;
 	retvalue r;
 
+	first = -1;
 	for (i = 0 ; i < ri->diffindex->patchcount ; i++) {
 		bool improves;
-		struct diffindex_patch *p = &ri->diffindex->patches[i];
-		char *patchsuffix, *c;
+		const struct diffindex_patch *p = &ri->diffindex->patches[i];
 
-		if (p->done || p->frompackages == NULL)
+		if (p->frompackages == NULL)
 			continue;
-
 		if (!checksums_check(ri->oldchecksums, p->frompackages,
 					&improves))
 			continue;
 		/* p->frompackages should only have sha1 and oldchecksums
 		 * should definitely list a sha1 hash */
 		assert (!improves);
+		first = i;
+		break;
+	}
+	if (first < 0) {
+		/* no patch matches, try next possibility... */
+		fprintf(stderr,
+"Error: available '%s' not listed in '%s.diffindex'.\n",
+				ri->cachefilename, ri->cachefilename);
+		return queue_next_encoding(rd, ri);
+	}
+	for (i = first + 1 ; i < ri->diffindex->patchcount ; i++) {
+		if (ri->diffindex->patches[i].frompackages != NULL)
+			continue;
+		fprintf(stderr,
+"Error: '%s.diffindex' lists no history for '%s'.\n",
+				ri->cachefilename,
+				ri->diffindex->patches[i].name);
+		return queue_next_encoding(rd, ri);
+	}
 
-		p->done = true;
+	remote_index_freepatches(ri);
+	ri->patchesfailed = false;
+	ri->patches = nzNEW(ri->diffindex->patchcount - first,
+			struct remote_patch);
+	if (FAILEDTOALLOC(ri->patches))
+		return RET_ERROR_OOM;
+	ri->patchcount = ri->diffindex->patchcount - first;
+	ri->patchesmissing = ri->patchcount;
+
+	for (k = 0 ; k < ri->patchcount ; k++) {
+		struct remote_patch *rp = &ri->patches[k];
+		const struct diffindex_patch *p =
+			&ri->diffindex->patches[first + k];
+		char *patchsuffix, *c;
 
-		free(ri->patchfilename);
-		ri->patchfilename = mprintf("%s.diff-%s", ri->cachefilename,
+		rp->index = ri;
+		rp->patch = p;
+		rp->filename = mprintf("%s.diff-%s", ri->cachefilename,
 				p->name);
-		if (FAILEDTOALLOC(ri->patchfilename))
+		if (FAILEDTOALLOC(rp->filename))
 			return RET_ERROR_OOM;
-		c = ri->patchfilename + strlen(ri->cachefilename);
+		c = rp->filename + strlen(ri->cachefilename);
 		while (*c != '\0') {
 			if ((*c < '0' || *c > '9')
 					&& (*c < 'A' || *c > 'Z')
@@ -1867,75 +1946,95 @@ static retvalue queue_next_diff(struct remote_index *ri) {
 				*c = '_';
 			c++;
 		}
-		ri->selectedpatch = p;
 		patchsuffix = mprintf(".diff/%s.gz", p->name);
 		if (FAILEDTOALLOC(patchsuffix))
 			return RET_ERROR_OOM;
 
-		/* found a matching patch, tell the downloader we want it */
 		r = aptmethod_enqueueindex(rr->download, rd->suite_base_dir,
 				ri->filename_in_release,
 				patchsuffix,
-				ri->patchfilename, ".gz",
-				diff_got_callback, ri, p);
+				rp->filename, ".gz",
+				diff_got_callback, rp, NULL);
 		free(patchsuffix);
-		return r;
+		if (RET_WAS_ERROR(r))
+			return r;
 	}
-	/* no patch matches, try next possibility... */
-	fprintf(stderr, "Error: available '%s' not listed in '%s.diffindex'.\n",
-			ri->cachefilename, ri->cachefilename);
-	return queue_next_encoding(rd, ri);
+	return RET_OK;
 }
 
-static retvalue diff_uncompressed(void *privdata, const char *compressed, bool failed) {
-	struct remote_index *ri = privdata;
+static void remove_patches(struct remote_index *ri) {
+	int k;
+
+	for (k = 0 ; k < ri->patchcount ; k++)
+		(void)unlink(ri->patches[k].filename);
+	remote_index_freepatches(ri);
+}
+
+/* merge all patches into one and apply that in a single pass */
+static retvalue apply_patches(struct remote_index *ri) {
 	struct remote_distribution *rd = ri->from;
-	const struct diffindex_patch *p = ri->selectedpatch;
+	struct rred_patch **loaded;
+	struct modification *m = NULL;
 	char *tempfilename;
-	struct rred_patch *rp;
 	FILE *f;
-	int i;
+	int i, k;
 	retvalue r;
 	bool dummy;
 
-	if (ri->deletecompressedpatch)
-		(void)unlink(compressed);
-	if (failed)
-		return RET_ERROR;
-
-	r = checksums_test(ri->patchfilename, p->checksums, NULL);
-	if (r == RET_NOTHING) {
-		fprintf(stderr, "Mysteriously vanished file '%s'!\n",
-				ri->patchfilename);
-		r = RET_ERROR_MISSING;
+	loaded = nzNEW(ri->patchcount, struct rred_patch *);
+	if (FAILEDTOALLOC(loaded))
+		return RET_ERROR_OOM;
+	r = RET_OK;
+	for (k = 0 ; k < ri->patchcount ; k++) {
+		const struct remote_patch *rp = &ri->patches[k];
+
+		r = patch_load(rp->filename,
+				checksums_getfilesize(rp->patch->checksums),
+				&loaded[k]);
+		ASSERT_NOT_NOTHING(r);
+		if (RET_WAS_ERROR(r))
+			break;
+		if (k == 0)
+			m = patch_getmodifications(loaded[0]);
+		else {
+			r = combine_patches(&m, m,
+					patch_getmodifications(loaded[k]));
+			if (RET_WAS_ERROR(r)) {
+				m = NULL;
+				break;
+			}
+		}
 	}
-	if (r == RET_ERROR_WRONG_MD5)
-		fprintf(stderr, "Corrupted package diff '%s'!\n",
-				ri->patchfilename);
-	if (RET_WAS_ERROR(r))
-		return r;
-
-	r = patch_load(ri->patchfilename,
-			checksums_getfilesize(p->checksums), &rp);
-	ASSERT_NOT_NOTHING(r);
-	if (RET_WAS_ERROR(r))
+	if (RET_WAS_ERROR(r)) {
+		modification_freelist(m);
+		for (k = 0 ; k < ri->patchcount ; k++)
+			if (loaded[k] != NULL)
+				patch_free(loaded[k]);
+		free(loaded);
 		return r;
+	}
 
 	tempfilename = calc_addsuffix(ri->cachefilename, "tmp");
-	if (FAILEDTOALLOC(tempfilename)) {
-		patch_free(rp);
-		return RET_ERROR_OOM;
+	if (FAILEDTOALLOC(tempfilename))
+		r = RET_ERROR_OOM;
+	else {
+		(void)unlink(tempfilename);
+		i = rename(ri->cachefilename, tempfilename);
+		if (i != 0) {
+			int e = errno;
+			fprintf(stderr, "Error %d moving '%s' to '%s': %s\n",
+					e, ri->cachefilename, tempfilename,
+					strerror(e));
+			r = RET_ERRNO(e);
+		}
 	}
-	(void)unlink(tempfilename);
-	i = rename(ri->cachefilename, tempfilename);
-	if (i != 0) {
-		int e = errno;
-		fprintf(stderr, "Error %d moving '%s' to '%s': %s\n",
-				e, ri->cachefilename, tempfilename,
-				strerror(e));
+	if (RET_WAS_ERROR(r)) {
 		free(tempfilename);
-		patch_free(rp);
-		return RET_ERRNO(e);
+		modification_freelist(m);
+		for (k = 0 ; k < ri->patchcount ; k++)
+			patch_free(loaded[k]);
+		free(loaded);
+		return r;
 	}
 	f = fopen(ri->cachefilename, "w");
 	if (f == NULL) {
@@ -1946,20 +2045,23 @@ static retvalue diff_uncompressed(void *privdata, const char *compressed, bool f
 		ri->olduncompressed->deleted = true;
 		ri->olduncompressed = NULL;
 		free(tempfilename);
-		patch_free(rp);
+		modification_freelist(m);
+		for (k = 0 ; k < ri->patchcount ; k++)
+			patch_free(loaded[k]);
+		free(loaded);
 		return RET_ERRNO(e);
 	}
-	r = patch_file(f, tempfilename, patch_getconstmodifications(rp));
+	r = patch_file(f, tempfilename, m);
 	(void)unlink(tempfilename);
-	(void)unlink(ri->patchfilename);
-	free(ri->patchfilename);
-	ri->patchfilename = NULL;
 	free(tempfilename);
-	patch_free(rp);
+	modification_freelist(m);
+	for (k = 0 ; k < ri->patchcount ; k++)
+		patch_free(loaded[k]);
+	free(loaded);
+	remove_patches(ri);
 	if (RET_WAS_ERROR(r)) {
 		(void)fclose(f);
 		remove_old_uncompressed(ri);
-		// TODO: fall back to downloading at once?
 		return r;
 	}
 	i = ferror(f);
@@ -1991,30 +2093,88 @@ static retvalue diff_uncompressed(void *privdata, const char *compressed, bool f
 		return r;
 	if (checksums_check(ri->oldchecksums,
 				rd->remotefiles.checksums[ri->ofs[c_none]],
-				&dummy)) {
+				&dummy) &&
+	    checksums_check(ri->oldchecksums,
+				ri->diffindex->destination, &dummy)) {
 		ri->olduncompressed->deleted = true;
 		ri->olduncompressed = NULL;
 		/* we have a winner */
 		return indexfile_mark_got(rd, ri, ri->oldchecksums);
 	}
-	/* let's see what patch we need next */
-	return queue_next_diff(ri);
+	fprintf(stderr,
+"Warning: applying the patches from '%s.diffindex' did not result in the\n"
+"expected file. Downloading '%s' as a whole instead...\n",
+			ri->cachefilename, ri->filename_in_release);
+	r = remove_old_uncompressed(ri);
+	if (RET_WAS_ERROR(r))
+		return r;
+	return queue_next_encoding(rd, ri);
+}
+
+static retvalue diff_uncompressed(void *privdata, const char *compressed, bool failed) {
+	struct remote_patch *rp = privdata;
+	struct remote_index *ri = rp->index;
+	retvalue r;
+
+	if (rp->deletecompressed)
+		(void)unlink(compressed);
+	if (ri->patchesfailed) {
+		/* some other patch already failed, so this is no
+		 * longer needed */
+		(void)unlink(rp->filename);
+		return RET_OK;
+	}
+	if (failed) {
+		ri->patchesfailed = true;
+		return RET_ERROR;
+	}
+
+	r = checksums_test(rp->filename, rp->patch->checksums, NULL);
+	if (r == RET_NOTHING) {
+		fprintf(stderr, "Mysteriously vanished file '%s'!\n",
+				rp->filename);
+		r = RET_ERROR_MISSING;
+	}
+	if (r == RET_ERROR_WRONG_MD5)
+		fprintf(stderr, "Corrupted package diff '%s'!\n",
+				rp->filename);
+	if (RET_WAS_ERROR(r)) {
+		ri->patchesfailed = true;
+		return r;
+	}
+
+	assert (ri->patchesmissing > 0);
+	ri->patchesmissing--;
+	if (ri->patchesmissing > 0)
+		return RET_OK;
+	return apply_patches(ri);
 }
 
 static retvalue diff_got_callback(enum queue_action action, void *privdata, UNUSED(void *privdata2), UNUSED(const char *uri), const char *gotfilename, const char *wantedfilename, UNUSED(/*@null@*/const struct checksums *gotchecksums), UNUSED(const char *methodname)) {
-	struct remote_index *ri = privdata;
+	struct remote_patch *rp = privdata;
+	struct remote_index *ri = rp->index;
 	retvalue r;
 
-	if (action == qa_error)
+	if (ri->patchesfailed) {
+		if (action == qa_got && strcmp(gotfilename,
+					wantedfilename) == 0)
+			(void)unlink(gotfilename);
+		return RET_OK;
+	}
+	if (action == qa_error) {
+		ri->patchesfailed = true;
 		return queue_next_encoding(ri->from, ri);
+	}
 	if (action != qa_got)
 		return RET_ERROR;
 
-	ri->deletecompressedpatch = strcmp(gotfilename, wantedfilename) == 0;
-	r = uncompress_queue_file(gotfilename, ri->patchfilename,
-			c_gzip, diff_uncompressed, ri);
-	if (RET_WAS_ERROR(r))
+	rp->deletecompressed = strcmp(gotfilename, wantedfilename) == 0;
+	r = uncompress_queue_file(gotfilename, rp->filename,
+			c_gzip, diff_uncompressed, rp);
+	if (RET_WAS_ERROR(r)) {
+		ri->patchesfailed = true;
 		(void)unlink(gotfilename);
+	}
 	return r;
 }
 
@@ -2099,5 +2259,5 @@ static retvalue diff_callback(enum queue_action action, void *privdata, UNUSED(v
 			return queue_next_encoding(rd, ri);
 		}
 	}
-	return queue_next_diff(ri);
+	return queue_diffs(ri);
 }
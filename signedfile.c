@@ -37,6 +37,7 @@
 #include "release.h"
 #include "filecntl.h"
 #include "hooks.h"
+#include "timings.h"
 
 #ifdef HAVE_LIBGPGME
 static retvalue check_signature_created(bool clearsign, bool willcleanup, /*@null@*/const struct strlist *options, const char *filename, const char *signaturename) {
@@ -457,6 +458,7 @@ retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, c
 		retvalue r;
 		const char *newsigned = *newsignedfilename_p;
 		const char *newdetached = *newdetachedsignature_p;
+		struct timing tm;
 
 		/* make sure the new files do not already exist: */
 		if (unlink(newdetached) != 0 && errno != ENOENT) {
@@ -471,6 +473,7 @@ retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, c
 					newsigned, strerror(errno));
 			return RET_ERROR;
 		}
+		timing_start(&tm);
 		/* if an hook is given, use that instead */
 		if (options->values[0][0] == '!')
 			r = signature_with_extern(options, newplainfilename,
@@ -489,6 +492,7 @@ retvalue signedfile_create(struct signedfile *f, const char *newplainfilename, c
 "is supported.\n", stderr);
 			return RET_ERROR_GPGME;
 #endif
+		timing_stop(tp_sign, NULL, &tm);
 		if (RET_WAS_ERROR(r))
 			return r;
 	} else {
@@ -28,17 +28,27 @@
 #include "database.h"
 #include "database_p.h"
 #include "files.h"
+#include "mprintf.h"
+#include "reference.h"
 #include "sizes.h"
 
+/* sizes of the files referenced by a distribution: all of them and
+ * only those not referenced by anything else, once without and once
+ * with the references by snapshots of this distribution */
+struct sizes {
+	unsigned long long all, onlyhere;
+};
+
 struct distribution_sizes {
 	struct distribution_sizes *next;
 	const char *codename;
 	char *v;
 	size_t codename_len;
-	struct {
-		unsigned long long all, onlyhere;
-	} this, withsnapshots;
+	struct sizes this, withsnapshots;
+	bool selected;
+	/* while looking at the references of a single file: */
 	bool seen, seensnapshot;
+	/*@null@*//*@dependent@*/struct distribution_sizes *nextseen;
 };
 
 static void distribution_sizes_freelist(struct distribution_sizes *ds) {
@@ -51,164 +61,638 @@ static void distribution_sizes_freelist(struct distribution_sizes *ds) {
 	}
 }
 
-static bool fromdist(struct distribution_sizes *dist, const char *data, size_t len, bool *snapshot_p) {
-	if (len < dist->codename_len + 1)
-		return false;
-	if (data[dist->codename_len] == '=')
-		*snapshot_p = true;
-	else if (data[dist->codename_len] == '|' ||
-			data[dist->codename_len] == ' ')
-		*snapshot_p = false;
+/* get the entry for a codename, adding a new one if there is none yet */
+static retvalue finddist(struct distribution_sizes **ds_p, const char *codename, size_t len, /*@out@*/struct distribution_sizes **dist_p) {
+	struct distribution_sizes *s;
+
+	while ((s = *ds_p) != NULL) {
+		if (s->codename_len == len &&
+				memcmp(s->codename, codename, len) == 0) {
+			*dist_p = s;
+			return RET_OK;
+		}
+		ds_p = &s->next;
+	}
+	s = zNEW(struct distribution_sizes);
+	if (FAILEDTOALLOC(s))
+		return RET_ERROR_OOM;
+	/* those not in conf/distributions are shown with a '*' */
+	s->v = malloc(len + 2);
+	if (FAILEDTOALLOC(s->v)) {
+		free(s);
+		return RET_ERROR_OOM;
+	}
+	memcpy(s->v, codename, len);
+	s->v[len] = '*';
+	s->v[len + 1] = '\0';
+	s->codename = s->v;
+	s->codename_len = len;
+	*ds_p = s;
+	*dist_p = s;
+	return RET_OK;
+}
+
+/* to which distribution each referee id belongs, so every referee's name
+ * only needs to be looked at once */
+struct referee_dist {
+	/*@null@*//*@dependent@*/struct distribution_sizes *dist;
+	bool known, snapshot;
+};
+
+struct referee_cache {
+	struct referee_dist *ids;
+	unsigned long size;
+};
+
+/* get the distribution of a referee (NULL if it belongs to none) */
+static retvalue referee_dist(struct referee_cache *cache, unsigned long id, struct distribution_sizes **ds_p, /*@out@*/struct distribution_sizes **dist_p, /*@out@*/bool *snapshot_p) {
+	struct referee_dist *c;
+	struct distribution_sizes *s = NULL;
+	char *name;
+	const char *data, *p;
+	retvalue r;
+
+	if (id >= cache->size) {
+		unsigned long newsize = id + 256;
+		struct referee_dist *n;
+
+		n = realloc(cache->ids, newsize * sizeof(struct referee_dist));
+		if (FAILEDTOALLOC(n))
+			return RET_ERROR_OOM;
+		memset(n + cache->size, 0, (newsize - cache->size)
+				* sizeof(struct referee_dist));
+		cache->ids = n;
+		cache->size = newsize;
+	}
+	c = &cache->ids[id];
+	if (c->known) {
+		*dist_p = c->dist;
+		*snapshot_p = c->snapshot;
+		return RET_OK;
+	}
+
+	r = references_refereename(id, &name);
+	if (RET_WAS_ERROR(r))
+		return r;
+	data = name;
+	if ((data[0] == 'u' && data[1] == '|') ||
+	    (data[0] == 's' && data[1] == '='))
+		data += 2;
+	p = data;
+	while (*p != '\0' && *p != ' ' && *p != '|' && *p != '=')
+		p++;
+	*snapshot_p = *p == '=';
+	if (*p != '\0') {
+		r = finddist(ds_p, data, p - data, &s);
+		if (RET_WAS_ERROR(r)) {
+			free(name);
+			return r;
+		}
+	}
+	free(name);
+	c->known = true;
+	c->dist = s;
+	c->snapshot = *snapshot_p;
+	*dist_p = s;
+	return RET_OK;
+}
+
+/* the distributions referencing the file currently looked at */
+struct filereferees {
+	/*@null@*//*@dependent@*/struct distribution_sizes *dists;
+	/* referenced by something not belonging to any distribution */
+	bool other;
+};
+
+static void filereferees_add(struct filereferees *f, struct distribution_sizes *s, bool snapshot) {
+	if (s == NULL) {
+		f->other = true;
+		return;
+	}
+	if (!s->seen && !s->seensnapshot) {
+		s->nextseen = f->dists;
+		f->dists = s;
+	}
+	if (snapshot)
+		s->seensnapshot = true;
+	else
+		s->seen = true;
+}
+
+static inline bool filereferees_onlyone(const struct filereferees *f) {
+	return !f->other && f->dists != NULL && f->dists->nextseen == NULL;
+}
+
+static inline void sizes_change(unsigned long long *v, unsigned long long size, bool add) {
+	if (add)
+		*v += size;
+	else if (*v >= size)
+		*v -= size;
 	else
-		return false;
-	return memcmp(data, dist->codename, dist->codename_len) == 0;
+		*v = 0;
 }
 
-static retvalue count_sizes(struct cursor *cursor, bool specific, struct distribution_sizes *ds, unsigned long long *all_p, unsigned long long *onlyall_p) {
+/* add (or remove) the size of the file to (or from) the sizes of all
+ * distributions referencing it and forget about those references */
+static void filereferees_account(struct filereferees *f, unsigned long long size, bool add) {
+	struct distribution_sizes *s;
+	bool onlyone = filereferees_onlyone(f);
+
+	while ((s = f->dists) != NULL) {
+		f->dists = s->nextseen;
+		s->nextseen = NULL;
+
+		sizes_change(&s->withsnapshots.all, size, add);
+		if (onlyone)
+			sizes_change(&s->withsnapshots.onlyhere, size, add);
+		if (s->seen) {
+			sizes_change(&s->this.all, size, add);
+			if (onlyone)
+				sizes_change(&s->this.onlyhere, size, add);
+		}
+		s->seen = false;
+		s->seensnapshot = false;
+	}
+	f->other = false;
+}
+
+static unsigned long long filesize(const char *filekey) {
+	off_t size;
+
+	size = files_getsize(filekey);
+	/* references to files not (or no longer) known have no size */
+	if (size < 0)
+		return 0;
+	return size;
+}
+
+static void count_file(const char *filekey, struct filereferees *f, struct sizes *selected) {
+	struct distribution_sizes *s;
+	unsigned long long size;
+	bool anyselected, onlyselected;
+
+	if (f->dists == NULL) {
+		f->other = false;
+		return;
+	}
+	size = filesize(filekey);
+	/* only here means only in selected ones for the sum of them */
+	onlyselected = !f->other;
+	anyselected = false;
+	for (s = f->dists ; s != NULL ; s = s->nextseen) {
+		if (s->selected)
+			anyselected = true;
+		else
+			onlyselected = false;
+	}
+	if (anyselected) {
+		selected->all += size;
+		if (onlyselected)
+			selected->onlyhere += size;
+	}
+	filereferees_account(f, size, true);
+}
+
+/* calculate the sizes of all distributions by looking at all references */
+static retvalue count_sizes(struct distribution_sizes **ds_p, /*@out@*/struct sizes *selected_p) {
+	struct cursor *cursor;
 	const char *key, *data;
 	size_t len;
 	char *last_file = NULL;
-	unsigned long long filesize = 0;
-	bool onlyone = true;
-	struct distribution_sizes *last_dist;
+	struct referee_cache cache = { NULL, 0 };
+	struct filereferees file = { NULL, false };
 	struct distribution_sizes *s;
+	struct sizes selected = { 0, 0 };
+	unsigned long id;
 	bool snapshot;
-	unsigned long long all = 0, onlyall = 0;
+	retvalue result, r;
 
+	r = table_newglobalcursor(rdb_references, &cursor);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (r == RET_NOTHING) {
+		*selected_p = selected;
+		return RET_OK;
+	}
+	result = RET_OK;
 	while (cursor_nexttempdata(rdb_references, cursor,
 				&key, &data, &len)) {
-		if (last_file == NULL || strcmp(last_file, key) != 0) {
-			if (last_file != NULL) {
-				free(last_file);
-				for (s = ds ; s != NULL ; s = s->next) {
-					s->seen = false;
-					s->seensnapshot = false;
-				}
-			}
-			last_file = strdup(key);
-			if (FAILEDTOALLOC(last_file))
-				return RET_ERROR_OOM;
-			onlyone = true;
-			filesize = 0;
-			last_dist = NULL;
-		}
-		if (data[0] == 'u' && data[1] == '|') {
-			data += 2;
-			len -= 2;
-		} else if (data[0] == 's' && data[1] == '=') {
-			data += 2;
-			len -= 2;
+		if (last_file != NULL && strcmp(last_file, key) != 0) {
+			count_file(last_file, &file, &selected);
+			free(last_file);
+			last_file = NULL;
 		}
-		if (last_dist != NULL &&
-				fromdist(last_dist, data, len, &snapshot)) {
-			/* same distribution again */
-			if (!snapshot && !last_dist->seen) {
-				last_dist->seen = true;
-				last_dist->this.all += filesize;
-				if (onlyone)
-					last_dist->this.onlyhere += filesize;
+		if (last_file == NULL) {
+			last_file = strdup(key);
+			if (FAILEDTOALLOC(last_file)) {
+				result = RET_ERROR_OOM;
+				break;
 			}
-			continue;
 		}
-		s = ds;
-		while (s != NULL && !fromdist(s, data, len, &snapshot))
-		     s = s->next;
-		if (s == NULL) {
-			if (onlyone && last_dist != NULL) {
-				if (!last_dist->seen)
-					last_dist->this.onlyhere -= filesize;
-				last_dist->withsnapshots.onlyhere -= filesize;
-			}
-			if (last_dist != NULL)
-				onlyall -= filesize;
-			onlyone = false;
-			if (!specific) {
-				struct distribution_sizes **s_p = &ds->next;
-				const char *p;
-
-				p = data;
-				while (*p != '\0' && *p != ' ' && *p != '|'
-						&& *p != '=')
-					p++;
-				if (*p == '\0')
-					continue;
-				while (*s_p != NULL)
-					s_p = &(*s_p)->next;
-				s = zNEW(struct distribution_sizes);
-				if (FAILEDTOALLOC(s)) {
-					free(last_file);
-					return RET_ERROR_OOM;
-				}
-				*s_p = s;
-				s->v = strndup(data, (p-data) + 1);
-				if (FAILEDTOALLOC(s)) {
-					free(last_file);
-					return RET_ERROR_OOM;
-				}
-				s->v[p-data] = '*';
-				s->codename = s->v;
-				s->codename_len = p-data;
-				snapshot = *p == '=';
-			} else
-				/* last_dist not changed on purpose */
-				continue;
+		if (!references_decodeid(data, len, &id)) {
+			fprintf(stderr,
+"Corrupted reference to '%s' in referencedby.db!\n", key);
+			result = RET_ERROR;
+			break;
 		}
-		/* found it to belong to distribution s */
-		if (s->seen) {
-			assert (last_dist != NULL);
-			assert (!onlyone);
-			continue;
+		r = referee_dist(&cache, id, ds_p, &s, &snapshot);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
 		}
-		if (s->seensnapshot && !snapshot) {
-			s->seen = true;
-			s->this.all += filesize;
-			assert (last_dist != NULL);
-			assert (!onlyone);
+		filereferees_add(&file, s, snapshot);
+	}
+	if (last_file != NULL && !RET_WAS_ERROR(result))
+		count_file(last_file, &file, &selected);
+	free(last_file);
+	free(cache.ids);
+	r = cursor_close(rdb_references, cursor);
+	RET_ENDUPDATE(result, r);
+	*selected_p = selected;
+	return result;
+}
+
+/* Once sizes was run with --fast or --verify, the sizes of every
+ * distribution are stored in referees.db as "+<codename>" and kept
+ * up to date whenever references are added or removed.
+ * "sizes" is "clean" if they are, or "dirty" while a command changing
+ * them runs (so they are calculated again if that one was aborted). */
+
+static const char statekey[] = "sizes";
+
+static retvalue totals_getstate(/*@out@*/bool *clean_p) {
+	const char *data;
+	retvalue r;
+
+	r = table_gettemprecord(rdb_referees, statekey, &data, NULL);
+	if (RET_IS_OK(r))
+		*clean_p = strcmp(data, "clean") == 0;
+	return r;
+}
+
+static retvalue totals_setstate(const char *state) {
+	return table_adduniqsizedrecord(rdb_referees, statekey,
+			state, strlen(state) + 1, true, false);
+}
+
+/* add the stored sizes to the list */
+static retvalue totals_read(struct distribution_sizes **ds_p) {
+	struct cursor *cursor;
+	const char *key, *data;
+	struct distribution_sizes *s;
+	retvalue result, r;
+
+	r = table_newglobalcursor(rdb_referees, &cursor);
+	if (!RET_IS_OK(r))
+		return r;
+	result = RET_NOTHING;
+	while (cursor_nexttempdata(rdb_referees, cursor,
+				&key, &data, NULL)) {
+		if (key[0] != '+')
 			continue;
+		r = finddist(ds_p, key + 1, strlen(key + 1), &s);
+		if (RET_WAS_ERROR(r)) {
+			result = r;
+			break;
+		}
+		if (sscanf(data, "%llu %llu %llu %llu",
+					&s->this.all, &s->this.onlyhere,
+					&s->withsnapshots.all,
+					&s->withsnapshots.onlyhere) != 4) {
+			fprintf(stderr,
+"Malformed sizes of '%s' in referees.db!\n", key + 1);
+			result = RET_ERROR;
+			break;
 		}
-		/* distribution seen for this file the first time */
-		if (last_dist != NULL) {
-			if (onlyone) {
-				last_dist->withsnapshots.onlyhere -= filesize;
-				if (last_dist->seen)
-					last_dist->this.onlyhere -= filesize;
-				onlyone = false;
+		result = RET_OK;
+	}
+	r = cursor_close(rdb_referees, cursor);
+	RET_ENDUPDATE(result, r);
+	return result;
+}
+
+static retvalue totals_write(const struct distribution_sizes *s) {
+	char *key, buffer[100];
+	retvalue r;
+
+	key = mprintf("+%.*s", (int)s->codename_len, s->codename);
+	if (FAILEDTOALLOC(key))
+		return RET_ERROR_OOM;
+	if (s->withsnapshots.all == 0)
+		r = table_deleterecord(rdb_referees, key, true);
+	else {
+		snprintf(buffer, sizeof(buffer), "%llu %llu %llu %llu",
+				s->this.all, s->this.onlyhere,
+				s->withsnapshots.all,
+				s->withsnapshots.onlyhere);
+		r = table_adduniqsizedrecord(rdb_referees, key,
+				buffer, strlen(buffer) + 1, true, false);
+	}
+	free(key);
+	return r;
+}
+
+/* replace all stored sizes with the given ones */
+static retvalue totals_store(const struct distribution_sizes *ds) {
+	struct cursor *cursor;
+	const char *key, *data;
+	retvalue result, r;
+
+	r = table_newglobalcursor(rdb_referees, &cursor);
+	if (RET_WAS_ERROR(r))
+		return r;
+	result = RET_OK;
+	if (RET_IS_OK(r)) {
+		while (cursor_nexttempdata(rdb_referees, cursor,
+					&key, &data, NULL)) {
+			if (key[0] != '+')
+				continue;
+			r = cursor_delete(rdb_referees, cursor, key, NULL);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
 			}
-			assert (filesize != 0);
-		} else {
-			/* and this is the first time
-			 * we are interested in the file */
-			filesize = files_getsize(key);
-			assert (filesize != 0);
-			if (onlyone)
-				onlyall += filesize;
-			all += filesize;
 		}
-		last_dist = s;
-		if (snapshot) {
-			s->seensnapshot = true;
-		} else {
-			s->seen = true;
-			last_dist->this.all += filesize;
-			if (onlyone)
-				last_dist->this.onlyhere += filesize;
+		r = cursor_close(rdb_referees, cursor);
+		RET_ENDUPDATE(result, r);
+	}
+	for (; ds != NULL && !RET_WAS_ERROR(result) ; ds = ds->next) {
+		r = totals_write(ds);
+		RET_UPDATE(result, r);
+	}
+	if (!RET_WAS_ERROR(result)) {
+		r = totals_setstate("clean");
+		RET_UPDATE(result, r);
+	}
+	return result;
+}
+
+static inline bool sizes_equal(const struct distribution_sizes *a, const struct distribution_sizes *b) {
+	return a->this.all == b->this.all &&
+		a->this.onlyhere == b->this.onlyhere &&
+		a->withsnapshots.all == b->withsnapshots.all &&
+		a->withsnapshots.onlyhere == b->withsnapshots.onlyhere;
+}
+
+/* compare stored sizes with newly calculated ones */
+static retvalue totals_verify(struct distribution_sizes *ds) {
+	struct distribution_sizes *stored = NULL, *s, *o;
+	struct distribution_sizes zero;
+	unsigned int wrong = 0;
+	bool clean = false;
+	retvalue r;
+
+	r = totals_getstate(&clean);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (r == RET_NOTHING) {
+		if (verbose > 0)
+			printf(
+"No sizes stored yet, they are kept up to date from now on.\n");
+		return RET_NOTHING;
+	}
+	r = totals_read(&stored);
+	if (RET_WAS_ERROR(r)) {
+		distribution_sizes_freelist(stored);
+		return r;
+	}
+	memset(&zero, 0, sizeof(zero));
+	/* look at those only stored, too: */
+	for (s = stored ; s != NULL ; s = s->next) {
+		r = finddist(&ds, s->codename, s->codename_len, &o);
+		if (RET_WAS_ERROR(r)) {
+			distribution_sizes_freelist(stored);
+			return r;
 		}
-		last_dist->withsnapshots.all += filesize;
-		if (onlyone)
-			last_dist->withsnapshots.onlyhere += filesize;
 	}
-	free(last_file);
-	*all_p = all;
-	*onlyall_p = onlyall;
+	for (s = ds ; s != NULL ; s = s->next) {
+		o = stored;
+		while (o != NULL && (o->codename_len != s->codename_len ||
+				memcmp(o->codename, s->codename,
+					s->codename_len) != 0))
+			o = o->next;
+		if (o == NULL)
+			o = &zero;
+		if (sizes_equal(s, o))
+			continue;
+		wrong++;
+		fprintf(stderr,
+"Stored sizes of '%.*s' were %llu %llu %llu %llu instead of %llu %llu %llu %llu!\n",
+				(int)s->codename_len, s->codename,
+				o->this.all, o->this.onlyhere,
+				o->withsnapshots.all,
+				o->withsnapshots.onlyhere,
+				s->this.all, s->this.onlyhere,
+				s->withsnapshots.all,
+				s->withsnapshots.onlyhere);
+	}
+	distribution_sizes_freelist(stored);
+	if (wrong == 0 && clean) {
+		if (verbose > 0)
+			printf("Stored sizes are correct.\n");
+	} else if (!clean && verbose >= 0)
+		printf(
+"Stored sizes were outdated (an earlier command was aborted), fixed them.\n");
+	else if (verbose >= 0)
+		printf("Fixed the stored sizes of %u distributions.\n", wrong);
 	return RET_OK;
 }
 
-retvalue sizes_distributions(struct distribution *alldistributions, bool specific) {
+/* the sizes kept up to date while references change */
+static struct {
+	bool loaded, maintained, wasclean, changed;
+	/*@null@*/struct distribution_sizes *totals;
+	struct referee_cache cache;
+	unsigned long *ids;
+	size_t idcount, idsize;
+} accounting;
+
+static retvalue accounting_load(void) {
+	bool clean = false;
+	retvalue r;
+
+	if (accounting.loaded)
+		return accounting.maintained ? RET_OK : RET_NOTHING;
+	accounting.loaded = true;
+	r = totals_getstate(&clean);
+	if (!RET_IS_OK(r))
+		return r;
+	r = totals_read(&accounting.totals);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (clean) {
+		r = totals_setstate("dirty");
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	/* the size of the files is needed, too: */
+	if (rdb_checksums == NULL) {
+		r = database_openfiles();
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+	accounting.wasclean = clean;
+	accounting.maintained = true;
+	return RET_OK;
+}
+
+static retvalue accounting_addid(unsigned long id) {
+	if (accounting.idcount >= accounting.idsize) {
+		size_t newsize = accounting.idsize * 2 + 16;
+		unsigned long *n;
+
+		n = realloc(accounting.ids, newsize * sizeof(unsigned long));
+		if (FAILEDTOALLOC(n))
+			return RET_ERROR_OOM;
+		accounting.ids = n;
+		accounting.idsize = newsize;
+	}
+	accounting.ids[accounting.idcount++] = id;
+	return RET_OK;
+}
+
+/* the sizes of the distributions referencing filekey before or after
+ * the reference by id was added or removed */
+static retvalue accounting_change(unsigned long long size, bool withid, unsigned long id, bool add) {
+	struct filereferees file = { NULL, false };
+	struct distribution_sizes *s;
+	bool snapshot;
+	size_t i;
+	retvalue r;
+
+	for (i = 0 ; i <= accounting.idcount ; i++) {
+		if (i < accounting.idcount)
+			r = referee_dist(&accounting.cache, accounting.ids[i],
+					&accounting.totals, &s, &snapshot);
+		else if (withid)
+			r = referee_dist(&accounting.cache, id,
+					&accounting.totals, &s, &snapshot);
+		else
+			break;
+		if (RET_WAS_ERROR(r)) {
+			/* forget what was collected so far */
+			filereferees_account(&file, 0, true);
+			return r;
+		}
+		filereferees_add(&file, s, snapshot);
+	}
+	filereferees_account(&file, size, add);
+	return RET_OK;
+}
+
+retvalue sizes_needupdates(void) {
+	return accounting_load();
+}
+
+retvalue sizes_referencechanged(const char *filekey, unsigned long id, bool added) {
 	struct cursor *cursor;
+	const char *key, *data;
+	size_t len;
+	unsigned long other;
+	unsigned long long size;
+	retvalue r;
+
+	r = accounting_load();
+	if (!RET_IS_OK(r))
+		return r;
+
+	/* all the other references to this file: */
+	accounting.idcount = 0;
+	r = table_newduplicatecursor(rdb_references, filekey, 0,
+			&cursor, &key, &data, &len);
+	if (RET_WAS_ERROR(r))
+		return r;
+	if (RET_IS_OK(r)) {
+		do {
+			if (!references_decodeid(data, len, &other)) {
+				fprintf(stderr,
+"Corrupted reference to '%s' in referencedby.db!\n", filekey);
+				r = RET_ERROR;
+			} else if (other != id)
+				r = accounting_addid(other);
+		} while (!RET_WAS_ERROR(r) && cursor_nexttempdata(
+				rdb_references, cursor, &key, &data, &len));
+		if (RET_WAS_ERROR(r)) {
+			(void)cursor_close(rdb_references, cursor);
+			return r;
+		}
+		r = cursor_close(rdb_references, cursor);
+		if (RET_WAS_ERROR(r))
+			return r;
+	}
+
+	size = filesize(filekey);
+	r = accounting_change(size, !added, id, false);
+	if (!RET_WAS_ERROR(r))
+		r = accounting_change(size, added, id, true);
+	if (RET_WAS_ERROR(r))
+		/* do not claim to have correct sizes */
+		accounting.wasclean = false;
+	accounting.changed = true;
+	return r;
+}
+
+retvalue sizes_writeback(void) {
+	struct distribution_sizes *s;
+	retvalue result, r;
+
+	result = RET_NOTHING;
+	if (accounting.changed) {
+		result = RET_OK;
+		for (s = accounting.totals ; s != NULL ; s = s->next) {
+			r = totals_write(s);
+			RET_UPDATE(result, r);
+			if (RET_WAS_ERROR(r))
+				break;
+		}
+		if (accounting.wasclean && !RET_WAS_ERROR(result)) {
+			r = totals_setstate("clean");
+			RET_UPDATE(result, r);
+		}
+	} else if (accounting.maintained && accounting.wasclean) {
+		result = totals_setstate("clean");
+	}
+	distribution_sizes_freelist(accounting.totals);
+	free(accounting.cache.ids);
+	free(accounting.ids);
+	memset(&accounting, 0, sizeof(accounting));
+	return result;
+}
+
+static void print_sizes(const struct distribution_sizes *ds, bool specific, /*@null@*/const struct sizes *selected) {
+	const struct distribution_sizes *s;
+	int count = 0;
+
+	printf("%-15s %13s %13s %13s %13s\n",
+			"Codename", "Size", "Only", "Size(+s)",
+			"Only(+s)");
+	for (s = ds ; s != NULL ; s = s->next) {
+		if (s->selected)
+			count++;
+		else if (specific || s->withsnapshots.all == 0)
+			continue;
+		printf("%-15s %13llu %13llu %13llu %13llu\n",
+				s->selected?s->codename:s->v,
+				s->this.all,
+				s->this.onlyhere,
+				s->withsnapshots.all,
+				s->withsnapshots.onlyhere);
+	}
+	/* which files are shared between them is not stored,
+	 * so the sum is only known if everything was looked at */
+	if (specific && count > 1 && selected != NULL)
+		printf("%-15s %13s %13s %13llu %13llu\n",
+				"<all selected> ",
+				"", "",
+				selected->all, selected->onlyhere);
+}
+
+retvalue sizes_distributions(struct distribution *alldistributions, bool specific, bool fast, bool verify) {
 	retvalue result, r;
 	struct distribution_sizes *ds = NULL, **lds = &ds, *s;
 	struct distribution *d;
-	unsigned long long all = 0, onlyall = 0;
+	struct sizes selected;
+	bool clean = false;
 
 	for (d = alldistributions ; d != NULL ; d = d->next) {
 		if (!d->selected)
@@ -220,37 +704,40 @@ retvalue sizes_distributions(struct distribution *alldistributions, bool specifi
 		}
 		s->codename = d->codename;
 		s->codename_len = strlen(d->codename);
+		s->selected = true;
 		*lds = s;
 		lds = &s->next;
 	}
 	if (ds == NULL)
 		return RET_NOTHING;
-	r = table_newglobalcursor(rdb_references, &cursor);
-	if (!RET_IS_OK(r)) {
-		distribution_sizes_freelist(ds);
-		return r;
-	}
-	result = count_sizes(cursor, specific, ds, &all, &onlyall);
-	r = cursor_close(rdb_references, cursor);
-	RET_ENDUPDATE(result, r);
-	if (RET_IS_OK(result)) {
-		printf("%-15s %13s %13s %13s %13s\n",
-				"Codename", "Size", "Only", "Size(+s)",
-				"Only(+s)");
-		for (s = ds ; s != NULL ; s = s->next) {
-			printf("%-15s %13llu %13llu %13llu %13llu\n",
-					s->codename,
-					s->this.all,
-					s->this.onlyhere,
-					s->withsnapshots.all,
-					s->withsnapshots.onlyhere);
+	if (fast && !verify) {
+		r = totals_getstate(&clean);
+		if (RET_WAS_ERROR(r)) {
+			distribution_sizes_freelist(ds);
+			return r;
+		}
+		if (RET_IS_OK(r) && clean) {
+			r = totals_read(&ds);
+			if (!RET_WAS_ERROR(r))
+				print_sizes(ds, specific, NULL);
+			distribution_sizes_freelist(ds);
+			return RET_WAS_ERROR(r)?r:RET_OK;
 		}
-		if (specific && ds->next != NULL)
-			printf("%-15s %13s %13s %13llu %13llu\n",
-					"<all selected> ",
-					"", "",
-					all, onlyall);
+		if (verbose > 0)
+			printf(
+"No up to date sizes stored, looking at all references...\n");
+	}
+	result = count_sizes(&ds, &selected);
+	if (RET_IS_OK(result) && verify) {
+		r = totals_verify(ds);
+		RET_UPDATE(result, r);
+	}
+	if (RET_IS_OK(result) && (fast || verify)) {
+		r = totals_store(ds);
+		RET_UPDATE(result, r);
 	}
+	if (RET_IS_OK(result))
+		print_sizes(ds, specific, &selected);
 	distribution_sizes_freelist(ds);
 	return result;
 }
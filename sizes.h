@@ -1,6 +1,14 @@
 #ifndef REPREPRO_SIZES_H
 #define REPREPRO_SIZES_H
 
-retvalue sizes_distributions(struct distribution * /*all*/, bool /* specific */);
+retvalue sizes_distributions(struct distribution * /*all*/, bool /* specific */, bool /*fast*/, bool /*verify*/);
+
+/* RET_OK if there are stored sizes to keep up to date */
+retvalue sizes_needupdates(void);
+/* keep the stored sizes up to date, to be called after a reference
+ * to the file by the referee with the given id was added or removed */
+retvalue sizes_referencechanged(const char * /*filekey*/, unsigned long /*id*/, bool /*added*/);
+/* store the sizes changed by sizes_referencechanged */
+retvalue sizes_writeback(void);
 
 #endif
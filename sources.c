@@ -118,10 +118,10 @@ static retvalue getBasenames(const struct strlist *filelines, /*@out@*/struct st
 	return r;
 }
 
-retvalue sources_getversion(const char *control, char **version) {
+retvalue sources_getversion(const char *control, struct chunkarena *arena, char **version) {
 	retvalue r;
 
-	r = chunk_getvalue(control, "Version", version);
+	r = chunk_getvaluein(control, "Version", arena, version);
 	if (RET_WAS_ERROR(r))
 		return r;
 	if (r == RET_NOTHING) {
@@ -137,7 +137,7 @@ retvalue sources_getarchitecture(UNUSED(const char *chunk), architecture_t *arch
 	return RET_OK;
 }
 
-retvalue sources_getinstalldata(const struct target *t, const char *packagename, UNUSED(const char *version), architecture_t architecture, const char *chunk, char **control, struct strlist *filekeys, struct checksumsarray *origfiles) {
+static retvalue getinstalldata(const struct target *t, const char *packagename, architecture_t architecture, const char *chunk, char **control, struct strlist *filekeys, struct checksumsarray *origfiles) {
 	retvalue r;
 	char *origdirectory, *directory, *mychunk;
 	struct strlist myfilekeys;
@@ -242,6 +242,18 @@ retvalue sources_getinstalldata(const struct target *t, const char *packagename,
 	return RET_OK;
 }
 
+retvalue sources_getinstalldata(const struct target *t, const char *packagename, UNUSED(const char *version), architecture_t architecture, const char *chunk, char **control, struct strlist *filekeys, struct checksumsarray *origfiles) {
+	struct chunkindex index;
+	retvalue r;
+
+	/* many fields are looked at, so only search for them once: */
+	chunk_index(&index, chunk);
+	r = getinstalldata(t, packagename, architecture, chunk,
+			control, filekeys, origfiles);
+	chunk_unindex(&index);
+	return r;
+}
+
 retvalue sources_getfilekeys(const char *chunk, struct strlist *filekeys) {
 	char *origdirectory;
 	struct strlist basenames;
@@ -286,7 +298,7 @@ retvalue sources_getfilekeys(const char *chunk, struct strlist *filekeys) {
 	return r;
 }
 
-retvalue sources_getchecksums(const char *chunk, struct checksumsarray *out) {
+static retvalue getchecksums(const char *chunk, struct checksumsarray *out) {
 	char *origdirectory;
 	struct checksumsarray a;
 	retvalue r;
@@ -338,6 +350,16 @@ retvalue sources_getchecksums(const char *chunk, struct checksumsarray *out) {
 	return RET_OK;
 }
 
+retvalue sources_getchecksums(const char *chunk, struct checksumsarray *out) {
+	struct chunkindex index;
+	retvalue r;
+
+	chunk_index(&index, chunk);
+	r = getchecksums(chunk, out);
+	chunk_unindex(&index);
+	return r;
+}
+
 retvalue sources_doreoverride(const struct target *target, const char *packagename, const char *controlchunk, /*@out@*/char **newcontrolchunk) {
 	const struct overridedata *o;
 	struct fieldtoadd *fields;
@@ -420,7 +442,7 @@ retvalue sources_retrack(const char *sourcename, const char *chunk, trackingdb t
 	return tracking_save(tracks, pkg);
 }
 
-retvalue sources_getsourceandversion(const char *chunk, const char *packagename, char **source, char **version) {
+retvalue sources_getsourceandversion(const char *chunk, const char *packagename, struct chunkarena *arena, char **source, char **version) {
 	retvalue r;
 	char *sourceversion;
 	char *sourcename;
@@ -428,7 +450,7 @@ retvalue sources_getsourceandversion(const char *chunk, const char *packagename,
 	//TODO: eliminate duplicate code!
 	assert(packagename!=NULL);
 
-	r = chunk_getvalue(chunk, "Version", &sourceversion);
+	r = chunk_getvaluein(chunk, "Version", arena, &sourceversion);
 	if (r == RET_NOTHING) {
 		fprintf(stderr, "Missing 'Version' field in chunk:'%s'\n",
 				chunk);
@@ -437,9 +459,14 @@ retvalue sources_getsourceandversion(const char *chunk, const char *packagename,
 	if (RET_WAS_ERROR(r)) {
 		return r;
 	}
-	sourcename = strdup(packagename);
+	if (arena != NULL)
+		sourcename = chunkarena_strndup(arena, packagename,
+				strlen(packagename));
+	else
+		sourcename = strdup(packagename);
 	if (FAILEDTOALLOC(sourcename)) {
-		free(sourceversion);
+		if (arena == NULL)
+			free(sourceversion);
 		return RET_ERROR_OOM;
 	}
 	*source = sourcename;
@@ -22,6 +22,7 @@
 #include <string.h>
 #include "error.h"
 #include "strlist.h"
+#include "names.h"
 
 bool strlist_in(const struct strlist *strlist, const char *element) {
 	int c;
@@ -209,6 +210,32 @@ void strlist_move(struct strlist *dest, struct strlist *orig) {
 	orig->values = NULL;
 }
 
+retvalue strlist_append(struct strlist *dest, struct strlist *orig) {
+	char **v;
+
+	assert(dest != NULL && orig != NULL && dest != orig);
+
+	if (dest->count + orig->count > dest->size) {
+		int newsize = 2 * dest->size;
+
+		if (newsize < dest->count + orig->count)
+			newsize = dest->count + orig->count + 8;
+		v = realloc(dest->values, newsize * sizeof(char *));
+		if (FAILEDTOALLOC(v))
+			return RET_ERROR_OOM;
+		dest->values = v;
+		dest->size = newsize;
+	}
+	if (orig->count > 0)
+		memcpy(dest->values + dest->count, orig->values,
+				orig->count * sizeof(char *));
+	dest->count += orig->count;
+	free(orig->values);
+	orig->size = orig->count = 0;
+	orig->values = NULL;
+	return RET_OK;
+}
+
 retvalue strlist_adduniq(struct strlist *strlist, char *element) {
 	// TODO: is there something better feasible?
 	if (strlist_in(strlist, element)) {
@@ -281,3 +308,117 @@ void strlist_remove(struct strlist *strlist, const char *element) {
 	}
 	strlist->count = j;
 }
+
+void strindex_init(struct strindex *index) {
+	strlist_init(&index->strings);
+	index->buckets = NULL;
+	index->chain = NULL;
+	index->bucketcount = 0;
+}
+
+void strindex_done(struct strindex *index) {
+	strlist_done(&index->strings);
+	free(index->buckets);
+	free(index->chain);
+	/* empty again, so it can be reused */
+	strindex_init(index);
+}
+
+static inline int strindex_hash(const char *s, size_t len, int bucketcount) {
+	/* bucketcount is always a power of two */
+	return (int)(hash_bytes(HASH_INIT, s, len) &
+			(unsigned int)(bucketcount - 1));
+}
+
+int strindex_ofs_l(const struct strindex *index, const char *s, size_t len) {
+	int i;
+
+	if (index->bucketcount == 0)
+		return -1;
+	for (i = index->buckets[strindex_hash(s, len, index->bucketcount)] ;
+	     i > 0 ; i = index->chain[i - 1]) {
+		const char *v = index->strings.values[i - 1];
+
+		if (strncmp(v, s, len) == 0 && v[len] == '\0')
+			return i - 1;
+	}
+	return -1;
+}
+
+int strindex_ofs(const struct strindex *index, const char *s) {
+	return strindex_ofs_l(index, s, strlen(s));
+}
+
+static retvalue strindex_rehash(struct strindex *index, int newcount) {
+	int *buckets, i;
+
+	buckets = nzNEW(newcount, int);
+	if (FAILEDTOALLOC(buckets))
+		return RET_ERROR_OOM;
+	for (i = 0 ; i < index->strings.count ; i++) {
+		const char *v = index->strings.values[i];
+		int b = strindex_hash(v, strlen(v), newcount);
+
+		index->chain[i] = buckets[b];
+		buckets[b] = i + 1;
+	}
+	free(index->buckets);
+	index->buckets = buckets;
+	index->bucketcount = newcount;
+	return RET_OK;
+}
+
+retvalue strindex_intern(struct strindex *index, const char *s, size_t len, int *ofs_p) {
+	retvalue r;
+	int ofs, b;
+	char *v;
+
+	ofs = strindex_ofs_l(index, s, len);
+	if (ofs >= 0) {
+		*ofs_p = ofs;
+		return RET_OK;
+	}
+	v = strndup(s, len);
+	if (FAILEDTOALLOC(v))
+		return RET_ERROR_OOM;
+	r = strlist_add(&index->strings, v);
+	if (RET_WAS_ERROR(r))
+		return r;
+	ofs = index->strings.count - 1;
+	if (index->strings.count > index->bucketcount) {
+		/* chain and strings get room for as many as there
+		 * are buckets, so this is only needed once in a while */
+		int newcount = (index->bucketcount == 0) ? 16 :
+			2 * index->bucketcount;
+		int *n = realloc(index->chain, newcount * sizeof(int));
+		char **values;
+
+		if (FAILEDTOALLOC(n)) {
+			index->strings.count--;
+			free(v);
+			return RET_ERROR_OOM;
+		}
+		index->chain = n;
+		values = realloc(index->strings.values,
+				newcount * sizeof(char *));
+		if (FAILEDTOALLOC(values)) {
+			index->strings.count--;
+			free(v);
+			return RET_ERROR_OOM;
+		}
+		index->strings.values = values;
+		index->strings.size = newcount;
+		r = strindex_rehash(index, newcount);
+		if (RET_WAS_ERROR(r)) {
+			index->strings.count--;
+			free(v);
+			return r;
+		}
+	} else {
+		b = strindex_hash(v, len, index->bucketcount);
+		index->chain[ofs] = index->buckets[b];
+		index->buckets[b] = ofs + 1;
+	}
+	*ofs_p = ofs;
+	return RET_OK;
+}
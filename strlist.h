@@ -34,6 +34,8 @@ retvalue strlist_fprint(FILE *, const struct strlist *);
 
 /* replace the contents of dest with those from orig, which get emptied */
 void strlist_move(/*@out@*/struct strlist *dest, /*@special@*/struct strlist *orig) /*@releases orig->values @*/;
+/* move all strings from orig to the end of dest, orig is emptied if RET_OK */
+retvalue strlist_append(struct strlist *dest, struct strlist *orig);
 
 bool strlist_in(const struct strlist *, const char *);
 int strlist_ofs(const struct strlist *, const char *);
@@ -47,4 +49,26 @@ char *strlist_concat(const struct strlist *, const char * /*prefix*/, const char
 
 /* remove all strings equal to the argument */
 void strlist_remove(struct strlist *, const char *);
+
+/* a strlist with a hash index, for fast lookup in larger lists
+ * (strings can only be added, positions never change) */
+struct strindex {
+	struct strlist strings;
+	/* position+1 of the first string of each bucket (0 = none) */
+	int *buckets;
+	/* position+1 of the next string in the same bucket */
+	int *chain;
+	int bucketcount;
+};
+
+void strindex_init(/*@out@*/struct strindex *);
+void strindex_done(/*@special@*/struct strindex *);
+/* position of the string or -1 if not there */
+int strindex_ofs(const struct strindex *, const char *);
+int strindex_ofs_l(const struct strindex *, const char *, size_t);
+static inline bool strindex_in(const struct strindex *i, const char *s) {
+	return strindex_ofs(i, s) >= 0;
+}
+/* add string if not yet there, returns its position in *ofs_p */
+retvalue strindex_intern(struct strindex *, const char *, size_t, /*@out@*/int *);
 #endif
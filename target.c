@@ -43,6 +43,7 @@
 #include "descriptions.h"
 #include "package.h"
 #include "target.h"
+#include "timings.h"
 
 static char *calc_identifier(const char *codename, component_t component, architecture_t architecture, packagetype_t packagetype) {
 	assert (strchr(codename, '|') == NULL);
@@ -209,6 +210,20 @@ retvalue target_initpackagesdb(struct target *target, bool readonly) {
 	return r;
 }
 
+/* to be called after each change of the packages of the target.
+ * With the first change (since the last export) the exported files are
+ * out of date, so their cached checksums are forgotten to make sure
+ * they are not reused before they are exported again */
+retvalue target_markmodified(struct target *target) {
+	if (target->wasmodified)
+		return RET_NOTHING;
+	target->wasmodified = true;
+	if (target->exportmode == NULL)
+		return RET_OK;
+	return export_forget(target->relativedirectory, target,
+			target->exportmode);
+}
+
 /* this closes databases... */
 retvalue target_closepackagesdb(struct target *target) {
 	retvalue r;
@@ -249,7 +264,8 @@ retvalue package_remove(struct package *old, struct logger *logger, struct track
 	result = table_deleterecord(old->target->packages, key, false);
 	free(key);
 	if (RET_IS_OK(result)) {
-		old->target->wasmodified = true;
+		r = target_markmodified(old->target);
+		RET_ENDUPDATE(result, r);
 		if (trackingdata != NULL && old->source != NULL
 				&& old->sourceversion != NULL) {
 			r = trackingdata_remove(trackingdata,
@@ -321,12 +337,31 @@ retvalue package_remove_by_cursor(struct package_cursor *tc, struct logger *logg
 	if (trackingdata != NULL) {
 		(void)package_getsource(old);
 	}
+	/* name and control might point into the record to be deleted,
+	 * so keep copies for the logger and the messages */
+	if (old->pkgname == NULL) {
+		old->pkgname = strdup(old->name);
+		if (FAILEDTOALLOC(old->pkgname)) {
+			strlist_done(&files);
+			return RET_ERROR_OOM;
+		}
+		old->name = old->pkgname;
+	}
+	if (old->pkgchunk == NULL) {
+		old->pkgchunk = strndup(old->control, old->controllen);
+		if (FAILEDTOALLOC(old->pkgchunk)) {
+			strlist_done(&files);
+			return RET_ERROR_OOM;
+		}
+		old->control = old->pkgchunk;
+	}
 	if (verbose > 0)
 		printf("removing '%s=%s' from '%s'...\n",
 				old->name, old->version, old->target->identifier);
 	result = cursor_delete(target->packages, tc->cursor, old->name, old->version);
 	if (RET_IS_OK(result)) {
-		old->target->wasmodified = true;
+		r = target_markmodified(old->target);
+		RET_ENDUPDATE(result, r);
 		if (trackingdata != NULL && old->source != NULL
 				&& old->sourceversion != NULL) {
 			r = trackingdata_remove(trackingdata,
@@ -619,7 +654,10 @@ retvalue target_addpackage(struct target *target, struct logger *logger, const c
 			old.source, old.sourceversion,
 			causingrule, suitefrom);
 	if (RET_IS_OK(r)) {
-		target->wasmodified = true;
+		retvalue r2;
+
+		r2 = target_markmodified(target);
+		RET_ENDUPDATE(r, r2);
 		if (trackingdata == NULL)
 			target->staletracking = true;
 	}
@@ -746,9 +784,14 @@ retvalue target_checkaddpackage(struct target *target, const char *name, const c
 	return RET_OK;
 }
 
+static int filekey_cmp(const void *a, const void *b) {
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
 retvalue target_rereference(struct target *target) {
 	retvalue result, r;
 	struct package_cursor iterator;
+	struct strlist allfilekeys;
 
 	if (verbose > 1) {
 		if (verbose > 2)
@@ -767,6 +810,9 @@ retvalue target_rereference(struct target *target) {
 	assert (r != RET_NOTHING);
 	if (RET_WAS_ERROR(r))
 		return r;
+	/* collect all filekeys first, so that references.db can be
+	 * written in the order of its keys */
+	strlist_init(&allfilekeys);
 	while (package_next(&iterator)) {
 		struct strlist filekeys;
 
@@ -781,12 +827,22 @@ retvalue target_rereference(struct target *target) {
 			(void)strlist_fprint(stderr, &filekeys);
 			(void)putc('\n', stderr);
 		}
-		r = references_insert(target->identifier, &filekeys, NULL);
-		strlist_done(&filekeys);
-		RET_UPDATE(result, r);
+		r = strlist_append(&allfilekeys, &filekeys);
+		if (RET_WAS_ERROR(r)) {
+			strlist_done(&filekeys);
+			RET_UPDATE(result, r);
+			break;
+		}
 	}
 	r = package_closeiterator(&iterator);
 	RET_ENDUPDATE(result, r);
+	if (!RET_WAS_ERROR(result) && allfilekeys.count > 0) {
+		qsort(allfilekeys.values, allfilekeys.count, sizeof(char *),
+				filekey_cmp);
+		r = references_insert(target->identifier, &allfilekeys, NULL);
+		RET_UPDATE(result, r);
+	}
+	strlist_done(&allfilekeys);
 	return result;
 }
 
@@ -809,13 +865,15 @@ retvalue package_referenceforsnapshot(struct package *package, void *data) {
 	return r;
 }
 
-retvalue package_check(struct package *package, UNUSED(void *pd)) {
+/* parse the package and extract the files it needs, files is
+ * always initialized (but may be empty) after this returned */
+static retvalue package_checkdata(struct package *package, /*@out@*/struct checksumsarray *files) {
 	struct target *target = package->target;
-	struct checksumsarray files;
 	struct strlist expectedfilekeys;
 	char *dummy;
 	retvalue result = RET_OK, r;
 
+	memset(files, 0, sizeof(*files));
 	r = package_getversion(package);
 	if (!RET_IS_OK(r)) {
 		fprintf(stderr,
@@ -846,7 +904,7 @@ retvalue package_check(struct package *package, UNUSED(void *pd)) {
 	}
 	r = target->getinstalldata(target, package->name, package->version,
 			package->architecture, package->control, &dummy,
-			&expectedfilekeys, &files);
+			&expectedfilekeys, files);
 	if (RET_WAS_ERROR(r)) {
 		fprintf(stderr,
 "Error extracting information of package '%s'!\n",
@@ -855,50 +913,190 @@ retvalue package_check(struct package *package, UNUSED(void *pd)) {
 	}
 	if (RET_IS_OK(r)) {
 		free(dummy);
-		if (!strlist_subset(&expectedfilekeys, &files.names, NULL) ||
-		    !strlist_subset(&expectedfilekeys, &files.names, NULL)) {
+		if (!strlist_subset(&expectedfilekeys, &files->names, NULL) ||
+		    !strlist_subset(&expectedfilekeys, &files->names, NULL)) {
 			(void)fprintf(stderr,
 "Reparsing the package information of '%s' yields to the expectation to find:\n",
 					package->name);
 			(void)strlist_fprint(stderr, &expectedfilekeys);
 			(void)fputs("but found:\n", stderr);
-			(void)strlist_fprint(stderr, &files.names);
+			(void)strlist_fprint(stderr, &files->names);
 			(void)putc('\n', stderr);
 			result = RET_ERROR;
 		}
 		strlist_done(&expectedfilekeys);
 	} else {
-		r = target->getchecksums(package->control, &files);
+		memset(files, 0, sizeof(*files));
+		r = target->getchecksums(package->control, files);
 		if (r == RET_NOTHING)
 			r = RET_ERROR;
 		if (RET_WAS_ERROR(r)) {
 			fprintf(stderr,
 "Even more errors extracting information of package '%s'!\n",
 					package->name);
+			memset(files, 0, sizeof(*files));
 			return r;
 		}
 	}
-
 	if (verbose > 10) {
-		fprintf(stderr, "checking files of '%s'\n", package->name);
+		(void)fprintf(stderr, "checking references to '%s' for '%s': ",
+				target->identifier, package->name);
+		(void)strlist_fprint(stderr, &files->names);
+		(void)putc('\n', stderr);
+	}
+	return result;
+}
+
+retvalue package_check(struct package *package, UNUSED(void *pd)) {
+	struct target *target = package->target;
+	struct checksumsarray files;
+	retvalue result, r;
+
+	result = package_checkdata(package, &files);
+	if (files.names.count == 0) {
+		checksumsarray_done(&files);
+		return result;
 	}
 	r = files_expectfiles(&files.names, files.checksums);
 	if (RET_WAS_ERROR(r)) {
 		fprintf(stderr, "Files are missing for '%s'!\n", package->name);
 	}
 	RET_UPDATE(result, r);
-	if (verbose > 10) {
-		(void)fprintf(stderr, "checking references to '%s' for '%s': ",
-				target->identifier, package->name);
-		(void)strlist_fprint(stderr, &files.names);
-		(void)putc('\n', stderr);
-	}
 	r = references_check(target->identifier, &files.names);
 	RET_UPDATE(result, r);
 	checksumsarray_done(&files);
 	return result;
 }
 
+struct checkentry {
+	/*@dependent@*/const char *filekey;
+	/*@only@*/struct checksums *checksums;
+	int package;
+};
+
+static int checkentry_cmp(const void *a, const void *b) {
+	const struct checkentry *ea = a, *eb = b;
+	int c;
+
+	c = strcmp(ea->filekey, eb->filekey);
+	if (c != 0)
+		return c;
+	/* keep the order of the packages for the same file */
+	return ea->package - eb->package;
+}
+
+/* like calling package_check for every package of the target, but
+ * first parse all packages and then look into checksums.db and
+ * references.db in the order of the filekeys, so that those are
+ * walked sequentially instead of hopping around. */
+retvalue target_check(struct target *target) {
+	struct package_cursor iterator;
+	struct strlist packagenames, allfilekeys;
+	struct checkentry *entries = NULL;
+	int count = 0, size = 0, i;
+	retvalue result = RET_NOTHING, r;
+
+	r = package_openiterator(target, READONLY, &iterator);
+	if (!RET_IS_OK(r))
+		return r;
+	strlist_init(&packagenames);
+	strlist_init(&allfilekeys);
+	while (package_next(&iterator)) {
+		struct checksumsarray files;
+		int first = allfilekeys.count;
+
+		r = package_checkdata(&iterator.current, &files);
+		RET_UPDATE(result, r);
+		if (files.names.count > 0) {
+			retvalue r2;
+
+			if (count + files.names.count > size) {
+				struct checkentry *n;
+				int newsize = 2 * size;
+
+				if (newsize < count + files.names.count)
+					newsize = count + files.names.count
+						+ 64;
+				n = realloc(entries, newsize *
+						sizeof(struct checkentry));
+				if (FAILEDTOALLOC(n)) {
+					checksumsarray_done(&files);
+					r = RET_ERROR_OOM;
+					RET_UPDATE(result, r);
+					break;
+				}
+				entries = n;
+				size = newsize;
+			}
+			r2 = strlist_add_dup(&packagenames,
+					iterator.current.name);
+			if (RET_IS_OK(r2))
+				r2 = strlist_append(&allfilekeys,
+						&files.names);
+			if (RET_WAS_ERROR(r2)) {
+				checksumsarray_done(&files);
+				r = r2;
+				RET_UPDATE(result, r);
+				break;
+			}
+			for (i = first ; i < allfilekeys.count ; i++) {
+				entries[count].filekey = allfilekeys.values[i];
+				entries[count].checksums =
+					files.checksums[i - first];
+				entries[count].package =
+					packagenames.count - 1;
+				count++;
+			}
+			free(files.checksums);
+		} else
+			checksumsarray_done(&files);
+		if (RET_WAS_ERROR(r))
+			break;
+	}
+	r = package_closeiterator(&iterator);
+	RET_ENDUPDATE(result, r);
+
+	qsort(entries, count, sizeof(struct checkentry), checkentry_cmp);
+	for (i = 0 ; i < count ; i++) {
+		const struct checkentry *e = &entries[i];
+
+		/* reorder the strings so references_check walks them
+		 * in the same order */
+		allfilekeys.values[i] = (char *)e->filekey;
+		if (result == RET_ERROR_OOM)
+			continue;
+		if (interrupted()) {
+			result = RET_ERROR_INTERRUPTED;
+			continue;
+		}
+		if (verbose > 10)
+			fprintf(stderr, "checking file '%s' of '%s'\n",
+					e->filekey,
+					packagenames.values[e->package]);
+		r = files_expect(e->filekey, e->checksums, verbose >= 0);
+		if (r == RET_NOTHING) {
+			/* File missing */
+			fprintf(stderr, "Missing file %s\n", e->filekey);
+			r = RET_ERROR_MISSING;
+		}
+		if (RET_WAS_ERROR(r))
+			fprintf(stderr, "Files are missing for '%s'!\n",
+					packagenames.values[e->package]);
+		RET_UPDATE(result, r);
+	}
+	if (result != RET_ERROR_OOM && result != RET_ERROR_INTERRUPTED
+			&& count > 0) {
+		r = references_check(target->identifier, &allfilekeys);
+		RET_UPDATE(result, r);
+	}
+	for (i = 0 ; i < count ; i++)
+		checksums_free(entries[i].checksums);
+	free(entries);
+	strlist_done(&allfilekeys);
+	strlist_done(&packagenames);
+	return result;
+}
+
 /* Reapply override information */
 
 retvalue target_reoverride(struct target *target, struct distribution *distribution) {
@@ -940,7 +1138,11 @@ retvalue target_reoverride(struct target *target, struct distribution *distribut
 				result = r;
 				break;
 			}
-			target->wasmodified = true;
+			r = target_markmodified(target);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
 		}
 	}
 	r = package_closeiterator(&iterator);
@@ -1002,7 +1204,11 @@ retvalue target_redochecksums(struct target *target, struct distribution *distri
 				result = r;
 				break;
 			}
-			target->wasmodified = true;
+			r = target_markmodified(target);
+			if (RET_WAS_ERROR(r)) {
+				result = r;
+				break;
+			}
 		}
 	}
 	r = package_closeiterator(&iterator);
@@ -1015,6 +1221,7 @@ retvalue target_redochecksums(struct target *target, struct distribution *distri
 retvalue target_export(struct target *target, bool onlyneeded, bool snapshot, struct release *release) {
 	retvalue result;
 	bool onlymissing;
+	struct timing tm;
 
 	assert (!target->noexport);
 
@@ -1029,14 +1236,17 @@ retvalue target_export(struct target *target, bool onlyneeded, bool snapshot, st
 	/* not exporting if file is already there? */
 	onlymissing = onlyneeded && !target->wasmodified;
 
+	timing_start(&tm);
 	result = export_target(target->relativedirectory, target,
 			target->exportmode, release, onlymissing, snapshot);
+	timing_stop(tp_export, target->identifier, &tm);
 
 	if (!RET_WAS_ERROR(result) && !snapshot) {
 		target->saved_wasmodified =
 			target->saved_wasmodified || target->wasmodified;
 		target->wasmodified = false;
 	}
+	target->clonedfrom = NULL;
 	return result;
 }
 
@@ -1132,6 +1342,8 @@ retvalue package_openiterator(struct target *t, bool readonly, /*@out@*/struct p
 	tc->target = t;
 	tc->cursor = c;
 	memset(&tc->current, 0, sizeof(tc->current));
+	chunkarena_init(&tc->arena);
+	tc->current.arena = &tc->arena;
 	return RET_OK;
 }
 
@@ -1160,6 +1372,8 @@ retvalue package_openduplicateiterator(struct target *t, const char *name, long
 	tc->current.target = t;
 	tc->target = t;
 	tc->cursor = c;
+	chunkarena_init(&tc->arena);
+	tc->current.arena = &tc->arena;
 	return RET_OK;
 }
 
@@ -1170,13 +1384,16 @@ bool package_next(struct package_cursor *tc) {
 		fprintf(stderr, "trace: package_next(tc={current: {name: %s, version: %s}}) called.\n", tc->current.name, tc->current.version);
 
 	package_done(&tc->current);
+	chunkarena_reset(&tc->arena);
 	success = cursor_nexttempdata(tc->target->packages, tc->cursor,
 			&tc->current.name, &tc->current.control,
 			&tc->current.controllen);
 	if (!success)
 		memset(&tc->current, 0, sizeof(tc->current));
-	else
+	else {
 		tc->current.target = tc->target;
+		tc->current.arena = &tc->arena;
+	}
 	return success;
 }
 
@@ -1184,6 +1401,7 @@ retvalue package_closeiterator(struct package_cursor *tc) {
 	retvalue result, r;
 
 	package_done(&tc->current);
+	chunkarena_done(&tc->arena);
 	result = cursor_close(tc->target->packages, tc->cursor);
 	if (tc->close_database) {
 		r = target_closepackagesdb(tc->target);
@@ -1200,7 +1418,17 @@ retvalue package_getversion(struct package *package) {
 	if (package->version != NULL)
 		return RET_OK;
 
-	r = package->target->getversion(package->control, &package->pkgversion);
+	if (package->arena != NULL) {
+		char *v;
+
+		r = package->target->getversion(package->control,
+				package->arena, &v);
+		if (RET_IS_OK(r))
+			package->version = v;
+		return r;
+	}
+	r = package->target->getversion(package->control, NULL,
+			&package->pkgversion);
 	if (RET_IS_OK(r)) {
 		assert (package->pkgversion != NULL);
 		package->version = package->pkgversion;
@@ -1222,7 +1450,19 @@ retvalue package_getsource(struct package *package) {
 	if (package->source != NULL)
 		return RET_OK;
 
-	r = package->target->getsourceandversion(package->control, package->name,
+	if (package->arena != NULL) {
+		char *s, *v;
+
+		r = package->target->getsourceandversion(package->control,
+				package->name, package->arena, &s, &v);
+		if (RET_IS_OK(r)) {
+			package->source = s;
+			package->sourceversion = v;
+		}
+		return r;
+	}
+	r = package->target->getsourceandversion(package->control,
+			package->name, NULL,
 			&package->pkgsource, &package->pkgsrcversion);
 	if (RET_IS_OK(r)) {
 		assert (package->pkgsource != NULL);
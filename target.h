@@ -25,8 +25,11 @@
 
 struct target;
 struct alloverrides;
+struct chunkarena;
 
-typedef retvalue get_version(const char *, /*@out@*/char **);
+/* the strings returned by get_version and get_sourceandversion live in
+ * the arena if one is given, otherwise they must be freed by the caller */
+typedef retvalue get_version(const char *, /*@null@*/struct chunkarena *, /*@out@*/char **);
 typedef retvalue get_architecture(const char *, /*@out@*/architecture_t *);
 typedef retvalue get_installdata(const struct target *, const char *, const char *, architecture_t, const char *, /*@out@*/char **, /*@out@*/struct strlist *, /*@out@*/struct checksumsarray *);
 /* md5sums may be NULL */
@@ -34,7 +37,7 @@ typedef retvalue get_filekeys(const char *, /*@out@*/struct strlist *);
 typedef retvalue get_checksums(const char *, /*@out@*/struct checksumsarray *);
 typedef retvalue do_reoverride(const struct target *, const char * /*packagename*/, const char *, /*@out@*/char **);
 typedef retvalue do_retrack(const char * /*packagename*/, const char * /*controlchunk*/, trackingdb);
-typedef retvalue get_sourceandversion(const char *, const char * /*packagename*/, /*@out@*/char ** /*source_p*/, /*@out@*/char ** /*version_p*/);
+typedef retvalue get_sourceandversion(const char *, const char * /*packagename*/, /*@null@*/struct chunkarena *, /*@out@*/char ** /*source_p*/, /*@out@*/char ** /*version_p*/);
 typedef retvalue complete_checksums(const char *, const struct strlist *, struct checksums **, /*@out@*/char **);
 
 struct distribution;
@@ -73,6 +76,10 @@ struct target {
 	/* was updated without tracking data (no problem when distribution
 	 * has no tracking, otherwise cause warning later) */
 	bool staletracking;
+	/* was filled with the packages of this target of another
+	 * distribution (with the same export options), so its exported
+	 * files can be used instead of generating new ones */
+	/*@null@*/struct target *clonedfrom;
 };
 
 retvalue target_initialize_ubinary(/*@dependant@*/struct distribution *, component_t, architecture_t, /*@dependent@*/const struct exportmode *, bool /*readonly*/, bool /*noexport*/, /*@NULL@*/const char *fakecomponentprefix, /*@out@*/struct target **);
@@ -86,6 +93,7 @@ retvalue target_export(struct target *, bool /*onlyneeded*/, bool /*snapshot*/,
 retvalue target_initpackagesdb(struct target *, bool /*readonly*/);
 /* this closes databases... */
 retvalue target_closepackagesdb(struct target *);
+retvalue target_markmodified(struct target *);
 
 /* The following calls can only be called if target_initpackagesdb was called before: */
 struct logger;
@@ -95,6 +103,7 @@ retvalue target_checkaddpackage(struct target *, const char *name, const char *v
 retvalue target_removepackage(struct target *, /*@null@*/struct logger *, const char *name, const char *version, struct trackingdata *);
 /* like target_removepackage, but do not read control data yourself but use available */
 retvalue target_rereference(struct target *);
+retvalue target_check(struct target *);
 retvalue target_reoverride(struct target *, struct distribution *);
 retvalue target_redochecksums(struct target *, struct distribution *);
 
@@ -0,0 +1,425 @@
+#!/usr/bin/python3
+# Copyright (C) 2026 Bernhard R. Link <brlink@debian.org>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02111-1301  USA
+
+# Benchmark reprepro on large synthetic repositories.
+#
+#  benchmark.py generate --packages 100000 --architectures 2 WORKDIR
+# writes a mirror into WORKDIR/mirror (dists/stable, and dists/next
+# with a part of the packages in a newer version) without needing dpkg.
+#
+#  benchmark.py run --reprepro ../reprepro --distributions 3 WORKDIR
+# creates a fresh WORKDIR/repo and times include, update from the mirror,
+# export, pull, check, checkpool, update to next and deleteunreferenced.
+# For every step the wall clock time, items per second and the peak
+# resident memory of reprepro are reported, --json saves them and
+# --compare reports steps that got slower than in a saved run.
+#
+# The same seed always generates the same archive, so runs on different
+# reprepro versions or database backends can be compared directly.
+#
+# With --compresschunks it also scans the packages of bench1 before and
+# after running compresschunks and reports the size of the packages
+# database and (with libdb) the page cache hit rate of those scans.
+
+import sys, os, io, argparse, random, tarfile, gzip, hashlib, json, time
+import shutil, subprocess
+
+COMPONENTS = ['main', 'contrib']
+ARCHITECTURES = ['amd64', 'arm64', 'i386', 'armhf', 'ppc64el', 's390x',
+		'mips64el', 'riscv64']
+SECTIONS = ['admin', 'devel', 'doc', 'editors', 'libs', 'net', 'python',
+		'utils', 'web', 'x11', 'text', 'science', 'games', 'misc']
+PRIORITIES = ['optional'] * 12 + ['important', 'standard', 'required']
+SYLLABLES = ['ab', 'ba', 'cor', 'dex', 'el', 'fu', 'gno', 'ha', 'in', 'jo',
+		'ka', 'lo', 'me', 'ni', 'ox', 'pa', 'qu', 'ro', 'si', 'tu',
+		'ux', 'vi', 'wa', 'xe', 'yo', 'ze']
+WORDS = ['fast', 'simple', 'library', 'tool', 'for', 'the', 'handling',
+		'of', 'data', 'files', 'network', 'small', 'program', 'with',
+		'support', 'and', 'many', 'useful', 'features', 'including',
+		'plugins', 'documentation', 'development', 'runtime']
+
+def log(message):
+	print(message, file=sys.stderr, flush=True)
+
+def words(rnd, count):
+	return ' '.join(rnd.choice(WORDS) for i in range(count))
+
+class Package:
+	def __init__(self, rnd, index, count):
+		name = ''.join(rnd.choice(SYLLABLES)
+				for i in range(rnd.randint(1, 3)))
+		kind = rnd.random()
+		if kind < 0.2:
+			name = 'lib' + name
+		self.name = '%s%d' % (name, index)
+		if kind < 0.3:
+			self.name = self.name + rnd.choice(['-dev', '-utils',
+				'-data', '-common', '-doc'])
+		self.source = 'src-' + name + str(index // 3)
+		self.version = '%d.%d.%d-%d' % (rnd.randint(0, 9),
+				rnd.randint(0, 30), rnd.randint(0, 99),
+				rnd.randint(1, 5))
+		self.all = rnd.random() < 0.2
+		self.component = 'contrib' if rnd.random() < 0.1 else 'main'
+		self.section = rnd.choice(SECTIONS)
+		self.priority = rnd.choice(PRIORITIES)
+		self.installedsize = int(rnd.lognormvariate(6, 1.5)) + 1
+		self.depends = sorted(set(rnd.randrange(count)
+			for i in range(rnd.randint(0, 6))))
+		self.files = ['usr/share/doc/%s/copyright' % self.name,
+				'usr/share/doc/%s/changelog.Debian.gz' % self.name]
+		for i in range(rnd.randint(0, 40)):
+			self.files.append('usr/%s/%s/%s%d' % (
+				rnd.choice(['bin', 'lib', 'share', 'include']),
+				self.name, rnd.choice(SYLLABLES), i))
+		self.short = words(rnd, rnd.randint(3, 8))
+		self.long = [words(rnd, rnd.randint(5, 12))
+				for i in range(rnd.randint(1, 8))]
+
+	def poolfile(self, architecture, version):
+		if self.source.startswith('src-lib'):
+			d = 'lib' + self.source[7]
+		else:
+			d = self.source[4]
+		return 'pool/%s/%s/%s/%s_%s_%s.deb' % (self.component, d,
+			self.source, self.name, version.split(':')[-1],
+			architecture)
+
+	def control(self, architecture, version, names):
+		depends = ['libc6 (>= 2.36)'] + ['%s (>= 0.1)' % names[d]
+				for d in self.depends]
+		lines = ['Package: ' + self.name,
+			'Source: %s' % self.source,
+			'Version: ' + version,
+			'Architecture: ' + architecture,
+			'Maintainer: Benchmark Team <bench@example.org>',
+			'Installed-Size: %d' % self.installedsize,
+			'Depends: ' + ', '.join(depends),
+			'Section: ' + self.section,
+			'Priority: ' + self.priority,
+			'Homepage: https://example.org/' + self.source,
+			'Description: ' + self.short]
+		lines.extend(' ' + l for l in self.long)
+		return '\n'.join(lines) + '\n'
+
+def tarball(members):
+	data = io.BytesIO()
+	with tarfile.open(fileobj=data, mode='w', format=tarfile.GNU_FORMAT) as t:
+		for name, content in members:
+			info = tarfile.TarInfo('./' + name)
+			info.size = len(content)
+			info.mtime = 315532800
+			info.mode = 0o644
+			t.addfile(info, io.BytesIO(content))
+	return gzip.compress(data.getvalue(), compresslevel=1, mtime=0)
+
+def armember(name, content):
+	header = '%-16s%-12d%-6d%-6d%-8s%-10d`\n' % (name, 315532800, 0, 0,
+			'100644', len(content))
+	padding = b'\n' if len(content) % 2 else b''
+	return header.encode('ascii') + content + padding
+
+def writedeb(filename, control, files):
+	controltar = tarball([('control', control.encode('utf-8'))])
+	datatar = tarball((f, ('%s\n' % f).encode('utf-8')) for f in files)
+	content = b'!<arch>\n' + armember('debian-binary', b'2.0\n') + \
+		armember('control.tar.gz', controltar) + \
+		armember('data.tar.gz', datatar)
+	os.makedirs(os.path.dirname(filename), exist_ok=True)
+	with open(filename, 'wb') as f:
+		f.write(content)
+	return content
+
+def generate(args):
+	rnd = random.Random(args.seed)
+	mirror = os.path.join(args.workdir, 'mirror')
+	if os.path.exists(mirror):
+		shutil.rmtree(mirror)
+	architectures = ARCHITECTURES[:args.architectures]
+	log('Generating %d package names...' % args.packages)
+	packages = [Package(rnd, i, args.packages)
+			for i in range(args.packages)]
+	names = [p.name for p in packages]
+	changed = set(rnd.sample(range(args.packages),
+		int(args.packages * args.churn / 100)))
+	indices = {}
+	debs = 0
+	for suite in ['stable', 'next']:
+		for i, p in enumerate(packages):
+			version = p.version
+			if suite == 'next' and i in changed:
+				version = version + '+b1'
+			for architecture in (['all'] if p.all else architectures):
+				filename = p.poolfile(architecture, version)
+				control = p.control(architecture, version, names)
+				full = os.path.join(mirror, filename)
+				if os.path.exists(full):
+					with open(full, 'rb') as f:
+						content = f.read()
+				else:
+					content = writedeb(full, control, p.files)
+					debs = debs + 1
+					if debs % 10000 == 0:
+						log('%d .deb files written...' % debs)
+				control = control + \
+					'Filename: %s\nSize: %d\nMD5sum: %s\nSHA256: %s\n' % (
+					filename, len(content),
+					hashlib.md5(content).hexdigest(),
+					hashlib.sha256(content).hexdigest())
+				for a in ([architecture] if architecture != 'all'
+						else architectures):
+					indices.setdefault((suite, p.component, a),
+							[]).append(control)
+	for (suite, component, architecture), chunks in indices.items():
+		d = os.path.join(mirror, 'dists', suite, component,
+				'binary-' + architecture)
+		os.makedirs(d, exist_ok=True)
+		with gzip.open(os.path.join(d, 'Packages.gz'), 'wb',
+				compresslevel=1) as f:
+			f.write('\n'.join(chunks).encode('utf-8'))
+	with open(os.path.join(args.workdir, 'mirror.json'), 'w') as f:
+		json.dump({'packages': args.packages,
+			'architectures': architectures,
+			'seed': args.seed, 'churn': len(changed),
+			'debs': debs}, f)
+	log('Wrote %d .deb files for %d packages into %s' % (
+		debs, args.packages, mirror))
+
+def writeconf(repo, architectures, count, suite, contents):
+	conf = os.path.join(repo, 'conf')
+	os.makedirs(conf, exist_ok=True)
+	with open(os.path.join(conf, 'distributions'), 'w') as f:
+		for i in range(1, count + 1):
+			f.write('Codename: bench%d\n' % i)
+			f.write('Architectures: %s\n' % ' '.join(architectures))
+			f.write('Components: %s\n' % ' '.join(COMPONENTS))
+			f.write('Update: %s\n' % suite)
+			if i == 1 and contents:
+				f.write('Contents: percomponent .gz\n')
+			f.write('\n')
+		f.write('Codename: pulled\n')
+		f.write('Architectures: %s\n' % ' '.join(architectures))
+		f.write('Components: %s\n' % ' '.join(COMPONENTS))
+		f.write('Pull: frombench1\n\n')
+		f.write('Codename: local\n')
+		f.write('Architectures: %s\n' % ' '.join(architectures))
+		f.write('Components: main\n')
+	with open(os.path.join(conf, 'updates'), 'w') as f:
+		for s in ['stable', 'next']:
+			f.write('Name: %s\nMethod: file:%s\nSuite: %s\n'
+				'IgnoreRelease: yes\nDownloadListsAs: .gz\n\n' % (
+				s, os.path.abspath(os.path.join(repo, '..',
+					'mirror')), s))
+	with open(os.path.join(conf, 'pulls'), 'w') as f:
+		f.write('Name: frombench1\nFrom: bench1\n')
+
+class Runner:
+	def __init__(self, args):
+		self.reprepro = os.path.abspath(args.reprepro)
+		self.repo = os.path.join(args.workdir, 'repo')
+		self.results = []
+		self.extra = args.reprepro_option or []
+
+	def run(self, step, items, *arguments):
+		statsfile = os.path.join(self.repo, 'stats-%s.json' % step)
+		command = [self.reprepro, '-b', self.repo, '--silent',
+				'--stats-json=' + statsfile] + self.extra + \
+				list(arguments)
+		started = time.monotonic()
+		process = subprocess.Popen(command, stdout=subprocess.DEVNULL)
+		pid, status, usage = os.wait4(process.pid, 0)
+		process.returncode = os.waitstatus_to_exitcode(status)
+		seconds = time.monotonic() - started
+		if process.returncode != 0:
+			raise SystemExit('%s failed with exit code %d' % (
+				' '.join(command), process.returncode))
+		result = {'step': step, 'seconds': seconds, 'items': items,
+			'peak_rss_kb': usage.ru_maxrss,
+			'dbsize': packagesdbsize(self.repo)}
+		if os.path.exists(statsfile):
+			with open(statsfile) as f:
+				result['stats'] = json.load(f)
+			hits = sum(t.get('cachehit', 0)
+				for t in result['stats']['tables']
+				if t['table'].startswith('package'))
+			misses = sum(t.get('cachemiss', 0)
+				for t in result['stats']['tables']
+				if t['table'].startswith('package'))
+			if hits + misses > 0:
+				result['cachehitrate'] = hits * 100 / (hits + misses)
+		self.results.append(result)
+		log('%-22s %9.2fs %10.0f/s %8d kB' % (step, seconds,
+			items / seconds if seconds > 0 else 0,
+			usage.ru_maxrss))
+		return result
+
+def packagesdbsize(repo):
+	size = 0
+	# libdb has it in its own files, lmdb all in one:
+	for name in ['packages.db', 'packagenames.db', 'data.mdb']:
+		filename = os.path.join(repo, 'db', name)
+		if os.path.exists(filename):
+			size = size + os.path.getsize(filename)
+	return size
+
+def poolfiles(repo):
+	count = 0
+	for directory, subdirs, files in os.walk(os.path.join(repo, 'pool')):
+		count = count + len(files)
+	return count
+
+def runbenchmark(args):
+	with open(os.path.join(args.workdir, 'mirror.json')) as f:
+		mirror = json.load(f)
+	architectures = mirror['architectures']
+	repo = os.path.join(args.workdir, 'repo')
+	if os.path.exists(repo):
+		shutil.rmtree(repo)
+	writeconf(repo, architectures, args.distributions, 'stable',
+			not args.nocontents)
+	r = Runner(args)
+
+	# every entry in a Packages file of the mirror:
+	entries = 0
+	for directory, subdirs, files in os.walk(os.path.join(args.workdir,
+			'mirror', 'dists', 'stable')):
+		for name in files:
+			with gzip.open(os.path.join(directory, name), 'rt') as f:
+				entries = entries + sum(1 for l in f
+						if l.startswith('Package: '))
+
+	debs = []
+	for directory, subdirs, files in os.walk(os.path.join(args.workdir,
+			'mirror', 'pool', 'main')):
+		debs.extend(os.path.join(directory, f) for f in sorted(files)
+				if f.endswith('_%s.deb' % architectures[0]))
+		if len(debs) >= args.include:
+			break
+	debs = debs[:args.include]
+	started = time.monotonic()
+	for i in range(0, len(debs), 500):
+		r.run('include', len(debs[i:i+500]), '-C', 'main',
+				'includedeb', 'local', *debs[i:i+500])
+	include = {'step': 'include', 'items': len(debs),
+			'seconds': time.monotonic() - started,
+			'peak_rss_kb': max([x['peak_rss_kb']
+				for x in r.results] + [0])}
+	r.results = [include]
+
+	total = entries * args.distributions
+	r.run('update', total, 'update')
+	r.run('export', total + entries, 'export')
+	r.run('pull', entries, 'pull')
+	r.run('check', total + entries, 'check')
+	if debs:
+		# looked up in packageindex.db instead of every target:
+		r.run('ls', 1, 'ls', os.path.basename(debs[0]).split('_')[0])
+	if args.compresschunks:
+		# listfilter has to look into every chunk:
+		r.run('scan', entries, 'listfilter', 'bench1', 'Package')
+		r.run('compresschunks', total + entries, 'compresschunks')
+		# libdb files only get smaller when rewritten:
+		r.run('compactdb', total + entries, 'compactdb')
+		r.run('scan-compressed', entries,
+				'listfilter', 'bench1', 'Package')
+	files = poolfiles(repo)
+	r.run('checkpool', files, 'checkpool')
+	writeconf(repo, architectures, args.distributions, 'next',
+			not args.nocontents)
+	r.run('update-next', total, '--keepunreferencedfiles', 'update')
+	r.run('deleteunreferenced', poolfiles(repo) - files,
+			'deleteunreferenced')
+	return r.results
+
+def report(results, compare, threshold):
+	print('%-22s %10s %12s %12s %14s %6s' % ('step', 'seconds', 'items/s',
+		'peak RSS kB', 'packages db', 'cache'))
+	for x in results:
+		if 'cachehitrate' in x:
+			hitrate = '%5.1f%%' % x['cachehitrate']
+		else:
+			hitrate = '-'
+		print('%-22s %10.2f %12.0f %12d %14d %6s' % (x['step'],
+			x['seconds'],
+			x['items'] / x['seconds'] if x['seconds'] > 0 else 0,
+			x['peak_rss_kb'], x.get('dbsize', 0), hitrate))
+	if compare is None:
+		return 0
+	with open(compare) as f:
+		old = dict((x['step'], x) for x in json.load(f)['results'])
+	slower = 0
+	for x in results:
+		o = old.get(x['step'])
+		if o is None or o['seconds'] <= 0:
+			continue
+		change = (x['seconds'] - o['seconds']) * 100 / o['seconds']
+		rss = (x['peak_rss_kb'] - o['peak_rss_kb']) * 100 / \
+				max(o['peak_rss_kb'], 1)
+		mark = ''
+		if change > threshold or rss > threshold:
+			mark = '  <- regression'
+			slower = slower + 1
+		print('%-22s %+9.1f%% time %+9.1f%% memory%s' % (
+			x['step'], change, rss, mark))
+	return 1 if slower > 0 else 0
+
+def main():
+	parser = argparse.ArgumentParser(description=
+		'Generate synthetic repositories and benchmark reprepro on them')
+	sub = parser.add_subparsers(dest='command', required=True)
+	g = sub.add_parser('generate', help='generate a synthetic mirror')
+	g.add_argument('--packages', type=int, default=20000,
+		help='number of binary package names (default 20000)')
+	g.add_argument('--architectures', type=int, default=2,
+		choices=range(1, len(ARCHITECTURES) + 1),
+		help='number of architectures (default 2)')
+	g.add_argument('--churn', type=float, default=10,
+		help='percentage of packages newer in next (default 10)')
+	g.add_argument('--seed', type=int, default=1)
+	g.add_argument('workdir')
+	b = sub.add_parser('run', help='run the benchmark')
+	b.add_argument('--reprepro', default=os.path.join(
+		os.path.dirname(os.path.abspath(__file__)), '..', 'reprepro'))
+	b.add_argument('--reprepro-option', action='append',
+		help='additional option to give reprepro (like --verbosedb)')
+	b.add_argument('--distributions', type=int, default=2,
+		help='number of distributions updating from the mirror')
+	b.add_argument('--include', type=int, default=1000,
+		help='number of .deb files to include with includedeb')
+	b.add_argument('--nocontents', action='store_true',
+		help='do not generate Contents files for bench1')
+	b.add_argument('--compresschunks', action='store_true',
+		help='also compare scans before and after compresschunks')
+	b.add_argument('--json', help='save the results into this file')
+	b.add_argument('--compare', help='compare with results saved by --json')
+	b.add_argument('--threshold', type=float, default=10,
+		help='percent slower or bigger to count as regression')
+	b.add_argument('workdir')
+	args = parser.parse_args()
+
+	os.makedirs(args.workdir, exist_ok=True)
+	if args.command == 'generate':
+		generate(args)
+		return 0
+	results = runbenchmark(args)
+	if args.json is not None:
+		with open(args.json, 'w') as f:
+			json.dump({'arguments': vars(args),
+				'results': results}, f, indent=1)
+	return report(results, args.compare, args.threshold)
+
+if __name__ == '__main__':
+	sys.exit(main())
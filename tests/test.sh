@@ -258,6 +258,10 @@ else
 	runtest various2
 	runtest various3
 	runtest copy
+	runtest clonedistribution
+	runtest compactdb
+	runtest packageindex
+	runtest watchincoming
 	runtest buildneeding
 	runtest morgue
 	runtest diffgeneration
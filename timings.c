@@ -0,0 +1,308 @@
+/*  This file is part of "reprepro"
+ *  Copyright (C) 2026 Bernhard R. Link <brlink@debian.org>
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02111-1301  USA
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "error.h"
+#include "timings.h"
+
+bool timings_enabled = false;
+unsigned long long timing_counters[tc_COUNT];
+
+static const char * const phase_names[tp_COUNT] = {
+	"config", "database", "download", "uncompress", "upgradelist",
+	"install", "export", "compress", "sign", "notify",
+	"check", "rereference"
+};
+static const char * const operation_names[to_COUNT] = {
+	"get", "add", "delete", "cursor", "next", "replace",
+	"cachehit", "cachemiss"
+};
+
+struct timing_sum {
+	long long wall, cpu;
+	unsigned long count;
+};
+
+static struct timing_sum phases[tp_COUNT];
+
+/* phase times of a single target, file, ... */
+static struct timing_detail {
+	struct timing_detail *next;
+	enum timing_phase phase;
+	char *name;
+	struct timing_sum sum;
+} *details = NULL, **lastdetail = &details;
+
+static struct timing_table {
+	struct timing_table *next;
+	char *name, *subname;
+	unsigned long ops[to_COUNT];
+} *tables = NULL, **lasttable = &tables;
+
+static long long microseconds(clockid_t clock) {
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) != 0)
+		return 0;
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void timing_start(struct timing *t) {
+	if (!timings_enabled)
+		return;
+	t->wall = microseconds(CLOCK_MONOTONIC);
+	t->cpu = microseconds(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static inline void sum_add(struct timing_sum *sum, long long wall, long long cpu) {
+	sum->wall += wall;
+	sum->cpu += cpu;
+	sum->count++;
+}
+
+void timing_stop(enum timing_phase phase, const char *detail, const struct timing *t) {
+	long long wall, cpu;
+	struct timing_detail *d;
+
+	if (!timings_enabled)
+		return;
+	assert (phase < tp_COUNT);
+	wall = microseconds(CLOCK_MONOTONIC) - t->wall;
+	cpu = microseconds(CLOCK_PROCESS_CPUTIME_ID) - t->cpu;
+	sum_add(&phases[phase], wall, cpu);
+	if (detail == NULL)
+		return;
+	for (d = details ; d != NULL ; d = d->next) {
+		if (d->phase == phase && strcmp(d->name, detail) == 0)
+			break;
+	}
+	if (d == NULL) {
+		d = zNEW(struct timing_detail);
+		if (FAILEDTOALLOC(d))
+			return;
+		d->phase = phase;
+		d->name = strdup(detail);
+		if (FAILEDTOALLOC(d->name)) {
+			free(d);
+			return;
+		}
+		*lastdetail = d;
+		lastdetail = &d->next;
+	}
+	sum_add(&d->sum, wall, cpu);
+}
+
+void timing_tableops(const char *name, const char *subname, const unsigned long ops[to_COUNT]) {
+	struct timing_table *t;
+	int i;
+
+	if (!timings_enabled)
+		return;
+	for (t = tables ; t != NULL ; t = t->next) {
+		if (strcmp(t->name, name) == 0 &&
+				strcmp2(t->subname, subname) == 0)
+			break;
+	}
+	if (t == NULL) {
+		t = zNEW(struct timing_table);
+		if (FAILEDTOALLOC(t))
+			return;
+		t->name = strdup(name);
+		if (subname != NULL)
+			t->subname = strdup(subname);
+		if (FAILEDTOALLOC(t->name) ||
+				(subname != NULL && t->subname == NULL)) {
+			free(t->name);
+			free(t->subname);
+			free(t);
+			return;
+		}
+		*lasttable = t;
+		lasttable = &t->next;
+	}
+	for (i = 0 ; i < to_COUNT ; i++)
+		t->ops[i] += ops[i];
+}
+
+static void print_sum(const char *name, const struct timing_sum *sum) {
+	printf(" %-40s %8lld.%03lld %8lld.%03lld %8lu\n", name,
+			sum->wall / 1000000, (sum->wall / 1000) % 1000,
+			sum->cpu / 1000000, (sum->cpu / 1000) % 1000,
+			sum->count);
+}
+
+static void timing_print(void) {
+	const struct timing_detail *d;
+	const struct timing_table *t;
+	int p, i;
+
+	printf("%-41s %12s %12s %8s\n", "Time spent (seconds):",
+			"wall", "cpu", "count");
+	for (p = 0 ; p < tp_COUNT ; p++) {
+		if (phases[p].count == 0)
+			continue;
+		print_sum(phase_names[p], &phases[p]);
+		for (d = details ; d != NULL ; d = d->next) {
+			if (d->phase != (enum timing_phase)p)
+				continue;
+			printf(" ");
+			print_sum(d->name, &d->sum);
+		}
+	}
+	if (tables != NULL) {
+		printf("Database operations:\n");
+		for (t = tables ; t != NULL ; t = t->next) {
+			if (t->subname != NULL)
+				printf(" %s %s:", t->name, t->subname);
+			else
+				printf(" %s:", t->name);
+			for (i = 0 ; i < to_COUNT ; i++)
+				printf(" %s %lu", operation_names[i],
+						t->ops[i]);
+			putchar('\n');
+		}
+	}
+	printf("Bytes hashed: %llu\nBytes compressed: %llu\n",
+			timing_counters[tc_hashed],
+			timing_counters[tc_compressed]);
+}
+
+static void json_string(FILE *f, const char *s) {
+	putc('"', f);
+	for (; *s != '\0' ; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(f, "\\u%04x", c);
+		else
+			putc(c, f);
+	}
+	putc('"', f);
+}
+
+static void json_sum(FILE *f, const struct timing_sum *sum) {
+	fprintf(f, "\"wall\": %lld.%06lld, \"cpu\": %lld.%06lld, "
+			"\"count\": %lu",
+			sum->wall / 1000000, sum->wall % 1000000,
+			sum->cpu / 1000000, sum->cpu % 1000000,
+			sum->count);
+}
+
+static retvalue timing_writejson(const char *filename) {
+	const struct timing_detail *d;
+	const struct timing_table *t;
+	const char *separator;
+	FILE *f;
+	int p, i;
+
+	f = fopen(filename, "w");
+	if (f == NULL) {
+		int e = errno;
+		fprintf(stderr, "Error %d creating '%s': %s\n",
+				e, filename, strerror(e));
+		return RET_ERRNO(e);
+	}
+	fputs("{\n\"phases\": {", f);
+	separator = "\n";
+	for (p = 0 ; p < tp_COUNT ; p++) {
+		if (phases[p].count == 0)
+			continue;
+		fprintf(f, "%s\t\"%s\": {", separator, phase_names[p]);
+		json_sum(f, &phases[p]);
+		fputs("}", f);
+		separator = ",\n";
+	}
+	fputs("\n},\n\"details\": [", f);
+	separator = "\n";
+	for (d = details ; d != NULL ; d = d->next) {
+		fprintf(f, "%s\t{\"phase\": \"%s\", \"name\": ",
+				separator, phase_names[d->phase]);
+		json_string(f, d->name);
+		fputs(", ", f);
+		json_sum(f, &d->sum);
+		fputs("}", f);
+		separator = ",\n";
+	}
+	fputs("\n],\n\"tables\": [", f);
+	separator = "\n";
+	for (t = tables ; t != NULL ; t = t->next) {
+		fprintf(f, "%s\t{\"table\": ", separator);
+		json_string(f, t->name);
+		if (t->subname != NULL) {
+			fputs(", \"subtable\": ", f);
+			json_string(f, t->subname);
+		}
+		for (i = 0 ; i < to_COUNT ; i++)
+			fprintf(f, ", \"%s\": %lu", operation_names[i],
+					t->ops[i]);
+		fputs("}", f);
+		separator = ",\n";
+	}
+	fprintf(f, "\n],\n\"bytes_hashed\": %llu,\n"
+			"\"bytes_compressed\": %llu\n}\n",
+			timing_counters[tc_hashed],
+			timing_counters[tc_compressed]);
+	if (ferror(f) != 0) {
+		int e = errno;
+		fprintf(stderr, "Error %d writing to '%s': %s\n",
+				e, filename, strerror(e));
+		(void)fclose(f);
+		return RET_ERRNO(e);
+	}
+	if (fclose(f) != 0) {
+		int e = errno;
+		fprintf(stderr, "Error %d writing to '%s': %s\n",
+				e, filename, strerror(e));
+		return RET_ERRNO(e);
+	}
+	return RET_OK;
+}
+
+retvalue timing_report(bool print, const char *jsonfilename) {
+	retvalue r = RET_NOTHING;
+
+	if (!timings_enabled)
+		return RET_NOTHING;
+	if (print)
+		timing_print();
+	if (jsonfilename != NULL)
+		r = timing_writejson(jsonfilename);
+	while (details != NULL) {
+		struct timing_detail *d = details;
+		details = d->next;
+		free(d->name);
+		free(d);
+	}
+	lastdetail = &details;
+	while (tables != NULL) {
+		struct timing_table *t = tables;
+		tables = t->next;
+		free(t->name);
+		free(t->subname);
+		free(t);
+	}
+	lasttable = &tables;
+	return r;
+}
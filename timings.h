@@ -0,0 +1,46 @@
+#ifndef REPREPRO_TIMINGS_H
+#define REPREPRO_TIMINGS_H
+
+#ifndef REPREPRO_ERROR_H
+#include "error.h"
+#warning "What's hapening here?"
+#endif
+
+/* phases of a run (they may contain each other, like export and compress) */
+enum timing_phase {
+	tp_config, tp_database, tp_download, tp_uncompress, tp_upgradelist,
+	tp_install, tp_export, tp_compress, tp_sign, tp_notify,
+	tp_check, tp_rereference,
+	tp_COUNT
+};
+
+/* database operations counted per table
+ * (and the page cache hits and misses, as far as libdb reports them) */
+enum table_operation {
+	to_get, to_add, to_delete, to_cursor, to_next, to_replace,
+	to_cachehit, to_cachemiss,
+	to_COUNT
+};
+
+enum timing_counter { tc_hashed, tc_compressed, tc_COUNT };
+
+/* only if this is set anything is measured or remembered */
+extern bool timings_enabled;
+extern unsigned long long timing_counters[tc_COUNT];
+
+struct timing {
+	long long wall, cpu;
+};
+
+#define timing_count(counter, amount) \
+	(timing_counters[counter] += (amount))
+
+void timing_start(/*@out@*/struct timing *);
+/* add the time since timing_start to the phase, if detail is not NULL
+ * it is also listed separately (like the target exported) */
+void timing_stop(enum timing_phase, /*@null@*/const char *detail, const struct timing *);
+void timing_tableops(const char *, /*@null@*/const char *, const unsigned long[to_COUNT]);
+/* print a table to stdout and/or write a json file */
+retvalue timing_report(bool print, /*@null@*/const char *jsonfilename);
+
+#endif
@@ -40,6 +40,7 @@
 #include "mprintf.h"
 #include "filecntl.h"
 #include "uncompression.h"
+#include "timings.h"
 
 const char * const uncompression_suffix[c_COUNT] = {
 	"", ".gz", ".bz2", ".lzma", ".xz", ".lz" };
@@ -441,6 +442,7 @@ static retvalue uncompress_queue_external(enum compression compression, const ch
 
 retvalue uncompress_queue_file(const char *compressed, const char *destination, enum compression compression, finishaction *action, void *privdata) {
 	retvalue r;
+	struct timing tm;
 
 	(void)unlink(destination);
 	if (extern_uncompressors[compression] != NULL) {
@@ -457,7 +459,9 @@ retvalue uncompress_queue_file(const char *compressed, const char *destination,
 				compressed, destination);
 	}
 	assert (uncompression_builtin(compression));
+	timing_start(&tm);
 	r = builtin_uncompress(compressed, destination, compression);
+	timing_stop(tp_uncompress, NULL, &tm);
 	if (RET_WAS_ERROR(r)) {
 		(void)unlink(destination);
 		return r;
@@ -467,10 +471,12 @@ retvalue uncompress_queue_file(const char *compressed, const char *destination,
 
 retvalue uncompress_file(const char *compressed, const char *destination, enum compression compression) {
 	retvalue r;
+	struct timing tm;
 
 	/* not allowed within a aptmethod session */
 	assert (tasks == NULL);
 
+	timing_start(&tm);
 	(void)unlink(destination);
 	if (uncompression_builtin(compression)) {
 		if (verbose > 1) {
@@ -514,6 +520,7 @@ retvalue uncompress_file(const char *compressed, const char *destination, enum c
 		assert ("Impossible uncompress error" == NULL);
 		r = RET_ERROR;
 	}
+	timing_stop(tp_uncompress, NULL, &tm);
 	if (RET_WAS_ERROR(r)) {
 		(void)unlink(destination);
 		return r;
@@ -190,6 +190,8 @@ struct update_pattern {
 
 	bool used;
 	struct remote_repository *repository;
+	/* the text of the FilterFormula, to notice changes */
+	/*@null@*/char *includeconditiontext;
 };
 
 struct update_origin {
@@ -264,6 +266,7 @@ static void update_pattern_free(/*@only@*/struct update_pattern *update) {
 	strlist_done(&update->udebcomponents_from);
 	strlist_done(&update->udebcomponents_into);
 	term_free(update->includecondition);
+	free(update->includeconditiontext);
 	filterlist_release(&update->filterlist);
 	filterlist_release(&update->filtersrclist);
 	free(update->listhook);
@@ -361,7 +364,23 @@ CFscriptSETPROC(update_pattern, listhook)
 CFallSETPROC(update_pattern, shellhook)
 CFfilterlistSETPROC(update_pattern, filterlist)
 CFfilterlistSETPROC(update_pattern, filtersrclist)
-CFtermSSETPROC(update_pattern, includecondition)
+/* like CFtermSSETPROC, but keeping the text */
+static retvalue configparser_update_pattern_set_includecondition(UNUSED(void *dummy), UNUSED(const char *name), void *data, struct configiterator *iter) {
+	struct update_pattern *item = data;
+	char *formula;
+	retvalue r;
+
+	r = config_getall(iter, &formula);
+	if (!RET_IS_OK(r))
+		return r;
+	r = term_compilefortargetdecision(&item->includecondition, formula);
+	item->includecondition_set = true;
+	if (RET_IS_OK(r))
+		item->includeconditiontext = formula;
+	else
+		free(formula);
+	return r;
+}
 CFtruthSETPROC(update_pattern, omitextrasource)
 
 CFUSETPROC(update_pattern, downloadlistsas) {
@@ -1966,10 +1985,43 @@ static retvalue updates_install(struct update_distribution *distribution) {
  *          time, unless --noskipold is given                               *
  ****************************************************************************/
 
+/* a hash of everything in the rules deciding what a target gets from
+ * the index files, so that changed filters cause it to be processed
+ * again even if the remote index files did not change. */
+static void target_confighash(const struct update_target *ut, /*@out@*/char confighash[17]) {
+	const struct update_index_connector *ui;
+	const struct update_pattern *p;
+	unsigned long long hash = HASH_INIT;
+
+	for (ui = ut->indices ; ui != NULL ; ui = ui->next) {
+		if (ui->remote == NULL || ui->origin == NULL ||
+				ui->origin->pattern == NULL) {
+			hash = hash_add(hash, "-");
+			continue;
+		}
+		for (p = ui->origin->pattern ; p != NULL ; p = p->pattern_from) {
+			hash = hash_add(hash, p->name);
+			if (p->includecondition_set)
+				hash = hash_add(hash, p->includeconditiontext);
+			hash = filterlist_hash(&p->filterlist, hash);
+			hash = filterlist_hash(&p->filtersrclist, hash);
+			hash = hash_add(hash, p->listhook);
+			hash = hash_add(hash, p->shellhook);
+			if (p->omitextrasource_set)
+				hash = hash_add(hash, p->omitextrasource ?
+						"omit" : "keep");
+		}
+	}
+	hash = filterlist_hash(&cmdline_bin_filter, hash);
+	hash = filterlist_hash(&cmdline_src_filter, hash);
+	snprintf(confighash, 17, "%016llx", hash);
+}
+
 static void markdone(struct update_distribution *d) {
 	struct markdonefile *done;
 	struct update_index_connector *i;
 	struct update_target *t;
+	char confighash[17];
 	retvalue r;
 
 	r = markdone_create(d->distribution->codename, &done);
@@ -1980,6 +2032,8 @@ static void markdone(struct update_distribution *d) {
 		if (t->incomplete)
 			continue;
 		markdone_target(done, t->target->identifier);
+		target_confighash(t, confighash);
+		markdone_config(done, confighash);
 		for (i = t->indices ; i != NULL ; i = i->next)
 			if (i->remote == NULL)
 				markdone_cleaner(done);
@@ -2001,6 +2055,7 @@ static retvalue markold(struct update_distribution *ud) {
 	retvalue r;
 	struct donefile *donefile;
 	const char *identifier;
+	char confighash[17];
 
 	r = donefile_open(ud->distribution->codename, &donefile);
 	if (!RET_IS_OK(r))
@@ -2013,6 +2068,11 @@ static retvalue markold(struct update_distribution *ud) {
 			ut = ut->next;
 		if (ut == NULL)
 			continue;
+		/* changed rules or filters, so everything has to be
+		 * looked at again */
+		target_confighash(ut, confighash);
+		if (!donefile_isconfig(donefile, confighash))
+			continue;
 		ut->nothingnew = true;
 		for (ui = ut->indices ; ui != NULL ; ui = ui->next) {
 			/* if the order does not match, it does not matter
@@ -31,6 +31,7 @@
 #include "descriptions.h"
 #include "package.h"
 #include "upgradelist.h"
+#include "timings.h"
 
 struct package_data {
 	struct package_data *next;
@@ -485,11 +486,14 @@ retvalue upgradelist_update(struct upgradelist *upgrade, void *privdata, const c
 	struct indexfile *i;
 	struct package package;
 	retvalue result, r;
+	struct timing tm;
 
 	r = indexfile_open(&i, filename, c_none);
 	if (!RET_IS_OK(r))
 		return r;
 
+	timing_start(&tm);
+
 	result = RET_NOTHING;
 	upgrade->last = NULL;
 	setzero(struct package, &package);
@@ -515,13 +519,16 @@ retvalue upgradelist_update(struct upgradelist *upgrade, void *privdata, const c
 	}
 	r = indexfile_close(i);
 	RET_ENDUPDATE(result, r);
+	timing_stop(tp_upgradelist, upgrade->target->identifier, &tm);
 	return result;
 }
 
 retvalue upgradelist_pull(struct upgradelist *upgrade, struct target *source, upgrade_decide_function *predecide, void *decide_data, void *privdata) {
 	retvalue result, r;
 	struct package_cursor iterator;
+	struct timing tm;
 
+	timing_start(&tm);
 	upgrade->last = NULL;
 	r = package_openiterator(source, READONLY, &iterator);
 	if (RET_WAS_ERROR(r))
@@ -563,6 +570,7 @@ retvalue upgradelist_pull(struct upgradelist *upgrade, struct target *source, up
 	}
 	r = package_closeiterator(&iterator);
 	RET_ENDUPDATE(result, r);
+	timing_stop(tp_upgradelist, upgrade->target->identifier, &tm);
 	return result;
 }
 
@@ -657,10 +665,12 @@ bool upgradelist_woulddelete(const struct upgradelist *upgrade) {
 retvalue upgradelist_install(struct upgradelist *upgrade, struct logger *logger, bool ignoredelete, void (*callback)(void *, const char **, const char **)){
 	struct package_data *pkg;
 	retvalue result, r;
+	struct timing tm;
 
 	if (upgrade->list == NULL)
 		return RET_NOTHING;
 
+	timing_start(&tm);
 	result = target_initpackagesdb(upgrade->target, READWRITE);
 	if (RET_WAS_ERROR(result))
 		return result;
@@ -726,6 +736,7 @@ retvalue upgradelist_install(struct upgradelist *upgrade, struct logger *logger,
 	}
 	r = target_closepackagesdb(upgrade->target);
 	RET_ENDUPDATE(result, r);
+	timing_stop(tp_install, upgrade->target->identifier, &tm);
 	return result;
 }
 
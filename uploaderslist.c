@@ -16,6 +16,8 @@
 #include <config.h>
 
 #include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -105,6 +107,7 @@ struct fileposition {
 		unsigned long lineno;
 		FILE *f;
 		int depth;
+		struct stat stat;
 	} *file;
 	unsigned long lineno;
 };
@@ -140,6 +143,8 @@ static void print_include_trace(struct filebeingparsed *includedby) {
 
 struct uploadergroup {
 	struct uploadergroup *next;
+	/* next in the same bucket of the hash table */
+	struct uploadergroup *hashnext;
 	size_t len;
 	char *name;
 	/* NULL terminated list of pointers, or NULL for none */
@@ -151,6 +156,10 @@ struct uploadergroup {
 
 struct uploader {
 	struct uploader *next;
+	/* next in the same bucket of the hash table */
+	struct uploader *hashnext;
+	/* position in the file, to keep the order of conditions */
+	size_t number;
 	/* NULL terminated list of pointers, or NULL for none */
 	const struct uploadergroup **memberof;
 	size_t len;
@@ -159,14 +168,35 @@ struct uploader {
 	bool allow_subkeys;
 };
 
+/* files read to parse an uploaders file, to see if it needs reloading */
+struct uploadersfile {
+	struct uploadersfile *next;
+	char *filename;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+};
+
 static struct uploaders {
 	struct uploaders *next;
 	size_t reference_count;
 	char *filename;
 	size_t filename_len;
 
-	struct uploadergroup *groups;
-	struct uploader *by_fingerprint;
+	struct uploadergroup *groups, **lastgroup;
+	struct uploader *by_fingerprint, **lastfingerprint;
+	size_t fingerprintcount, groupcount;
+	/* hash tables, indexed by (reversed) fingerprint or name */
+	struct uploader **fingerprinthash;
+	struct uploadergroup **grouphash;
+	size_t fingerprinthashsize, grouphashsize;
+	/* the different lengths of fingerprints listed */
+	size_t *lengths;
+	size_t lengthcount;
+	struct uploadersfile *files;
+	/* no longer returned by uploaders_get (file changed) */
+	bool outdated;
 	struct upload_condition anyvalidkeypermissions;
 	struct upload_condition unsignedpermissions;
 	struct upload_condition anybodypermissions;
@@ -237,6 +267,16 @@ static void uploaders_free(struct uploaders *u) {
 		uploadergroup_free(u->groups);
 		u->groups = next;
 	}
+	while (u->files != NULL) {
+		struct uploadersfile *next = u->files->next;
+
+		free(u->files->filename);
+		free(u->files);
+		u->files = next;
+	}
+	free(u->fingerprinthash);
+	free(u->grouphash);
+	free(u->lengths);
 	uploadpermission_release(&u->anyvalidkeypermissions);
 	uploadpermission_release(&u->anybodypermissions);
 	uploadpermission_release(&u->unsignedpermissions);
@@ -255,6 +295,11 @@ void uploaders_unlock(struct uploaders *u) {
 		if (u->reference_count == 0)
 			return;
 
+		if (u->outdated) {
+			/* already removed from the list */
+			uploaders_free(u);
+			return;
+		}
 		while (*p != NULL && *p != u)
 			p = &(*p)->next;
 		assert (p != NULL && *p == u);
@@ -265,6 +310,36 @@ void uploaders_unlock(struct uploaders *u) {
 	}
 }
 
+static inline size_t hash_string(const char *s, size_t len, size_t hashsize) {
+	/* hashsize is always a power of two */
+	return hash_bytes(HASH_INIT, s, len) & (hashsize - 1);
+}
+
+static const struct uploader *lookup_fingerprint(const struct uploaders *u, const char *reversed, size_t len, bool allow_subkeys) {
+	const struct uploader *uploader;
+
+	if (u->fingerprinthash == NULL)
+		return NULL;
+	uploader = u->fingerprinthash[hash_string(reversed, len,
+			u->fingerprinthashsize)];
+	for (; uploader != NULL ; uploader = uploader->hashnext) {
+		if (uploader->len == len &&
+		    uploader->allow_subkeys == allow_subkeys &&
+		    memcmp(uploader->reversed_fingerprint, reversed, len) == 0)
+			return uploader;
+	}
+	return NULL;
+}
+
+static int uploader_cmp(const void *a, const void *b) {
+	const struct uploader *u1 = *(const struct uploader * const *)a;
+	const struct uploader *u2 = *(const struct uploader * const *)b;
+
+	if (u1->number < u2->number)
+		return -1;
+	return u1->number > u2->number;
+}
+
 static retvalue upload_conditions_add_group(struct upload_conditions **c_p, const struct uploadergroup **groups) {
 	const struct uploadergroup *group;
 	retvalue r;
@@ -284,11 +359,16 @@ static retvalue find_key_and_add(struct uploaders *u, struct upload_conditions *
 	char *reversed;
 	const char *fingerprint, *primary_fingerprint;
 	char *reversed_primary_key;
-	const struct uploader *uploader;
+	const struct uploader *uploader, **found;
+	size_t foundcount, l;
 	retvalue r;
 
 	assert (u != NULL);
 
+	/* TODO: allow ignoring */
+	if (s->state != sist_valid)
+		return RET_OK;
+
 	fingerprint = s->keyid;
 	assert (fingerprint != NULL);
 	len = strlen(fingerprint);
@@ -316,7 +396,7 @@ static retvalue find_key_and_add(struct uploaders *u, struct upload_conditions *
 	/* hm, this only sees the key is expired when it is kind of late... */
 	primary_fingerprint = s->primary_keyid;
 	primary_len = strlen(primary_fingerprint);
-	reversed_primary_key = alloca(len+1);
+	reversed_primary_key = alloca(primary_len+1);
 	if (FAILEDTOALLOC(reversed_primary_key))
 		return RET_ERROR_OOM;
 
@@ -339,33 +419,39 @@ static retvalue find_key_and_add(struct uploaders *u, struct upload_conditions *
 	primary_len = i;
 	reversed_primary_key[primary_len] = '\0';
 
-	for (uploader = u->by_fingerprint ; uploader != NULL ;
-	                                    uploader = uploader->next) {
-		/* TODO: allow ignoring */
-		if (s->state != sist_valid)
-			continue;
-		if (uploader->allow_subkeys) {
-			if (uploader->len > primary_len)
-				continue;
-			if (memcmp(uploader->reversed_fingerprint,
-						reversed_primary_key,
-						uploader->len) != 0)
-				continue;
-		} else {
-			if (uploader->len > len)
-				continue;
-			if (memcmp(uploader->reversed_fingerprint,
-						reversed, uploader->len) != 0)
-				continue;
+	/* a key might match multiple specifications of different length,
+	 * so look for every length specified: */
+	found = alloca(2 * u->lengthcount * sizeof(struct uploader *) + 1);
+	if (FAILEDTOALLOC(found))
+		return RET_ERROR_OOM;
+	foundcount = 0;
+	for (l = 0 ; l < u->lengthcount ; l++) {
+		size_t ulen = u->lengths[l];
+
+		if (ulen <= len) {
+			uploader = lookup_fingerprint(u, reversed, ulen, false);
+			if (uploader != NULL)
+				found[foundcount++] = uploader;
 		}
+		if (ulen <= primary_len) {
+			uploader = lookup_fingerprint(u, reversed_primary_key,
+					ulen, true);
+			if (uploader != NULL)
+				found[foundcount++] = uploader;
+		}
+	}
+	/* keep the order of the file */
+	if (foundcount > 1)
+		qsort(found, foundcount, sizeof(struct uploader *),
+				uploader_cmp);
+	for (l = 0 ; l < foundcount ; l++) {
+		uploader = found[l];
 		r = upload_conditions_add(c_p, &uploader->permissions);
 		if (!RET_WAS_ERROR(r) && uploader->memberof != NULL)
 			r = upload_conditions_add_group(c_p,
 					uploader->memberof);
 		if (RET_WAS_ERROR(r))
 			return r;
-		/* no break here, as a key might match
-		 * multiple specifications of different length */
 	}
 	return RET_OK;
 }
@@ -542,10 +628,47 @@ bool uploaders_verifyatom(struct upload_conditions *conditions, atom_t atom) {
 	assert (conditions->current->needs != conditions->current->needs);
 }
 
+static bool rehash_fingerprints(struct uploaders *u) {
+	size_t newsize = (u->fingerprinthashsize == 0) ? 256 :
+		2 * u->fingerprinthashsize;
+	struct uploader **h, *uploader;
+
+	h = calloc(newsize, sizeof(struct uploader *));
+	if (FAILEDTOALLOC(h))
+		return false;
+	for (uploader = u->by_fingerprint ; uploader != NULL ;
+	     uploader = uploader->next) {
+		size_t b = hash_string(uploader->reversed_fingerprint,
+				uploader->len, newsize);
+
+		uploader->hashnext = h[b];
+		h[b] = uploader;
+	}
+	free(u->fingerprinthash);
+	u->fingerprinthash = h;
+	u->fingerprinthashsize = newsize;
+	return true;
+}
+
+static bool add_length(struct uploaders *u, size_t len) {
+	size_t i, *n;
+
+	for (i = 0 ; i < u->lengthcount ; i++) {
+		if (u->lengths[i] == len)
+			return true;
+	}
+	n = realloc(u->lengths, (u->lengthcount + 1) * sizeof(size_t));
+	if (FAILEDTOALLOC(n))
+		return false;
+	u->lengths = n;
+	u->lengths[u->lengthcount++] = len;
+	return true;
+}
+
 static struct uploader *addfingerprint(struct uploaders *u, const char *fingerprint, size_t len, bool allow_subkeys) {
-	size_t i;
+	size_t i, b;
 	char *reversed = malloc(len+1);
-	struct uploader *uploader, **last;
+	struct uploader *uploader;
 
 	if (FAILEDTOALLOC(reversed))
 		return NULL;
@@ -557,43 +680,78 @@ static struct uploader *addfingerprint(struct uploaders *u, const char *fingerpr
 		reversed[i] = c;
 	}
 	reversed[len] = '\0';
-	last = &u->by_fingerprint;
-	for (uploader = u->by_fingerprint ;
-	     uploader != NULL ;
-	     uploader = *(last = &uploader->next)) {
-		if (uploader->len != len)
-			continue;
-		if (memcmp(uploader->reversed_fingerprint, reversed, len) != 0)
-			continue;
-		if (uploader->allow_subkeys != allow_subkeys)
-			continue;
+	uploader = (struct uploader *)lookup_fingerprint(u, reversed, len,
+			allow_subkeys);
+	if (uploader != NULL) {
 		free(reversed);
 		return uploader;
 	}
-	assert (*last == NULL);
+	if (u->fingerprintcount >= 2 * u->fingerprinthashsize &&
+	    !rehash_fingerprints(u)) {
+		free(reversed);
+		return NULL;
+	}
+	if (!add_length(u, len)) {
+		free(reversed);
+		return NULL;
+	}
 	uploader = zNEW(struct uploader);
-	if (FAILEDTOALLOC(uploader))
+	if (FAILEDTOALLOC(uploader)) {
+		free(reversed);
 		return NULL;
-	*last = uploader;
+	}
+	if (u->lastfingerprint == NULL)
+		u->lastfingerprint = &u->by_fingerprint;
+	assert (*u->lastfingerprint == NULL);
+	*u->lastfingerprint = uploader;
+	u->lastfingerprint = &uploader->next;
+	uploader->number = u->fingerprintcount++;
 	uploader->reversed_fingerprint = reversed;
 	uploader->len = len;
 	uploader->allow_subkeys = allow_subkeys;
+	b = hash_string(reversed, len, u->fingerprinthashsize);
+	uploader->hashnext = u->fingerprinthash[b];
+	u->fingerprinthash[b] = uploader;
 	return uploader;
 }
 
+static bool rehash_groups(struct uploaders *u) {
+	size_t newsize = (u->grouphashsize == 0) ? 64 :
+		2 * u->grouphashsize;
+	struct uploadergroup **h, *group;
+
+	h = calloc(newsize, sizeof(struct uploadergroup *));
+	if (FAILEDTOALLOC(h))
+		return false;
+	for (group = u->groups ; group != NULL ; group = group->next) {
+		size_t b = hash_string(group->name, group->len, newsize);
+
+		group->hashnext = h[b];
+		h[b] = group;
+	}
+	free(u->grouphash);
+	u->grouphash = h;
+	u->grouphashsize = newsize;
+	return true;
+}
+
 static struct uploadergroup *addgroup(struct uploaders *u, const char *name, size_t len) {
-	struct uploadergroup *group, **last;
-
-	last = &u->groups;
-	for (group = u->groups ;
-	     group != NULL ; group = *(last = &group->next)) {
-		if (group->len != len)
-			continue;
-		if (memcmp(group->name, name, len) != 0)
-			continue;
-		return group;
+	struct uploadergroup *group;
+	size_t b;
+
+	if (u->grouphash != NULL) {
+		b = hash_string(name, len, u->grouphashsize);
+		for (group = u->grouphash[b] ; group != NULL ;
+		     group = group->hashnext) {
+			if (group->len != len)
+				continue;
+			if (memcmp(group->name, name, len) != 0)
+				continue;
+			return group;
+		}
 	}
-	assert (*last == NULL);
+	if (u->groupcount >= 2 * u->grouphashsize && !rehash_groups(u))
+		return NULL;
 	group = zNEW(struct uploadergroup);
 	if (FAILEDTOALLOC(group))
 		return NULL;
@@ -603,7 +761,15 @@ static struct uploadergroup *addgroup(struct uploaders *u, const char *name, siz
 		free(group);
 		return NULL;
 	}
-	*last = group;
+	if (u->lastgroup == NULL)
+		u->lastgroup = &u->groups;
+	assert (*u->lastgroup == NULL);
+	*u->lastgroup = group;
+	u->lastgroup = &group->next;
+	u->groupcount++;
+	b = hash_string(name, len, u->grouphashsize);
+	group->hashnext = u->grouphash[b];
+	u->grouphash[b] = group;
 	return group;
 }
 
@@ -1370,6 +1536,15 @@ static retvalue openfiletobeparsed(struct filebeingparsed *includedby, const cha
 		free(fbp);
 		return RET_ERRNO(e);
 	}
+	if (fstat(fileno(fbp->f), &fbp->stat) != 0) {
+		int e = errno;
+		fprintf(stderr, "Error stat'ing '%s': %s\n",
+				fbp->filename, strerror(e));
+		(void)fclose(fbp->f);
+		free(fbp->filename);
+		free(fbp);
+		return RET_ERRNO(e);
+	}
 	fbp->depth = (includedby != NULL)?(includedby->depth+1):0;
 	fbp->includedby = includedby;
 	*fbp_p = fbp;
@@ -1481,12 +1656,64 @@ static retvalue uploaders_load(/*@out@*/struct uploaders **list, const char *fna
 					g->name);
 	}
 	assert (fbp == NULL);
+	/* remember what was read, to notice when it changes: */
+	for (fbp = filesroot ; fbp != NULL ; fbp = fbp->next) {
+		struct uploadersfile *f = zNEW(struct uploadersfile);
+
+		if (FAILEDTOALLOC(f)) {
+			filebeingparsed_free(filesroot);
+			uploaders_free(u);
+			return RET_ERROR_OOM;
+		}
+		f->next = u->files;
+		u->files = f;
+		f->filename = strdup(fbp->filename);
+		if (FAILEDTOALLOC(f->filename)) {
+			filebeingparsed_free(filesroot);
+			uploaders_free(u);
+			return RET_ERROR_OOM;
+		}
+		f->dev = fbp->stat.st_dev;
+		f->ino = fbp->stat.st_ino;
+		f->size = fbp->stat.st_size;
+		f->mtime = fbp->stat.st_mtime;
+	}
 	/* only free file information once filenames are no longer needed: */
 	filebeingparsed_free(filesroot);
 	*list = u;
 	return RET_OK;
 }
 
+/* check if any of the files read changed since, if yes the list is
+ * no longer returned by uploaders_get (and needs to be reloaded) */
+bool uploaders_outdated(struct uploaders *u) {
+	const struct uploadersfile *f;
+	struct uploaders **p;
+	struct stat s;
+
+	if (u->outdated)
+		return true;
+	for (f = u->files ; f != NULL ; f = f->next) {
+		if (stat(f->filename, &s) != 0 || s.st_dev != f->dev ||
+				s.st_ino != f->ino || s.st_size != f->size ||
+				s.st_mtime != f->mtime)
+			break;
+	}
+	if (f == NULL)
+		return false;
+	if (verbose > 1)
+		printf("'%s' changed, reloading uploaders list...\n",
+				f->filename);
+	u->outdated = true;
+	p = &uploaderslists;
+	while (*p != NULL && *p != u)
+		p = &(*p)->next;
+	if (*p == u)
+		*p = u->next;
+	u->next = NULL;
+	return true;
+}
+
 retvalue uploaders_get(/*@out@*/struct uploaders **list, const char *filename) {
 	retvalue r;
 	struct uploaders *u;
@@ -1499,6 +1726,8 @@ retvalue uploaders_get(/*@out@*/struct uploaders **list, const char *filename) {
 	while (u != NULL && (u->filename_len != len ||
 	                      memcmp(u->filename, filename, len) != 0))
 		u = u->next;
+	if (u != NULL && uploaders_outdated(u))
+		u = NULL;
 	if (u == NULL) {
 		r = uploaders_load(&u, filename);
 		if (!RET_IS_OK(r))
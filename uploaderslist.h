@@ -13,6 +13,8 @@ enum upload_condition_type { uc_REJECTED = 0, uc_ALWAYS,
 
 retvalue uploaders_get(/*@out@*/struct uploaders **list, const char *filename);
 void uploaders_unlock(/*@only@*//*@null@*/struct uploaders *);
+/* true if the files were changed since the list was read */
+bool uploaders_outdated(struct uploaders *);
 
 struct signatures;
 retvalue uploaders_permissions(struct uploaders *, const struct signatures *, /*@out@*/struct upload_conditions **);